@@ -14,6 +14,8 @@
 
 // A client sending requests to server every 1 second.
 
+#include <algorithm>
+#include <vector>
 #include <gflags/gflags.h>
 #include <butil/logging.h>
 #include <butil/time.h>
@@ -29,6 +31,40 @@ DEFINE_int32(timeout_ms, 100, "RPC timeout in milliseconds");
 DEFINE_int32(max_retry, 3, "Max retries(not including the first RPC)"); 
 DEFINE_int32(interval_ms, 1000, "Milliseconds between consecutive requests");
 DEFINE_string(http_content_type, "application/json", "Content type of http request");
+DEFINE_int32(bench_count, 0, "Send so many requests back-to-back without "
+             "logging and print percentiles of latencies. Compare "
+             "-event_dispatcher_busy_poll_us=N (set on both sides) against "
+             "the default");
+
+// Send `count' requests one after another and print latency percentiles.
+static int RunBenchmark(example::EchoService_Stub* stub, int count) {
+    std::vector<int64_t> latencies;
+    latencies.reserve(count);
+    example::EchoRequest request;
+    request.set_message("hello world");
+    for (int i = 0; i < count && !brpc::IsAskedToQuit(); ++i) {
+        example::EchoResponse response;
+        brpc::Controller cntl;
+        stub->Echo(&cntl, &request, &response, NULL);
+        if (cntl.Failed()) {
+            LOG(ERROR) << cntl.ErrorText();
+            return -1;
+        }
+        latencies.push_back(cntl.latency_us());
+    }
+    if (latencies.empty()) {
+        return -1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const size_t n = latencies.size();
+    LOG(INFO) << "Sent " << n << " requests, latency(us):"
+              << " p50=" << latencies[n * 50 / 100]
+              << " p90=" << latencies[n * 90 / 100]
+              << " p99=" << latencies[n * 99 / 100]
+              << " p999=" << latencies[n * 999 / 1000]
+              << " max=" << latencies[n - 1];
+    return 0;
+}
 
 int main(int argc, char* argv[]) {
     // Parse gflags. We recommend you to use gflags as well.
@@ -53,6 +89,10 @@ int main(int argc, char* argv[]) {
     // a stub Service wrapping it. stub can be shared by all threads as well.
     example::EchoService_Stub stub(&channel);
 
+    if (FLAGS_bench_count > 0) {
+        return RunBenchmark(&stub, FLAGS_bench_count);
+    }
+
     // Send a request and wait for the response every 1 second.
     int log_id = 0;
     while (!brpc::IsAskedToQuit()) {
@@ -16,6 +16,7 @@
 //          Ge,Jun(gejun@baidu.com)
 
 #include <inttypes.h>
+#include <algorithm>                        // std::find
 #include <gflags/gflags.h>
 #include "butil/fd_guard.h"                 // fd_guard 
 #include "butil/fd_utility.h"               // make_close_on_exec
@@ -27,14 +28,17 @@ namespace brpc {
 
 static const int INITIAL_CONNECTION_CAP = 65536;
 
-Acceptor::Acceptor(bthread_keytable_pool_t* pool)
+Acceptor::Acceptor(bthread_keytable_pool_t* pool, bthread_tag_t tag)
     : InputMessenger()
     , _keytable_pool(pool)
+    , _bthread_tag(tag)
+    , _cork_window_us(-1)
+    , _cork_max_bytes(-1)
     , _status(UNINITIALIZED)
     , _idle_timeout_sec(-1)
     , _close_idle_tid(INVALID_BTHREAD)
     , _listened_fd(-1)
-    , _acception_id(0)
+    , _nacception(0)
     , _empty_cond(&_map_mutex)
     , _ssl_ctx(NULL) {
 }
@@ -46,10 +50,22 @@ Acceptor::~Acceptor() {
 
 int Acceptor::StartAccept(
     int listened_fd, int idle_timeout_sec, SSL_CTX* ssl_ctx) {
-    if (listened_fd < 0) {
-        LOG(FATAL) << "Invalid listened_fd=" << listened_fd;
+    return StartAccept(std::vector<int>(1, listened_fd),
+                       idle_timeout_sec, ssl_ctx);
+}
+
+int Acceptor::StartAccept(const std::vector<int>& listened_fds,
+                          int idle_timeout_sec, SSL_CTX* ssl_ctx) {
+    if (listened_fds.empty()) {
+        LOG(FATAL) << "No listened_fds";
         return -1;
     }
+    for (size_t i = 0; i < listened_fds.size(); ++i) {
+        if (listened_fds[i] < 0) {
+            LOG(FATAL) << "Invalid listened_fd=" << listened_fds[i];
+            return -1;
+        }
+    }
     
     BAIDU_SCOPED_LOCK(_map_mutex);
     if (_status == UNINITIALIZED) {
@@ -73,19 +89,38 @@ int Acceptor::StartAccept(
     _idle_timeout_sec = idle_timeout_sec;
     _ssl_ctx = ssl_ctx;
     
-    // Creation of _acception_id is inside lock so that OnNewConnections
+    // Creation of _acception_ids is inside lock so that OnNewConnections
     // (which may run immediately) should see sane fields set below.
-    SocketOptions options;
-    options.fd = listened_fd;
-    options.user = this;
-    options.on_edge_triggered_events = OnNewConnections;
-    if (Socket::Create(options, &_acception_id) != 0) {
-        // Close-idle-socket thread will be stopped inside destructor
-        LOG(FATAL) << "Fail to create _acception_id";
-        return -1;
+    _acception_ids.clear();
+    for (size_t i = 0; i < listened_fds.size(); ++i) {
+        SocketOptions options;
+        options.fd = listened_fds[i];
+        options.user = this;
+        options.on_edge_triggered_events = OnNewConnections;
+        if (listened_fds.size() > 1) {
+            options.dispatcher_index = i;
+        }
+        SocketId acception_id;
+        if (Socket::Create(options, &acception_id) != 0) {
+            if (i == 0) {
+                // Close-idle-socket thread will be stopped inside destructor
+                LOG(FATAL) << "Fail to create acception socket";
+                return -1;
+            }
+            // Serve with listeners created so far, the kernel only
+            // distributes connections to listening sockets.
+            LOG(ERROR) << "Fail to create acception socket for fd="
+                       << listened_fds[i] << ", use " << i << " listeners";
+            for (size_t j = i; j < listened_fds.size(); ++j) {
+                close(listened_fds[j]);
+            }
+            break;
+        }
+        _acception_ids.push_back(acception_id);
     }
     
-    _listened_fd = listened_fd;
+    _listened_fd = listened_fds[0];
+    _nacception = _acception_ids.size();
     _status = RUNNING;
     return 0;
 }
@@ -120,8 +155,10 @@ void Acceptor::StopAccept(int /*closewait_ms*/) {
         _status = STOPPING;
     }
 
-    // Don't set _acception_id to 0 because BeforeRecycle needs it.
-    Socket::SetFailed(_acception_id);
+    // Don't clear _acception_ids because BeforeRecycle needs it.
+    for (size_t i = 0; i < _acception_ids.size(); ++i) {
+        Socket::SetFailed(_acception_ids[i]);
+    }
 
     // SetFailed all existing connections. Connections added after this piece
     // of code will be SetFailed directly in OnNewConnectionsUntilEAGAIN
@@ -239,9 +276,10 @@ void Acceptor::ListConnections(std::vector<SocketId>* conn_list) {
 
 void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
     while (1) {
-        struct sockaddr in_addr;
+        struct sockaddr_storage in_addr;
         socklen_t in_len = sizeof(in_addr);
-        butil::fd_guard in_fd(accept(acception->fd(), &in_addr, &in_len));
+        butil::fd_guard in_fd(accept(acception->fd(),
+                                     (struct sockaddr*)&in_addr, &in_len));
         if (in_fd < 0) {
             // no EINTR because listened fd is non-blocking.
             if (errno == EAGAIN) {
@@ -267,8 +305,17 @@ void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
         SocketId socket_id;
         SocketOptions options;
         options.keytable_pool = am->_keytable_pool;
+        options.bthread_tag = am->_bthread_tag;
+        options.cork_window_us = am->_cork_window_us;
+        options.cork_max_bytes = am->_cork_max_bytes;
         options.fd = in_fd;
-        options.remote_side = butil::EndPoint(*(sockaddr_in*)&in_addr);
+        // Clients of unix domain sockets are generally unnamed and shown
+        // as "unix:".
+        if (butil::sockaddr2endpoint(&in_addr, in_len,
+                                     &options.remote_side) != 0) {
+            LOG(ERROR) << "Fail to get address of fd=" << in_fd;
+            continue;
+        }
         options.user = acception->user();
         options.on_edge_triggered_events = InputMessenger::OnNewMessages;
         options.ssl_ctx = am->_ssl_ctx;
@@ -323,12 +370,15 @@ void Acceptor::OnNewConnections(Socket* acception) {
 
 void Acceptor::BeforeRecycle(Socket* sock) {
     BAIDU_SCOPED_LOCK(_map_mutex);
-    if (sock->id() == _acception_id) {
-        // Set _listened_fd to -1 when acception socket has been recycled
-        // so that we are ensured no more events will arrive (and `Join'
-        // will return to its caller)
-        _listened_fd = -1;
-        _empty_cond.Broadcast();
+    if (std::find(_acception_ids.begin(), _acception_ids.end(), sock->id())
+        != _acception_ids.end()) {
+        // Set _listened_fd to -1 when all acception sockets have been
+        // recycled so that we are ensured no more events will arrive (and
+        // `Join' will return to its caller)
+        if (--_nacception == 0) {
+            _listened_fd = -1;
+            _empty_cond.Broadcast();
+        }
         return;
     }
     // If a Socket could not be addressed shortly after its creation, it
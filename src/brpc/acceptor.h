@@ -42,7 +42,8 @@ public:
     };
 
 public:
-    explicit Acceptor(bthread_keytable_pool_t* pool = NULL);
+    explicit Acceptor(bthread_keytable_pool_t* pool = NULL,
+                      bthread_tag_t tag = BTHREAD_TAG_INVALID);
     ~Acceptor();
 
     // [thread-safe] Accept connections from `listened_fd'. Ownership of
@@ -54,6 +55,15 @@ public:
     // Return 0 on success, -1 otherwise.
     int StartAccept(int listened_fd, int idle_timeout_sec, SSL_CTX* ssl_ctx);
 
+    // [thread-safe] Accept connections from all `listened_fds' which are
+    // generally bound to the same port with SO_REUSEPORT. The i-th fd is
+    // watched by the i-th EventDispatcher so that accepting connections
+    // scales with -event_dispatcher_num. Ownership of `listened_fds' is
+    // transferred on success, fds failed to be watched are closed.
+    // Return 0 on success, -1 otherwise.
+    int StartAccept(const std::vector<int>& listened_fds,
+                    int idle_timeout_sec, SSL_CTX* ssl_ctx);
+
     // [thread-safe] Stop accepting connections.
     // `closewait_ms' is not used anymore.
     void StopAccept(int /*closewait_ms*/);
@@ -61,7 +71,8 @@ public:
     // Wait until all existing Sockets(defined in socket.h) are recycled.
     void Join();
 
-    // The parameter to StartAccept. Negative when acceptor is stopped.
+    // The parameter to StartAccept(the first one if there're multiple).
+    // Negative when acceptor is stopped.
     int listened_fd() const { return _listened_fd; }
 
     // Get number of existing connections.
@@ -75,6 +86,13 @@ public:
 
     Status status() const { return _status; }
 
+    // Coalesce writes to accepted connections, see SocketOptions.cork_window_us.
+    // Must be called before StartAccept().
+    void SetCorkOptions(int cork_window_us, int cork_max_bytes) {
+        _cork_window_us = cork_window_us;
+        _cork_max_bytes = cork_max_bytes;
+    }
+
 private:
     // Accept connections.
     static void OnNewConnectionsUntilEAGAIN(Socket* m);
@@ -89,13 +107,18 @@ private:
     virtual void BeforeRecycle(Socket* sock);
 
     bthread_keytable_pool_t* _keytable_pool; // owned by Server
+    bthread_tag_t _bthread_tag;
+    int _cork_window_us;
+    int _cork_max_bytes;
     Status _status;
     int _idle_timeout_sec;
     bthread_t _close_idle_tid;
 
     int _listened_fd;
-    // The Socket tso accept connections.
-    SocketId _acception_id;
+    // The Sockets to accept connections.
+    std::vector<SocketId> _acception_ids;
+    // Number of Sockets in _acception_ids that are not recycled yet.
+    size_t _nacception;
 
     butil::Mutex _map_mutex;
     butil::ConditionVariable _empty_cond;
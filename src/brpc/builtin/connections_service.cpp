@@ -170,7 +170,11 @@ void ConnectionsService::PrintConnections(
             os << min_width("Broken", 26) << bar
                << min_width(NameOfPoint(ptr->remote_side()), 19) << bar;
             if (need_local) {
-                os << min_width(ptr->local_side().port, 5) << bar;
+                if (butil::is_unix_endpoint(ptr->local_side())) {
+                    os << min_width("-", 5) << bar;
+                } else {
+                    os << min_width(ptr->local_side().port, 5) << bar;
+                }
             }
             os << min_width("-", 3) << bar
                << min_width("-", 9) << bar
@@ -237,7 +241,8 @@ void ConnectionsService::PrintConnections(
             }
             os << bar << min_width(NameOfPoint(ptr->remote_side()), 19) << bar;
             if (need_local) {
-                if (ptr->local_side().port > 0) {
+                if (ptr->local_side().port > 0 &&
+                    !butil::is_unix_endpoint(ptr->local_side())) {
                     os << min_width(ptr->local_side().port, 5) << bar;
                 } else {
                     os << min_width((first_sub ? "*" : "-"), 5) << bar;
@@ -45,6 +45,10 @@ ChannelOptions::ChannelOptions()
     , max_retry(3)
     , protocol(PROTOCOL_BAIDU_STD)
     , connection_type(CONNECTION_TYPE_UNKNOWN)
+    , min_idle_connections(0)
+    , max_idle_connections(-1)
+    , cork_window_us(-1)
+    , cork_max_bytes(-1)
     , succeed_without_server(true)
     , log_succeed_without_server(true)
     , auth(NULL)
@@ -184,7 +188,8 @@ int Channel::Init(butil::EndPoint server_addr_and_port,
         return -1;
     }
     const int port = server_addr_and_port.port;
-    if (port < 0 || port > 65535) {
+    if ((port < 0 || port > 65535) &&
+        !butil::is_unix_endpoint(server_addr_and_port)) {
         LOG(ERROR) << "Invalid port=" << port;
         return -1;
     }
@@ -193,6 +198,23 @@ int Channel::Init(butil::EndPoint server_addr_and_port,
         LOG(ERROR) << "Fail to insert into SocketMap";
         return -1;
     }
+    if (_options.connection_type == CONNECTION_TYPE_POOLED &&
+        (_options.min_idle_connections > 0 ||
+         _options.max_idle_connections >= 0)) {
+        SocketUniquePtr ptr;
+        if (Socket::Address(_server_id, &ptr) == 0) {
+            ptr->SetPooledSocketLimits(_options.min_idle_connections,
+                                       _options.max_idle_connections,
+                                       _options.connect_timeout_ms);
+        }
+    }
+    if (_options.cork_window_us >= 0 || _options.cork_max_bytes >= 0) {
+        SocketUniquePtr ptr;
+        if (Socket::Address(_server_id, &ptr) == 0) {
+            ptr->SetCorkOptions(_options.cork_window_us,
+                                _options.cork_max_bytes);
+        }
+    }
     return 0;
 }
 
@@ -212,6 +234,12 @@ int Channel::Init(const char* ns_url,
         LOG(FATAL) << "Fail to new LoadBalancerWithNaming";
         return -1;        
     }
+    if (_options.connection_type == CONNECTION_TYPE_POOLED) {
+        lb->SetPooledSocketLimits(_options.min_idle_connections,
+                                  _options.max_idle_connections,
+                                  _options.connect_timeout_ms);
+    }
+    lb->SetCorkOptions(_options.cork_window_us, _options.cork_max_bytes);
     GetNamingServiceThreadOptions ns_opt;
     ns_opt.succeed_without_server = _options.succeed_without_server;
     ns_opt.log_succeed_without_server = _options.log_succeed_without_server;
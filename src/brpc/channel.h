@@ -79,6 +79,30 @@ struct ChannelOptions {
     // Possible values: "single", "pooled", "short".
     AdaptiveConnectionType connection_type;
 
+    // [connection_type="pooled"] Keep at least so many idle connections to
+    // each server. The connections are established when the server is
+    // added into this channel, and re-established in background after being
+    // closed, so that RPC does not pay the cost of connecting after a
+    // restart or a change in the NamingService.
+    // Channels connecting to a same server share the pool, the maximum
+    // values are used.
+    // Default: 0 (connect on demand)
+    int min_idle_connections;
+    // Idle connections to each server beyond this number are closed
+    // periodically. Negative values mean no limit other than
+    // -max_connection_pool_size.
+    // Default: -1
+    int max_idle_connections;
+
+    // Coalesce writes to each server for at most so many microseconds or
+    // until `cork_max_bytes' are queued, see SocketOptions.cork_window_us in
+    // brpc/socket.h. Channels connecting to a same server share the
+    // connection, the options of the channel initialized last are used.
+    // Negative values mean -socket_cork_window_us and -socket_cork_max_bytes.
+    // Default: -1
+    int cork_window_us;
+    int cork_max_bytes;
+
     // Channel.Init() succeeds even if there's no server in the NamingService. 
     // E.g. the BNS directory is empty. All RPC over the channel will fail before
     // new nodes being added to the NamingService.
@@ -0,0 +1,149 @@
+// Copyright (c) 2014 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRPC_COROUTINE_H
+#define BRPC_COROUTINE_H
+
+// To brpc developers: This is a header included by user, don't depend
+// on internal structures, use opaque pointers instead.
+
+// Awaiting RPC in C++20 coroutines(see bthread/coroutine.h), requires
+// -std=c++20. Example:
+//
+//   bthread::CoTask<void> FanOut(brpc::Channel* channels, int n) {
+//       std::vector<brpc::Controller> cntls(n);
+//       std::vector<EchoResponse> responses(n);
+//       EchoRequest request;
+//       ...
+//       // All calls are issued before the coroutine is suspended.
+//       co_await brpc::CoAwaitAllDone(
+//           n, [&](int i, google::protobuf::Closure* done) {
+//               example::EchoService_Stub stub(&channels[i]);
+//               stub.Echo(&cntls[i], &request, &responses[i], done);
+//           });
+//       for (int i = 0; i < n; ++i) {
+//           if (cntls[i].Failed()) { ... }
+//       }
+//   }
+//
+// Awaiting CoCallMethod() or CoAwaitDone() in a loop issues the calls one
+// after another instead.
+//
+// The coroutine does not occupy a bthread while the RPC is in flight, so a
+// server may keep many more outstanding calls than bthreads.
+
+#include <utility>                                 // std::move
+#include <google/protobuf/service.h>               // RpcChannel
+#include "bthread/coroutine.h"
+
+namespace brpc {
+
+template <typename Fn>
+class DoneAwaiter : public bthread::internal::AsyncAwaiter {
+public:
+    explicit DoneAwaiter(Fn fn) : _fn(std::move(fn)), _done(this) {}
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        return suspend(h, [this]() {
+            _fn(&_done);
+            return true;
+        });
+    }
+    void await_resume() {}
+
+private:
+    class Done : public google::protobuf::Closure {
+    public:
+        explicit Done(DoneAwaiter* awaiter) : _awaiter(awaiter) {}
+        void Run() { _awaiter->complete(); }
+    private:
+        DoneAwaiter* _awaiter;
+    };
+
+    Fn _fn;
+    Done _done;
+};
+
+// co_await CoAwaitDone(fn) calls fn(done) to issue an asynchronous operation,
+// and suspends the coroutine until done->Run() is called. `done' is owned by
+// the awaiter and must not be deleted.
+template <typename Fn>
+inline DoneAwaiter<Fn> CoAwaitDone(Fn fn) {
+    return DoneAwaiter<Fn>(std::move(fn));
+}
+
+template <typename Fn>
+class AllDoneAwaiter : public bthread::internal::AsyncAwaiter {
+public:
+    AllDoneAwaiter(int n, Fn fn)
+        : _n(n), _nleft(n), _fn(std::move(fn)), _done(this) {}
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        return suspend(h, [this]() {
+            if (_n <= 0) {
+                return false;
+            }
+            for (int i = 0; i < _n; ++i) {
+                _fn(i, &_done);
+            }
+            return true;
+        });
+    }
+    void await_resume() {}
+
+private:
+    class Done : public google::protobuf::Closure {
+    public:
+        explicit Done(AllDoneAwaiter* awaiter) : _awaiter(awaiter) {}
+        void Run() {
+            if (_awaiter->_nleft.fetch_sub(
+                    1, butil::memory_order_acq_rel) == 1) {
+                _awaiter->complete();
+            }
+        }
+    private:
+        AllDoneAwaiter* _awaiter;
+    };
+
+    int _n;
+    butil::atomic<int> _nleft;
+    Fn _fn;
+    Done _done;
+};
+
+// co_await CoAwaitAllDone(n, fn) calls fn(i, done) for i in [0, n) to issue
+// n asynchronous operations at once, and suspends the coroutine until
+// done->Run() is called n times, i.e. all of them completed. `done' is shared
+// by the operations, owned by the awaiter and must not be deleted.
+template <typename Fn>
+inline AllDoneAwaiter<Fn> CoAwaitAllDone(int n, Fn fn) {
+    return AllDoneAwaiter<Fn>(n, std::move(fn));
+}
+
+// co_await CoCallMethod(&channel, ...) is the asynchronous version of
+// channel.CallMethod(...) without a done. Check cntl->Failed() after it.
+inline auto CoCallMethod(google::protobuf::RpcChannel* channel,
+                         const google::protobuf::MethodDescriptor* method,
+                         google::protobuf::RpcController* cntl,
+                         const google::protobuf::Message* request,
+                         google::protobuf::Message* response) {
+    return CoAwaitDone(
+        [=](google::protobuf::Closure* done) {
+            channel->CallMethod(method, cntl, request, response, done);
+        });
+}
+
+} // namespace brpc
+
+#endif  // BRPC_COROUTINE_H
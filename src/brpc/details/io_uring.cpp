@@ -0,0 +1,289 @@
+// Copyright (c) 2014 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <string.h>                                // memset
+#include <unistd.h>                                // syscall
+#include <sys/mman.h>                              // mmap
+#include <sys/syscall.h>                           // __NR_io_uring_*
+#include "butil/atomicops.h"
+#include "brpc/details/io_uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+// Multishot polls and poll updates are added in Linux 5.13 which is also
+// the version introducing IORING_FEAT_RSRC_TAGS.
+#if defined(IORING_POLL_ADD_MULTI) && defined(IORING_POLL_UPDATE_EVENTS) \
+    && defined(IORING_FEAT_RSRC_TAGS)
+#define BRPC_HAS_IO_URING 1
+#endif
+#endif
+#endif
+
+
+namespace brpc {
+
+IOUring::IOUring()
+    : _ring_fd(-1)
+    , _sq_khead(NULL)
+    , _sq_ktail(NULL)
+    , _sq_mask(0)
+    , _sq_entries(0)
+    , _sq_tail(0)
+    , _sqes(NULL)
+    , _sq_ring(NULL)
+    , _sq_ring_size(0)
+    , _sqes_size(0)
+    , _cq_khead(NULL)
+    , _cq_ktail(NULL)
+    , _cq_mask(0)
+    , _cqes(NULL)
+    , _cq_ring(NULL)
+    , _cq_ring_size(0) {
+}
+
+IOUring::~IOUring() {
+    if (_sqes) {
+        munmap(_sqes, _sqes_size);
+        _sqes = NULL;
+    }
+    if (_cq_ring && _cq_ring != _sq_ring) {
+        munmap(_cq_ring, _cq_ring_size);
+    }
+    _cq_ring = NULL;
+    if (_sq_ring) {
+        munmap(_sq_ring, _sq_ring_size);
+        _sq_ring = NULL;
+    }
+    if (_ring_fd >= 0) {
+        close(_ring_fd);
+        _ring_fd = -1;
+    }
+}
+
+#ifdef BRPC_HAS_IO_URING
+
+static inline unsigned load_acquire(const unsigned* p) {
+    return ((const butil::atomic<unsigned>*)p)->load(butil::memory_order_acquire);
+}
+
+static inline void store_release(unsigned* p, unsigned v) {
+    ((butil::atomic<unsigned>*)p)->store(v, butil::memory_order_release);
+}
+
+int IOUring::Init(unsigned entries) {
+    if (_ring_fd >= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // Completions of multishot polls are much more than submissions, make
+    // the completion queue large enough to avoid overflowing.
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    const int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        return -1;
+    }
+    _ring_fd = fd;
+    if (!(p.features & IORING_FEAT_RSRC_TAGS) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP);
+    if (single_mmap) {
+        if (_cq_ring_size > _sq_ring_size) {
+            _sq_ring_size = _cq_ring_size;
+        }
+        _cq_ring_size = _sq_ring_size;
+    }
+    _sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+        _sq_ring = NULL;
+        return -1;
+    }
+    if (single_mmap) {
+        _cq_ring = _sq_ring;
+    } else {
+        _cq_ring = mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (_cq_ring == MAP_FAILED) {
+            _cq_ring = NULL;
+            return -1;
+        }
+    }
+    _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        _sqes = NULL;
+        return -1;
+    }
+
+    char* sq = (char*)_sq_ring;
+    _sq_khead = (unsigned*)(sq + p.sq_off.head);
+    _sq_ktail = (unsigned*)(sq + p.sq_off.tail);
+    _sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    _sq_entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    _sq_tail = *_sq_ktail;
+    // Map submission entries to slots one by one so that the array never
+    // needs to be modified again.
+    unsigned* sq_array = (unsigned*)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < _sq_entries; ++i) {
+        sq_array[i] = i;
+    }
+
+    char* cq = (char*)_cq_ring;
+    _cq_khead = (unsigned*)(cq + p.cq_off.head);
+    _cq_ktail = (unsigned*)(cq + p.cq_off.tail);
+    _cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    _cqes = cq + p.cq_off.cqes;
+    return 0;
+}
+
+void* IOUring::GetSqe() {
+    if (_sq_tail - load_acquire(_sq_khead) >= _sq_entries) {
+        // The queue is full, let the kernel consume queued entries.
+        if (Submit() != 0) {
+            return NULL;
+        }
+        if (_sq_tail - load_acquire(_sq_khead) >= _sq_entries) {
+            errno = EAGAIN;
+            return NULL;
+        }
+    }
+    io_uring_sqe* sqe = (io_uring_sqe*)_sqes + (_sq_tail & _sq_mask);
+    ++_sq_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IOUring::AddPoll(int fd, uint32_t events, bool multishot,
+                     uint64_t user_data) {
+    io_uring_sqe* sqe = (io_uring_sqe*)GetSqe();
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = (multishot ? IORING_POLL_ADD_MULTI : 0);
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int IOUring::UpdatePoll(uint64_t user_data, uint32_t events) {
+    io_uring_sqe* sqe = (io_uring_sqe*)GetSqe();
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+    sqe->user_data = CONTROL_USER_DATA;
+    return 0;
+}
+
+int IOUring::RemovePoll(uint64_t user_data) {
+    io_uring_sqe* sqe = (io_uring_sqe*)GetSqe();
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = CONTROL_USER_DATA;
+    return 0;
+}
+
+int IOUring::Nop(uint64_t user_data) {
+    io_uring_sqe* sqe = (io_uring_sqe*)GetSqe();
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int IOUring::Submit() {
+    store_release(_sq_ktail, _sq_tail);
+    const unsigned to_submit = _sq_tail - load_acquire(_sq_khead);
+    if (to_submit == 0) {
+        return 0;
+    }
+    while (syscall(__NR_io_uring_enter, _ring_fd, to_submit, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int IOUring::Wait() {
+    if (syscall(__NR_io_uring_enter, _ring_fd, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+size_t IOUring::PeekCompletions(IOUringCompletion* out, size_t n) {
+    unsigned head = *_cq_khead;
+    const unsigned tail = load_acquire(_cq_ktail);
+    size_t i = 0;
+    for (; i < n && head != tail; ++i, ++head) {
+        const io_uring_cqe* cqe = (const io_uring_cqe*)_cqes + (head & _cq_mask);
+        out[i].user_data = cqe->user_data;
+        out[i].res = cqe->res;
+        out[i].more = (cqe->flags & IORING_CQE_F_MORE);
+    }
+    if (i) {
+        store_release(_cq_khead, head);
+    }
+    return i;
+}
+
+#else  // BRPC_HAS_IO_URING
+
+int IOUring::Init(unsigned) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void* IOUring::GetSqe() {
+    errno = ENOSYS;
+    return NULL;
+}
+
+int IOUring::AddPoll(int, uint32_t, bool, uint64_t) { return (GetSqe() ? 0 : -1); }
+int IOUring::UpdatePoll(uint64_t, uint32_t) { return (GetSqe() ? 0 : -1); }
+int IOUring::RemovePoll(uint64_t) { return (GetSqe() ? 0 : -1); }
+int IOUring::Nop(uint64_t) { return (GetSqe() ? 0 : -1); }
+int IOUring::Submit() { errno = ENOSYS; return -1; }
+int IOUring::Wait() { errno = ENOSYS; return -1; }
+size_t IOUring::PeekCompletions(IOUringCompletion*, size_t) { return 0; }
+
+#endif  // BRPC_HAS_IO_URING
+
+} // namespace brpc
@@ -0,0 +1,115 @@
+// Copyright (c) 2014 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRPC_IO_URING_H
+#define BRPC_IO_URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "butil/macros.h"                     // DISALLOW_COPY_AND_ASSIGN
+
+
+namespace brpc {
+
+// A completion copied out of the completion queue.
+struct IOUringCompletion {
+    uint64_t user_data;
+    int32_t res;
+    // True if the operation generating this completion is still active,
+    // namely a multishot poll that will generate more completions.
+    bool more;
+};
+
+// A minimal wrapper of io_uring(7) implemented with raw syscalls so that we
+// don't depend on liburing. Only poll-related operations used by
+// EventDispatcher are supported.
+// Submitting methods are NOT thread-safe and must be serialized by caller.
+// Wait() and PeekCompletions() must be called from one thread, but they can
+// run concurrently with submitting methods.
+class IOUring {
+public:
+    IOUring();
+    ~IOUring();
+
+    // Setup a ring with at least `entries' submission entries.
+    // Returns 0 on success, -1 otherwise and errno is set. errno is ENOSYS
+    // when io_uring or multishot polling is not supported by the kernel.
+    int Init(unsigned entries);
+
+    bool initialized() const { return _ring_fd >= 0; }
+
+    // Watch `events'(EPOLLIN/EPOLLOUT...) on `fd' in edge-triggered mode.
+    // Completions carry `user_data' and the triggered events in `res'.
+    // A multishot poll keeps generating completions (with IORING_CQE_F_MORE
+    // set) until it's removed. A oneshot poll is removed after the first
+    // completion.
+    int AddPoll(int fd, uint32_t events, bool multishot, uint64_t user_data);
+
+    // Replace events of the multishot poll identified by `user_data'.
+    int UpdatePoll(uint64_t user_data, uint32_t events);
+
+    // Cancel the poll identified by `user_data'.
+    int RemovePoll(uint64_t user_data);
+
+    // Queue an operation doing nothing, used for waking up Wait().
+    int Nop(uint64_t user_data);
+
+    // Make queued operations visible to the kernel.
+    // Returns 0 on success, -1 otherwise.
+    int Submit();
+
+    // Block until at least one completion is available.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int Wait();
+
+    // Copy at most `n' completions into `out' and mark them consumed.
+    // Returns number of completions copied.
+    size_t PeekCompletions(IOUringCompletion* out, size_t n);
+
+    // Operations submitted by control methods (Update/Remove/Nop) complete
+    // with this user_data.
+    static const uint64_t CONTROL_USER_DATA = (uint64_t)-1;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(IOUring);
+
+    // Get a free submission entry, submit queued ones if the queue is full.
+    void* GetSqe();
+
+    int _ring_fd;
+
+    // Submission queue
+    unsigned* _sq_khead;
+    unsigned* _sq_ktail;
+    unsigned _sq_mask;
+    unsigned _sq_entries;
+    unsigned _sq_tail;  // local tail, published in Submit()
+    void* _sqes;
+    void* _sq_ring;
+    size_t _sq_ring_size;
+    size_t _sqes_size;
+
+    // Completion queue
+    unsigned* _cq_khead;
+    unsigned* _cq_ktail;
+    unsigned _cq_mask;
+    void* _cqes;
+    void* _cq_ring;
+    size_t _cq_ring_size;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_IO_URING_H
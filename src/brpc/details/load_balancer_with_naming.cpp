@@ -14,6 +14,7 @@
 
 // Authors: Ge,Jun (gejun@baidu.com)
 
+#include "brpc/socket.h"
 #include "brpc/details/load_balancer_with_naming.h"
 
 
@@ -44,6 +45,24 @@ int LoadBalancerWithNaming::Init(const char* ns_url, const char* lb_name,
 
 void LoadBalancerWithNaming::OnAddedServers(
     const std::vector<ServerId>& servers) {
+    if (_min_idle_connections > 0 || _max_idle_connections >= 0) {
+        for (size_t i = 0; i < servers.size(); ++i) {
+            SocketUniquePtr ptr;
+            if (Socket::Address(servers[i].id, &ptr) == 0) {
+                ptr->SetPooledSocketLimits(_min_idle_connections,
+                                           _max_idle_connections,
+                                           _connect_timeout_ms);
+            }
+        }
+    }
+    if (_cork_window_us >= 0 || _cork_max_bytes >= 0) {
+        for (size_t i = 0; i < servers.size(); ++i) {
+            SocketUniquePtr ptr;
+            if (Socket::Address(servers[i].id, &ptr) == 0) {
+                ptr->SetCorkOptions(_cork_window_us, _cork_max_bytes);
+            }
+        }
+    }
     AddServersInBatch(servers);
 }
 
@@ -27,9 +27,30 @@ namespace brpc {
 class LoadBalancerWithNaming : public SharedLoadBalancer,
                                public NamingServiceWatcher {
 public:
-    LoadBalancerWithNaming() {}
+    LoadBalancerWithNaming()
+        : _min_idle_connections(0)
+        , _max_idle_connections(-1)
+        , _connect_timeout_ms(0)
+        , _cork_window_us(-1)
+        , _cork_max_bytes(-1) {}
     ~LoadBalancerWithNaming();
 
+    // Set limits of pooled sockets of servers added later, must be called
+    // before Init(). See Socket::SetPooledSocketLimits().
+    void SetPooledSocketLimits(int min_idle, int max_idle,
+                               int connect_timeout_ms) {
+        _min_idle_connections = min_idle;
+        _max_idle_connections = max_idle;
+        _connect_timeout_ms = connect_timeout_ms;
+    }
+
+    // Set parameters of coalescing writes to servers added later, must be
+    // called before Init(). See Socket::SetCorkOptions().
+    void SetCorkOptions(int cork_window_us, int cork_max_bytes) {
+        _cork_window_us = cork_window_us;
+        _cork_max_bytes = cork_max_bytes;
+    }
+
     int Init(const char* ns_url, const char* lb_name,
              const NamingServiceFilter* filter,
              const GetNamingServiceThreadOptions* options);
@@ -41,6 +62,11 @@ public:
 
 private:
     butil::intrusive_ptr<NamingServiceThread> _nsthread_ptr;
+    int _min_idle_connections;
+    int _max_idle_connections;
+    int _connect_timeout_ms;
+    int _cork_window_us;
+    int _cork_max_bytes;
 };
 
 } // namespace brpc
@@ -15,22 +15,31 @@
 // Authors: Ge,Jun (gejun@baidu.com)
 
 #include <limits>
+#include <gflags/gflags.h>
 #include "butil/macros.h"
 #include "brpc/details/method_status.h"
 
 namespace brpc {
 
+DEFINE_bool(show_method_queue_latency_in_vars, false,
+            "Record the time from receiving requests to processing them of "
+            "each method in /vars/<method>_queue_*, effective for methods "
+            "exposed after this flag is on");
+
 static int cast_nprocessing(void* arg) {
     return *(int*)arg;
 }
 
 MethodStatus::MethodStatus()
     : _max_concurrency(0)
+    , _queue_latency_rec(NULL)
     , _nprocessing_bvar(cast_nprocessing, &_nprocessing)
     , _nprocessing(0) {
 }
 
 MethodStatus::~MethodStatus() {
+    delete _queue_latency_rec;
+    _queue_latency_rec = NULL;
 }
 
 int MethodStatus::Expose(const butil::StringPiece& prefix) {
@@ -43,6 +52,14 @@ int MethodStatus::Expose(const butil::StringPiece& prefix) {
     if (_latency_rec.expose(prefix) != 0) {
         return -1;
     }
+    if (FLAGS_show_method_queue_latency_in_vars) {
+        if (_queue_latency_rec == NULL) {
+            _queue_latency_rec = new bvar::LatencyRecorder;
+        }
+        if (_queue_latency_rec->expose(prefix, "queue") != 0) {
+            return -1;
+        }
+    }
     return 0;
 }
 
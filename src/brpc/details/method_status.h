@@ -43,6 +43,12 @@ public:
     // false, `latency_us' is not used.
     void OnResponded(bool success, int64_t latency_us);
 
+    // Call this when the request is about to be processed.
+    // `queue_us' : microseconds from receiving the request to processing it,
+    // mostly spent on waiting in runqueues of bthread. Only recorded when
+    // -show_method_queue_latency_in_vars is on before the server starts.
+    void OnDequeued(int64_t queue_us);
+
     // Expose internal vars.
     // Return 0 on success, -1 otherwise.
     int Expose(const butil::StringPiece& prefix);
@@ -61,6 +67,7 @@ friend class ScopedMethodStatus;
     int _max_concurrency;
     bvar::Adder<int64_t>         _nerror;
     bvar::LatencyRecorder        _latency_rec;
+    bvar::LatencyRecorder*       _queue_latency_rec;
     bvar::PassiveStatus<int>     _nprocessing_bvar;
     butil::atomic<int> BAIDU_CACHELINE_ALIGNMENT _nprocessing;
 };
@@ -103,6 +110,12 @@ inline void MethodStatus::OnResponded(bool success, int64_t latency) {
     }
 }
 
+inline void MethodStatus::OnDequeued(int64_t queue_us) {
+    if (_queue_latency_rec) {
+        *_queue_latency_rec << queue_us;
+    }
+}
+
 inline void MethodStatus::OnError() {
     _nerror << 1;
     _nprocessing.fetch_sub(1, butil::memory_order_relaxed);
@@ -0,0 +1,414 @@
+// Copyright (c) 2014 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>                           // memcmp
+#include <unistd.h>                           // ftruncate
+#include <sys/mman.h>                         // mmap
+#include <sys/socket.h>                       // sendmsg, recvmsg
+#include <sys/stat.h>                         // fstat
+#include <sys/syscall.h>                      // SYS_memfd_create
+#include <algorithm>                          // std::min
+#include <memory>
+#include "butil/fd_guard.h"                   // fd_guard
+#include "butil/logging.h"
+#include "brpc/details/shm_transport.h"
+
+
+// Older headers may not have sealing of memfd which is since linux 3.17.
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_GET_SEALS (1024 + 10)
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+namespace brpc {
+
+// The first message sent by the client along with the fd of shared memory.
+struct ShmHello {
+    char magic[8];
+    uint32_t version;
+    uint32_t ring_size;
+};
+
+static const char SHM_MAGIC[8] = { 'B', 'R', 'P', 'C', 'S', 'H', 'M', '\0' };
+static const uint32_t SHM_VERSION = 1;
+// Layout of the shared memory:
+//   [ShmRingHeader of client->server][ShmRingHeader of server->client]
+//   [data of client->server at SHM_DATA_OFFSET][data of server->client]
+static const size_t SHM_DATA_OFFSET = 4096;
+static const size_t SHM_MIN_RING_SIZE = 64 * 1024;
+static const size_t SHM_MAX_RING_SIZE = 1024 * 1024 * 1024;
+
+// The peer must not be able to resize the shared memory after we mapped it,
+// otherwise accessing pages beyond the new size raises SIGBUS.
+static const int SHM_REQUIRED_SEALS = F_SEAL_SHRINK | F_SEAL_GROW;
+
+BAIDU_CASSERT(2 * sizeof(ShmRingHeader) <= SHM_DATA_OFFSET,
+              too_big_ShmRingHeader);
+
+ssize_t ShmRing::CutFrom(butil::IOBuf* const* pieces, size_t count) {
+    const uint64_t tail = _header->tail.load(butil::memory_order_relaxed);
+    const uint64_t head = _header->head.load(butil::memory_order_acquire);
+    if (tail - head > _capacity) {
+        // The peer corrupted the header.
+        errno = EPROTO;
+        return -1;
+    }
+    size_t space = _capacity - (size_t)(tail - head);
+    size_t nw = 0;
+    for (size_t i = 0; i < count && space > 0; ++i) {
+        butil::IOBuf* p = pieces[i];
+        while (!p->empty() && space > 0) {
+            const size_t offset = (tail + nw) & (_capacity - 1);
+            const size_t len = std::min(std::min(space, _capacity - offset),
+                                        p->size());
+            p->cutn(_data + offset, len);
+            nw += len;
+            space -= len;
+        }
+    }
+    if (nw) {
+        _header->tail.store(tail + nw, butil::memory_order_release);
+    }
+    return nw;
+}
+
+ssize_t ShmRing::AppendTo(butil::IOBuf* out) {
+    const uint64_t head = _header->head.load(butil::memory_order_relaxed);
+    const uint64_t tail = _header->tail.load(butil::memory_order_acquire);
+    if (tail - head > _capacity) {
+        // The peer corrupted the header.
+        errno = EPROTO;
+        return -1;
+    }
+    const size_t n = tail - head;
+    if (n == 0) {
+        return 0;
+    }
+    const size_t offset = head & (_capacity - 1);
+    const size_t len = std::min(n, _capacity - offset);
+    out->append(_data + offset, len);
+    if (len < n) {
+        out->append(_data, n - len);
+    }
+    _header->head.store(tail, butil::memory_order_release);
+    return n;
+}
+
+// Create an anonymous file for shared memory which can be sealed. Kernels
+// before 3.17 don't have memfd_create and shared memory is not used.
+static int create_shm_fd() {
+#if defined(SYS_memfd_create)
+    return syscall(SYS_memfd_create, "brpc_shm",
+                   1/*MFD_CLOEXEC*/ | MFD_ALLOW_SEALING);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void ring_doorbell(int fd) {
+    // EAGAIN means the peer has unread doorbells and will be woken up
+    // anyway. Other errors are found by the reader.
+    const char c = 0;
+    butil::ignore_result(send(fd, &c, 1, MSG_NOSIGNAL | MSG_DONTWAIT));
+}
+
+ShmTransport::ShmTransport()
+    : _mem(NULL)
+    , _mem_size(0)
+    , _unsent_shm_fd(-1)
+    , _peer_closed(false)
+    , _nwaiting_writer(0) {
+}
+
+ShmTransport::~ShmTransport() {
+    if (_mem) {
+        munmap(_mem, _mem_size);
+        _mem = NULL;
+    }
+    if (_unsent_shm_fd >= 0) {
+        close(_unsent_shm_fd);
+        _unsent_shm_fd = -1;
+    }
+}
+
+int ShmTransport::Map(int shm_fd, size_t ring_size, bool client) {
+    const size_t mem_size = SHM_DATA_OFFSET + 2 * ring_size;
+    void* mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     shm_fd, 0);
+    if (mem == MAP_FAILED) {
+        PLOG(WARNING) << "Fail to mmap " << mem_size << " bytes";
+        return -1;
+    }
+    _mem = mem;
+    _mem_size = mem_size;
+    ShmRingHeader* c2s = (ShmRingHeader*)mem;
+    ShmRingHeader* s2c = c2s + 1;
+    char* c2s_data = (char*)mem + SHM_DATA_OFFSET;
+    char* s2c_data = c2s_data + ring_size;
+    if (client) {
+        _out.Init(c2s, c2s_data, ring_size);
+        _in.Init(s2c, s2c_data, ring_size);
+    } else {
+        _in.Init(c2s, c2s_data, ring_size);
+        _out.Init(s2c, s2c_data, ring_size);
+    }
+    return 0;
+}
+
+int ShmTransport::Create(size_t ring_size, ShmTransport** transport) {
+    *transport = NULL;
+    size_t n = SHM_MIN_RING_SIZE;
+    while (n < ring_size && n < SHM_MAX_RING_SIZE) {
+        n <<= 1;
+    }
+    butil::fd_guard shm_fd(create_shm_fd());
+    if (shm_fd < 0) {
+        PLOG(WARNING) << "Fail to create shared memory";
+        return -1;
+    }
+    if (ftruncate(shm_fd, SHM_DATA_OFFSET + 2 * n) != 0) {
+        PLOG(WARNING) << "Fail to truncate shared memory to "
+                      << SHM_DATA_OFFSET + 2 * n << " bytes";
+        return -1;
+    }
+    if (fcntl(shm_fd, F_ADD_SEALS, SHM_REQUIRED_SEALS | F_SEAL_SEAL) != 0) {
+        PLOG(WARNING) << "Fail to seal shared memory";
+        return -1;
+    }
+    std::unique_ptr<ShmTransport> t(new ShmTransport);
+    if (t->Map(shm_fd, n, true) != 0) {
+        return -1;
+    }
+    // Both sides wake up each other from the very beginning.
+    t->_in.header()->consumer_waiting.store(1, butil::memory_order_relaxed);
+    t->_out.header()->consumer_waiting.store(1, butil::memory_order_relaxed);
+    t->_unsent_shm_fd = shm_fd.release();
+    *transport = t.release();
+    return 0;
+}
+
+int ShmTransport::SendShm(int fd) {
+    ShmHello hello;
+    memcpy(hello.magic, SHM_MAGIC, sizeof(hello.magic));
+    hello.version = SHM_VERSION;
+    hello.ring_size = _out.capacity();
+    struct iovec iov = { &hello, sizeof(hello) };
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    memset(cbuf, 0, sizeof(cbuf));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &_unsent_shm_fd, sizeof(int));
+    // Nothing was written to the connection before, the message should be
+    // sent in whole into the empty buffer. Not being able to send it is
+    // treated as an error rather than EAGAIN which means that the ring is
+    // full and would make the writer wait for a wakeup never coming.
+    const ssize_t nw = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (nw != (ssize_t)sizeof(hello)) {
+        if (nw >= 0 || errno == EAGAIN) {
+            errno = EPROTO;
+        }
+        PLOG(WARNING) << "Fail to send shared memory via fd=" << fd;
+        return -1;
+    }
+    close(_unsent_shm_fd);
+    _unsent_shm_fd = -1;
+    return 0;
+}
+
+int ShmTransport::Accept(int fd, ShmTransport** transport) {
+    *transport = NULL;
+    ShmHello hello;
+    const ssize_t nr = recv(fd, &hello, sizeof(hello), MSG_PEEK);
+    if (nr < 0) {
+        return -1;
+    }
+    if (memcmp(&hello, SHM_MAGIC,
+               std::min((size_t)nr, sizeof(SHM_MAGIC))) != 0 || nr == 0) {
+        // Not using shared memory, or EOF which is handled by later reads.
+        return 0;
+    }
+    if ((size_t)nr < sizeof(hello)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    struct iovec iov = { &hello, sizeof(hello) };
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    const ssize_t nr2 = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (nr2 != (ssize_t)sizeof(hello)) {
+        if (nr2 >= 0) {
+            errno = EPROTO;
+        }
+        return -1;
+    }
+    butil::fd_guard shm_fd(-1);
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int received_fd = -1;
+            memcpy(&received_fd, CMSG_DATA(cmsg), sizeof(int));
+            shm_fd.reset(received_fd);
+        }
+    }
+    const size_t n = hello.ring_size;
+    if (shm_fd < 0 || hello.version != SHM_VERSION ||
+        n < SHM_MIN_RING_SIZE || n > SHM_MAX_RING_SIZE || (n & (n - 1))) {
+        LOG(WARNING) << "Invalid shared memory from fd=" << fd
+                     << " version=" << hello.version << " ring_size=" << n;
+        errno = EPROTO;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(shm_fd, &st) != 0 ||
+        (size_t)st.st_size < SHM_DATA_OFFSET + 2 * n) {
+        LOG(WARNING) << "Shared memory from fd=" << fd << " is too small";
+        errno = EPROTO;
+        return -1;
+    }
+    const int seals = fcntl(shm_fd, F_GET_SEALS);
+    if (seals < 0 || (seals & SHM_REQUIRED_SEALS) != SHM_REQUIRED_SEALS) {
+        LOG(WARNING) << "Shared memory from fd=" << fd
+                     << " can be resized, seals=" << seals;
+        errno = EPROTO;
+        return -1;
+    }
+    std::unique_ptr<ShmTransport> t(new ShmTransport);
+    if (t->Map(shm_fd, n, false) != 0) {
+        return -1;
+    }
+    *transport = t.release();
+    return 1;
+}
+
+ssize_t ShmTransport::Write(int fd, butil::IOBuf* const* pieces, size_t count) {
+    if (_unsent_shm_fd >= 0 && SendShm(fd) != 0) {
+        return -1;
+    }
+    const ssize_t nw = _out.CutFrom(pieces, count);
+    if (nw <= 0) {
+        if (nw < 0) {
+            return -1;
+        }
+        if (_out.writable_size() == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return 0;
+    }
+    // Pair with the fence in Read(): either the consumer sees the data, or
+    // we see the consumer waiting.
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    ShmRingHeader* h = _out.header();
+    if (h->consumer_waiting.load(butil::memory_order_relaxed) &&
+        h->consumer_waiting.exchange(0, butil::memory_order_relaxed)) {
+        ring_doorbell(fd);
+    }
+    return nw;
+}
+
+int ShmTransport::ConsumeDoorbells(int fd) {
+    char buf[64];
+    while (!_peer_closed) {
+        const ssize_t nr = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (nr > 0) {
+            // Read until EAGAIN, otherwise EOF arrived along with the
+            // doorbells is missed by edge-triggered events.
+            continue;
+        } else if (nr == 0) {
+            _peer_closed = true;
+        } else if (errno == EAGAIN) {
+            break;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+ssize_t ShmTransport::Read(int fd, butil::IOBuf* out) {
+    if (_nwaiting_writer.load(butil::memory_order_relaxed) > 0 &&
+        ConsumeDoorbells(fd) != 0) {
+        return -1;
+    }
+    ssize_t nr = _in.AppendTo(out);
+    if (nr < 0) {
+        return -1;
+    }
+    if (nr == 0) {
+        if (ConsumeDoorbells(fd) != 0) {
+            return -1;
+        }
+        // Pair with the fence in Write().
+        _in.header()->consumer_waiting.store(1, butil::memory_order_relaxed);
+        butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        nr = _in.AppendTo(out);
+        if (nr < 0) {
+            return -1;
+        }
+        if (nr == 0) {
+            if (_peer_closed) {
+                return 0;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    // Pair with the fence in BeginWaitWritable() of the peer.
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    ShmRingHeader* h = _in.header();
+    if (h->producer_waiting.load(butil::memory_order_relaxed) &&
+        h->producer_waiting.exchange(0, butil::memory_order_relaxed)) {
+        ring_doorbell(fd);
+    }
+    return nr;
+}
+
+bool ShmTransport::BeginWaitWritable() {
+    _nwaiting_writer.fetch_add(1, butil::memory_order_relaxed);
+    _out.header()->producer_waiting.store(1, butil::memory_order_relaxed);
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    if (_out.writable_size() > 0) {
+        _nwaiting_writer.fetch_sub(1, butil::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void ShmTransport::EndWaitWritable() {
+    _nwaiting_writer.fetch_sub(1, butil::memory_order_relaxed);
+}
+
+}  // namespace brpc
@@ -0,0 +1,163 @@
+// Copyright (c) 2014 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRPC_SHM_TRANSPORT_H
+#define BRPC_SHM_TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>                        // ssize_t
+#include "butil/atomicops.h"                  // butil::atomic
+#include "butil/macros.h"                     // DISALLOW_COPY_AND_ASSIGN
+#include "butil/compiler_specific.h"          // BAIDU_CACHELINE_ALIGNMENT
+#include "butil/iobuf.h"                      // butil::IOBuf
+
+
+namespace brpc {
+
+// Control fields of a ShmRing, placed in the shared memory. Fields modified
+// by different sides are put in different cachelines.
+struct ShmRingHeader {
+    // Bytes ever written, modified by the producer.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<uint64_t> tail;
+    // Bytes ever read, modified by the consumer.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<uint64_t> head;
+    // Set by the consumer before waiting for data. The producer rings the
+    // doorbell after writing if it's set.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int> consumer_waiting;
+    // Set by the producer before waiting for space. The consumer rings the
+    // doorbell after reading if it's set.
+    butil::atomic<int> producer_waiting;
+};
+
+// Single-producer single-consumer ring of bytes in shared memory.
+class ShmRing {
+public:
+    ShmRing() : _header(NULL), _data(NULL), _capacity(0) {}
+
+    // `capacity' must be power of 2.
+    void Init(ShmRingHeader* header, char* data, size_t capacity) {
+        _header = header;
+        _data = data;
+        _capacity = capacity;
+    }
+
+    // [Producer] Cut data from `pieces' into the ring until the ring is full.
+    // Returns bytes written, -1 with errno=EPROTO if the header modified by
+    // the peer is corrupted.
+    ssize_t CutFrom(butil::IOBuf* const* pieces, size_t count);
+
+    // [Consumer] Append all readable data to `out'.
+    // Returns bytes appended, -1 with errno=EPROTO if the header modified by
+    // the peer is corrupted.
+    ssize_t AppendTo(butil::IOBuf* out);
+
+    // Sizes of a corrupted ring are 0.
+    size_t readable_size() const {
+        const size_t n = _header->tail.load(butil::memory_order_acquire)
+            - _header->head.load(butil::memory_order_relaxed);
+        return n <= _capacity ? n : 0;
+    }
+    size_t writable_size() const {
+        const size_t n = _header->tail.load(butil::memory_order_relaxed)
+            - _header->head.load(butil::memory_order_acquire);
+        return n <= _capacity ? _capacity - n : 0;
+    }
+    size_t capacity() const { return _capacity; }
+    ShmRingHeader* header() const { return _header; }
+
+private:
+    ShmRingHeader* _header;
+    char* _data;
+    size_t _capacity;
+};
+
+// Exchange data with the peer of a connected unix domain socket through a
+// pair of ShmRing in shared memory. The socket is kept as the doorbell: a
+// side sends one byte to wake up the peer only when the peer is waiting for
+// data or space, and the peer is woken up by EventDispatcher as if data
+// arrived at the socket. Closing the socket closes the transport.
+// Write() must be serialized by caller, so is Read().
+class ShmTransport {
+public:
+    ~ShmTransport();
+
+    // [Client] Create sealed shared memory with two rings of `ring_size'
+    // bytes (rounded up to power of 2). The memory is sent to the server in
+    // the first Write(), no data must be written to the connection before.
+    // Returns 0 and sets *transport on success, -1 if shared memory is not
+    // available and the connection should be used without it.
+    static int Create(size_t ring_size, ShmTransport** transport);
+
+    // [Server] Check if the client at the other side of `fd' sent shared
+    // memory, which must be the first message of the connection. Memory
+    // which can be resized by the client is rejected.
+    // Returns 1 and sets *transport if the client did, 0 if the client
+    // does not use shared memory, -1 otherwise and errno is set (EAGAIN
+    // means the message is incomplete).
+    static int Accept(int fd, ShmTransport** transport);
+
+    // Cut data from `pieces' into the outgoing ring and wake up the peer
+    // through `fd' if needed. The first call of a client sends the shared
+    // memory to the server via the non-blocking `fd'.
+    // Returns bytes written, -1 otherwise and errno is set (EAGAIN means
+    // the ring is full).
+    ssize_t Write(int fd, butil::IOBuf* const* pieces, size_t count);
+
+    // Append data in the incoming ring to `out'. Doorbells in `fd' are
+    // consumed when the ring is empty or writers are waiting.
+    // Returns bytes appended, 0 when the peer closed the connection and
+    // all data was read, -1 otherwise and errno is set (EAGAIN means
+    // no data now and the caller will be woken up by events of `fd').
+    ssize_t Read(int fd, butil::IOBuf* out);
+
+    // A writer calls this before waiting for space in the outgoing ring.
+    // Returns false if the ring is writable now and the writer should not
+    // wait. Otherwise the writer should wait and call EndWaitWritable()
+    // after being woken up.
+    bool BeginWaitWritable();
+    void EndWaitWritable();
+
+    // True if some writers are waiting and the outgoing ring is writable,
+    // the reader of `fd' should wake them up.
+    bool ShouldWakeWriters() const {
+        return _nwaiting_writer.load(butil::memory_order_relaxed) > 0
+            && _out.writable_size() > 0;
+    }
+
+    size_t ring_size() const { return _out.capacity(); }
+
+private:
+    ShmTransport();
+    int Map(int shm_fd, size_t ring_size, bool client);
+    // Send `_unsent_shm_fd' to the server. Returns -1 on error.
+    int SendShm(int fd);
+    // Consume doorbells in `fd'. Returns -1 on error.
+    int ConsumeDoorbells(int fd);
+
+    DISALLOW_COPY_AND_ASSIGN(ShmTransport);
+
+    void* _mem;
+    size_t _mem_size;
+    // fd of the shared memory before being sent to the server.
+    int _unsent_shm_fd;
+    ShmRing _in;
+    ShmRing _out;
+    bool _peer_closed;
+    butil::atomic<int> _nwaiting_writer;
+};
+
+}  // namespace brpc
+
+#endif  // BRPC_SHM_TRANSPORT_H
@@ -25,6 +25,21 @@
 #include "brpc/socket.h"
 #include "brpc/details/ssl_helper.h"
 
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/tls.h>)
+#include <linux/tls.h>                 // TLS_GET_RECORD_TYPE
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define BRPC_HAS_KTLS 1
+#endif
+#endif
+#endif
+
+#ifdef BRPC_HAS_KTLS
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 namespace brpc {
 
 #ifndef OPENSSL_NO_DH
@@ -364,6 +379,18 @@ SSL_CTX* CreateSSLContext(const std::string& certificate,
     // TODO: Support client certification validation
     SSL_CTX_set_verify(ssl_ctx.get(), SSL_VERIFY_NONE, NULL);
 
+    if (options.enable_ktls) {
+#ifdef BRPC_HAS_KTLS
+        // OpenSSL installs keys into the kernel after handshake if both the
+        // kernel and the negotiated cipher support it, and falls back to
+        // encrypting in user space silently otherwise.
+        SSL_CTX_set_options(ssl_ctx.get(), SSL_OP_ENABLE_KTLS);
+#else
+        LOG(WARNING) << "kTLS is not supported by this build, ignore"
+            " SSLOptions.enable_ktls";
+#endif
+    }
+
     if (!options.ciphers.empty() &&
         SSL_CTX_set_cipher_list(ssl_ctx.get(),
                                 options.ciphers.c_str()) != 1) {
@@ -469,6 +496,89 @@ SSLState DetectSSLState(int fd, int* error_code) {
     }
 }
 
+void GetKTLSState(SSL* ssl, bool* send, bool* recv) {
+    *send = false;
+    *recv = false;
+#ifdef BRPC_HAS_KTLS
+    if (!SSL_is_init_finished(ssl)) {
+        return;
+    }
+    *send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+    *recv = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#else
+    (void)ssl;
+#endif
+}
+
+#ifdef BRPC_HAS_KTLS
+// Record types and messages in RFC 5246 and RFC 8446
+static const unsigned char TLS_RECORD_ALERT = 21;
+static const unsigned char TLS_RECORD_HANDSHAKE = 22;
+static const unsigned char TLS_RECORD_APPLICATION_DATA = 23;
+static const unsigned char TLS_ALERT_CLOSE_NOTIFY = 0;
+static const unsigned char TLS_HANDSHAKE_NEW_SESSION_TICKET = 4;
+// Max size of plaintext in a record
+static const size_t TLS_MAX_PLAINTEXT = 16384;
+
+int ReadKTLSRecord(int fd, butil::IOBuf* out) {
+    char buf[TLS_MAX_PLAINTEXT];
+    char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    iovec iov = { buf, sizeof(buf) };
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    const ssize_t nr = recvmsg(fd, &msg, 0);
+    if (nr <= 0) {
+        return nr;
+    }
+    unsigned char record_type = TLS_RECORD_APPLICATION_DATA;
+    const cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_TLS &&
+        cmsg->cmsg_type == TLS_GET_RECORD_TYPE) {
+        record_type = *(const unsigned char*)CMSG_DATA(cmsg);
+    }
+    switch (record_type) {
+    case TLS_RECORD_APPLICATION_DATA:
+        // Not expected after EIO, but don't lose the data.
+        out->append(buf, nr);
+        return 1;
+    case TLS_RECORD_HANDSHAKE:
+        if (buf[0] == TLS_HANDSHAKE_NEW_SESSION_TICKET) {
+            // Tickets are sent by TLS 1.3 servers after handshake, they're
+            // useless to us.
+            return 1;
+        }
+        // Others(e.g. KeyUpdate) need OpenSSL to process, which does not
+        // hold the keys anymore.
+        LOG(WARNING) << "Unsupported handshake message=" << (int)buf[0]
+                     << " on ktls_fd=" << fd;
+        errno = EPROTO;
+        return -1;
+    case TLS_RECORD_ALERT:
+        if (nr >= 2 && buf[1] == TLS_ALERT_CLOSE_NOTIFY) {
+            return 0;
+        }
+        LOG(WARNING) << "Received TLS alert=" << (nr >= 2 ? (int)buf[1] : -1)
+                     << " on ktls_fd=" << fd;
+        errno = ECONNRESET;
+        return -1;
+    default:
+        LOG(WARNING) << "Unknown TLS record_type=" << (int)record_type
+                     << " on ktls_fd=" << fd;
+        errno = EPROTO;
+        return -1;
+    }
+}
+#else
+int ReadKTLSRecord(int, butil::IOBuf*) {
+    errno = ENOSYS;
+    return -1;
+}
+#endif  // BRPC_HAS_KTLS
+
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 
 // NOTE: Can't find a macro for CRYPTO_THREADID
@@ -21,6 +21,7 @@
 #include <openssl/ssl.h>
 // For some versions of openssl, SSL_* are defined inside this header
 #include <openssl/ossl_typ.h>
+#include "butil/iobuf.h"               // butil::IOBuf
 #include "brpc/server.h"               // SSLOptions
 #include "brpc/socket_id.h"            // SocketId
 
@@ -68,6 +69,18 @@ SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode);
 // set to indicate the reason (0 for EOF)
 SSLState DetectSSLState(int fd, int* error_code);
 
+// Check whether the kernel encrypts(`send') and decrypts(`recv') data of
+// `ssl' after handshake, namely kernel TLS is installed by OpenSSL.
+// See SSLOptions.enable_ktls
+void GetKTLSState(SSL* ssl, bool* send, bool* recv);
+
+// Consume the record at the head of `fd' whose receiving side is decrypted
+// by the kernel. Called when read() fails with EIO which means the record
+// is not application data. Application data read is appended to `out'.
+// Returns 1 when reading can go on, 0 when the peer closes the TLS session,
+// -1 otherwise and errno is set.
+int ReadKTLSRecord(int fd, butil::IOBuf* out);
+
 } // namespace brpc
 
 
@@ -19,9 +19,11 @@
 #include <sys/epoll.h>                               // epoll_create
 #include "butil/fd_utility.h"                         // make_close_on_exec
 #include "butil/logging.h"                            // LOG
+#include "butil/time.h"                               // cpuwide_time_us
 #include "butil/third_party/murmurhash3/murmurhash3.h"// fmix32
 #include "bthread/bthread.h"                         // bthread_start_background
 #include "brpc/event_dispatcher.h"
+#include "brpc/details/io_uring.h"
 #ifdef BRPC_SOCKET_HAS_EOF
 #include "brpc/details/has_epollrdhup.h"
 #endif
@@ -35,8 +37,40 @@ DEFINE_int32(event_dispatcher_num, 1, "Number of event dispatcher");
 DEFINE_bool(usercode_in_pthread, false, 
             "Call user's callback in pthreads, use bthreads otherwise");
 
+DEFINE_bool(event_dispatcher_use_io_uring, false,
+            "Poll events with io_uring(requires linux 5.13+) instead of "
+            "epoll. Fall back to epoll when io_uring is not supported");
+
+DEFINE_int32(event_dispatcher_busy_poll_us, 0,
+             "Keep polling events without blocking for so many microseconds "
+             "after the last event, which trades CPU for latency. Each "
+             "dispatcher occupies a worker while spinning. 0 disables it");
+BRPC_VALIDATE_GFLAG(event_dispatcher_busy_poll_us, NonNegativeInteger);
+
+DEFINE_int32(event_dispatcher_inline_max_bytes, 0,
+             "When -event_dispatcher_busy_poll_us is positive, process input "
+             "events of connections whose messages are no larger than so many"
+             " bytes on average inside the dispatcher instead of new bthreads."
+             " The last message of each read runs user code inside the "
+             "dispatcher as well, which must not block, e.g. synchronous RPCs"
+             " inside server handlers hang. 0 disables it");
+BRPC_VALIDATE_GFLAG(event_dispatcher_inline_max_bytes, NonNegativeInteger);
+
+// Number of submission entries of each io_uring.
+static const unsigned IO_URING_ENTRIES = 4096;
+
+// Oneshot polls added by AddEpollOut are tagged with this bit so that their
+// completions are not mistaken for terminated multishot polls of consumers,
+// which share the same SocketId. The bit is the highest bit of the version
+// of SocketId, which needs 2^30 reuses of one Socket to be reached, checked
+// in AddConsumer and AddEpollOut.
+static const uint64_t ONESHOT_POLL_TAG = (1ULL << 63);
+BAIDU_CASSERT(ONESHOT_POLL_TAG != IOUring::CONTROL_USER_DATA,
+              oneshot_polls_must_not_look_like_control_operations);
+
 EventDispatcher::EventDispatcher()
     : _epfd(-1)
+    , _ring(NULL)
     , _stop(false)
     , _tid(0)
     , _consumer_thread_attr(BTHREAD_ATTR_NORMAL)
@@ -54,6 +88,19 @@ EventDispatcher::EventDispatcher()
         PLOG(FATAL) << "Fail to create pipe";
         return;
     }
+
+    if (FLAGS_event_dispatcher_use_io_uring) {
+        IOUring* ring = new IOUring;
+        if (ring->Init(IO_URING_ENTRIES) != 0) {
+            PLOG(WARNING) << "Fail to setup io_uring, use epoll instead";
+            delete ring;
+        } else if (_ring_consumers.init(1024) != 0) {
+            LOG(WARNING) << "Fail to init _ring_consumers, use epoll instead";
+            delete ring;
+        } else {
+            _ring = ring;
+        }
+    }
 }
 
 EventDispatcher::~EventDispatcher() {
@@ -67,6 +114,8 @@ EventDispatcher::~EventDispatcher() {
         close(_wakeup_fds[0]);
         close(_wakeup_fds[1]);
     }
+    delete _ring;
+    _ring = NULL;
 }
 
 int EventDispatcher::Start(const bthread_attr_t* consumer_thread_attr) {
@@ -107,6 +156,13 @@ bool EventDispatcher::Running() const {
 void EventDispatcher::Stop() {
     _stop = true;
 
+    if (_ring) {
+        BAIDU_SCOPED_LOCK(_ring_mutex);
+        if (_ring->Nop(IOUring::CONTROL_USER_DATA) == 0) {
+            _ring->Submit();
+        }
+        return;
+    }
     if (_epfd >= 0) {
         epoll_event evt = { EPOLLOUT,  { NULL } };
         epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakeup_fds[1], &evt);
@@ -132,6 +188,24 @@ int EventDispatcher::AddEpollOut(SocketId socket_id, int fd, bool pollin) {
 #ifdef BRPC_SOCKET_HAS_EOF
     evt.events |= has_epollrdhup;
 #endif
+    if (_ring) {
+        // Polls of io_uring are edge-triggered already.
+        const uint32_t events = evt.events & ~EPOLLET;
+        CHECK_EQ(0UL, socket_id & ONESHOT_POLL_TAG) << "SocketId=" << socket_id
+            << " collides with tags of oneshot polls";
+        BAIDU_SCOPED_LOCK(_ring_mutex);
+        // Unlike EPOLL_CTL_MOD, updating a removed poll does not fail
+        // synchronously. The caller waits for EPOLLOUT with a timeout and
+        // checks the socket again, so nothing is lost.
+        const int rc = (pollin ?
+                        _ring->UpdatePoll(socket_id, events | EPOLLIN) :
+                        _ring->AddPoll(fd, events, false,
+                                       socket_id | ONESHOT_POLL_TAG));
+        if (rc != 0) {
+            return -1;
+        }
+        return _ring->Submit();
+    }
     if (pollin) {
         evt.events |= EPOLLIN;
         if (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &evt) < 0) {
@@ -149,6 +223,19 @@ int EventDispatcher::AddEpollOut(SocketId socket_id, int fd, bool pollin) {
 
 int EventDispatcher::RemoveEpollOut(SocketId socket_id, 
                                     int fd, bool pollin) {
+    if (_ring) {
+        BAIDU_SCOPED_LOCK(_ring_mutex);
+        uint32_t events = EPOLLIN;
+#ifdef BRPC_SOCKET_HAS_EOF
+        events |= has_epollrdhup;
+#endif
+        const int rc = (pollin ? _ring->UpdatePoll(socket_id, events) :
+                        _ring->RemovePoll(socket_id | ONESHOT_POLL_TAG));
+        if (rc != 0) {
+            return -1;
+        }
+        return _ring->Submit();
+    }
     if (pollin) {
         epoll_event evt;
         evt.data.u64 = socket_id;
@@ -173,13 +260,37 @@ int EventDispatcher::AddConsumer(SocketId socket_id, int fd) {
 #ifdef BRPC_SOCKET_HAS_EOF
     evt.events |= has_epollrdhup;
 #endif
+    if (_ring) {
+        CHECK_EQ(0UL, socket_id & ONESHOT_POLL_TAG) << "SocketId=" << socket_id
+            << " collides with tags of oneshot polls";
+        BAIDU_SCOPED_LOCK(_ring_mutex);
+        if (_ring->AddPoll(fd, evt.events & ~EPOLLET, true, socket_id) != 0) {
+            return -1;
+        }
+        if (_ring->Submit() != 0) {
+            return -1;
+        }
+        _ring_consumers[socket_id] = fd;
+        return 0;
+    }
     return epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &evt);
 }
 
-int EventDispatcher::RemoveConsumer(int fd) {
+int EventDispatcher::RemoveConsumer(SocketId socket_id, int fd) {
     if (fd < 0) {
         return -1;
     }
+    if (_ring) {
+        // Polls in io_uring hold references to the file, closing the fd
+        // does not remove them, they must be cancelled explicitly.
+        BAIDU_SCOPED_LOCK(_ring_mutex);
+        _ring_consumers.erase(socket_id);
+        if (_ring->RemovePoll(socket_id) != 0 || _ring->Submit() != 0) {
+            PLOG(WARNING) << "Fail to remove fd=" << fd << " from io_uring";
+            return -1;
+        }
+        return 0;
+    }
     // Removing the consumer from dispatcher before closing the fd because
     // if process was forked and the fd is not marked as close-on-exec,
     // closing does not set reference count of the fd to 0, thus does not
@@ -199,18 +310,52 @@ void* EventDispatcher::RunThis(void* arg) {
     return NULL;
 }
 
+// Called when polling returns no events in busy-polling mode. Returns true
+// if the dispatcher should poll again without blocking.
+static bool KeepBusyPolling(int busy_poll_us, int64_t* idle_start_us) {
+    const int64_t now_us = butil::cpuwide_time_us();
+    if (*idle_start_us == 0) {
+        *idle_start_us = now_us;
+    }
+    if (now_us - *idle_start_us < busy_poll_us) {
+        // Don't starve bthreads queued in this worker.
+        bthread_yield();
+        return true;
+    }
+    *idle_start_us = 0;
+    return false;
+}
+
 void EventDispatcher::Run() {
+    if (_ring) {
+        return RunIOUring();
+    }
     epoll_event e[32];
+    int64_t idle_start_us = 0;
     while (!_stop) {
+        // NOTE: save the gflag which may be reloaded at any time.
+        const int busy_poll_us = FLAGS_event_dispatcher_busy_poll_us;
+        int n = 0;
+        if (busy_poll_us > 0) {
+            n = epoll_wait(_epfd, e, ARRAY_SIZE(e), 0);
+            if (n == 0) {
+                if (KeepBusyPolling(busy_poll_us, &idle_start_us)) {
+                    continue;
+                }
+                n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
+            }
+            idle_start_us = 0;
+        } else {
 #ifdef BRPC_ADDITIONAL_EPOLL
-        // Performance downgrades in examples.
-        int n = epoll_wait(_epfd, e, ARRAY_SIZE(e), 0);
-        if (n == 0) {
-            n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
-        }
+            // Performance downgrades in examples.
+            n = epoll_wait(_epfd, e, ARRAY_SIZE(e), 0);
+            if (n == 0) {
+                n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
+            }
 #else
-        const int n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
+            n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
 #endif
+        }
         if (_stop) {
             // epoll_ctl/epoll_wait should have some sort of memory fencing
             // guaranteeing that we(after epoll_wait) see _stop set before
@@ -225,6 +370,14 @@ void EventDispatcher::Run() {
             PLOG(FATAL) << "Fail to epoll_wait epfd=" << _epfd;
             break;
         }
+        for (int i = 0; i < n; ++i) {
+            if (e[i].events & EPOLLERR) {
+                // Error queue may contain completions of MSG_ZEROCOPY.
+                Socket::ReapZeroCopyCompletions(e[i].data.u64);
+            }
+        }
+        const int inline_max_bytes =
+            (busy_poll_us > 0 ? FLAGS_event_dispatcher_inline_max_bytes : 0);
         for (int i = 0; i < n; ++i) {
             if (e[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)
 #ifdef BRPC_SOCKET_HAS_EOF
@@ -233,7 +386,8 @@ void EventDispatcher::Run() {
                 ) {
                 // We don't care about the return value.
                 Socket::StartInputEvent(e[i].data.u64, e[i].events,
-                                        _consumer_thread_attr);
+                                        _consumer_thread_attr,
+                                        inline_max_bytes);
             }
         }
         for (int i = 0; i < n; ++i) {
@@ -245,6 +399,88 @@ void EventDispatcher::Run() {
     }
 }
 
+void EventDispatcher::RunIOUring() {
+    IOUringCompletion c[32];
+    int64_t idle_start_us = 0;
+    while (!_stop) {
+        const int busy_poll_us = FLAGS_event_dispatcher_busy_poll_us;
+        const size_t n = _ring->PeekCompletions(c, ARRAY_SIZE(c));
+        if (_stop) {
+            break;
+        }
+        if (n == 0) {
+            if (busy_poll_us > 0 &&
+                KeepBusyPolling(busy_poll_us, &idle_start_us)) {
+                continue;
+            }
+            if (_ring->Wait() != 0 && errno != EINTR) {
+                PLOG(FATAL) << "Fail to wait for io_uring";
+                break;
+            }
+            continue;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (c[i].user_data == IOUring::CONTROL_USER_DATA) {
+                continue;
+            }
+            const bool oneshot = (c[i].user_data & ONESHOT_POLL_TAG);
+            c[i].user_data &= ~ONESHOT_POLL_TAG;
+            if (c[i].res == -ECANCELED) {
+                // Removed by RemoveConsumer/RemoveEpollOut.
+                c[i].user_data = IOUring::CONTROL_USER_DATA;
+                continue;
+            }
+            if (c[i].res < 0) {
+                // Report the error to the socket as epoll does.
+                c[i].res = EPOLLERR;
+            } else if (!c[i].more && !oneshot) {
+                // Multishot poll of a consumer may be terminated by the
+                // kernel (e.g. completion queue overflowed), arm it again
+                // unless the consumer was removed in the meantime.
+                uint32_t events = EPOLLIN;
+#ifdef BRPC_SOCKET_HAS_EOF
+                events |= has_epollrdhup;
+#endif
+                BAIDU_SCOPED_LOCK(_ring_mutex);
+                const int* fd = _ring_consumers.seek(c[i].user_data);
+                if (fd != NULL &&
+                    (_ring->AddPoll(*fd, events, true, c[i].user_data) != 0
+                     || _ring->Submit() != 0)) {
+                    PLOG(WARNING) << "Fail to re-arm fd=" << *fd;
+                }
+            }
+        }
+        idle_start_us = 0;
+        const int inline_max_bytes =
+            (busy_poll_us > 0 ? FLAGS_event_dispatcher_inline_max_bytes : 0);
+        for (size_t i = 0; i < n; ++i) {
+            if (c[i].user_data != IOUring::CONTROL_USER_DATA &&
+                (c[i].res & EPOLLERR)) {
+                Socket::ReapZeroCopyCompletions(c[i].user_data);
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            const uint32_t events = c[i].res;
+            if (c[i].user_data != IOUring::CONTROL_USER_DATA &&
+                ((events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+#ifdef BRPC_SOCKET_HAS_EOF
+                 || (events & has_epollrdhup)
+#endif
+                    )) {
+                Socket::StartInputEvent(c[i].user_data, events,
+                                        _consumer_thread_attr,
+                                        inline_max_bytes);
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (c[i].user_data != IOUring::CONTROL_USER_DATA &&
+                (c[i].res & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                Socket::HandleEpollOut(c[i].user_data);
+            }
+        }
+    }
+}
+
 static EventDispatcher* g_edisp = NULL;
 static pthread_once_t g_edisp_once = PTHREAD_ONCE_INIT;
 
@@ -275,4 +511,12 @@ EventDispatcher& GetGlobalEventDispatcher(int fd) {
     return g_edisp[index];
 }
 
+EventDispatcher& GetGlobalEventDispatcher(int fd, int index) {
+    if (index < 0) {
+        return GetGlobalEventDispatcher(fd);
+    }
+    pthread_once(&g_edisp_once, InitializeGlobalDispatchers);
+    return g_edisp[index % FLAGS_event_dispatcher_num];
+}
+
 } // namespace brpc
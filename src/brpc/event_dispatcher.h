@@ -19,12 +19,16 @@
 #define BRPC_EVENT_DISPATCHER_H
 
 #include "butil/macros.h"                     // DISALLOW_COPY_AND_ASSIGN
+#include "butil/synchronization/lock.h"       // butil::Mutex
+#include "butil/containers/flat_map.h"         // butil::FlatMap
 #include "bthread/types.h"                   // bthread_t, bthread_attr_t
 #include "brpc/socket.h"                     // Socket, SocketId
 
 
 namespace brpc {
 
+class IOUring;
+
 // Dispatch edge-triggered events of file descriptors to consumers
 // running in separate bthreads.
 class EventDispatcher {
@@ -78,12 +82,28 @@ private:
     // Thread entry.
     void Run();
 
-    // Remove the file descriptor `fd' from epoll.
-    int RemoveConsumer(int fd);
+    // Thread entry when events are polled by io_uring.
+    void RunIOUring();
+
+    // Remove the file descriptor `fd' of `socket_id' from epoll.
+    int RemoveConsumer(SocketId socket_id, int fd);
 
     // The epoll to watch events.
     int _epfd;
 
+    // Non-NULL when -event_dispatcher_use_io_uring is on and the kernel
+    // supports it, in which case _epfd is not used for polling.
+    IOUring* _ring;
+
+    // Serialize submissions to _ring.
+    butil::Mutex _ring_mutex;
+
+    // fds of consumers with multishot polls in _ring, protected by
+    // _ring_mutex. A poll terminated by the kernel is re-armed only if its
+    // consumer is still here, otherwise the re-armed poll would hold the
+    // file after RemoveConsumer.
+    butil::FlatMap<SocketId, int> _ring_consumers;
+
     // false unless Stop() is called.
     volatile bool _stop;
 
@@ -99,6 +119,10 @@ private:
 
 EventDispatcher& GetGlobalEventDispatcher(int fd);
 
+// Get the dispatcher at `index' (modulo -event_dispatcher_num), or the one
+// chosen by hashing `fd' when `index' is negative.
+EventDispatcher& GetGlobalEventDispatcher(int fd, int index);
+
 } // namespace brpc
 
 
@@ -0,0 +1,69 @@
+// Copyright (c) 2014 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BRPC_FUTURE_DONE_H
+#define BRPC_FUTURE_DONE_H
+
+// To brpc developers: This is a header included by user, don't depend
+// on internal structures, use opaque pointers instead.
+
+#include <utility>                                 // std::move
+#include <google/protobuf/service.h>               // RpcChannel
+#include "bthread/future.h"
+
+namespace brpc {
+
+// A done making a bthread::Future ready when the asynchronous RPC completes,
+// so that RPCs can be combined by bthread::when_all/when_any.
+// Example:
+//   std::vector<bthread::Future<void> > fs;
+//   for (int i = 0; i < n; ++i) {
+//       brpc::FutureDone* done = new brpc::FutureDone;
+//       fs.push_back(done->get_future());
+//       stubs[i].Echo(&cntls[i], &requests[i], &responses[i], done);
+//   }
+//   bthread::when_all(fs).wait();
+//   // Check cntls[i].Failed() ...
+class FutureDone : public google::protobuf::Closure {
+public:
+    bthread::Future<void> get_future() { return _promise.get_future(); }
+
+    void Run() {
+        // Delete this before running callbacks of the future.
+        bthread::Promise<void> promise(std::move(_promise));
+        delete this;
+        promise.set_value();
+    }
+
+private:
+    bthread::Promise<void> _promise;
+};
+
+// Issue an asynchronous RPC, the returned future is ready when the RPC
+// completes. Check cntl->Failed() after that.
+inline bthread::Future<void> CallMethodAsync(
+    google::protobuf::RpcChannel* channel,
+    const google::protobuf::MethodDescriptor* method,
+    google::protobuf::RpcController* cntl,
+    const google::protobuf::Message* request,
+    google::protobuf::Message* response) {
+    FutureDone* done = new FutureDone;
+    bthread::Future<void> f = done->get_future();
+    channel->CallMethod(method, cntl, request, response, done);
+    return f;
+}
+
+} // namespace brpc
+
+#endif  // BRPC_FUTURE_DONE_H
@@ -66,6 +66,7 @@
 #include <malloc.h>                   // malloc_trim
 #include "butil/fd_guard.h"
 #include "butil/files/file_watcher.h"
+#include "butil/iobuf_slab_allocator.h"
 
 extern "C" {
 // defined in gperftools/malloc_extension_c.h
@@ -81,6 +82,15 @@ DEFINE_int32(free_memory_to_system_interval, 0,
              "values <= 0 disables this feature");
 BRPC_VALIDATE_GFLAG(free_memory_to_system_interval, PassValidate);
 
+DEFINE_bool(iobuf_slab_allocator, false,
+            "Allocate blocks of IOBuf from a contiguous region with per-thread"
+            " caches rather than malloc");
+DEFINE_int32(iobuf_slab_max_memory_mb, 1024,
+             "Size of the region used by -iobuf_slab_allocator in megabytes");
+BRPC_VALIDATE_GFLAG(iobuf_slab_max_memory_mb, NonNegativeInteger);
+DEFINE_bool(iobuf_slab_hugepage, false,
+            "Back the region of -iobuf_slab_allocator with 2MB huge pages");
+
 namespace policy {
 // Defined in http_rpc_protocol.cpp
 void InitCommonStrings();
@@ -152,6 +162,17 @@ static int64_t GetIOBufNewBigViewCount(void*) {
 static int64_t GetIOBufBlockMemory(void*) {
     return butil::IOBuf::block_memory();
 }
+static int64_t GetIOBufSlabCarvedBytes(void*) {
+    butil::iobuf::SlabAllocatorStat stat;
+    butil::iobuf::get_slab_allocator_stat(&stat);
+    return stat.carved_bytes;
+}
+static double GetIOBufSlabHitRatio(void*) {
+    butil::iobuf::SlabAllocatorStat stat;
+    butil::iobuf::get_slab_allocator_stat(&stat);
+    const size_t total = stat.nhit + stat.nmiss;
+    return (total ? (double)stat.nhit / total : 0);
+}
 
 // Defined in server.cpp
 extern butil::static_atomic<int> g_running_server_count;
@@ -173,6 +194,10 @@ static void* GlobalUpdate(void*) {
         "iobuf_newbigview_second", &var_iobuf_new_bigview_count);
     bvar::PassiveStatus<int64_t> var_iobuf_block_memory(
         "iobuf_block_memory", GetIOBufBlockMemory, NULL);
+    bvar::PassiveStatus<int64_t> var_iobuf_slab_carved_bytes(
+        "iobuf_slab_carved_bytes", GetIOBufSlabCarvedBytes, NULL);
+    bvar::PassiveStatus<double> var_iobuf_slab_hit_ratio(
+        "iobuf_slab_hit_ratio", GetIOBufSlabHitRatio, NULL);
     bvar::PassiveStatus<int> var_running_server_count(
         "rpc_server_count", GetRunningServerCount, NULL);
     
@@ -287,6 +312,16 @@ static void GlobalInitializeOrDieImpl() {
     // the variable before main() for only once.
     // setenv("TCMALLOC_SAMPLE_PARAMETER", "524288", 0);
 
+    if (FLAGS_iobuf_slab_allocator) {
+        butil::iobuf::SlabAllocatorOptions slab_options;
+        slab_options.max_memory = FLAGS_iobuf_slab_max_memory_mb * 1024L * 1024;
+        slab_options.use_hugepage = FLAGS_iobuf_slab_hugepage;
+        if (butil::iobuf::use_slab_allocator(&slab_options) != 0) {
+            LOG(WARNING) << "Fail to use slab allocator for IOBuf, blocks are"
+                " still allocated by malloc";
+        }
+    }
+
     // Initialize openssl library
     SSL_library_init();
     SSL_load_error_strings();
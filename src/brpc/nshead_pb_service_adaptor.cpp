@@ -26,12 +26,25 @@
 #include "brpc/span.h"
 #include "brpc/details/server_private_accessor.h"
 #include "brpc/details/controller_private_accessor.h"
+#include "brpc/details/usercode_backup_pool.h"
 #include "brpc/nshead_pb_service_adaptor.h"
 #include "brpc/policy/most_common_message.h"
 
 
 namespace brpc {
 
+namespace policy {
+// Defined in baidu_rpc_protocol.cpp
+void CallMethodInWorkerPool(
+    bthread_tag_t tag,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done);
+}  // namespace policy
+
 struct SendNsheadPbResponse : public google::protobuf::Closure {
     SendNsheadPbResponse(const NsheadPbServiceAdaptor* adaptor,
                          Controller* cntl,
@@ -134,6 +147,13 @@ void NsheadPbServiceAdaptor::ProcessNsheadRequest(
         }
 
         // `meta', `req' and `res' will be deleted inside `pbdone'
+        if (!FLAGS_usercode_in_pthread &&
+            sp->bthread_tag != BTHREAD_TAG_INVALID) {
+            // Call the method in its own worker pool.
+            return policy::CallMethodInWorkerPool(
+                sp->bthread_tag, svc, method, controller,
+                pbdone->pbreq.get(), pbdone->pbres.get(), pbdone);
+        }
         return svc->CallMethod(method, controller, pbdone->pbreq.get(),
                                pbdone->pbres.get(), pbdone);
     } while (false);
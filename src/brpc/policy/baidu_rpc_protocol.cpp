@@ -252,6 +252,7 @@ void SendRpcResponse(int64_t correlation_id,
         // users to set max_concurrency.
         Socket::WriteOptions wopt;
         wopt.ignore_eovercrowded = true;
+        wopt.flush_immediately = true;
         if (sock->Write(&res_buf, &wopt) != 0) {
             const int errcode = errno;
             PLOG_IF(WARNING, errcode != EPIPE) << "Fail to write into " << *sock;
@@ -305,6 +306,48 @@ void EndRunningCallMethodInPool(
     return EndRunningUserCodeInPool(CallMethodInBackupThread, args);
 };
 
+static void* CallMethodInBthread(void* void_args) {
+    CallMethodInBackupThreadArgs* args = (CallMethodInBackupThreadArgs*)void_args;
+    Span* span = ControllerPrivateAccessor(
+        static_cast<Controller*>(args->controller)).span();
+    if (span) {
+        span->AsParent();
+    }
+    CallMethodInBackupThread(args);
+    return NULL;
+}
+
+// Used by other protocols as well.
+void CallMethodInWorkerPool(
+    bthread_tag_t tag,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done) {
+    if (tag == bthread_self_tag()) {
+        return service->CallMethod(method, controller, request, response, done);
+    }
+    CallMethodInBackupThreadArgs* args = new CallMethodInBackupThreadArgs;
+    args->service = service;
+    args->method = method;
+    args->controller = controller;
+    args->request = request;
+    args->response = response;
+    args->done = done;
+    // Start a bthread in the pool rather than moving the calling bthread,
+    // which may be the one reading the socket and must stay in the pool
+    // of the server.
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = tag;
+    bthread_t th;
+    if (bthread_start_background(&th, &attr, CallMethodInBthread, args) != 0) {
+        LOG(WARNING) << "Fail to start bthread in worker pool of tag=" << tag;
+        CallMethodInBthread(args);
+    }
+}
+
 void ProcessRpcRequest(InputMessageBase* msg_base) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
@@ -437,6 +480,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
                                 method_status->max_concurrency());
                 break;
             }
+            method_status->OnDequeued(start_parse_us - msg->received_us());
         }
         google::protobuf::Service* svc = mp->service;
         const google::protobuf::MethodDescriptor* method = mp->method;
@@ -487,6 +531,12 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             span->AsParent();
         }
         if (!FLAGS_usercode_in_pthread) {
+            if (mp->bthread_tag != BTHREAD_TAG_INVALID) {
+                // Call the method in its own worker pool.
+                return CallMethodInWorkerPool(
+                    mp->bthread_tag, svc, method, cntl.release(),
+                    req.release(), res.release(), done);
+            }
             return svc->CallMethod(method, cntl.release(), 
                                    req.release(), res.release(), done);
         }
@@ -718,6 +718,9 @@ static void SendHttpResponse(Controller *cntl,
     butil::IOBuf* content = NULL;
     if (cntl->Failed() || !cntl->has_progressive_writer()) {
         content = &cntl->response_attachment();
+        // The response is complete, don't wait for coalescing. Otherwise
+        // the last chunk written by ProgressiveAttachment flushes.
+        wopt.flush_immediately = true;
     }
     butil::IOBuf res_buf;
     SerializeHttpResponse(&res_buf, res_header, content);
@@ -987,6 +990,7 @@ ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
             SerializeHttpRequest(&bad_req, &header, socket->remote_side(), NULL);
             Socket::WriteOptions wopt;
             wopt.ignore_eovercrowded = true;
+            wopt.flush_immediately = true;
             socket->Write(&bad_req, &wopt);
             return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
         } else {
@@ -1044,6 +1048,16 @@ void EndRunningCallMethodInPool(
     ::google::protobuf::Message* response,
     ::google::protobuf::Closure* done);
 
+// Defined in baidu_rpc_protocol.cpp
+void CallMethodInWorkerPool(
+    bthread_tag_t tag,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done);
+
 void ProcessHttpRequest(InputMessageBase *msg) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<HttpContext> imsg_guard(static_cast<HttpContext*>(msg));
@@ -1192,6 +1206,7 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                             method_status->max_concurrency());
             return SendHttpResponse(cntl.release(), server, method_status);
         }
+        method_status->OnDequeued(start_parse_us - msg->received_us());
     }
     
     if (span) {
@@ -1296,6 +1311,12 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         span->AsParent();
     }
     if (!FLAGS_usercode_in_pthread) {
+        if (sp->bthread_tag != BTHREAD_TAG_INVALID) {
+            // Call the method in its own worker pool.
+            return CallMethodInWorkerPool(
+                sp->bthread_tag, svc, method, cntl.release(),
+                req.release(), res.release(), done);
+        }
         return svc->CallMethod(method, cntl.release(), 
                                req.release(), res.release(), done);
     }
@@ -1311,6 +1332,10 @@ void ProcessHttpRequest(InputMessageBase *msg) {
 }
 
 bool ParseHttpServerAddress(butil::EndPoint* point, const char* server_addr_and_port) {
+    if (strncmp(server_addr_and_port, "unix:", 5) == 0) {
+        // Unix domain socket: "unix:<path>"
+        return str2endpoint(server_addr_and_port, point) == 0;
+    }
     std::string host;
     int port = -1;
     if (ParseHostAndPortFromURL(server_addr_and_port, &host, &port) != 0) {
@@ -98,6 +98,7 @@ void SendMongoResponse::Run() {
         // users to set max_concurrency.
         Socket::WriteOptions wopt;
         wopt.ignore_eovercrowded = true;
+        wopt.flush_immediately = true;
         if (socket->Write(&res_buf, &wopt) != 0) {
             PLOG(WARNING) << "Fail to write into " << *socket;
             return;
@@ -171,6 +172,14 @@ void EndRunningCallMethodInPool(
     const ::google::protobuf::Message* request,
     ::google::protobuf::Message* response,
     ::google::protobuf::Closure* done);
+void CallMethodInWorkerPool(
+    bthread_tag_t tag,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done);
 
 void ProcessMongoRequest(InputMessageBase* msg_base) {
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
@@ -273,6 +282,12 @@ void ProcessMongoRequest(InputMessageBase* msg_base) {
         accessor.set_method(method);
         
         if (!FLAGS_usercode_in_pthread) {
+            if (mp->bthread_tag != BTHREAD_TAG_INVALID) {
+                // Call the method in its own worker pool.
+                return CallMethodInWorkerPool(
+                    mp->bthread_tag, svc, method, &(mongo_done->cntl),
+                    &(mongo_done->req), &(mongo_done->res), mongo_done);
+            }
             return svc->CallMethod(
                 method, &(mongo_done->cntl), &(mongo_done->req),
                 &(mongo_done->res), mongo_done);
@@ -284,6 +284,7 @@ static void SendSofaResponse(int64_t correlation_id,
     // users to set max_concurrency.
     Socket::WriteOptions wopt;
     wopt.ignore_eovercrowded = true;
+    wopt.flush_immediately = true;
     if (sock->Write(&res_buf, &wopt) != 0) {
         const int errcode = errno;
         PLOG_IF(WARNING, errcode != EPIPE) << "Fail to write into " << *sock;
@@ -309,6 +310,14 @@ void EndRunningCallMethodInPool(
     const ::google::protobuf::Message* request,
     ::google::protobuf::Message* response,
     ::google::protobuf::Closure* done);
+void CallMethodInWorkerPool(
+    bthread_tag_t tag,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done);
 
 void ProcessSofaRequest(InputMessageBase* msg_base) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
@@ -410,6 +419,7 @@ void ProcessSofaRequest(InputMessageBase* msg_base) {
                                 method_status->max_concurrency());
                 break;
             }
+            method_status->OnDequeued(start_parse_us - msg->received_us());
         }
         google::protobuf::Service* svc = sp->service;
         const google::protobuf::MethodDescriptor* method = sp->method;
@@ -441,6 +451,12 @@ void ProcessSofaRequest(InputMessageBase* msg_base) {
             span->AsParent();
         }
         if (!FLAGS_usercode_in_pthread) {
+            if (sp->bthread_tag != BTHREAD_TAG_INVALID) {
+                // Call the method in its own worker pool.
+                return CallMethodInWorkerPool(
+                    sp->bthread_tag, svc, method, cntl.release(),
+                    req.release(), res.release(), done);
+            }
             return svc->CallMethod(method, cntl.release(), 
                                    req.release(), res.release(), done);
         }
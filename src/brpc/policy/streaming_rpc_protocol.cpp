@@ -155,7 +155,11 @@ int SendStreamData(Socket* sock, const butil::IOBuf* data,
     fm.set_has_continuation(false);
     butil::IOBuf out;
     PackStreamMessage(&out, fm, data);
-    return sock->Write(&out);
+    // Sent as the response establishing the stream, don't wait for
+    // coalescing.
+    Socket::WriteOptions wopt;
+    wopt.flush_immediately = true;
+    return sock->Write(&out, &wopt);
 }
 
 }  // namespace policy
@@ -51,6 +51,8 @@ ProgressiveAttachment::~ProgressiveAttachment() {
                 tmpbuf.append("0\r\n\r\n", 5);
                 Socket::WriteOptions wopt;
                 wopt.ignore_eovercrowded = true;
+                // Last chunk of the response.
+                wopt.flush_immediately = true;
                 _httpsock->Write(&tmpbuf, &wopt);
             }
         } else {
@@ -109,6 +109,7 @@ DEFINE_bool(enable_threads_service, false, "Enable /threads");
 
 DECLARE_int32(usercode_backup_threads);
 DECLARE_bool(usercode_in_pthread);
+DECLARE_int32(event_dispatcher_num);
 
 const int INITIAL_SERVICE_CAP = 64;
 const int INITIAL_CERT_MAP = 64;
@@ -122,10 +123,12 @@ SSLOptions::SSLOptions()
     , session_lifetime_s(300)
     , session_cache_size(20480)
     , ecdhe_curve_name("prime256v1")
+    , enable_ktls(false)
 {}
 
 ServerOptions::ServerOptions()
     : idle_timeout_sec(-1)
+    , reuse_port(false)
     , nshead_service(NULL)
     , mongo_service_adaptor(NULL)
     , auth(NULL)
@@ -139,6 +142,9 @@ ServerOptions::ServerOptions()
     , bthread_init_fn(NULL)
     , bthread_init_args(NULL)
     , bthread_init_count(0)
+    , bthread_tag(BTHREAD_TAG_DEFAULT)
+    , cork_window_us(-1)
+    , cork_max_bytes(-1)
     , internal_port(-1) 
     , has_builtin_services(true)
     , http_master_service(NULL)
@@ -161,7 +167,8 @@ Server::MethodProperty::MethodProperty()
     , http_url(NULL)
     , service(NULL)
     , method(NULL)
-    , status(NULL) {
+    , status(NULL)
+    , bthread_tag(BTHREAD_TAG_INVALID) {
 }
 
 static timeval GetUptime(void* arg/*start_time*/) {
@@ -534,11 +541,13 @@ Acceptor* Server::BuildAcceptor() {
         whitelist.insert(protocol);
     }
     const bool has_whitelist = !whitelist.empty();
-    Acceptor* acceptor = new (std::nothrow) Acceptor(_keytable_pool);
+    Acceptor* acceptor = new (std::nothrow) Acceptor(
+        _keytable_pool, _options.bthread_tag);
     if (NULL == acceptor) {
         LOG(ERROR) << "Fail to new Acceptor";
         return NULL;
     }
+    acceptor->SetCorkOptions(_options.cork_window_us, _options.cork_max_bytes);
     InputMessageHandler handler;
     std::vector<Protocol> protocols;
     ListProtocols(&protocols);
@@ -688,6 +697,23 @@ int Server::StartInternal(const butil::ip_t& ip,
         _options = ServerOptions();
     }
 
+    if (bthread_getconcurrency_by_tag(_options.bthread_tag) < 0) {
+        LOG(ERROR) << "bthread worker pool of ServerOptions.bthread_tag="
+                   << _options.bthread_tag << " does not exist";
+        return -1;
+    }
+    for (MethodMap::const_iterator it = _method_map.begin();
+         it != _method_map.end(); ++it) {
+        const bthread_tag_t tag = it->second.bthread_tag;
+        if (tag != BTHREAD_TAG_INVALID &&
+            bthread_getconcurrency_by_tag(tag) < 0) {
+            LOG(ERROR) << "bthread worker pool of method="
+                       << it->first << " with tag=" << tag
+                       << " does not exist";
+            return -1;
+        }
+    }
+
     if (_options.http_master_service) {
         // Check requirements for http_master_service:
         //  has "default_method" & request/response have no fields
@@ -772,6 +798,7 @@ int Server::StartInternal(const butil::ip_t& ip,
             init_args[i].stop = false;
             bthread_attr_t tmp = BTHREAD_ATTR_NORMAL;
             tmp.keytable_pool = _keytable_pool;
+            tmp.tag = _options.bthread_tag;
             if (bthread_start_background(
                     &init_args[i].th, &tmp, BthreadInitEntry, &init_args[i]) != 0) {
                 break;
@@ -870,9 +897,17 @@ int Server::StartInternal(const butil::ip_t& ip,
         return -1;
     }
     _listen_addr.ip = ip;
+    // An unix domain socket is addressed by IP_NONE and a port beyond 65535,
+    // see butil/endpoint.h
+    const bool unix_socket = butil::is_unix_endpoint(
+        butil::EndPoint(ip, port_range.min_port));
+    const bool reuse_port = (_options.reuse_port && !unix_socket);
+    const int nlistener = (reuse_port ?
+                           std::max(FLAGS_event_dispatcher_num, 1) : 1);
     for (int port = port_range.min_port; port <= port_range.max_port; ++port) {
         _listen_addr.port = port;
-        butil::fd_guard sockfd(tcp_listen(_listen_addr, FLAGS_reuse_addr));
+        butil::fd_guard sockfd(tcp_listen(_listen_addr, FLAGS_reuse_addr,
+                                          reuse_port));
         if (sockfd < 0) {
             if (port != port_range.max_port) { // not the last port, try next
                 continue;
@@ -909,10 +944,27 @@ int Server::StartInternal(const butil::ip_t& ip,
         GenerateVersionIfNeeded();
         g_running_server_count.fetch_add(1, butil::memory_order_relaxed);
 
-        // Pass ownership of `sockfd' to `_am'
-        if (_am->StartAccept(sockfd, _options.idle_timeout_sec,
+        // Other listeners share the port(which may be dynamically selected)
+        // with `sockfd'.
+        std::vector<int> listened_fds;
+        listened_fds.push_back(sockfd);
+        for (int i = 1; i < nlistener; ++i) {
+            const int fd = tcp_listen(_listen_addr, FLAGS_reuse_addr, true);
+            if (fd < 0) {
+                PLOG(WARNING) << "Fail to listen " << _listen_addr
+                              << " again, use " << i << " listeners";
+                break;
+            }
+            listened_fds.push_back(fd);
+        }
+
+        // Pass ownership of `listened_fds' to `_am'
+        if (_am->StartAccept(listened_fds, _options.idle_timeout_sec,
                              _default_ssl_ctx) != 0) {
             LOG(ERROR) << "Fail to start acceptor";
+            for (size_t i = 1; i < listened_fds.size(); ++i) {
+                close(listened_fds[i]);
+            }
             return -1;
         }
         sockfd.release();
@@ -931,6 +983,11 @@ int Server::StartInternal(const butil::ip_t& ip,
             return -1;
         }
         butil::EndPoint internal_point = _listen_addr;
+        if (unix_socket) {
+            // Builtin services of a server on an unix domain socket are
+            // accessible from all TCP addresses of internal_port.
+            internal_point.ip = butil::IP_ANY;
+        }
         internal_point.port = _options.internal_port;
         butil::fd_guard sockfd(tcp_listen(internal_point, FLAGS_reuse_addr));
         if (sockfd < 0) {
@@ -966,23 +1023,35 @@ int Server::StartInternal(const butil::ip_t& ip,
     // Print tips to server launcher.
     int http_port = _listen_addr.port;
     std::ostringstream server_info;
-    server_info << "Server[" << version() << "] is serving on port="
-                << _listen_addr.port;
+    if (unix_socket) {
+        http_port = -1;
+        server_info << "Server[" << version() << "] is serving on "
+                    << _listen_addr;
+    } else {
+        server_info << "Server[" << version() << "] is serving on port="
+                    << _listen_addr.port;
+    }
     if (_options.internal_port >= 0 && _options.has_builtin_services) {
         http_port = _options.internal_port;
         server_info << " and internal_port=" << _options.internal_port;
     }
     LOG(INFO) << server_info.str() << '.';
 
-    if (_options.has_builtin_services) {
+    if (!_options.has_builtin_services) {
+        LOG(WARNING) << "Builtin services are disabled according to "
+            "ServerOptions.has_builtin_services";
+    } else if (http_port >= 0) {
         LOG(INFO) << "Check out http://" << butil::my_hostname() << ':'
                   << http_port << " in web browser.";
     } else {
-        LOG(WARNING) << "Builtin services are disabled according to "
-            "ServerOptions.has_builtin_services";
+        LOG(INFO) << "Check out builtin services with `curl --unix-socket "
+                  << butil::endpoint2unix_path(_listen_addr)
+                  << " http://localhost/'.";
+    }
+    if (http_port >= 0) {
+        // For trackme reporting
+        SetTrackMeAddress(butil::EndPoint(butil::my_ip(), http_port));
     }
-    // For trackme reporting
-    SetTrackMeAddress(butil::EndPoint(butil::my_ip(), http_port));
     revert_server.release();
     return 0;
 }
@@ -1145,6 +1214,7 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
         mp.service = service;
         mp.method = md;
         mp.status = new MethodStatus;
+        mp.bthread_tag = svc_opt.bthread_tag;
         _method_map[md->full_name()] = mp;
         if (is_idl_support && sd->name() != sd->full_name()/*has ns*/) {
             MethodProperty mp2 = mp;
@@ -1323,6 +1393,7 @@ ServiceOptions::ServiceOptions()
 #else
     , pb_bytes_to_base64(true)
 #endif
+    , bthread_tag(BTHREAD_TAG_INVALID)
     {}
 
 int Server::AddService(google::protobuf::Service* service,
@@ -2009,6 +2080,22 @@ int Server::MaxConcurrencyOf(google::protobuf::Service* service,
     return MaxConcurrencyOf(service->GetDescriptor()->full_name(), method_name);
 }
 
+int Server::SetBthreadTagOf(const butil::StringPiece& full_method_name,
+                            bthread_tag_t tag) {
+    if (status() == RUNNING) {
+        LOG(ERROR) << "Can't set bthread_tag of method=" << full_method_name
+                   << " when server is running";
+        return -1;
+    }
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        return -1;
+    }
+    mp->bthread_tag = tag;
+    return 0;
+}
+
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
 int Server::SSLSwitchCTXByHostname(struct ssl_st* ssl,
                                    int* al, Server* server) {
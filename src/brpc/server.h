@@ -116,6 +116,15 @@ struct SSLOptions {
     // Name of the elliptic curve used to generate ECDH ephemerial keys
     // Default: prime256v1
     std::string ecdhe_curve_name;
+
+    // When set, encryption/decryption is offloaded to the kernel(kTLS) after
+    // handshake so that data is written/read with writev/readv directly.
+    // Requires OpenSSL 3.0+ built with kTLS, the `tls' kernel module and
+    // a cipher supported by the kernel(e.g. AES-GCM), otherwise connections
+    // fall back to OpenSSL silently. Sending and receiving fall back
+    // independently, e.g. linux before 4.17 only offloads sending.
+    // Default: false
+    bool enable_ktls;
     
     // TODO: Support NPN & ALPN
     // TODO: Support OSCP stapling
@@ -129,6 +138,15 @@ struct ServerOptions {
     // Default: -1 (disabled)
     int idle_timeout_sec;
 
+    // Listen to the port with one SO_REUSEPORT socket per EventDispatcher
+    // (-event_dispatcher_num) rather than a single socket. Each socket is
+    // watched by a different dispatcher and the kernel spreads incoming
+    // connections between them, making accepting connections scalable
+    // under connection storms. The port can also be shared with other
+    // servers (possibly in other processes) setting this option.
+    // Default: false
+    bool reuse_port;
+
     // If this option is not empty, a file named so containing Process Id
     // of the server will be created when the server is started.
     // Default: ""
@@ -238,6 +256,23 @@ struct ServerOptions {
     void* bthread_init_args;             // default: NULL
     size_t bthread_init_count;           // default: 0
 
+    // Read and process requests in bthreads of the worker pool with this
+    // tag, which is created by -bthread_worker_pools or
+    // bthread_add_worker_pool() before starting the server. Isolates the
+    // server from bthreads running in other pools.
+    // Default: BTHREAD_TAG_DEFAULT
+    bthread_tag_t bthread_tag;
+
+    // Coalesce writes to each connection for at most so many microseconds
+    // or until `cork_max_bytes' are queued, see SocketOptions.cork_window_us
+    // in brpc/socket.h. The last write of each response is flushed without
+    // waiting, so that only responses written in multiple parts(e.g. with
+    // progressive attachments) are coalesced.
+    // Negative values mean -socket_cork_window_us and -socket_cork_max_bytes.
+    // Default: -1
+    int cork_window_us;
+    int cork_max_bytes;
+
     // Provide builtin services at this port rather than the port to Start().
     // When your server needs to be accessed from public (including traffic
     // redirected by nginx or other http front-end servers), set this port
@@ -334,6 +369,17 @@ struct ServiceOptions {
     // option is turned on.
     // Default: false if BAIDU_INTERNAL is defined, otherwise true
     bool pb_bytes_to_base64;
+
+    // Run methods of the service in bthreads of the worker pool with this
+    // tag rather than the one of ServerOptions.bthread_tag. Requests are
+    // still parsed in the server's pool. Honored by all protocols calling
+    // methods of services added by AddService(): baidu_std, http, hulu_pbrpc,
+    // sofa_pbrpc, mongo and protocols served by NsheadPbServiceAdaptor
+    // (nova_pbrpc, public_pbrpc, ubrpc). Services set in ServerOptions
+    // (nshead_service, rtmp_service...) always run in the server's pool, so
+    // does user code with -usercode_in_pthread.
+    // Default: BTHREAD_TAG_INVALID (use the pool of the server)
+    bthread_tag_t bthread_tag;
 };
 
 // Represent ports inside [min_port, max_port]
@@ -391,6 +437,8 @@ public:
         google::protobuf::Service* service;
         const google::protobuf::MethodDescriptor* method;
         MethodStatus* status;
+        // Methods are called in this worker pool if it's valid.
+        bthread_tag_t bthread_tag;
 
         MethodProperty();
     };
@@ -417,7 +465,8 @@ public:
     //   stopped by Stop() and Join().
     // * port can be 0, which makes kernel to choose a port dynamically.
     
-    // Start on an address in form of "0.0.0.0:8000".
+    // Start on an address in form of "0.0.0.0:8000", or an unix domain
+    // socket in form of "unix:/path/to/sock".
     int Start(const char* ip_port_str, const ServerOptions* opt);
     int Start(const butil::EndPoint& ip_port, const ServerOptions* opt);
     // Start on IP_ANY:port.
@@ -565,6 +614,14 @@ public:
     int MaxConcurrencyOf(google::protobuf::Service* service,
                          const butil::StringPiece& method_name) const;
 
+    // Run a method in the bthread worker pool with `tag' which overrides
+    // ServiceOptions.bthread_tag. Must be called before Start().
+    // Example:
+    //    server.SetBthreadTagOf("example.EchoService.Echo", tag);
+    // Returns 0 on success, -1 otherwise.
+    int SetBthreadTagOf(const butil::StringPiece& full_method_name,
+                        bthread_tag_t tag);
+
 private:
 friend class StatusService;
 friend class ProtobufsService;
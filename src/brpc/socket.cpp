@@ -20,6 +20,9 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <netinet/tcp.h>                         // getsockopt
+#include <linux/errqueue.h>                      // sock_extended_err
+#include <linux/sockios.h>                       // SIOCOUTQ
+#include <sys/ioctl.h>                           // ioctl
 #include <gflags/gflags.h>
 #include "bthread/unstable.h"                    // bthread_timer_del
 #include "butil/fd_utility.h"                     // make_non_blocking
@@ -37,10 +40,16 @@
 #include "brpc/socket.h"
 #include "brpc/input_messenger.h"
 #include "brpc/details/sparse_minute_counter.h"
+#include "brpc/details/shm_transport.h"
 #include "brpc/stream_impl.h"
 #include "brpc/shared_object.h"
 #include "brpc/policy/rtmp_protocol.h"  // FIXME
 
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define BRPC_HAS_ZEROCOPY_SEND
+#endif
+
 namespace bthread {
 size_t __attribute__((weak))
 get_sizes(const bthread_id_list_t* list, size_t* cnt, size_t n);
@@ -85,6 +94,56 @@ static bool validate_connect_timeout_as_unreachable(const char*, int32_t v) {
 BRPC_VALIDATE_GFLAG(connect_timeout_as_unreachable,
                          validate_connect_timeout_as_unreachable);
 
+DEFINE_bool(socket_zerocopy_send, false,
+            "Send large data with MSG_ZEROCOPY(linux 4.14+) to avoid copying "
+            "data into the kernel");
+BRPC_VALIDATE_GFLAG(socket_zerocopy_send, PassValidate);
+
+DEFINE_int32(socket_zerocopy_min_bytes, 1024 * 1024,
+             "A batch of writes to a socket is sent with MSG_ZEROCOPY if it "
+             "has at least so many bytes and -socket_zerocopy_send is on");
+BRPC_VALIDATE_GFLAG(socket_zerocopy_min_bytes, PositiveInteger);
+
+DEFINE_int32(socket_max_read_block_size, butil::IOBuf::MAX_BLOCK_SIZE,
+             "Blocks for reading from a connection grow up to so many bytes"
+             " when the connection keeps reading full buffers, values not"
+             " larger than the default block size(8192) disable growing");
+BRPC_VALIDATE_GFLAG(socket_max_read_block_size, PassValidate);
+
+DEFINE_int32(socket_cork_window_us, 0,
+             "Writes to a socket within so many microseconds are coalesced"
+             " into one syscall unless -socket_cork_max_bytes are queued,"
+             " 0 disables coalescing. Applied to sockets created after");
+BRPC_VALIDATE_GFLAG(socket_cork_window_us, NonNegativeInteger);
+
+DEFINE_int32(socket_cork_max_bytes, 64 * 1024,
+             "Coalesced writes to a socket are flushed once so many bytes"
+             " are queued");
+BRPC_VALIDATE_GFLAG(socket_cork_max_bytes, NonNegativeInteger);
+
+DEFINE_bool(unix_socket_shm, false,
+            "Connections to unix domain sockets exchange data via shared "
+            "memory, servers must be brpc servers with -unix_socket_shm_accept"
+            " on. Applied to new connections");
+BRPC_VALIDATE_GFLAG(unix_socket_shm, PassValidate);
+
+DEFINE_bool(unix_socket_shm_accept, false,
+            "Accept shared memory sent by clients of unix domain sockets with "
+            "-unix_socket_shm on. Applied to new connections");
+BRPC_VALIDATE_GFLAG(unix_socket_shm_accept, PassValidate);
+
+DEFINE_int32(shm_ring_size, 4 * 1024 * 1024,
+             "Bytes of each ring(one for each direction) in the shared memory"
+             " of a connection, see -unix_socket_shm");
+BRPC_VALIDATE_GFLAG(shm_ring_size, PositiveInteger);
+
+DEFINE_int32(socket_busy_poll_us, 0,
+             "Set SO_BUSY_POLL of new TCP connections to so many microseconds "
+             "so that the kernel polls the device queue for data when the "
+             "socket is empty. Values above net.core.busy_read require "
+             "CAP_NET_ADMIN. 0 disables it");
+BRPC_VALIDATE_GFLAG(socket_busy_poll_us, NonNegativeInteger);
+
 const int WAIT_EPOLLOUT_TIMEOUT_MS = 50;
 static const uint32_t REDIS_AUTH_FLAG = (1ul << 15);
 
@@ -110,6 +169,28 @@ public:
     
     // Get all pooled sockets inside.
     void ListSockets(std::vector<SocketId>* list, size_t max_count);
+
+    // Merge limits set by different Channels by taking the maximum.
+    void SetLimits(int min_idle, int max_idle, int connect_timeout_ms);
+
+    // Remove failed sockets, sockets beyond max_idle and sockets without
+    // data transmission for `idle_seconds' (unless there're no more than
+    // min_idle sockets). Returns number of sockets left.
+    int Trim(int idle_seconds);
+
+    // Returns true if the caller should warm up the pool and call
+    // EndWarmUp() after that.
+    bool BeginWarmUp();
+    void EndWarmUp() { _warming_up.store(false, butil::memory_order_release); }
+
+    int count() const { return _count.load(butil::memory_order_relaxed); }
+    // Sockets beyond -max_connection_pool_size can't be returned.
+    int min_idle() const {
+        return std::min(_min_idle.load(butil::memory_order_relaxed),
+                        FLAGS_max_connection_pool_size);
+    }
+    int connect_timeout_ms() const
+    { return _connect_timeout_ms.load(butil::memory_order_relaxed); }
     
 private:
     butil::Mutex _mutex;
@@ -117,6 +198,11 @@ private:
     butil::EndPoint _remote_side;
     // #free-sockets in all sub pools.
     butil::atomic<int> _count;
+    butil::atomic<int> _min_idle;
+    // Negative means no limit other than -max_connection_pool_size.
+    butil::atomic<int> _max_idle;
+    butil::atomic<int> _connect_timeout_ms;
+    butil::atomic<bool> _warming_up;
 };
 
 // NOTE: sizeof of this class is 1200 bytes. If we have 10K sockets, total
@@ -265,6 +351,9 @@ struct SocketVarsCollector {
         , nkeepwrite_second("rpc_keepwrite_second", &nkeepwrite)
         , nwaitepollout("rpc_waitepollout_count")
         , nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout)
+        , zerocopy_bytes("rpc_socket_zerocopy_bytes")
+        , nzerocopy_fallback("rpc_socket_zerocopy_fallback_count")
+        , ncorkedwrite("rpc_socket_corked_write_count")
     {}
 
     bvar::Adder<int64_t> nsocket;
@@ -276,6 +365,12 @@ struct SocketVarsCollector {
     bvar::PerSecond<bvar::Adder<int64_t> > nkeepwrite_second;
     bvar::Adder<int64_t> nwaitepollout;
     bvar::PerSecond<bvar::Adder<int64_t> > nwaitepollout_second;
+    // Bytes sent with MSG_ZEROCOPY
+    bvar::Adder<int64_t> zerocopy_bytes;
+    // Zero-copy sendings that fell back to copying
+    bvar::Adder<int64_t> nzerocopy_fallback;
+    // Batches of writes that waited for coalescing
+    bvar::Adder<int64_t> ncorkedwrite;
 };
 
 static SocketVarsCollector* s_vars = NULL;
@@ -293,6 +388,19 @@ bool Socket::CreatedByConnect() const {
     return _user == static_cast<SocketUser*>(get_client_side_messenger());
 }
 
+struct Socket::ZeroCopyData {
+    ZeroCopyData() : seq(0), done(false), sending(false) {}
+    uint32_t seq;
+    bool done;
+    // sendmsg() of this entry is not returned yet.
+    bool sending;
+    butil::IOBuf data;
+};
+
+static const size_t ZEROCOPY_IOV_MAX = 256;
+// Interval of checking send queues of closing fds with zero-copy data.
+static const int64_t ZEROCOPY_LINGER_CHECK_US = 100000;
+
 SocketMessage* const DUMMY_USER_MESSAGE = (SocketMessage*)0x1;
 const uint32_t MAX_PIPELINED_COUNT = 32768;
 
@@ -415,6 +523,7 @@ Socket::Socket(Forbidden)
     , _shared_part(NULL)
     , _nevent(0)
     , _keytable_pool(NULL)
+    , _bthread_tag(BTHREAD_TAG_INVALID)
     , _fd(-1)
     , _tos(0)
     , _reset_fd_real_us(-1)
@@ -427,6 +536,8 @@ Socket::Socket(Forbidden)
     , _hc_count(0)
     , _last_msg_size(0)
     , _avg_msg_size(0)
+    , _nbulk_read(0)
+    , _nsmall_read(0)
     , _last_readtime_us(0)
     , _parsing_context(NULL)
     , _correlation_id(0)
@@ -438,6 +549,12 @@ Socket::Socket(Forbidden)
     , _ssl_state(SSL_UNKNOWN)
     , _ssl_ctx(NULL)
     , _ssl_session(NULL)
+    , _ktls_send(false)
+    , _ktls_recv(false)
+    , _ktls_checked(false)
+    , _ktls_send_checked(false)
+    , _shm(NULL)
+    , _detect_shm(false)
     , _connection_type_for_progressive_read(CONNECTION_TYPE_UNKNOWN)
     , _controller_released_socket(false)
     , _overcrowded(false)
@@ -449,17 +566,26 @@ Socket::Socket(Forbidden)
     , _last_writetime_us(0)
     , _unwritten_bytes(0)
     , _epollout_butex(NULL)
+    , _cork_window_us(0)
+    , _cork_max_bytes(0)
+    , _cork_bytes(0)
+    , _cork_butex(NULL)
     , _write_head(NULL)
     , _stream_set(NULL)
+    , _zerocopy_state(0)
+    , _zerocopy_seq(0)
+    , _zerocopy_q(NULL)
 {
     CreateVarsOnce();
     pthread_mutex_init(&_id_wait_list_mutex, NULL);
     _epollout_butex = bthread::butex_create_checked<butil::atomic<int> >();
+    _cork_butex = bthread::butex_create_checked<butil::atomic<int> >();
 }
 
 Socket::~Socket() {
     pthread_mutex_destroy(&_id_wait_list_mutex);
     bthread::butex_destroy(_epollout_butex);
+    bthread::butex_destroy(_cork_butex);
 }
 
 void Socket::ReturnSuccessfulWriteRequest(Socket::WriteRequest* p) {
@@ -517,6 +643,11 @@ int Socket::ResetFileDescriptor(int fd) {
     // Reset message sizes when fd is changed.
     _last_msg_size = 0;
     _avg_msg_size = 0;
+    _nbulk_read = 0;
+    _nsmall_read = 0;
+    _read_buf.set_block_size(butil::IOBuf::DEFAULT_BLOCK_SIZE);
+    _zerocopy_state = 0;
+    _zerocopy_seq = 0;
     // MUST store `_fd' before adding itself into epoll device to avoid
     // race conditions with the callback function inside epoll
     _fd.store(fd, butil::memory_order_release);
@@ -528,6 +659,21 @@ int Socket::ResetFileDescriptor(int fd) {
     if (butil::get_local_side(fd, &_local_side) != 0) {
         _local_side = butil::EndPoint();
     }
+    delete _shm;
+    _shm = NULL;
+    _detect_shm = false;
+    if (butil::is_unix_endpoint(remote_side())) {
+        if (!CreatedByConnect()) {
+            // Check the first message from the client.
+            _detect_shm = FLAGS_unix_socket_shm_accept;
+        } else if (FLAGS_unix_socket_shm) {
+            // The shared memory is sent in the first write.
+            if (ShmTransport::Create(FLAGS_shm_ring_size, &_shm) != 0) {
+                LOG(WARNING) << "Fail to use shared memory for "
+                             << remote_side();
+            }
+        }
+    }
 
     // FIXME : close-on-exec should be set by new syscalls or worse: set right
     // after fd-creation syscall. Setting at here has higher probabilities of
@@ -565,8 +711,19 @@ int Socket::ResetFileDescriptor(int fd) {
         }
     }
 
+#ifdef SO_BUSY_POLL
+    const int busy_poll_us = FLAGS_socket_busy_poll_us;
+    if (busy_poll_us > 0 && !butil::is_unix_endpoint(remote_side()) &&
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us,
+                   sizeof(busy_poll_us)) != 0) {
+        PLOG_FIRST_N(WARNING, 1) << "Fail to set SO_BUSY_POLL of fd=" << fd
+                                 << " to " << busy_poll_us;
+    }
+#endif
+
     if (_on_edge_triggered_events) {
-        if (GetGlobalEventDispatcher(fd).AddConsumer(id(), fd) != 0) {
+        if (GetGlobalEventDispatcher(fd, _dispatcher_index).
+            AddConsumer(id(), fd) != 0) {
             PLOG(ERROR) << "Fail to add SocketId=" << id() 
                         << " into EventDispatcher";
             _fd.store(-1, butil::memory_order_release);
@@ -590,9 +747,20 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
     CHECK(NULL == m->_shared_part.load(butil::memory_order_relaxed));
     m->_nevent.store(0, butil::memory_order_relaxed);
     m->_keytable_pool = options.keytable_pool;
+    m->_bthread_tag = options.bthread_tag;
     m->_tos = 0;
     m->_remote_side = options.remote_side;
     m->_on_edge_triggered_events = options.on_edge_triggered_events;
+    m->_dispatcher_index = options.dispatcher_index;
+    m->_cork_window_us.store(options.cork_window_us >= 0 ?
+                             options.cork_window_us :
+                             FLAGS_socket_cork_window_us,
+                             butil::memory_order_relaxed);
+    m->_cork_max_bytes.store(options.cork_max_bytes >= 0 ?
+                             options.cork_max_bytes :
+                             FLAGS_socket_cork_max_bytes,
+                             butil::memory_order_relaxed);
+    m->_cork_bytes.store(0, butil::memory_order_relaxed);
     m->_user = options.user;
     m->_conn = options.conn;
     m->_app_connect = options.app_connect;
@@ -623,6 +791,10 @@ int Socket::Create(const SocketOptions& options, SocketId* id) {
     m->_ssl_state = (options.ssl_ctx == NULL ? SSL_OFF : SSL_UNKNOWN);
     m->_ssl_ctx = options.ssl_ctx;
     m->_ssl_session = NULL;
+    m->_ktls_send.store(false, butil::memory_order_relaxed);
+    m->_ktls_recv = false;
+    m->_ktls_checked = false;
+    m->_ktls_send_checked = false;
     m->_connection_type_for_progressive_read = CONNECTION_TYPE_UNKNOWN;
     m->_controller_released_socket.store(false, butil::memory_order_relaxed);
     m->_overcrowded = false;
@@ -685,9 +857,10 @@ int Socket::WaitAndReset(int32_t expected_nref) {
     const int prev_fd = _fd.exchange(-1, butil::memory_order_relaxed);
     if (ValidFileDescriptor(prev_fd)) {
         if (_on_edge_triggered_events != NULL) {
-            GetGlobalEventDispatcher(prev_fd).RemoveConsumer(prev_fd);
+            GetGlobalEventDispatcher(prev_fd, _dispatcher_index)
+                .RemoveConsumer(id(), prev_fd);
         }
-        close(prev_fd);
+        CloseFileDescriptor(prev_fd);
         if (CreatedByConnect()) {
             s_vars->channel_conn << -1;
         }
@@ -697,6 +870,10 @@ int Socket::WaitAndReset(int32_t expected_nref) {
         SSL_free(_ssl_session);
         _ssl_session = NULL;
     }        
+    _ktls_send.store(false, butil::memory_order_relaxed);
+    _ktls_recv = false;
+    _ktls_checked = false;
+    _ktls_send_checked = false;
     _nevent.store(0, butil::memory_order_relaxed);
     // parsing_context is very likely to be associated with the fd,
     // removing it is a safer choice and required by http2.
@@ -810,8 +987,12 @@ int Socket::SetFailed(int error_code, const char* error_fmt, ...) {
             // comes online.
             if (_health_check_interval_s > 0) {
                 bthread_t th = 0;
+                // Run health checking before bulk work to revive the
+                // socket ASAP.
+                bthread_attr_t attr = BRPC_AUXTHREAD_ATTR;
+                attr.priority = BTHREAD_PRIORITY_HIGH;
                 int rc = bthread_start_background(
-                    &th, &BRPC_AUXTHREAD_ATTR, HealthCheckThread, (void*)id());
+                    &th, &attr, HealthCheckThread, (void*)id());
                 CHECK_EQ(0, rc);
             }
             // Wake up all threads waiting on EPOLLOUT when closing fd
@@ -1011,9 +1192,10 @@ void Socket::OnRecycle() {
     const int prev_fd = _fd.exchange(-1, butil::memory_order_relaxed);
     if (ValidFileDescriptor(prev_fd)) {
         if (_on_edge_triggered_events != NULL) {
-            GetGlobalEventDispatcher(prev_fd).RemoveConsumer(prev_fd);
+            GetGlobalEventDispatcher(prev_fd, _dispatcher_index)
+                .RemoveConsumer(id(), prev_fd);
         }
-        close(prev_fd);
+        CloseFileDescriptor(prev_fd);
         if (create_by_connect) {
             s_vars->channel_conn << -1;
         }
@@ -1030,6 +1212,9 @@ void Socket::OnRecycle() {
         SSL_free(_ssl_session);
         _ssl_session = NULL;
     }
+
+    delete _shm;
+    _shm = NULL;
     
     delete _pipeline_q;
     _pipeline_q = NULL;
@@ -1039,6 +1224,9 @@ void Socket::OnRecycle() {
 
     delete _stream_set;
     _stream_set = NULL;
+
+    delete _zerocopy_q;
+    _zerocopy_q = NULL;
     
     s_vars->nsocket << -1;
 }
@@ -1120,7 +1308,22 @@ int Socket::WaitEpollOut(int fd, bool pollin, const timespec* abstime) {
     // Do not need to check addressable since it will be called by
     // health checker which called `SetFailed' before
     const int expected_val = _epollout_butex->load(butil::memory_order_relaxed);
-    EventDispatcher& edisp = GetGlobalEventDispatcher(fd);
+    if (_shm) {
+        // Space of the ring is freed by the peer which rings the doorbell
+        // and wakes us up in DoShmRead(), EPOLLOUT of `fd' is meaningless.
+        if (!_shm->BeginWaitWritable()) {
+            return 0;
+        }
+        int rc = bthread::butex_wait(_epollout_butex, expected_val, abstime);
+        const int saved_errno = errno;
+        if (rc < 0 && errno == EWOULDBLOCK) {
+            rc = 0;
+        }
+        _shm->EndWaitWritable();
+        errno = saved_errno;
+        return rc;
+    }
+    EventDispatcher& edisp = GetGlobalEventDispatcher(fd, _dispatcher_index);
     if (edisp.AddEpollOut(id(), fd, pollin) != 0) {
         return -1;
     }
@@ -1148,7 +1351,16 @@ int Socket::Connect(const timespec* abstime,
     } else {
         _ssl_state = SSL_OFF;
     }
-    butil::fd_guard sockfd(socket(AF_INET, SOCK_STREAM, 0));
+    struct sockaddr_storage serv_addr;
+    socklen_t serv_addr_len = 0;
+    if (butil::endpoint2sockaddr(remote_side(), &serv_addr,
+                                 &serv_addr_len) != 0) {
+        LOG(ERROR) << "Invalid remote_side=" << remote_side();
+        errno = EINVAL;
+        return -1;
+    }
+    // TCP or unix domain socket according to remote_side()
+    butil::fd_guard sockfd(socket(serv_addr.ss_family, SOCK_STREAM, 0));
     if (sockfd < 0) {
         PLOG(ERROR) << "Fail to create socket";
         return -1;
@@ -1157,14 +1369,8 @@ int Socket::Connect(const timespec* abstime,
     // We need to do async connect (to manage the timeout by ourselves).
     CHECK_EQ(0, butil::make_non_blocking(sockfd));
     
-    
-    struct sockaddr_in serv_addr;
-    bzero((char*)&serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr = remote_side().ip;
-    serv_addr.sin_port = htons(remote_side().port);
     const int rc = ::connect(
-        sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
+        sockfd, (struct sockaddr*)&serv_addr, serv_addr_len);
     if (rc != 0 && errno != EINPROGRESS) {
         PLOG(WARNING) << "Fail to connect to " << remote_side();
         return -1;
@@ -1251,13 +1457,20 @@ int Socket::CheckConnected(int sockfd) {
         return -1;
     }
 
-    struct sockaddr_in client;
-    socklen_t size = sizeof(client);
-    CHECK_EQ(0, getsockname(sockfd, (struct sockaddr*) &client, &size));
+    butil::EndPoint client;
+    if (butil::get_local_side(sockfd, &client) != 0) {
+        // e.g. the table of unix socket paths is full.
+        const int saved_errno = errno;
+        PLOG(ERROR) << "Fail to get local side of fd=" << sockfd;
+        SetFailed(saved_errno, "Fail to get local side of %s: %s",
+                  description().c_str(), berror(saved_errno));
+        errno = saved_errno;
+        return -1;
+    }
     LOG_IF(INFO, FLAGS_log_connected)
             << "Connected to " << remote_side()
             << " via fd=" << (int)sockfd << " SocketId=" << id()
-            << " local_port=" << ntohs(client.sin_port);
+            << " local_side=" << client;
     if (CreatedByConnect()) {
         s_vars->channel_conn << 1;
     }
@@ -1501,6 +1714,22 @@ int Socket::Write(SocketMessagePtr<>& msg, const WriteOptions* options_in) {
 }
 
 int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
+    // Count bytes for coalescing before publishing `req' which may be
+    // written and returned by the KeepWrite thread at any time after.
+    bool flush_cork = false;
+    const int cork_window_us = _cork_window_us.load(butil::memory_order_relaxed);
+    if (cork_window_us > 0) {
+        const int cork_max_bytes =
+            _cork_max_bytes.load(butil::memory_order_relaxed);
+        int64_t nadd = req->data.size();
+        if (opt.flush_immediately) {
+            // Reach the threshold so that the coalescing writer stops
+            // waiting even if it has not started waiting yet.
+            nadd += cork_max_bytes;
+        }
+        flush_cork = (_cork_bytes.fetch_add(nadd, butil::memory_order_relaxed)
+                      + nadd >= cork_max_bytes);
+    }
     // Release fence makes sure the thread getting request sees *req
     WriteRequest* const prev_head =
         _write_head.exchange(req, butil::memory_order_release);
@@ -1511,6 +1740,9 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
         // depending on compiler) that the spin rarely occurs in practice
         // (I've not seen any spin in highly contended tests).
         req->next = prev_head;
+        if (flush_cork) {
+            WakeCorkedWriter();
+        }
         return 0;
     }
 
@@ -1518,6 +1750,7 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
     bthread_t th;
     SocketUniquePtr ptr_for_keep_write;
     ssize_t nw = 0;
+    bool corked = false;
 
     // We've got the right to write.
     req->next = NULL;
@@ -1538,8 +1771,14 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
     // which is assumed to run before any SocketMessage.AppendAndDestroySelf()
     // in some protocols(namely RTMP).
     req->Setup(this);
+
+    if (cork_window_us > 0 && !flush_cork) {
+        // Wait for more writes to coalesce in the background.
+        corked = true;
+        goto KEEPWRITE_IN_BACKGROUND;
+    }
     
-    if (ssl_state() != SSL_OFF) {
+    if (ssl_state() != SSL_OFF && !IsKTLSSendEnabled()) {
         // Writing into SSL may block the current bthread, always write
         // in the background.
         goto KEEPWRITE_IN_BACKGROUND;
@@ -1547,9 +1786,13 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
     
     // Write once in the calling thread. If the write is not complete,
     // continue it in KeepWrite thread.
+    _cork_bytes.store(0, butil::memory_order_relaxed);
     if (_conn) {
         butil::IOBuf* data_arr[1] = { &req->data };
         nw = _conn->CutMessageIntoFileDescriptor(fd(), data_arr, 1);
+    } else if (_shm) {
+        butil::IOBuf* data_arr[1] = { &req->data };
+        nw = _shm->Write(fd(), data_arr, 1);
     } else {
         nw = req->data.cut_into_file_descriptor(fd());
     }
@@ -1575,7 +1818,8 @@ KEEPWRITE_IN_BACKGROUND:
     ReAddress(&ptr_for_keep_write);
     req->socket = ptr_for_keep_write.release();
     if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL,
-                                 KeepWrite, req) != 0) {
+                                 (corked ? CorkAndKeepWrite : KeepWrite),
+                                 req) != 0) {
         LOG(FATAL) << "Fail to start KeepWrite";
         KeepWrite(req);
     }
@@ -1590,6 +1834,38 @@ FAIL_TO_WRITE:
     return -1;
 }
 
+void Socket::WakeCorkedWriter() {
+    _cork_butex->fetch_add(1, butil::memory_order_release);
+    bthread::butex_wake(_cork_butex);
+}
+
+void* Socket::CorkAndKeepWrite(void* void_arg) {
+    s_vars->ncorkedwrite << 1;
+    WriteRequest* req = static_cast<WriteRequest*>(void_arg);
+    // Owned by `req' and released by KeepWrite.
+    Socket* s = req->socket;
+    const int64_t deadline_us = butil::gettimeofday_us() +
+        s->_cork_window_us.load(butil::memory_order_relaxed);
+    while (!s->Failed()) {
+        const int expected_val =
+            s->_cork_butex->load(butil::memory_order_acquire);
+        if (s->_cork_bytes.load(butil::memory_order_relaxed)
+            >= s->_cork_max_bytes.load(butil::memory_order_relaxed)) {
+            break;
+        }
+        const timespec duetime = butil::microseconds_to_timespec(deadline_us);
+        if (bthread::butex_wait(s->_cork_butex, expected_val, &duetime) < 0
+            && errno == ETIMEDOUT) {
+            break;
+        }
+    }
+    // Link requests queued during the wait so that they're written along
+    // with `req' in one syscall. Writes queued from now on are written by
+    // KeepWrite without waiting.
+    s->IsWriteComplete(req, false, NULL);
+    return KeepWrite(req);
+}
+
 static const size_t DATA_LIST_MAX = 256;
 
 void* Socket::KeepWrite(void* void_arg) {
@@ -1608,6 +1884,9 @@ void* Socket::KeepWrite(void* void_arg) {
             req = req->next;
             s->ReturnSuccessfulWriteRequest(saved_req);
         }
+        // Bytes for coalescing are counted from the last flush, including
+        // the ones of batches not waiting for coalescing.
+        s->_cork_bytes.store(0, butil::memory_order_relaxed);
         const ssize_t nw = s->DoWrite(req);
         if (nw < 0) {
             if (errno != EAGAIN && errno != EOVERCROWDED) {
@@ -1669,7 +1948,9 @@ void* Socket::KeepWrite(void* void_arg) {
 }
 
 ssize_t Socket::DoWrite(WriteRequest* req) {
-    if (ssl_state() == SSL_OFF) {
+    // With kTLS, the kernel encrypts whatever written into the fd.
+    const bool ktls_send = (ssl_state() != SSL_OFF && IsKTLSSendEnabled());
+    if (ssl_state() == SSL_OFF || ktls_send) {
         // Group butil::IOBuf in the list into a batch array.
         butil::IOBuf* data_list[DATA_LIST_MAX];
         size_t ndata = 0;
@@ -1677,14 +1958,25 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
              p = p->next) {
             data_list[ndata++] = &p->data;
         }
+        if (_shm) {
+            return _shm->Write(fd(), data_list, ndata);
+        }
         // Write IOBuf in the batch array into the fd.
         if (_conn) {
             return _conn->CutMessageIntoFileDescriptor(fd(), data_list, ndata);
-        } else {
-            ssize_t nw = butil::IOBuf::cut_multiple_into_file_descriptor(
-                fd(), data_list, ndata);
-            return nw;
         }
+        if (FLAGS_socket_zerocopy_send && !ktls_send) {
+            size_t total = 0;
+            for (size_t i = 0; i < ndata; ++i) {
+                total += data_list[i]->size();
+            }
+            if (total >= (size_t)FLAGS_socket_zerocopy_min_bytes) {
+                return DoZeroCopyWrite(data_list, ndata);
+            }
+        }
+        ssize_t nw = butil::IOBuf::cut_multiple_into_file_descriptor(
+            fd(), data_list, ndata);
+        return nw;
     } else if (ssl_state() == SSL_UNKNOWN) {
         LOG(FATAL) << "Impossible! SSL state MUST have been set before";
         errno = EINVAL;
@@ -1733,7 +2025,269 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
     return nw;
 }
 
+ssize_t Socket::DoZeroCopyWrite(butil::IOBuf* const* data_list,
+                                size_t ndata) {
+    const int fd = this->fd();
+#ifdef BRPC_HAS_ZEROCOPY_SEND
+    if (_zerocopy_state == 0) {
+        const int on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+            _zerocopy_state = 1;
+        } else {
+            PLOG(WARNING) << "Fail to set SO_ZEROCOPY on fd=" << fd;
+            _zerocopy_state = -1;
+        }
+    }
+    if (_zerocopy_state > 0) {
+        struct iovec vec[ZEROCOPY_IOV_MAX];
+        size_t nvec = 0;
+        for (size_t i = 0; i < ndata && nvec < ZEROCOPY_IOV_MAX; ++i) {
+            const size_t nblock = data_list[i]->backing_block_num();
+            for (size_t j = 0; j < nblock && nvec < ZEROCOPY_IOV_MAX;
+                 ++j, ++nvec) {
+                const butil::StringPiece blk = data_list[i]->backing_block(j);
+                vec[nvec].iov_base = (void*)blk.data();
+                vec[nvec].iov_len = blk.size();
+            }
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vec;
+        msg.msg_iovlen = nvec;
+        // The kernel numbers successful sendings from 0 and notifies
+        // completions with ranges of the numbers, which may be reaped by
+        // EventDispatcher before sendmsg() returns. Reserve the entry before
+        // sending so that no completion is missed.
+        {
+            BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+            if (_zerocopy_q == NULL) {
+                _zerocopy_q = new std::deque<ZeroCopyData>;
+            }
+            _zerocopy_q->push_back(ZeroCopyData());
+            _zerocopy_q->back().seq = _zerocopy_seq;
+            _zerocopy_q->back().sending = true;
+        }
+        const ssize_t nw = sendmsg(fd, &msg, MSG_ZEROCOPY);
+        const int saved_errno = errno;
+        // Released outside the lock.
+        butil::IOBuf released;
+        {
+            BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+            std::deque<ZeroCopyData>& q = *_zerocopy_q;
+            if (nw > 0) {
+                // Keep referencing the written blocks until completed.
+                ZeroCopyData& zd = q.back();
+                ++_zerocopy_seq;
+                size_t npop_all = nw;
+                for (size_t i = 0; i < ndata && npop_all > 0; ++i) {
+                    npop_all -= data_list[i]->cutn(&zd.data, npop_all);
+                }
+                zd.sending = false;
+                while (!q.empty() && q.front().done && !q.front().sending) {
+                    released.append(butil::IOBuf::Movable(q.front().data));
+                    q.pop_front();
+                }
+            } else {
+                q.pop_back();
+            }
+        }
+        if (nw > 0) {
+            s_vars->zerocopy_bytes << nw;
+            return nw;
+        }
+        errno = saved_errno;
+        if (nw == 0 || errno != ENOBUFS) {
+            return nw;
+        }
+        // ENOBUFS: pinned pages exceed the limit(optmem_max), copy instead.
+    }
+    s_vars->nzerocopy_fallback << 1;
+#endif
+    return butil::IOBuf::cut_multiple_into_file_descriptor(
+        fd, data_list, ndata);
+}
+
+void Socket::ReapZeroCopyCompletions(SocketId socket_id) {
+#ifdef BRPC_HAS_ZEROCOPY_SEND
+    SocketUniquePtr s;
+    if (Socket::Address(socket_id, &s) != 0) {
+        // Data will be released in OnRecycle.
+        return;
+    }
+    // Drain the error queue even if no data is waiting for completions,
+    // otherwise the fd keeps reporting EPOLLERR.
+    const int fd = s->fd();
+    if (fd < 0) {
+        return;
+    }
+    // Released outside the lock.
+    butil::IOBuf released;
+    while (true) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                PLOG_EVERY_SECOND(WARNING) << "Fail to read error queue of fd="
+                                           << fd;
+            }
+            break;
+        }
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            const sock_extended_err* err = (sock_extended_err*)CMSG_DATA(cm);
+            if (err->ee_errno != 0 ||
+                err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // Sendings numbered in [lo, hi] are completed.
+            const uint32_t lo = err->ee_info;
+            const uint32_t hi = err->ee_data;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // The kernel copied the data anyway, e.g. the device does
+                // not support scatter-gather or the peer is on loopback.
+                s_vars->nzerocopy_fallback << (int64_t)(hi - lo + 1);
+            }
+            BAIDU_SCOPED_LOCK(s->_zerocopy_mutex);
+            if (s->_zerocopy_q == NULL) {
+                continue;
+            }
+            std::deque<ZeroCopyData>& q = *s->_zerocopy_q;
+            for (std::deque<ZeroCopyData>::iterator
+                     it = q.begin(); it != q.end(); ++it) {
+                if (it->seq - lo <= hi - lo) {
+                    it->done = true;
+                }
+            }
+            // Completions are mostly in order. An entry still being sent
+            // is popped by the sender.
+            while (!q.empty() && q.front().done && !q.front().sending) {
+                released.append(butil::IOBuf::Movable(q.front().data));
+                q.pop_front();
+            }
+        }
+    }
+#else
+    (void)socket_id;
+#endif
+}
+
+struct ZeroCopyLinger {
+    int fd;
+    butil::IOBuf data;
+};
+
+// Close the fd and release the data when nothing is left in the send queue
+// of the fd, check again later otherwise.
+static void CloseZeroCopyLinger(void* arg) {
+    ZeroCopyLinger* l = static_cast<ZeroCopyLinger*>(arg);
+    int unsent = 0;
+    if (ioctl(l->fd, SIOCOUTQ, &unsent) == 0 && unsent > 0) {
+        bthread_timer_t timer;
+        if (bthread_timer_add(
+                &timer, butil::microseconds_from_now(ZEROCOPY_LINGER_CHECK_US),
+                CloseZeroCopyLinger, l) == 0) {
+            return;
+        }
+        LOG(WARNING) << "Fail to add timer, release zero-copy data of fd="
+                     << l->fd << " before the kernel finishes sending";
+    }
+    close(l->fd);
+    delete l;
+}
+
+void Socket::CloseFileDescriptor(int fd) {
+    ZeroCopyLinger* l = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_zerocopy_mutex);
+        if (_zerocopy_q != NULL && !_zerocopy_q->empty()) {
+            l = new ZeroCopyLinger;
+            l->fd = fd;
+            for (size_t i = 0; i < _zerocopy_q->size(); ++i) {
+                l->data.append(butil::IOBuf::Movable((*_zerocopy_q)[i].data));
+            }
+            _zerocopy_q->clear();
+        }
+    }
+    if (l == NULL) {
+        close(fd);
+        return;
+    }
+    // The kernel keeps sending(and retransmitting) remaining data after
+    // the fd is closed, reusing the blocks before that corrupts the data on
+    // wire, and completions can't be read from a closed fd. Shut down the
+    // connection now so that the peer sees EOF just like closing, but keep
+    // the fd until its send queue is empty, which happens when all data is
+    // acknowledged or the kernel gives up retransmitting(tcp_retries2).
+    shutdown(fd, SHUT_RDWR);
+    CloseZeroCopyLinger(l);
+}
+
+// Number of consecutive bulk(or small) reads to grow(or shrink) blocks.
+static const uint16_t ADAPT_READ_BLOCK_THRESHOLD = 4;
+
+void Socket::AdaptReadBlockSize(size_t nr, size_t size_hint) {
+    const size_t block_size = _read_buf.block_size();
+    const int32_t max_flag = FLAGS_socket_max_read_block_size;
+    const size_t max_block_size =
+        (max_flag > (int32_t)butil::IOBuf::DEFAULT_BLOCK_SIZE ?
+         (size_t)max_flag : butil::IOBuf::DEFAULT_BLOCK_SIZE);
+    if (block_size > max_block_size) {
+        // The flag was lowered.
+        _read_buf.set_block_size(max_block_size);
+        _nbulk_read = 0;
+        _nsmall_read = 0;
+        return;
+    }
+    if (nr >= size_hint && nr >= 4 * block_size) {
+        // Filled all requested space which spans many blocks, the peer is
+        // probably sending bulk data.
+        _nsmall_read = 0;
+        if (block_size < max_block_size &&
+            ++_nbulk_read >= ADAPT_READ_BLOCK_THRESHOLD) {
+            _nbulk_read = 0;
+            _read_buf.set_block_size(std::min(block_size * 2, max_block_size));
+        }
+    } else if (nr < block_size) {
+        _nbulk_read = 0;
+        if (block_size > butil::IOBuf::DEFAULT_BLOCK_SIZE &&
+            ++_nsmall_read >= ADAPT_READ_BLOCK_THRESHOLD) {
+            _nsmall_read = 0;
+            _read_buf.set_block_size(block_size / 2);
+        }
+    } else {
+        _nbulk_read = 0;
+        _nsmall_read = 0;
+    }
+}
+
 ssize_t Socket::DoRead(size_t size_hint) {
+    if (_detect_shm) {
+        ShmTransport* t = NULL;
+        const int rc = ShmTransport::Accept(fd(), &t);
+        if (rc < 0) {
+            return -1;
+        }
+        _detect_shm = false;
+        if (rc > 0) {
+            _shm = t;
+            _ssl_state = SSL_OFF;
+            RPC_VLOG << "Use shared memory of " << _shm->ring_size()
+                     << " bytes each direction on " << *this;
+        }
+    }
+    if (_shm) {
+        return DoShmRead();
+    }
     if (ssl_state() == SSL_UNKNOWN) {
         int error_code = 0;
         _ssl_state = DetectSSLState(fd(), &error_code);
@@ -1768,7 +2322,17 @@ ssize_t Socket::DoRead(size_t size_hint) {
     }
     // _ssl_state has been set
     if (ssl_state() == SSL_OFF) {
-        return _read_buf.append_from_file_descriptor(fd(), size_hint);
+        const ssize_t nr = _read_buf.append_from_file_descriptor(fd(), size_hint);
+        if (nr > 0) {
+            AdaptReadBlockSize(nr, size_hint);
+        }
+        return nr;
+    }
+
+    // Data buffered inside the SSL session must be read out before reading
+    // the fd directly.
+    if (_ktls_recv && SSL_pending(_ssl_session) <= 0) {
+        return DoKTLSRead(size_hint);
     }
 
     // Doing SSL handshake inside `append_from_SSL_channel'
@@ -1812,9 +2376,73 @@ ssize_t Socket::DoRead(size_t size_hint) {
         }
         }
     } while (need_continue);
+    if (!_ktls_checked && SSL_is_init_finished(_ssl_session)) {
+        _ktls_checked = true;
+        const int saved_errno = errno;
+        bool ktls_send = false;
+        GetKTLSState(_ssl_session, &ktls_send, &_ktls_recv);
+        if (ktls_send) {
+            _ktls_send.store(true, butil::memory_order_release);
+        }
+        if (ktls_send || _ktls_recv) {
+            RPC_VLOG << "Enabled kTLS on " << *this << " send=" << ktls_send
+                     << " recv=" << _ktls_recv;
+        }
+        errno = saved_errno;
+    }
+    return nr;
+}
+
+bool Socket::IsKTLSSendEnabled() {
+    if (_ktls_send.load(butil::memory_order_acquire)) {
+        return true;
+    }
+    if (_ktls_send_checked || ssl_state() != SSL_CONNECTED ||
+        !SSL_is_init_finished(_ssl_session)) {
+        return false;
+    }
+    _ktls_send_checked = true;
+    bool ktls_send = false;
+    bool ktls_recv = false;
+    GetKTLSState(_ssl_session, &ktls_send, &ktls_recv);
+    if (ktls_send) {
+        _ktls_send.store(true, butil::memory_order_release);
+    }
+    return ktls_send;
+}
+
+ssize_t Socket::DoShmRead() {
+    const ssize_t nr = _shm->Read(fd(), &_read_buf);
+    if (_shm->ShouldWakeWriters()) {
+        // Same as HandleEpollOut()
+        _epollout_butex->fetch_add(1, butil::memory_order_relaxed);
+        bthread::butex_wake_except(_epollout_butex, 0);
+    }
     return nr;
 }
 
+ssize_t Socket::DoKTLSRead(size_t size_hint) {
+    while (true) {
+        const ssize_t nr = _read_buf.append_from_file_descriptor(fd(), size_hint);
+        if (nr > 0) {
+            AdaptReadBlockSize(nr, size_hint);
+            return nr;
+        }
+        if (nr == 0 || errno != EIO) {
+            return nr;
+        }
+        // The next record is not application data.
+        const size_t old_size = _read_buf.size();
+        const int rc = ReadKTLSRecord(fd(), &_read_buf);
+        if (rc <= 0) {
+            return rc;
+        }
+        if (_read_buf.size() != old_size) {
+            return _read_buf.size() - old_size;
+        }
+    }
+}
+
 int Socket::FightAuthentication(int* auth_error) {
     // Use relaxed fence since `bthread_id_trylock' ensures thread safety
     // Here `flag_error' just acts like a cache information
@@ -1864,7 +2492,8 @@ AuthContext* Socket::mutable_auth_context() {
 }
 
 int Socket::StartInputEvent(SocketId id, uint32_t epoll_events,
-                            const bthread_attr_t& thread_attr) {
+                            const bthread_attr_t& thread_attr,
+                            int inline_max_bytes) {
     SocketUniquePtr s;
     if (Address(id, &s) < 0) {
         return -1;
@@ -1891,12 +2520,23 @@ int Socket::StartInputEvent(SocketId id, uint32_t epoll_events,
         // is just 1500~1700/s
         s_vars->neventthread << 1;
 
+        // No one is reading the socket, _avg_msg_size is stable. Messages
+        // bound to another worker pool are never processed inline.
+        if (s->_avg_msg_size > 0 &&
+            s->_avg_msg_size <= (uint32_t)inline_max_bytes &&
+            (s->_bthread_tag == BTHREAD_TAG_INVALID ||
+             s->_bthread_tag == bthread_self_tag())) {
+            ProcessEvent(s.release());
+            return 0;
+        }
+
         bthread_t tid;
         // transfer ownership as well, don't use s anymore!
         Socket* const p = s.release();
 
         bthread_attr_t attr = thread_attr;
         attr.keytable_pool = p->_keytable_pool;
+        attr.tag = p->_bthread_tag;
         if (bthread_start_urgent(&tid, &attr, ProcessEvent, p) != 0) {
             LOG(FATAL) << "Fail to start ProcessEvent";
             ProcessEvent(p);
@@ -2020,9 +2660,14 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
         // NOTE: We're assuming that butil::IOBuf.size() is thread-safe, it is now
         // however it's not guaranteed.
        << "\nread_buf=" << ptr->_read_buf.size()
+       << "\nread_block_size=" << ptr->_read_buf.block_size()
        << "\nlast_read_to_now=" << cpuwide_now - ptr->_last_readtime_us << "us"
        << "\nlast_write_to_now=" << cpuwide_now - ptr->_last_writetime_us << "us"
-       << "\novercrowded=" << ptr->_overcrowded;
+       << "\novercrowded=" << ptr->_overcrowded
+       << "\ncork_window_us="
+       << ptr->_cork_window_us.load(butil::memory_order_relaxed)
+       << "\ncork_max_bytes="
+       << ptr->_cork_max_bytes.load(butil::memory_order_relaxed);
     os << "\nid_wait_list={";
     for (size_t i = 0; i < nidsize; ++i) {
         if (i) {
@@ -2051,6 +2696,9 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
        << "\nssl_state=" << SSLStateToString(ptr->_ssl_state)
        << "\nssl_ctx=" << (void*)ptr->_ssl_ctx
        << "\nssl_session=" << (void*)ptr->_ssl_session // TODO: print SSL internal
+       << "\nktls_send=" << ptr->_ktls_send.load(butil::memory_order_relaxed)
+       << "\nktls_recv=" << ptr->_ktls_recv
+       << "\nshm=" << (ptr->_shm != NULL)
        << "\nlogoff_flag=" << ptr->_logoff_flag.load(butil::memory_order_relaxed)
        << "\nrecycle_flag=" << ptr->_recycle_flag.load(butil::memory_order_relaxed)
        << "\ncid=" << ptr->_correlation_id
@@ -2161,7 +2809,12 @@ void SocketUser::AfterRevived(Socket* ptr) {
 ////////// SocketPool //////////////
 
 inline SocketPool::SocketPool(const butil::EndPoint& pt)
-    : _remote_side(pt), _count(0) {
+    : _remote_side(pt)
+    , _count(0)
+    , _min_idle(0)
+    , _max_idle(-1)
+    , _connect_timeout_ms(0)
+    , _warming_up(false) {
 }
 
 inline SocketPool::~SocketPool() {
@@ -2258,6 +2911,79 @@ inline void SocketPool::ListSockets(std::vector<SocketId>* out, size_t max_count
     _mutex.unlock();
 }
 
+static void UpdateMax(butil::atomic<int>* value, int new_value) {
+    int old_value = value->load(butil::memory_order_relaxed);
+    while (new_value > old_value &&
+           !value->compare_exchange_weak(old_value, new_value,
+                                         butil::memory_order_relaxed)) {}
+}
+
+void SocketPool::SetLimits(int min_idle, int max_idle, int connect_timeout_ms) {
+    UpdateMax(&_min_idle, min_idle);
+    UpdateMax(&_max_idle, max_idle);
+    UpdateMax(&_connect_timeout_ms, connect_timeout_ms);
+}
+
+int SocketPool::Trim(int idle_seconds) {
+    const int min_idle = _min_idle.load(butil::memory_order_relaxed);
+    const int max_idle = _max_idle.load(butil::memory_order_relaxed);
+    const int64_t now_us = butil::cpuwide_time_us();
+    std::vector<Socket*> unused;
+    std::vector<Socket*> idle;
+    int nleft = 0;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        // Sockets are got from and returned to the back, the ones at the
+        // front are least recently used. Scan from the back so that the
+        // most recently used sockets are kept.
+        size_t j = _pool.size();
+        for (size_t i = _pool.size(); i > 0; --i) {
+            SocketUniquePtr ptr;
+            if (Socket::Address(_pool[i - 1], &ptr) != 0) {
+                continue;
+            }
+            if (max_idle >= 0 && nleft >= max_idle) {
+                unused.push_back(ptr.release());
+                continue;
+            }
+            if (idle_seconds > 0 && nleft >= min_idle &&
+                now_us - ptr->last_active_time_us() >
+                idle_seconds * 1000000L) {
+                idle.push_back(ptr.release());
+                continue;
+            }
+            ++nleft;
+            _pool[--j] = _pool[i - 1];
+        }
+        _pool.erase(_pool.begin(), _pool.begin() + j);
+        _count.fetch_sub(j, butil::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < unused.size(); ++i) {
+        SocketUniquePtr ptr(unused[i]);
+        ptr->SetFailed(EUNUSED, "Close unused pooled socket");
+    }
+    // Idleness was checked under _mutex and the sockets are out of the pool,
+    // close them unconditionally. Checking again here(as in
+    // ReleaseReferenceIfIdle) would leak sockets which just became active:
+    // neither pooled nor closed.
+    for (size_t i = 0; i < idle.size(); ++i) {
+        SocketUniquePtr ptr(idle[i]);
+        LOG_IF(WARNING, FLAGS_log_idle_connection_close)
+            << "Close " << *ptr << " due to no data transmission for "
+            << idle_seconds << " seconds";
+        ptr->SetFailed(EUNUSED, "No data transmission for %d seconds",
+                       idle_seconds);
+    }
+    return nleft;
+}
+
+bool SocketPool::BeginWarmUp() {
+    if (count() >= min_idle()) {
+        return false;
+    }
+    return !_warming_up.exchange(true, butil::memory_order_acquire);
+}
+
 Socket::SharedPart* Socket::GetOrNewSharedPartSlower() {
     // Create _shared_part optimistically.
     SharedPart* shared_part = GetSharedPart();
@@ -2285,33 +3011,137 @@ void Socket::ShareStats(Socket* main_socket) {
     }
 }
 
-int Socket::GetPooledSocket(Socket* main_socket,
-                            SocketUniquePtr* pooled_socket) {
-    if (main_socket == NULL || pooled_socket == NULL) {
-        LOG(ERROR) << "main_socket or pooled_socket is NULL";
-        return -1;
-    }
-    SharedPart* main_sp = main_socket->GetOrNewSharedPart();
-    if (main_sp == NULL) {
-        LOG(ERROR) << "main_socket->_shared_part is NULL";
-        return -1;
+SocketPool* Socket::GetOrNewSocketPool() {
+    SharedPart* sp = GetOrNewSharedPart();
+    if (sp == NULL) {
+        LOG(ERROR) << "_shared_part is NULL";
+        return NULL;
     }
     // Create socket_pool optimistically.
-    SocketPool* socket_pool = main_sp->socket_pool.load(butil::memory_order_consume);
+    SocketPool* socket_pool = sp->socket_pool.load(butil::memory_order_consume);
     if (socket_pool == NULL) {
-        socket_pool = new SocketPool(main_socket->remote_side());
+        socket_pool = new SocketPool(remote_side());
         SocketPool* expected = NULL;
-        if (!main_sp->socket_pool.compare_exchange_strong(
+        if (!sp->socket_pool.compare_exchange_strong(
                 expected, socket_pool, butil::memory_order_acq_rel)) {
             delete socket_pool;
             CHECK(expected);
             socket_pool = expected;
         }
     }
+    return socket_pool;
+}
+
+void Socket::SetPooledSocketLimits(int min_idle, int max_idle,
+                                   int connect_timeout_ms) {
+    SocketPool* pool = GetOrNewSocketPool();
+    if (pool == NULL) {
+        return;
+    }
+    pool->SetLimits(min_idle, max_idle, connect_timeout_ms);
+    StartWarmUpPooledSockets(pool);
+}
+
+void Socket::SetCorkOptions(int cork_window_us, int cork_max_bytes) {
+    if (cork_window_us >= 0) {
+        _cork_window_us.store(cork_window_us, butil::memory_order_relaxed);
+    }
+    if (cork_max_bytes >= 0) {
+        _cork_max_bytes.store(cork_max_bytes, butil::memory_order_relaxed);
+    }
+}
+
+void Socket::MaintainPooledSockets(int idle_seconds) {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        return;
+    }
+    SocketPool* pool = sp->socket_pool.load(butil::memory_order_consume);
+    if (pool == NULL) {
+        return;
+    }
+    pool->Trim(idle_seconds);
+    StartWarmUpPooledSockets(pool);
+}
+
+void Socket::StartWarmUpPooledSockets(SocketPool* pool) {
+    // Don't connect to servers failing health checking.
+    if (Failed() || !pool->BeginWarmUp()) {
+        return;
+    }
+    SocketUniquePtr ptr;
+    // Hold a reference to this socket which owns `pool'.
+    ReAddress(&ptr);
+    bthread_t th;
+    if (bthread_start_background(&th, &BTHREAD_ATTR_SMALL,
+                                 WarmUpPooledSockets, ptr.get()) != 0) {
+        LOG(WARNING) << "Fail to start WarmUpPooledSockets";
+        pool->EndWarmUp();
+        return;
+    }
+    ptr.release();
+}
+
+void* Socket::WarmUpPooledSockets(void* arg) {
+    SocketUniquePtr main_socket(static_cast<Socket*>(arg));
+    SocketPool* pool = main_socket->GetSharedPart()->socket_pool.load(
+        butil::memory_order_consume);
+    int nconnected = 0;
+    while (pool->count() < pool->min_idle() && !main_socket->Failed()) {
+        SocketId sid;
+        if (get_client_side_messenger()->Create(
+                main_socket->remote_side(), -1, &sid) != 0) {
+            break;
+        }
+        SocketUniquePtr ptr;
+        if (Socket::Address(sid, &ptr) != 0) {
+            break;
+        }
+        // Connect synchronously so that RPC getting this socket from the
+        // pool does not pay the cost.
+        const int timeout_ms = pool->connect_timeout_ms();
+        timespec abstime;
+        if (timeout_ms > 0) {
+            abstime = butil::milliseconds_from_now(timeout_ms);
+        }
+        const int fd = ptr->Connect((timeout_ms > 0 ? &abstime : NULL),
+                                    NULL, NULL);
+        if (fd < 0 || ptr->ResetFileDescriptor(fd) != 0) {
+            const int saved_errno = errno;
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            ptr->SetFailed(saved_errno, "Fail to connect %s: %s",
+                           ptr->description().c_str(), berror(saved_errno));
+            break;
+        }
+        pool->ReturnSocket(ptr.get());
+        ++nconnected;
+    }
+    RPC_VLOG_IF(nconnected > 0) << "Connected " << nconnected
+                                << " pooled sockets to "
+                                << main_socket->remote_side();
+    pool->EndWarmUp();
+    return NULL;
+}
+
+int Socket::GetPooledSocket(Socket* main_socket,
+                            SocketUniquePtr* pooled_socket) {
+    if (main_socket == NULL || pooled_socket == NULL) {
+        LOG(ERROR) << "main_socket or pooled_socket is NULL";
+        return -1;
+    }
+    SocketPool* socket_pool = main_socket->GetOrNewSocketPool();
+    if (socket_pool == NULL) {
+        return -1;
+    }
     if (socket_pool->GetSocket(pooled_socket) != 0) {
         return -1;
     }
     (*pooled_socket)->ShareStats(main_socket);
+    (*pooled_socket)->SetCorkOptions(
+        main_socket->_cork_window_us.load(butil::memory_order_relaxed),
+        main_socket->_cork_max_bytes.load(butil::memory_order_relaxed));
     CHECK((*pooled_socket)->parsing_context() == NULL)
         << "context=" << (*pooled_socket)->parsing_context()
         << " is not NULL when socket={" << *(*pooled_socket) << "} is got from"
@@ -2374,6 +3204,9 @@ int Socket::GetShortSocket(Socket* main_socket,
         return -1;
     }
     (*short_socket)->ShareStats(main_socket);
+    (*short_socket)->SetCorkOptions(
+        main_socket->_cork_window_us.load(butil::memory_order_relaxed),
+        main_socket->_cork_max_bytes.load(butil::memory_order_relaxed));
     return 0;
 }
 
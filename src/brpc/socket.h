@@ -51,6 +51,8 @@ class Socket;
 class AuthContext;
 class EventDispatcher;
 class Stream;
+class ShmTransport;
+class SocketPool;
 
 // A special closure for processing the about-to-recycle socket. Socket does
 // not delete SocketUser, if you want, `delete this' at the end of
@@ -156,10 +158,24 @@ struct SocketOptions {
     int health_check_interval_s;
     SSL_CTX* ssl_ctx;
     bthread_keytable_pool_t* keytable_pool;
+    // Messages read from the socket are processed in bthreads of the
+    // worker pool with this tag. BTHREAD_TAG_INVALID means no preference.
+    bthread_tag_t bthread_tag;
     SocketConnection* conn;
     AppConnect* app_connect;
     // The created socket will set parsing_context with this value.
     Destroyable* initial_parsing_context;
+    // Events of `fd' are watched by the EventDispatcher at this index
+    // (modulo -event_dispatcher_num). If it's negative, the dispatcher is
+    // chosen by hashing `fd'.
+    int dispatcher_index;
+    // Coalesce writes to the socket: the write starting a batch waits for
+    // at most so many microseconds or until `cork_max_bytes' are queued,
+    // then the queued data is written in one syscall. 0 disables coalescing.
+    // If they're negative, -socket_cork_window_us and -socket_cork_max_bytes
+    // are used.
+    int cork_window_us;
+    int cork_max_bytes;
 };
 
 // Abstractions on reading from and writing into file descriptors.
@@ -178,6 +194,7 @@ friend class schan::ChannelBalancer;
     class SharedPart;
     struct Forbidden {};
     struct WriteRequest;
+    struct ZeroCopyData;
 
 public:
     const static int STREAM_FAKE_FD = INT_MAX;
@@ -221,9 +238,16 @@ public:
 
         bool with_auth;
 
+        // Write without waiting for more data even if writes to the socket
+        // are coalesced(SocketOptions.cork_window_us), data queued before
+        // is flushed as well.
+        // Default: false
+        bool flush_immediately;
+
         WriteOptions()
             : id_wait(INVALID_BTHREAD_ID), abstime(NULL)
-            , pipelined_count(0), ignore_eovercrowded(false), with_auth(false) {}
+            , pipelined_count(0), ignore_eovercrowded(false), with_auth(false)
+            , flush_immediately(false) {}
     };
     int Write(butil::IOBuf *msg, const WriteOptions* options = NULL);
     
@@ -326,9 +350,13 @@ public:
     bool IsLogOff() const;
     
     // Start to process edge-triggered events from the fd.
-    // This function does not block caller.
+    // This function does not block caller, unless `inline_max_bytes' is
+    // positive and messages of the socket are no more than so many bytes
+    // on average, in which case the events are processed in the calling
+    // thread to save creation of a bthread.
     static int StartInputEvent(SocketId id, uint32_t epoll_events,
-                               const bthread_attr_t& thread_attr);
+                               const bthread_attr_t& thread_attr,
+                               int inline_max_bytes = 0);
 
     static const int PROGRESS_INIT = 1;
     bool MoreReadEvents(int* progress);
@@ -406,6 +434,25 @@ public:
     // Put all sockets in _shared_part->socket_pool into `list'.
     void ListPooledSockets(std::vector<SocketId>* list, size_t max_count = 0);
 
+    // Keep at least `min_idle' connected sockets in the pool and close the
+    // ones beyond `max_idle'(no limit if it's negative) in
+    // MaintainPooledSockets(). Missing sockets are connected in background
+    // within `connect_timeout_ms'. Values set by different callers are
+    // merged by taking the maximum.
+    void SetPooledSocketLimits(int min_idle, int max_idle,
+                               int connect_timeout_ms);
+
+    // Change parameters of coalescing writes, see SocketOptions.cork_window_us.
+    // Negative values are ignored. Pooled and short sockets got from this
+    // socket later use the same parameters.
+    void SetCorkOptions(int cork_window_us, int cork_max_bytes);
+
+    // Close failed sockets, superfluous sockets and sockets without data
+    // transmission for `idle_seconds'(no effect if it's non-positive) in the
+    // pool, and connect new sockets if there're less than `min_idle' ones.
+    // Called by SocketMap periodically.
+    void MaintainPooledSockets(int idle_seconds);
+
     // Create a socket connecting to the same place of main_socket.
     static int GetShortSocket(Socket* main_socket,
                               SocketUniquePtr* short_socket);
@@ -464,11 +511,41 @@ friend void DereferenceSocket(Socket*);
     // bytes on success, 0 on EOF, -1 otherwise and errno is set
     ssize_t DoRead(size_t size_hint);  
 
+    // Read from the fd whose receiving side is decrypted by the kernel.
+    ssize_t DoKTLSRead(size_t size_hint);
+
+    // Returns true if data written into the fd is encrypted by the kernel.
+    // Checks kTLS state at the first call after the handshake, which may be
+    // finished in either reading or writing. Called by the writing side.
+    bool IsKTLSSendEnabled();
+
+    // Read from the shared memory of `_shm'.
+    ssize_t DoShmRead();
+
+    // Grow or shrink blocks of `_read_buf' according to `nr' bytes just
+    // read with `size_hint'.
+    void AdaptReadBlockSize(size_t nr, size_t size_hint);
+
     // Based upon whether the underlying channel is using SSL, write
     // `req' using the corresponding method. Returns written bytes on
     // success, -1 otherwise and errno is set
     ssize_t DoWrite(WriteRequest* req);
 
+    // Write `data_list' into fd with MSG_ZEROCOPY. Written data is moved
+    // into `_zerocopy_q' and kept until the kernel notifies completion.
+    // Falls back to normal writes when zero-copy is not supported.
+    ssize_t DoZeroCopyWrite(butil::IOBuf* const* data_list, size_t ndata);
+
+    // Release data in `_zerocopy_q' whose zero-copy sendings are completed
+    // according to notifications in the error queue of the socket.
+    // Called by EventDispatcher on EPOLLERR.
+    static void ReapZeroCopyCompletions(SocketId socket_id);
+
+    // Close `fd' and release all data in `_zerocopy_q'. If the kernel may
+    // still be sending the data, `fd' is shut down at once but closed
+    // (along with releasing the data) after its send queue drains.
+    void CloseFileDescriptor(int fd);
+
     // Called before returning to pool.
     void OnRecycle();
 
@@ -511,6 +588,9 @@ friend void DereferenceSocket(Socket*);
     static void* ProcessEvent(void*);
 
     static void* KeepWrite(void*);
+    // Wait for more data to coalesce before KeepWrite.
+    static void* CorkAndKeepWrite(void*);
+    void WakeCorkedWriter();
 
     bool IsWriteComplete(WriteRequest* old_head, bool singular_node,
                          WriteRequest** new_tail);
@@ -563,6 +643,11 @@ friend void DereferenceSocket(Socket*);
     SharedPart* GetOrNewSharedPart();
     SharedPart* GetOrNewSharedPartSlower();
 
+    SocketPool* GetOrNewSocketPool();
+    // Start a bthread to connect sockets into `pool' if needed.
+    void StartWarmUpPooledSockets(SocketPool* pool);
+    static void* WarmUpPooledSockets(void* arg);
+
     void CheckEOFInternal();
     
     // _error_code is set after a socket becomes failed, during the time
@@ -602,6 +687,9 @@ private:
     // May be set by Acceptor to share keytables between reading threads
     // on sockets created by the Acceptor.
     bthread_keytable_pool_t* _keytable_pool;
+
+    // May be set by Acceptor to process messages in a bthread worker pool.
+    bthread_tag_t _bthread_tag;
     
     // [ Set in ResetFileDescriptor ] 
     butil::atomic<int> _fd;  // -1 when not connected.
@@ -619,6 +707,10 @@ private:
     // carefully before implementing the callback.
     void (*_on_edge_triggered_events)(Socket*);
 
+    // Index of the EventDispatcher watching `_fd', see
+    // SocketOptions.dispatcher_index
+    int _dispatcher_index;
+
     // A set of callbacks to monitor important events of this socket.
     // Initialized by SocketOptions.user
     SocketUser* _user;
@@ -646,6 +738,10 @@ private:
     // Average message size of last #MSG_SIZE_WINDOW messages (roughly)
     uint32_t _avg_msg_size;
 
+    // Numbers of consecutive bulk/small reads, see AdaptReadBlockSize().
+    uint16_t _nbulk_read;
+    uint16_t _nsmall_read;
+
     // Storing data read from `_fd' but cut-off yet.
     butil::IOPortal _read_buf;
 
@@ -688,6 +784,23 @@ private:
     SSL_CTX* _ssl_ctx;               // not owner
     SSL* _ssl_session;               // owner
 
+    // Set when data written into(or read from) `_fd' is encrypted(or
+    // decrypted) by the kernel, see SSLOptions.enable_ktls. The SSL session
+    // is then bypassed and writev/readv are used directly.
+    butil::atomic<bool> _ktls_send;
+    bool _ktls_recv;
+    // True if kTLS state has been checked after the handshake by the
+    // reading(or writing) side. Each is only accessed by that side.
+    bool _ktls_checked;
+    bool _ktls_send_checked;
+
+    // Data is exchanged via shared memory rather than `_fd' when this is
+    // set, which only happens on unix domain sockets. See -unix_socket_shm.
+    ShmTransport* _shm;              // owner
+    // True if the server side hasn't checked whether the client uses
+    // shared memory.
+    bool _detect_shm;
+
     // Pass from controller, for progressive reading.
     ConnectionType _connection_type_for_progressive_read;
     butil::atomic<bool> _controller_released_socket;
@@ -725,11 +838,30 @@ private:
     // Butex to wait for EPOLLOUT event
     butil::atomic<int>* _epollout_butex;
 
+    // Parameters of coalescing writes, see SocketOptions.cork_window_us.
+    // Atomic because SetCorkOptions() may be called during writing.
+    butil::atomic<int> _cork_window_us;
+    butil::atomic<int> _cork_max_bytes;
+    // Bytes queued since last flush.
+    butil::atomic<int64_t> _cork_bytes;
+    // Butex to wake up the coalescing writer.
+    butil::atomic<int>* _cork_butex;
+
     // Storing data that are not flushed into `fd' yet.
     butil::atomic<WriteRequest*> _write_head;
 
     butil::Mutex _stream_mutex;
     std::set<StreamId> *_stream_set;
+
+    // 0: SO_ZEROCOPY is not set yet, 1: set, -1: not supported.
+    // Only accessed by the thread writing the fd.
+    int _zerocopy_state;
+    // Sequence number of next MSG_ZEROCOPY sending, starting from 0 for
+    // each fd, just like the counter inside kernel.
+    uint32_t _zerocopy_seq;
+    // Data that may be still referenced by the kernel.
+    butil::Mutex _zerocopy_mutex;
+    std::deque<ZeroCopyData>* _zerocopy_q;
 };
 
 } // namespace brpc
@@ -56,9 +56,13 @@ inline SocketOptions::SocketOptions()
     , health_check_interval_s(-1)
     , ssl_ctx(NULL)
     , keytable_pool(NULL)
+    , bthread_tag(BTHREAD_TAG_INVALID)
     , conn(NULL)
     , app_connect(NULL)
     , initial_parsing_context(NULL)
+    , dispatcher_index(-1)
+    , cork_window_us(-1)
+    , cork_max_bytes(-1)
 {}
 
 inline int Socket::Dereference() {
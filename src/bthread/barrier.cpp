@@ -0,0 +1,108 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pthread.h>                             // PTHREAD_BARRIER_SERIAL_THREAD
+#include "butil/atomicops.h"
+#include "bthread/butex.h"                       // butex_*
+#include "bthread/bthread.h"
+
+namespace bthread {
+
+// Layout of the butex of bthread_barrier_t:
+//   bit 20 - 31: generation, increased when all parties arrived. Waiters
+//                wait on the butex for the change.
+//   bit 0 - 19 : number of parties arrived in current generation.
+// Arrivals and the generation are in one word so that an arrival is always
+// counted in the right generation.
+static const unsigned BARRIER_GENERATION_UNIT = 1u << 20;
+static const unsigned BARRIER_ARRIVED_MASK = BARRIER_GENERATION_UNIT - 1;
+static const unsigned BARRIER_MAX_COUNT = BARRIER_ARRIVED_MASK;
+
+inline int barrier_wait(bthread_barrier_t* b, const timespec* abstime) {
+    // The barrier may be destroyed by others after all parties arrived,
+    // don't touch `b' after the arrival.
+    butil::atomic<unsigned>* word = (butil::atomic<unsigned>*)b->butex;
+    const unsigned count = b->count;
+    // The last one starts next generation in the same CAS so that parties
+    // leaving on timeout never leave a completed generation.
+    unsigned prev = word->load(butil::memory_order_relaxed);
+    bool last = false;
+    do {
+        last = ((prev & BARRIER_ARRIVED_MASK) + 1 == count);
+    } while (!word->compare_exchange_weak(
+                 prev, (last ? (prev & ~BARRIER_ARRIVED_MASK) +
+                        BARRIER_GENERATION_UNIT : prev + 1),
+                 butil::memory_order_acq_rel, butil::memory_order_relaxed));
+    if (last) {
+        butex_wake_all(word);
+        return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+    const unsigned gen = prev & ~BARRIER_ARRIVED_MASK;
+    while (true) {
+        unsigned v = word->load(butil::memory_order_acquire);
+        if ((v & ~BARRIER_ARRIVED_MASK) != gen) {
+            return 0;
+        }
+        if (butex_wait(word, v, abstime) == 0 ||
+            errno == EWOULDBLOCK || errno == EINTR) {
+            continue;
+        }
+        const int rc = errno;
+        // Leave the barrier unless the generation was just completed.
+        v = word->load(butil::memory_order_relaxed);
+        while ((v & ~BARRIER_ARRIVED_MASK) == gen) {
+            if (word->compare_exchange_weak(v, v - 1,
+                                            butil::memory_order_relaxed)) {
+                return rc;
+            }
+        }
+        return 0;
+    }
+}
+
+}  // namespace bthread
+
+extern "C" {
+
+int bthread_barrier_init(bthread_barrier_t* __restrict b,
+                         const bthread_barrierattr_t* __restrict,
+                         unsigned count) __THROW {
+    if (count == 0 || count > bthread::BARRIER_MAX_COUNT) {
+        return EINVAL;
+    }
+    b->butex = bthread::butex_create_checked<unsigned>();
+    if (!b->butex) {
+        return ENOMEM;
+    }
+    *b->butex = 0;
+    b->count = count;
+    return 0;
+}
+
+int bthread_barrier_destroy(bthread_barrier_t* b) __THROW {
+    bthread::butex_destroy(b->butex);
+    return 0;
+}
+
+int bthread_barrier_wait(bthread_barrier_t* b) __THROW {
+    return bthread::barrier_wait(b, NULL);
+}
+
+int bthread_barrier_timedwait(bthread_barrier_t* __restrict b,
+                              const struct timespec* __restrict abstime) __THROW {
+    return bthread::barrier_wait(b, abstime);
+}
+
+}  // extern "C"
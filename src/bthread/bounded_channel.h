@@ -0,0 +1,133 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef  BTHREAD_BOUNDED_CHANNEL_H
+#define  BTHREAD_BOUNDED_CHANNEL_H
+
+#include "butil/atomicops.h"                     // butil::atomic
+#include "butil/macros.h"                        // DISALLOW_COPY_AND_ASSIGN
+#include "butil/memory/aligned_memory.h"         // butil::AlignedMemory
+#include "bthread/bthread.h"
+
+namespace bthread {
+
+// A bounded multi-producer multi-consumer queue for passing items between
+// bthreads (or pthreads), like buffered channels of Go. Pushing and popping
+// are lock-free, send() and recv() block the calling bthread (not the worker
+// pthread) when the channel is full or empty respectively.
+//
+// Compared to ExecutionQueue, items are consumed by any number of long-lived
+// consumers instead of a bthread started on demand, and producers are slowed
+// down when consumers can't keep up.
+//
+// Example:
+//   bthread::BoundedChannel<Request*> chan;
+//   chan.init(1024);
+//   // producers
+//   chan.send(req);
+//   // consumers
+//   Request* reqs[32];
+//   size_t n = 0;
+//   while (chan.recv_batch(reqs, arraysize(reqs), &n) == 0) {
+//       process(reqs, n);
+//   }
+//   // ESTOP: the channel was closed and all items were received.
+//
+// Methods return 0 on success, error code otherwise:
+//   EAGAIN    try_send() on a full channel or try_recv() on an empty one.
+//   ETIMEDOUT `abstime' was reached.
+//   ESTOP     The channel was closed: sending fails, receiving fails after
+//             all items sent successfully were received.
+template <typename T>
+class BoundedChannel {
+public:
+    BoundedChannel();
+    // Remaining items are destroyed.
+    ~BoundedChannel();
+
+    // Must be called before using. `capacity' is rounded up to power of 2
+    // which is at least 2.
+    int init(size_t capacity);
+
+    // Put `item' into the channel, wait until there's space or `abstime'
+    // is reached if abstime is not NULL.
+    int send(const T& item, const timespec* abstime = NULL);
+    int try_send(const T& item);
+
+    // Take one item from the channel, wait until there's one or `abstime'
+    // is reached if abstime is not NULL.
+    int recv(T* item, const timespec* abstime = NULL);
+    int try_recv(T* item);
+
+    // Take at most `max_items' items from the channel and put the number
+    // into *nitems. Wait until there's at least one item or `abstime' is
+    // reached if abstime is not NULL.
+    int recv_batch(T* items, size_t max_items, size_t* nitems,
+                   const timespec* abstime = NULL);
+
+    // Wake up all blocked senders and receivers. Senders fail ever after,
+    // receivers fail after the channel is drained.
+    void close();
+    bool closed() const {
+        return _send_pos.load(butil::memory_order_acquire) & CLOSED_BIT;
+    }
+
+    size_t capacity() const { return _mask + 1; }
+    // Number of items in the channel, not accurate under contention.
+    size_t size() const;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(BoundedChannel);
+
+    // A cell is free for the push at position `pos' when seq == pos, and
+    // is full for the pop at `pos' when seq == pos + 1.
+    struct Cell {
+        butil::atomic<size_t> seq;
+        butil::AlignedMemory<sizeof(T), ALIGNOF(T)> data;
+    };
+
+    // Set in _send_pos by close() so that a push either happens before
+    // close() and is seen by receivers, or fails.
+    static const size_t CLOSED_BIT = (size_t)1 << (sizeof(size_t) * 8 - 1);
+
+    // Returns 0 on success, EAGAIN when full, ESTOP when closed.
+    int push(const T& item);
+    bool pop(T* item);
+    // True if the channel is closed and all pushed items were popped.
+    bool drained_after_close() const;
+    // Wake up at most `n' waiters counted in `nwaiting' after changing
+    // the channel.
+    static void wake_up(butil::atomic<int>* butex,
+                        butil::atomic<int>* nwaiting, size_t n);
+    // Wake up senders after `n' items were popped, and receivers if the
+    // channel is drained after close().
+    void wake_up_after_recv(size_t n);
+
+    Cell* _cells;
+    size_t _mask;
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<size_t> _send_pos;
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<size_t> _recv_pos;
+    // Bumped after pushes/pops to wake up receivers/senders respectively.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int>* _recv_butex;
+    butil::atomic<int> _nwaiting_receivers;
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int>* _send_butex;
+    butil::atomic<int> _nwaiting_senders;
+};
+
+}  // namespace bthread
+
+#include "bthread/bounded_channel_inl.h"
+
+#endif  // BTHREAD_BOUNDED_CHANNEL_H
@@ -0,0 +1,324 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef  BTHREAD_BOUNDED_CHANNEL_INL_H
+#define  BTHREAD_BOUNDED_CHANNEL_INL_H
+
+#include <new>                                   // std::nothrow
+#include "bthread/butex.h"                       // butex_*
+#include "bthread/errno.h"                       // ESTOP
+
+namespace bthread {
+
+template <typename T>
+BoundedChannel<T>::BoundedChannel()
+    : _cells(NULL)
+    , _mask(0)
+    , _send_pos(0)
+    , _recv_pos(0)
+    , _recv_butex(NULL)
+    , _nwaiting_receivers(0)
+    , _send_butex(NULL)
+    , _nwaiting_senders(0) {
+}
+
+template <typename T>
+BoundedChannel<T>::~BoundedChannel() {
+    if (_cells) {
+        const size_t end =
+            _send_pos.load(butil::memory_order_relaxed) & ~CLOSED_BIT;
+        for (size_t pos = _recv_pos.load(butil::memory_order_relaxed);
+             pos != end; ++pos) {
+            Cell* c = &_cells[pos & _mask];
+            if (c->seq.load(butil::memory_order_relaxed) == pos + 1) {
+                c->data.template data_as<T>()->~T();
+            }
+        }
+        delete [] _cells;
+        _cells = NULL;
+    }
+    if (_recv_butex) {
+        butex_destroy(_recv_butex);
+        _recv_butex = NULL;
+    }
+    if (_send_butex) {
+        butex_destroy(_send_butex);
+        _send_butex = NULL;
+    }
+}
+
+template <typename T>
+int BoundedChannel<T>::init(size_t capacity) {
+    if (_cells != NULL || capacity == 0 || capacity > (1UL << 31)) {
+        return EINVAL;
+    }
+    // Positions of full cells and free cells are not distinguishable with
+    // one cell.
+    size_t n = 2;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    _recv_butex = butex_create_checked<butil::atomic<int> >();
+    _send_butex = butex_create_checked<butil::atomic<int> >();
+    _cells = new (std::nothrow) Cell[n];
+    if (_recv_butex == NULL || _send_butex == NULL || _cells == NULL) {
+        delete [] _cells;
+        _cells = NULL;
+        if (_recv_butex) {
+            butex_destroy(_recv_butex);
+            _recv_butex = NULL;
+        }
+        if (_send_butex) {
+            butex_destroy(_send_butex);
+            _send_butex = NULL;
+        }
+        return ENOMEM;
+    }
+    _recv_butex->store(0, butil::memory_order_relaxed);
+    _send_butex->store(0, butil::memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i) {
+        _cells[i].seq.store(i, butil::memory_order_relaxed);
+    }
+    _mask = n - 1;
+    return 0;
+}
+
+template <typename T>
+int BoundedChannel<T>::push(const T& item) {
+    size_t pos = _send_pos.load(butil::memory_order_relaxed);
+    Cell* c = NULL;
+    while (true) {
+        if (pos & CLOSED_BIT) {
+            return ESTOP;
+        }
+        c = &_cells[pos & _mask];
+        const size_t seq = c->seq.load(butil::memory_order_acquire);
+        const long dif = (long)(seq - pos);
+        if (dif == 0) {
+            if (_send_pos.compare_exchange_weak(
+                    pos, pos + 1, butil::memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return EAGAIN;  // full
+        } else {
+            pos = _send_pos.load(butil::memory_order_relaxed);
+        }
+    }
+    new (c->data.void_data()) T(item);
+    c->seq.store(pos + 1, butil::memory_order_release);
+    return 0;
+}
+
+template <typename T>
+bool BoundedChannel<T>::pop(T* item) {
+    size_t pos = _recv_pos.load(butil::memory_order_relaxed);
+    Cell* c = NULL;
+    while (true) {
+        c = &_cells[pos & _mask];
+        const size_t seq = c->seq.load(butil::memory_order_acquire);
+        const long dif = (long)(seq - (pos + 1));
+        if (dif == 0) {
+            if (_recv_pos.compare_exchange_weak(
+                    pos, pos + 1, butil::memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return false;  // empty, or the sender has not finished writing.
+        } else {
+            pos = _recv_pos.load(butil::memory_order_relaxed);
+        }
+    }
+    T* data = c->data.template data_as<T>();
+    *item = *data;
+    data->~T();
+    c->seq.store(pos + _mask + 1, butil::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool BoundedChannel<T>::drained_after_close() const {
+    const size_t send_pos = _send_pos.load(butil::memory_order_acquire);
+    // Positions claimed before close() are never pushed again, a sender
+    // which claimed a position may not have finished writing the item,
+    // receivers wait for it.
+    return (send_pos & CLOSED_BIT) &&
+        _recv_pos.load(butil::memory_order_relaxed) == (send_pos & ~CLOSED_BIT);
+}
+
+// Waiters count themselves in `nwaiting' and re-check the channel after a
+// full fence, wakers change the channel and check `nwaiting' after a full
+// fence, so that either the waiter sees the change or the waker sees the
+// waiter and bumps the butex which fails the coming butex_wait.
+template <typename T>
+void BoundedChannel<T>::wake_up(butil::atomic<int>* butex,
+                                butil::atomic<int>* nwaiting, size_t n) {
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    if (nwaiting->load(butil::memory_order_relaxed) == 0) {
+        return;
+    }
+    butex->fetch_add(1, butil::memory_order_release);
+    for (size_t i = 0; i < n && butex_wake(butex) > 0; ++i) {}
+}
+
+template <typename T>
+void BoundedChannel<T>::wake_up_after_recv(size_t n) {
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    if (_nwaiting_senders.load(butil::memory_order_relaxed) != 0) {
+        _send_butex->fetch_add(1, butil::memory_order_release);
+        for (size_t i = 0; i < n && butex_wake(_send_butex) > 0; ++i) {}
+    }
+    // Receivers woken up by close() may wait for items of senders which
+    // claimed positions before close(). The receiver taking the last item
+    // wakes all of them up to see the channel drained.
+    if (_nwaiting_receivers.load(butil::memory_order_relaxed) != 0 &&
+        drained_after_close()) {
+        _recv_butex->fetch_add(1, butil::memory_order_release);
+        butex_wake_all(_recv_butex);
+    }
+}
+
+template <typename T>
+int BoundedChannel<T>::try_send(const T& item) {
+    const int rc = push(item);
+    if (rc != 0) {
+        return rc;
+    }
+    wake_up(_recv_butex, &_nwaiting_receivers, 1);
+    return 0;
+}
+
+template <typename T>
+int BoundedChannel<T>::send(const T& item, const timespec* abstime) {
+    while (true) {
+        const int rc = try_send(item);
+        if (rc != EAGAIN) {
+            return rc;
+        }
+        const int expected = _send_butex->load(butil::memory_order_relaxed);
+        _nwaiting_senders.fetch_add(1, butil::memory_order_relaxed);
+        butil::atomic_thread_fence(butil::memory_order_seq_cst);
+        const int rc2 = try_send(item);
+        if (rc2 != EAGAIN) {
+            _nwaiting_senders.fetch_sub(1, butil::memory_order_relaxed);
+            return rc2;
+        }
+        const int rc3 = butex_wait(_send_butex, expected, abstime);
+        const int saved_errno = errno;
+        _nwaiting_senders.fetch_sub(1, butil::memory_order_relaxed);
+        if (rc3 < 0 && saved_errno != EWOULDBLOCK && saved_errno != EINTR) {
+            // We may be woken up and timed out at the same time, try again
+            // to not miss the space. Report close() rather than the failed
+            // wait if both happened.
+            const int rc4 = try_send(item);
+            if (rc4 != EAGAIN) {
+                return rc4;
+            }
+            return closed() ? ESTOP : saved_errno;
+        }
+    }
+}
+
+template <typename T>
+int BoundedChannel<T>::try_recv(T* item) {
+    if (!pop(item)) {
+        return drained_after_close() ? ESTOP : EAGAIN;
+    }
+    wake_up_after_recv(1);
+    return 0;
+}
+
+template <typename T>
+int BoundedChannel<T>::recv(T* item, const timespec* abstime) {
+    size_t n = 0;
+    return recv_batch(item, 1, &n, abstime);
+}
+
+template <typename T>
+int BoundedChannel<T>::recv_batch(T* items, size_t max_items,
+                                  size_t* nitems, const timespec* abstime) {
+    *nitems = 0;
+    if (max_items == 0) {
+        return EINVAL;
+    }
+    bool counted = false;
+    int expected = 0;
+    while (true) {
+        size_t n = 0;
+        while (n < max_items && pop(items + n)) {
+            ++n;
+        }
+        if (n != 0) {
+            if (counted) {
+                _nwaiting_receivers.fetch_sub(1, butil::memory_order_relaxed);
+            }
+            *nitems = n;
+            wake_up_after_recv(n);
+            return 0;
+        }
+        if (drained_after_close()) {
+            if (counted) {
+                _nwaiting_receivers.fetch_sub(1, butil::memory_order_relaxed);
+            }
+            return ESTOP;
+        }
+        if (!counted) {
+            // Count ourselves and check the channel again before sleeping.
+            expected = _recv_butex->load(butil::memory_order_relaxed);
+            _nwaiting_receivers.fetch_add(1, butil::memory_order_relaxed);
+            butil::atomic_thread_fence(butil::memory_order_seq_cst);
+            counted = true;
+            continue;
+        }
+        const int rc = butex_wait(_recv_butex, expected, abstime);
+        const int saved_errno = errno;
+        _nwaiting_receivers.fetch_sub(1, butil::memory_order_relaxed);
+        counted = false;
+        if (rc < 0 && saved_errno != EWOULDBLOCK && saved_errno != EINTR) {
+            // Woken up and timed out at the same time, try again to not
+            // miss the item.
+            while (n < max_items && pop(items + n)) {
+                ++n;
+            }
+            if (n == 0) {
+                return drained_after_close() ? ESTOP : saved_errno;
+            }
+            *nitems = n;
+            wake_up_after_recv(n);
+            return 0;
+        }
+    }
+}
+
+template <typename T>
+void BoundedChannel<T>::close() {
+    _send_pos.fetch_or(CLOSED_BIT, butil::memory_order_seq_cst);
+    _recv_butex->fetch_add(1, butil::memory_order_release);
+    _send_butex->fetch_add(1, butil::memory_order_release);
+    butex_wake_all(_recv_butex);
+    butex_wake_all(_send_butex);
+}
+
+template <typename T>
+size_t BoundedChannel<T>::size() const {
+    const size_t recv_pos = _recv_pos.load(butil::memory_order_relaxed);
+    const size_t send_pos =
+        _send_pos.load(butil::memory_order_relaxed) & ~CLOSED_BIT;
+    return send_pos > recv_pos ? send_pos - recv_pos : 0;
+}
+
+}  // namespace bthread
+
+#endif  // BTHREAD_BOUNDED_CHANNEL_INL_H
@@ -81,28 +81,52 @@ inline TaskControl* get_or_new_task_control() {
 
 __thread TaskGroup* tls_task_group_nosignal = NULL;
 
+// Tag of the pool that bthreads created with `attr' by a thread running
+// TaskGroup `g' (NULL for non-workers) run in.
+inline bthread_tag_t tag_to_start(const bthread_attr_t* attr, TaskGroup* g) {
+    if (attr != NULL && attr->tag != BTHREAD_TAG_INVALID) {
+        return attr->tag;
+    }
+    return g ? g->tag() : BTHREAD_TAG_DEFAULT;
+}
+
 BUTIL_FORCE_INLINE int
 start_from_non_worker(bthread_t* __restrict tid,
                       const bthread_attr_t* __restrict attr,
                       void * (*fn)(void*),
-                      void* __restrict arg) {
+                      void* __restrict arg,
+                      bthread_tag_t tag) {
     TaskControl* c = get_or_new_task_control();
     if (NULL == c) {
         return ENOMEM;
     }
+    if (!c->valid_tag(tag)) {
+        return EINVAL;
+    }
     if (attr != NULL && (attr->flags & BTHREAD_NOSIGNAL)) {
+        if (tls_task_group != NULL) {
+            // Started by a worker of another pool whose bthread_flush()
+            // does not flush groups of this pool, signal now.
+            bthread_attr_t signaled_attr = *attr;
+            signaled_attr.flags &= ~BTHREAD_NOSIGNAL;
+            return c->choose_one_group(tag)->start_background<true>(
+                tid, &signaled_attr, fn, arg);
+        }
         // Remember the TaskGroup to insert NOSIGNAL tasks for 2 reasons:
         // 1. NOSIGNAL is often for creating many bthreads in batch,
         //    inserting into the same TaskGroup maximizes the batch.
         // 2. bthread_flush() needs to know which TaskGroup to flush.
         TaskGroup* g = tls_task_group_nosignal;
-        if (NULL == g) {
-            g = c->choose_one_group();
+        if (NULL == g || g->tag() != tag) {
+            if (g != NULL) {
+                g->flush_nosignal_tasks_remote();
+            }
+            g = c->choose_one_group(tag);
             tls_task_group_nosignal = g;
         }
         return g->start_background<true>(tid, attr, fn, arg);
     }
-    return c->choose_one_group()->start_background<true>(
+    return c->choose_one_group(tag)->start_background<true>(
         tid, attr, fn, arg);
 }
 
@@ -135,11 +159,12 @@ int bthread_start_urgent(bthread_t* __restrict tid,
                          void * (*fn)(void*),
                          void* __restrict arg) __THROW {
     bthread::TaskGroup* g = bthread::tls_task_group;
-    if (g) {
+    const bthread_tag_t tag = bthread::tag_to_start(attr, g);
+    if (g && g->tag() == tag) {
         // start from worker
         return bthread::TaskGroup::start_foreground(&g, tid, attr, fn, arg);
     }
-    return bthread::start_from_non_worker(tid, attr, fn, arg);
+    return bthread::start_from_non_worker(tid, attr, fn, arg, tag);
 }
 
 int bthread_start_background(bthread_t* __restrict tid,
@@ -147,11 +172,12 @@ int bthread_start_background(bthread_t* __restrict tid,
                              void * (*fn)(void*),
                              void* __restrict arg) __THROW {
     bthread::TaskGroup* g = bthread::tls_task_group;
-    if (g) {
+    const bthread_tag_t tag = bthread::tag_to_start(attr, g);
+    if (g && g->tag() == tag) {
         // start from worker
         return g->start_background<false>(tid, attr, fn, arg);
     }
-    return bthread::start_from_non_worker(tid, attr, fn, arg);
+    return bthread::start_from_non_worker(tid, attr, fn, arg, tag);
 }
 
 void bthread_flush() __THROW {
@@ -264,6 +290,56 @@ int bthread_setconcurrency(int num) __THROW {
     return (num == bthread::FLAGS_bthread_concurrency ? 0 : EPERM);
 }
 
+int bthread_add_worker_pool(const char* name, int concurrency,
+                            bthread_tag_t* tag) __THROW {
+    if (name == NULL || tag == NULL) {
+        return EINVAL;
+    }
+    bthread::TaskControl* c = bthread::get_or_new_task_control();
+    if (c == NULL) {
+        return ENOMEM;
+    }
+    // Serialized with bthread_setconcurrency which also creates workers.
+    BAIDU_SCOPED_LOCK(bthread::g_task_control_mutex);
+    return c->add_pool(name, concurrency, tag);
+}
+
+bthread_tag_t bthread_find_worker_pool(const char* name) __THROW {
+    if (name == NULL) {
+        return BTHREAD_TAG_INVALID;
+    }
+    bthread::TaskControl* c = bthread::get_or_new_task_control();
+    if (c == NULL) {
+        return BTHREAD_TAG_INVALID;
+    }
+    return c->find_pool(name);
+}
+
+int bthread_getconcurrency_by_tag(bthread_tag_t tag) __THROW {
+    bthread::TaskControl* c = bthread::get_task_control();
+    if (c == NULL) {
+        return (tag == BTHREAD_TAG_DEFAULT ?
+                bthread::FLAGS_bthread_concurrency : -1);
+    }
+    if (!c->valid_tag(tag)) {
+        return -1;
+    }
+    return c->concurrency(tag);
+}
+
+bthread_tag_t bthread_self_tag(void) __THROW {
+    bthread::TaskGroup* g = bthread::tls_task_group;
+    return g ? g->tag() : BTHREAD_TAG_INVALID;
+}
+
+int bthread_switch_worker_pool(bthread_tag_t tag) __THROW {
+    bthread::TaskGroup* g = bthread::tls_task_group;
+    if (g == NULL) {
+        return EPERM;
+    }
+    return bthread::TaskGroup::switch_pool(&g, tag);
+}
+
 int bthread_about_to_quit() __THROW {
     bthread::TaskGroup* g = bthread::tls_task_group;
     if (g != NULL) {
@@ -27,6 +27,7 @@
 #if defined(__cplusplus)
 #  include <iostream>
 #  include "bthread/mutex.h"        // use bthread_mutex_t in the RAII way
+#  include "bthread/rwlock.h"       // use bthread_rwlock_t in the RAII way
 #endif
 
 #include "bthread/id.h"
@@ -143,6 +144,33 @@ extern int bthread_getconcurrency(void) __THROW;
 // NOTE: currently concurrency cannot be reduced after any bthread created.
 extern int bthread_setconcurrency(int num) __THROW;
 
+// Create a pool of `concurrency' worker pthreads named `name' and put the
+// tag of the pool into `*tag'. bthreads started with attr.tag == *tag only
+// run in workers of the pool, which have their own runqueues and never
+// steal bthreads from other pools, so that bthreads doing heavy computations
+// do not delay bthreads in other pools. Pools can also be created by
+// -bthread_worker_pools. bthreads started with attr.tag ==
+// BTHREAD_TAG_INVALID run in the pool of the creator.
+// NOTE: pools cannot be removed.
+// Returns 0 on success, error code otherwise.
+extern int bthread_add_worker_pool(const char* name, int concurrency,
+                                   bthread_tag_t* tag) __THROW;
+
+// Get tag of the pool named `name', BTHREAD_TAG_INVALID if not found.
+extern bthread_tag_t bthread_find_worker_pool(const char* name) __THROW;
+
+// Get number of worker pthreads in pool `tag', -1 if the pool does not exist.
+extern int bthread_getconcurrency_by_tag(bthread_tag_t tag) __THROW;
+
+// Get tag of the pool running the calling thread, BTHREAD_TAG_INVALID if
+// the caller is not a worker.
+extern bthread_tag_t bthread_self_tag(void) __THROW;
+
+// Suspend calling bthread and resume it in a worker of pool `tag'.
+// Returns 0 on success, EINVAL if the pool does not exist, EPERM if the
+// caller is not a bthread or runs in pthread mode (BTHREAD_ATTR_PTHREAD).
+extern int bthread_switch_worker_pool(bthread_tag_t tag) __THROW;
+
 // Yield processor to another bthread. 
 // Notice that current implementation is not fair, which means that 
 // even if bthread_yield() is called, suspended threads may still starve.
@@ -279,8 +307,49 @@ extern int bthread_barrier_init(bthread_barrier_t* __restrict barrier,
 
 extern int bthread_barrier_destroy(bthread_barrier_t* barrier) __THROW;
 
+// Wait until `count' (specified in bthread_barrier_init) threads are
+// waiting on `barrier'. One of the threads gets PTHREAD_BARRIER_SERIAL_THREAD
+// and others get 0. Returns error code otherwise.
 extern int bthread_barrier_wait(bthread_barrier_t* barrier) __THROW;
 
+// Same as bthread_barrier_wait but returns ETIMEDOUT after `abstime' and the
+// caller is not counted as waiting anymore.
+extern int bthread_barrier_timedwait(
+    bthread_barrier_t* __restrict barrier,
+    const struct timespec* __restrict abstime) __THROW;
+
+// ---------------------------------------------
+// Functions for handling counting semaphores.
+// ---------------------------------------------
+
+// Initialize semaphore `sem' with `value'.
+// Returns 0 on success, error code otherwise.
+extern int bthread_sem_init(bthread_sem_t* sem, unsigned value) __THROW;
+
+// Destroy semaphore `sem'.
+extern int bthread_sem_destroy(bthread_sem_t* sem) __THROW;
+
+// Decrease `sem' by 1, block until it's positive.
+// Returns 0 on success, error code otherwise. Interruptions are ignored.
+extern int bthread_sem_wait(bthread_sem_t* sem) __THROW;
+
+// Decrease `sem' by 1 if it's positive, return EAGAIN otherwise.
+extern int bthread_sem_trywait(bthread_sem_t* sem) __THROW;
+
+// Same as bthread_sem_wait but returns ETIMEDOUT after `abstime'.
+extern int bthread_sem_timedwait(bthread_sem_t* __restrict sem,
+                                 const struct timespec* __restrict abstime) __THROW;
+
+// Increase `sem' by 1 and wake up one waiter.
+extern int bthread_sem_post(bthread_sem_t* sem) __THROW;
+
+// Increase `sem' by `n' and wake up waiters.
+extern int bthread_sem_post_n(bthread_sem_t* sem, unsigned n) __THROW;
+
+// Get current value of `sem'.
+extern int bthread_sem_getvalue(bthread_sem_t* __restrict sem,
+                                int* __restrict value) __THROW;
+
 // ---------------------------------------------------------------------
 // Functions for handling thread-specific data. 
 // Notice that they can be used in pthread: get pthread-specific data in 
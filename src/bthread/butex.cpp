@@ -97,12 +97,18 @@ struct ButexBthreadWaiter : public ButexWaiter {
     int expected_value;
     Butex* initial_butex;
     TaskControl* control;
+    // Tag of the pool which the waiter should be woken up in.
+    bthread_tag_t tag;
 };
 
 // pthread_task or main_task allocates this structure on stack and queue it
 // in Butex::waiters.
+// butex_wait_async() allocates this structure on heap with `on_wakeup' set,
+// which is called instead of signaling `sig'.
 struct ButexPthreadWaiter : public ButexWaiter {
     butil::atomic<int> sig;
+    void (*on_wakeup)(void*);
+    void* on_wakeup_arg;
 };
 
 typedef butil::LinkedList<ButexWaiter> ButexWaiterList;
@@ -122,6 +128,15 @@ BAIDU_CASSERT(offsetof(Butex, value) == 0, offsetof_value_must_0);
 BAIDU_CASSERT(sizeof(Butex) == BAIDU_CACHELINE_SIZE, butex_fits_in_one_cacheline);
 
 static void wakeup_pthread(ButexPthreadWaiter* pw) {
+    if (pw->on_wakeup) {
+        // Asynchronous waiters can't be timed out or interrupted, the waiter
+        // is owned by the thread removing it from the butex.
+        void (*on_wakeup)(void*) = pw->on_wakeup;
+        void* arg = pw->on_wakeup_arg;
+        delete pw;
+        on_wakeup(arg);
+        return;
+    }
     // release fence makes wait_pthread see changes before wakeup.
     pw->sig.store(PTHREAD_SIGNALLED, butil::memory_order_release);
     // At this point, wait_pthread() possibly has woken up and destroyed `pw'.
@@ -254,9 +269,21 @@ void butex_destroy(void* butex) {
     butil::return_object(b);
 }
 
-inline TaskGroup* get_task_group(TaskControl* c) {
+inline TaskGroup* get_task_group(TaskControl* c, bthread_tag_t tag) {
     TaskGroup* g = tls_task_group;
-    return g ? g : c->choose_one_group();
+    return (g && g->tag() == tag) ? g : c->choose_one_group(tag);
+}
+
+// Wake up `w' in `g' without signaling if `w' belongs to the pool of `g',
+// otherwise wake it up in its own pool.
+inline void ready_to_run_in_pool(TaskGroup* g, ButexBthreadWaiter* w) {
+    const bool prioritized = is_prioritized(w->task_meta);
+    if (w->tag == g->tag()) {
+        g->ready_to_run_general(w->tid, true, prioritized);
+    } else {
+        get_task_group(w->control, w->tag)->ready_to_run_general(
+            w->tid, false, prioritized);
+    }
 }
 
 int butex_wake(void* arg) {
@@ -278,10 +305,11 @@ int butex_wake(void* arg) {
     ButexBthreadWaiter* bbw = static_cast<ButexBthreadWaiter*>(front);
     unsleep_if_necessary(bbw, get_global_timer_thread());
     TaskGroup* g = tls_task_group;
-    if (g) {
+    if (g && g->tag() == bbw->tag) {
         TaskGroup::exchange(&g, bbw->tid);
     } else {
-        bbw->control->choose_one_group()->ready_to_run_remote(bbw->tid);
+        bbw->control->choose_one_group(bbw->tag)->ready_to_run_remote(
+            bbw->tid, false, is_prioritized(bbw->task_meta));
     }
     return 1;
 }
@@ -322,7 +350,7 @@ int butex_wake_all(void* arg) {
     next->RemoveFromList();
     unsleep_if_necessary(next, get_global_timer_thread());
     ++nwakeup;
-    TaskGroup* g = get_task_group(next->control);
+    TaskGroup* g = get_task_group(next->control, next->tag);
     const int saved_nwakeup = nwakeup;
     while (!bthread_waiters.empty()) {
         // pop reversely
@@ -330,7 +358,7 @@ int butex_wake_all(void* arg) {
             bthread_waiters.tail()->value());
         w->RemoveFromList();
         unsleep_if_necessary(w, get_global_timer_thread());
-        g->ready_to_run_general(w->tid, true);
+        ready_to_run_in_pool(g, w);
         ++nwakeup;
     }
     if (saved_nwakeup != nwakeup) {
@@ -339,7 +367,8 @@ int butex_wake_all(void* arg) {
     if (g == tls_task_group) {
         TaskGroup::exchange(&g, next->tid);
     } else {
-        g->ready_to_run_remote(next->tid);
+        g->ready_to_run_remote(next->tid, false,
+                               is_prioritized(next->task_meta));
     }
     return nwakeup;
 }
@@ -389,7 +418,7 @@ int butex_wake_except(void* arg, bthread_t excluded_bthread) {
     ButexBthreadWaiter* front = static_cast<ButexBthreadWaiter*>(
                 bthread_waiters.head()->value());
 
-    TaskGroup* g = get_task_group(front->control);
+    TaskGroup* g = get_task_group(front->control, front->tag);
     const int saved_nwakeup = nwakeup;
     do {
         // pop reversely
@@ -397,7 +426,7 @@ int butex_wake_except(void* arg, bthread_t excluded_bthread) {
             bthread_waiters.tail()->value());
         w->RemoveFromList();
         unsleep_if_necessary(w, get_global_timer_thread());
-        g->ready_to_run_general(w->tid, true);
+        ready_to_run_in_pool(g, w);
         ++nwakeup;
     } while (!bthread_waiters.empty());
     if (saved_nwakeup != nwakeup) {
@@ -438,10 +467,11 @@ int butex_requeue(void* arg, void* arg2) {
     ButexBthreadWaiter* bbw = static_cast<ButexBthreadWaiter*>(front);
     unsleep_if_necessary(bbw, get_global_timer_thread());
     TaskGroup* g = tls_task_group;
-    if (g) {
+    if (g && g->tag() == bbw->tag) {
         TaskGroup::exchange(&g, front->tid);
     } else {
-        bbw->control->choose_one_group()->ready_to_run_remote(front->tid);
+        bbw->control->choose_one_group(bbw->tag)->ready_to_run_remote(
+            front->tid, false, is_prioritized(bbw->task_meta));
     }
     return 1;
 }
@@ -479,7 +509,8 @@ inline bool erase_from_butex(ButexWaiter* bw, bool wakeup, WaiterState state) {
     if (erased && wakeup) {
         if (bw->tid) {
             ButexBthreadWaiter* bbw = static_cast<ButexBthreadWaiter*>(bw);
-            get_task_group(bbw->control)->ready_to_run_general(bw->tid);
+            get_task_group(bbw->control, bbw->tag)->ready_to_run_general(
+                bw->tid, false, is_prioritized(bbw->task_meta));
         } else {
             ButexPthreadWaiter* pw = static_cast<ButexPthreadWaiter*>(bw);
             wakeup_pthread(pw);
@@ -523,7 +554,8 @@ static void wait_for_butex(void* arg) {
     // the two functions. The on-stack ButexBthreadWaiter is safe to use and
     // bw->waiter_state will not change again.
     unsleep_if_necessary(bw, get_global_timer_thread());
-    tls_task_group->ready_to_run(bw->tid);
+    tls_task_group->ready_to_run(bw->tid, false,
+                                 is_prioritized(bw->task_meta));
     // FIXME: jump back to original thread is buggy.
     
     // // Value unmatched or waiter is already woken up by TimerThread, jump
@@ -557,6 +589,8 @@ static int butex_wait_from_pthread(TaskGroup* g, Butex* b, int expected_value,
     ButexPthreadWaiter pw;
     pw.tid = 0;
     pw.sig.store(PTHREAD_NOT_SIGNALLED, butil::memory_order_relaxed);
+    pw.on_wakeup = NULL;
+    pw.on_wakeup_arg = NULL;
     int rc = 0;
     
     if (g) {
@@ -628,6 +662,7 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     bbw.expected_value = expected_value;
     bbw.initial_butex = b;
     bbw.control = g->control();
+    bbw.tag = g->tag();
 
     if (abstime != NULL) {
         // Schedule timer before queueing. If the timer is triggered before
@@ -690,6 +725,33 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     return 0;
 }
 
+int butex_wait_async(void* arg, int expected_value,
+                     void (*on_wakeup)(void*), void* on_wakeup_arg) {
+    Butex* b = container_of(static_cast<butil::atomic<int>*>(arg), Butex, value);
+    if (b->value.load(butil::memory_order_relaxed) != expected_value) {
+        errno = EWOULDBLOCK;
+        butil::atomic_thread_fence(butil::memory_order_acquire);
+        return -1;
+    }
+    ButexPthreadWaiter* pw = new ButexPthreadWaiter;
+    pw->tid = 0;
+    pw->container.store(NULL, butil::memory_order_relaxed);
+    pw->sig.store(PTHREAD_NOT_SIGNALLED, butil::memory_order_relaxed);
+    pw->on_wakeup = on_wakeup;
+    pw->on_wakeup_arg = on_wakeup_arg;
+    {
+        BAIDU_SCOPED_LOCK(b->waiter_lock);
+        if (b->value.load(butil::memory_order_relaxed) == expected_value) {
+            b->waiters.Append(pw);
+            pw->container.store(b, butil::memory_order_relaxed);
+            return 0;
+        }
+    }
+    delete pw;
+    errno = EWOULDBLOCK;
+    return -1;
+}
+
 }  // namespace bthread
 
 namespace butil {
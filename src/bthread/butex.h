@@ -67,6 +67,15 @@ int butex_requeue(void* butex1, void* butex2);
 // Returns 0 on success, -1 otherwise and errno is set.
 int butex_wait(void* butex, int expected_value, const timespec* abstime);
 
+// Wait on |butex| without blocking the calling thread: if *butex equals
+// |expected_value|, |on_wakeup|(|arg|) will be called exactly once by the
+// thread calling butex_wake* on |butex|, which should not block.
+// Unlike butex_wait, the waiting can't be timed out or interrupted.
+// Returns 0 on success, -1 with errno=EWOULDBLOCK when the value does not
+// match, in which case |on_wakeup| is not called.
+int butex_wait_async(void* butex, int expected_value,
+                     void (*on_wakeup)(void* arg), void* arg);
+
 }  // namespace bthread
 
 #endif  // BTHREAD_BUTEX_H
@@ -0,0 +1,375 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BTHREAD_COROUTINE_H
+#define BTHREAD_COROUTINE_H
+
+// C++20 coroutines running on bthread workers.
+//
+//   bthread::CoTask<int> foo(bthread::Mutex* m) {
+//       co_await bthread::co_sleep(1000);          // sleep 1ms
+//       co_await bthread::co_lock(*m);
+//       ...
+//       m->unlock();
+//       co_return 1;
+//   }
+//   bthread::CoTask<void> bar(bthread::Mutex* m) {
+//       int x = co_await foo(m);
+//       ...
+//   }
+//   bthread::co_start(bar(&m));                    // run in background
+//   bthread::sync_wait(bar(&m));                   // run and wait
+//
+// A suspended coroutine does not occupy a bthread(and its stack). When the
+// operation it waits for completes, the coroutine is resumed in a new
+// bthread in the worker pool where it was suspended, so code after co_await
+// always runs on bthread workers and may call blocking bthread functions.
+// This header is not used by the library itself and requires -std=c++20.
+
+#if !defined(__cpp_impl_coroutine)
+#error "bthread/coroutine.h requires C++20 coroutines, compile with -std=c++20"
+#endif
+
+#include <coroutine>
+#include <exception>                        // std::exception_ptr
+#include <optional>
+#include <type_traits>                      // std::conditional
+#include <utility>                          // std::move
+#include "butil/atomicops.h"
+#include "butil/time.h"                     // butil::microseconds_from_now
+#include "bthread/bthread.h"
+#include "bthread/butex.h"
+#include "bthread/mutex.h"
+#include "bthread/countdown_event.h"
+#include "bthread/unstable.h"               // bthread_timer_add
+
+namespace bthread {
+
+namespace internal {
+
+inline void* run_coroutine(void* arg) {
+    std::coroutine_handle<>::from_address(arg).resume();
+    return NULL;
+}
+
+// Resume `h' in a new bthread in the worker pool `tag', or in the calling
+// thread if the bthread can't be created.
+inline void resume_in_bthread(std::coroutine_handle<> h, bthread_tag_t tag) {
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = tag;
+    bthread_t th;
+    if (bthread_start_background(&th, &attr, run_coroutine, h.address()) != 0) {
+        h.resume();
+    }
+}
+
+// Base of awaiters waiting for an asynchronous operation which completes in
+// another thread, possibly even before await_suspend() returns. Subclasses
+// issue the operation inside suspend() and call complete() once it's done.
+class AsyncAwaiter {
+public:
+    AsyncAwaiter() : _state(INIT), _tag(BTHREAD_TAG_INVALID) {}
+
+    bool await_ready() const { return false; }
+
+protected:
+    // Called by subclasses in await_suspend(). `issue' starts the operation
+    // and returns false if it completed synchronously. Returns false when the
+    // operation completes before suspension, in which case the coroutine
+    // continues in the current thread.
+    template <typename Issue>
+    bool suspend(std::coroutine_handle<> h, Issue issue) {
+        _handle = h;
+        _tag = bthread_self_tag();
+        if (!issue()) {
+            return false;
+        }
+        return _state.exchange(SUSPENDED, butil::memory_order_acq_rel) != DONE;
+    }
+
+    void complete() {
+        if (_state.exchange(DONE, butil::memory_order_acq_rel) == SUSPENDED) {
+            resume_in_bthread(_handle, _tag);
+        }
+    }
+
+private:
+    enum State { INIT, SUSPENDED, DONE };
+    butil::atomic<int> _state;
+    bthread_tag_t _tag;
+    std::coroutine_handle<> _handle;
+};
+
+template <typename T>
+class CoTaskPromiseBase {
+public:
+    template <typename U>
+    void return_value(U&& value) { _value.emplace(std::forward<U>(value)); }
+    T take_value() { return std::move(*_value); }
+private:
+    std::optional<T> _value;
+};
+
+template <>
+class CoTaskPromiseBase<void> {
+public:
+    void return_void() {}
+    void take_value() {}
+};
+
+}  // namespace internal
+
+// Return type of coroutines which can be awaited by other coroutines, or run
+// with co_start()/sync_wait(). The coroutine does not start until awaited.
+template <typename T>
+class CoTask {
+public:
+    class promise_type : public internal::CoTaskPromiseBase<T> {
+    public:
+        CoTask get_return_object() {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        // Transfer control to the awaiting coroutine.
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(
+                std::coroutine_handle<promise_type> h) noexcept {
+                std::coroutine_handle<> c = h.promise()._continuation;
+                return c ? c : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { _exception = std::current_exception(); }
+
+    private:
+        friend class CoTask;
+        std::coroutine_handle<> _continuation;
+        std::exception_ptr _exception;
+    };
+
+    CoTask() {}
+    CoTask(CoTask&& rhs) : _handle(rhs._handle) { rhs._handle = nullptr; }
+    CoTask& operator=(CoTask&& rhs) {
+        if (this != &rhs) {
+            reset();
+            _handle = rhs._handle;
+            rhs._handle = nullptr;
+        }
+        return *this;
+    }
+    ~CoTask() { reset(); }
+
+    bool valid() const { return (bool)_handle; }
+
+    bool await_ready() const { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+        _handle.promise()._continuation = awaiting;
+        return _handle;
+    }
+    T await_resume() {
+        if (_handle.promise()._exception) {
+            std::rethrow_exception(_handle.promise()._exception);
+        }
+        return _handle.promise().take_value();
+    }
+
+private:
+    CoTask(const CoTask&) = delete;
+    void operator=(const CoTask&) = delete;
+    explicit CoTask(std::coroutine_handle<promise_type> h) : _handle(h) {}
+    void reset() {
+        if (_handle) {
+            _handle.destroy();
+            _handle = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+namespace internal {
+
+// A coroutine destroying itself after running.
+struct DetachedCoroutine {
+    struct promise_type {
+        DetachedCoroutine get_return_object() {
+            return DetachedCoroutine{
+                std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+inline DetachedCoroutine run_detached(CoTask<void> task) {
+    co_await task;
+}
+
+template <typename T>
+DetachedCoroutine run_and_signal(CoTask<T> task, std::optional<T>* result,
+                                 std::exception_ptr* exception,
+                                 CountdownEvent* event) {
+    try {
+        result->emplace(co_await task);
+    } catch (...) {
+        *exception = std::current_exception();
+    }
+    event->signal();
+}
+
+inline DetachedCoroutine run_and_signal(CoTask<void> task, std::optional<bool>* result,
+                                        std::exception_ptr* exception,
+                                        CountdownEvent* event) {
+    try {
+        co_await task;
+        result->emplace(true);
+    } catch (...) {
+        *exception = std::current_exception();
+    }
+    event->signal();
+}
+
+}  // namespace internal
+
+// Run `task' in background in a new bthread with attributes `attr'(
+// BTHREAD_ATTR_NORMAL if NULL). An exception escaping from `task'
+// terminates the program.
+// Returns 0 on success, errno otherwise.
+inline int co_start(CoTask<void> task, const bthread_attr_t* attr = NULL) {
+    internal::DetachedCoroutine c = internal::run_detached(std::move(task));
+    bthread_t th;
+    const int rc = bthread_start_background(
+        &th, attr, internal::run_coroutine, c.handle.address());
+    if (rc != 0) {
+        c.handle.destroy();
+    }
+    return rc;
+}
+
+// Run `task' in a new bthread and block the calling bthread or pthread until
+// it completes. Returns the value returned by `task' or rethrows the exception
+// thrown by `task'.
+template <typename T>
+T sync_wait(CoTask<T> task) {
+    typedef typename std::conditional<std::is_void<T>::value, bool, T>::type R;
+    std::optional<R> result;
+    std::exception_ptr exception;
+    CountdownEvent event(1);
+    internal::DetachedCoroutine c =
+        internal::run_and_signal(std::move(task), &result, &exception, &event);
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, internal::run_coroutine,
+                                 c.handle.address()) != 0) {
+        c.handle.resume();
+    }
+    event.wait();
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+    if constexpr (!std::is_void<T>::value) {
+        return std::move(*result);
+    }
+}
+
+class SleepAwaiter : public internal::AsyncAwaiter {
+public:
+    explicit SleepAwaiter(int64_t us) : _us(us) {}
+    bool await_ready() const { return _us <= 0; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        return suspend(h, [this]() {
+            bthread_timer_t id;
+            if (bthread_timer_add(&id, butil::microseconds_from_now(_us),
+                                  on_timer, this) != 0) {
+                // Sleep in the current thread rather than returning early.
+                bthread_usleep(_us);
+                return false;
+            }
+            return true;
+        });
+    }
+    void await_resume() {}
+private:
+    static void on_timer(void* arg) { static_cast<SleepAwaiter*>(arg)->complete(); }
+    int64_t _us;
+};
+
+class LockAwaiter : public internal::AsyncAwaiter {
+public:
+    explicit LockAwaiter(bthread_mutex_t* m) : _mutex(m) {}
+    bool await_ready() const { return !bthread_mutex_trylock(_mutex); }
+    bool await_suspend(std::coroutine_handle<> h) {
+        return suspend(h, [this]() {
+            return mutex_lock_async(_mutex, on_locked, this) != 0;
+        });
+    }
+    void await_resume() {}
+private:
+    static void on_locked(void* arg) { static_cast<LockAwaiter*>(arg)->complete(); }
+    bthread_mutex_t* _mutex;
+};
+
+class ButexAwaiter : public internal::AsyncAwaiter {
+public:
+    ButexAwaiter(void* butex, int expected_value)
+        : _butex(butex), _expected_value(expected_value), _rc(0) {}
+    bool await_suspend(std::coroutine_handle<> h) {
+        return suspend(h, [this]() {
+            if (butex_wait_async(_butex, _expected_value, on_wakeup, this) != 0) {
+                _rc = -1;
+                return false;
+            }
+            return true;
+        });
+    }
+    int await_resume() {
+        if (_rc < 0) {
+            errno = EWOULDBLOCK;
+        }
+        return _rc;
+    }
+private:
+    static void on_wakeup(void* arg) { static_cast<ButexAwaiter*>(arg)->complete(); }
+    void* _butex;
+    int _expected_value;
+    int _rc;
+};
+
+// co_await co_sleep(us) suspends the coroutine for at least `us'
+// microseconds. If the timer can't be added, the calling bthread sleeps
+// instead.
+inline SleepAwaiter co_sleep(int64_t us) { return SleepAwaiter(us); }
+
+// co_await co_lock(mutex) suspends the coroutine until `mutex' is locked.
+// Unlock the mutex as usual.
+inline LockAwaiter co_lock(bthread_mutex_t* mutex) { return LockAwaiter(mutex); }
+inline LockAwaiter co_lock(Mutex& mutex) {
+    return LockAwaiter(mutex.native_handler());
+}
+
+// co_await co_butex_wait(butex, expected_value) suspends the coroutine until
+// the butex is woken up if its value equals `expected_value'. Returns 0 when
+// woken up, -1 with errno=EWOULDBLOCK when the value does not match.
+inline ButexAwaiter co_butex_wait(void* butex, int expected_value) {
+    return ButexAwaiter(butex, expected_value);
+}
+
+}  // namespace bthread
+
+#endif  // BTHREAD_COROUTINE_H
@@ -143,6 +143,10 @@ void* ExecutionQueueBase::_execute_tasks(void* arg) {
         }
         if (rc == ESTOP) {
             destroy_queue = true;
+        } else if (rc == EAGAIN) {
+            // The batch is limited by options, let other bthreads run
+            // before executing the remaining tasks.
+            bthread_yield();
         }
         // Release TaskNode until uniterated task or last task
         while (head->next != NULL && head->iterated) {
@@ -269,7 +273,7 @@ int ExecutionQueueBase::_execute(TaskNode* head, bool high_priority, int* nitera
     if (niterated) {
         *niterated = iter.num_iterated();
     }
-    return 0;
+    return iter._reach_batch_limit ? EAGAIN : 0;
 }
 
 TaskNode* ExecutionQueueBase::allocate_node() {
@@ -371,6 +375,27 @@ inline bool TaskIteratorBase::should_break_for_high_priority_tasks() {
     return false;
 }
 
+inline bool TaskIteratorBase::should_break_for_batch_limit() {
+    const ExecutionQueueOptions& opt = _q->_options;
+    if (opt.max_tasks_in_batch > 0 &&
+            _num_iterated >= opt.max_tasks_in_batch) {
+        _should_break = true;
+        _reach_batch_limit = true;
+        return true;
+    }
+    if (opt.max_batch_time_us > 0) {
+        const int64_t now = butil::cpuwide_time_us();
+        if (_start_us == 0) {
+            _start_us = now;
+        } else if (now - _start_us >= opt.max_batch_time_us) {
+            _should_break = true;
+            _reach_batch_limit = true;
+            return true;
+        }
+    }
+    return false;
+}
+
 void TaskIteratorBase::operator++() {
     if (!(*this)) {
         return;
@@ -381,6 +406,9 @@ void TaskIteratorBase::operator++() {
     if (should_break_for_high_priority_tasks()) {
         return;
     }  // else the next high_priority_task would be delayed for at most one task
+    if (should_break_for_batch_limit()) {
+        return;
+    }
 
     while (_cur_node && !_cur_node->stop_task) {
         if (_high_priority == _cur_node->high_priority) {
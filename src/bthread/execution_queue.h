@@ -19,6 +19,7 @@
 #ifndef  BTHREAD_EXECUTION_QUEUE_H
 #define  BTHREAD_EXECUTION_QUEUE_H
 
+#include <vector>
 #include "bthread/bthread.h"
 #include "butil/type_traits.h"
 
@@ -51,7 +52,9 @@ protected:
         , _is_stopped(is_stopped)
         , _high_priority(high_priority)
         , _should_break(false)
+        , _reach_batch_limit(false)
         , _num_iterated(0)
+        , _start_us(0)
     { operator++(); }
     ~TaskIteratorBase();
     void operator++();
@@ -59,6 +62,7 @@ protected:
 private:
     int num_iterated() const { return _num_iterated; }
     bool should_break_for_high_priority_tasks();
+    bool should_break_for_batch_limit();
 
     TaskNode*               _cur_node;
     TaskNode*               _head;
@@ -66,7 +70,9 @@ private:
     bool                    _is_stopped;
     bool                    _high_priority;
     bool                    _should_break;
+    bool                    _reach_batch_limit;
     int                     _num_iterated;
+    int64_t                 _start_us;
 };
 
 // Iterate over the given tasks
@@ -133,6 +139,18 @@ struct ExecutionQueueOptions {
     // Attribute of the bthread which execute runs on
     // default: BTHREAD_ATTR_NORMAL
     bthread_attr_t bthread_attr;
+
+    // At most so many tasks are given to one call of |execute|, after which
+    // the TaskIterator ends and the executor yields before calling |execute|
+    // with the remaining tasks, so that a busy queue doesn't occupy the
+    // worker for too long and the tasks are handled in bounded batches.
+    // default: 0 (unlimited)
+    int max_tasks_in_batch;
+
+    // Similar to |max_tasks_in_batch|, but limits the time of iterating
+    // over one batch.
+    // default: 0 (unlimited)
+    int64_t max_batch_time_us;
 };
 
 // Start a ExecutionQueue. If |options| is NULL, the queue will be created with
@@ -209,6 +227,54 @@ template <typename T>
 typename ExecutionQueue<T>::scoped_ptr_t 
 execution_queue_address(ExecutionQueueId<T> id);
 
+// A group of ExecutionQueues sharing the same |execute| and |meta|, tasks are
+// dispatched to the queues by keys. Tasks with the same key are executed in
+// the FIFO order as they always go to the same queue, while tasks with
+// different keys may be executed concurrently by the consumers of different
+// queues. This scales stateful work sharded by keys beyond one core which
+// is the limit of a single ExecutionQueue.
+//
+// Example:
+//   bthread::ExecutionQueueGroup<Task> group;
+//   group.init(0/*one queue per worker*/, &options, execute, meta);
+//   group.execute(task.user_id, task);
+//   ...
+//   group.stop();
+//   group.join();
+//
+// NOTE: |execute| is called with TaskIterator::is_queue_stopped() being true
+// once for each queue, release resources referenced by |meta| after join().
+template <typename T>
+class ExecutionQueueGroup {
+DISALLOW_COPY_AND_ASSIGN(ExecutionQueueGroup);
+public:
+    ExecutionQueueGroup() {}
+    // Stop and join the queues if they're not.
+    ~ExecutionQueueGroup();
+
+    // Start |nqueue| ExecutionQueues, or bthread_getconcurrency() queues if
+    // |nqueue| is 0. Other arguments are the same with execution_queue_start.
+    // Returns 0 on success, errno otherwise.
+    int init(size_t nqueue, const ExecutionQueueOptions* options,
+             int (*execute)(void* meta, TaskIterator<T>& iter),
+             void* meta);
+
+    // Thread-safe and Wait-free.
+    // Execute a task in the queue selected by |key|.
+    int execute(uint64_t key, typename butil::add_const_reference<T>::type task,
+                const TaskOptions* options = NULL, TaskHandle* handle = NULL);
+
+    // Stop/Join all the queues.
+    int stop();
+    int join();
+
+    size_t queue_count() const { return _queues.size(); }
+    ExecutionQueueId<T> queue_of_key(uint64_t key) const;
+
+private:
+    std::vector<ExecutionQueueId<T> > _queues;
+};
+
 }  // namespace bthread
 
 #include "bthread/execution_queue_inl.h"
@@ -24,6 +24,7 @@
 #include "butil/memory/scoped_ptr.h"     // butil::scoped_ptr
 #include "butil/logging.h"               // LOG
 #include "butil/time.h"                  // butil::cpuwide_time_ns
+#include "butil/third_party/murmurhash3/murmurhash3.h"  // fmix64
 #include "bvar/bvar.h"                  // bvar::Adder
 #include "bthread/butex.h"              // butex_construct
 
@@ -318,6 +319,8 @@ public:
 
 inline ExecutionQueueOptions::ExecutionQueueOptions()
     : bthread_attr(BTHREAD_ATTR_NORMAL)
+    , max_tasks_in_batch(0)
+    , max_batch_time_us(0)
 {}
 
 template <typename T>
@@ -378,6 +381,81 @@ inline int execution_queue_join(ExecutionQueueId<T> id) {
     return ExecutionQueue<T>::join(id.value);
 }
 
+//--------------------- ExecutionQueueGroup ------------------------
+
+template <typename T>
+ExecutionQueueGroup<T>::~ExecutionQueueGroup() {
+    stop();
+    join();
+}
+
+template <typename T>
+int ExecutionQueueGroup<T>::init(size_t nqueue,
+                                 const ExecutionQueueOptions* options,
+                                 int (*execute)(void* meta, TaskIterator<T>&),
+                                 void* meta) {
+    if (!_queues.empty()) {
+        return EINVAL;
+    }
+    if (nqueue == 0) {
+        const int concurrency = bthread_getconcurrency();
+        nqueue = (concurrency > 0 ? concurrency : 1);
+    }
+    _queues.resize(nqueue);
+    for (size_t i = 0; i < nqueue; ++i) {
+        const int rc = execution_queue_start(&_queues[i], options, execute, meta);
+        if (rc != 0) {
+            _queues.resize(i);
+            stop();
+            join();
+            _queues.clear();
+            return rc;
+        }
+    }
+    return 0;
+}
+
+template <typename T>
+inline ExecutionQueueId<T> ExecutionQueueGroup<T>::queue_of_key(
+        uint64_t key) const {
+    // Mix the key so that sequential or aligned keys spread evenly.
+    return _queues[butil::fmix64(key) % _queues.size()];
+}
+
+template <typename T>
+inline int ExecutionQueueGroup<T>::execute(
+        uint64_t key, typename butil::add_const_reference<T>::type task,
+        const TaskOptions* options, TaskHandle* handle) {
+    if (_queues.empty()) {
+        return EINVAL;
+    }
+    return execution_queue_execute(queue_of_key(key), task, options, handle);
+}
+
+template <typename T>
+int ExecutionQueueGroup<T>::stop() {
+    int rc = 0;
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        const int rc2 = execution_queue_stop(_queues[i]);
+        if (rc2 != 0) {
+            rc = rc2;
+        }
+    }
+    return rc;
+}
+
+template <typename T>
+int ExecutionQueueGroup<T>::join() {
+    int rc = 0;
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        const int rc2 = execution_queue_join(_queues[i]);
+        if (rc2 != 0) {
+            rc = rc2;
+        }
+    }
+    return rc;
+}
+
 inline TaskOptions::TaskOptions()
     : high_priority(false)
     , in_place_if_possible(false)
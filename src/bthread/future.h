@@ -0,0 +1,160 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef  BTHREAD_FUTURE_H
+#define  BTHREAD_FUTURE_H
+
+#include <time.h>                                // timespec
+#include <utility>                               // std::declval
+#include <vector>
+#include "butil/macros.h"                        // DISALLOW_COPY_AND_ASSIGN
+#include "bthread/bthread.h"
+
+namespace bthread {
+
+// A Future is the reading side of a value which will be set by the writing
+// side: Promise, possibly in another bthread or pthread. Waiting for the
+// value blocks the calling bthread (not the worker pthread) on a butex.
+// States shared by Future and Promise are pooled by butil::ObjectPool.
+//
+// Example:
+//   bthread::Promise<int> p;
+//   bthread::Future<int> f = p.get_future();
+//   // in another thread
+//   p.set_value(1);
+//   // in this thread
+//   f.then([](int x) { return x + 1; }).get();  // 2
+//
+//   // fan-out
+//   std::vector<bthread::Future<Result> > fs;
+//   for (...) { fs.push_back(start_something()); }
+//   bthread::when_all(fs).wait();         // or when_any(fs).get() for the
+//                                         // index of first ready one
+//   for (...) { use(fs[i].get()); }
+//
+// Callbacks attached by then(), when_all() and when_any() run in the thread
+// calling Promise::set_value(), or in the calling thread if the future is
+// already ready, thus they should be light and non-blocking.
+//
+// A Promise destroyed without setting the value breaks its future: get()
+// on the future crashes and then() does not call the callback but breaks
+// the returned future as well. Futures of a broken promise are still ready,
+// so that waiting, when_all() and when_any() don't hang.
+
+template <typename T> class Future;
+template <typename T> class Promise;
+
+namespace internal {
+template <typename T> class FutureState;
+template <typename T, typename F> struct FutureThenResult {
+    typedef decltype(std::declval<F&>()(std::declval<T>())) type;
+};
+template <typename F> struct FutureThenResult<void, F> {
+    typedef decltype(std::declval<F&>()()) type;
+};
+}  // namespace internal
+
+template <typename T>
+class Future {
+public:
+    // Create an invalid future.
+    Future() : _state(NULL) {}
+    Future(Future&& rhs) : _state(rhs._state) { rhs._state = NULL; }
+    Future& operator=(Future&& rhs);
+    ~Future();
+
+    // False for default-constructed futures, or futures consumed by get()
+    // or then().
+    bool valid() const { return _state != NULL; }
+
+    // True if the value is set or the promise is broken.
+    bool is_ready() const;
+
+    // Block until the future is ready.
+    // Returns 0 on success, error code otherwise.
+    int wait() const;
+
+    // Block until the future is ready or `abstime' is reached.
+    // Returns 0 on success, error code otherwise. ETIMEDOUT is for timeout.
+    int timed_wait(const timespec& abstime) const;
+
+    // Wait until ready and move the value out. The future is invalid after.
+    T get();
+
+    // Call `f' with the value(or without arguments for Future<void>) when
+    // this future is ready, the returned future holds the result of `f'.
+    // The future is invalid after. If `f' throws, the exception is logged
+    // and not propagated, the returned future is broken and other callbacks
+    // of this future still run.
+    template <typename F>
+    Future<typename internal::FutureThenResult<T, F>::type> then(F f);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Future);
+    friend class Promise<T>;
+    template <typename U>
+    friend Future<void> when_all(const std::vector<Future<U> >& futures);
+    template <typename U>
+    friend Future<size_t> when_any(const std::vector<Future<U> >& futures);
+
+    explicit Future(internal::FutureState<T>* state) : _state(state) {}
+
+    internal::FutureState<T>* _state;
+};
+
+template <typename T>
+class Promise {
+public:
+    Promise();
+    Promise(Promise&& rhs) : _state(rhs._state), _future_retrieved(
+        rhs._future_retrieved) { rhs._state = NULL; }
+    Promise& operator=(Promise&& rhs);
+    // Break the future if the value was not set.
+    ~Promise();
+
+    // Get the future associated with this promise, at most once.
+    Future<T> get_future();
+
+    // Construct the value with `args' and make the future ready, at most
+    // once. Promise<void>::set_value() has no arguments.
+    template <typename... Args>
+    void set_value(Args&&... args);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Promise);
+    internal::FutureState<T>* _state;
+    bool _future_retrieved;
+};
+
+// Returns a future which is already ready.
+template <typename T>
+Future<T> make_ready_future(T value);
+Future<void> make_ready_future();
+
+// Returns a future which is ready when all `futures' are ready. Values are
+// still got from `futures' respectively.
+template <typename T>
+Future<void> when_all(const std::vector<Future<T> >& futures);
+
+// Returns a future of the index of the first ready future in `futures'.
+// If `futures' is empty, the returned future is ready with 0.
+template <typename T>
+Future<size_t> when_any(const std::vector<Future<T> >& futures);
+
+}  // namespace bthread
+
+#include "bthread/future_inl.h"
+
+#endif  // BTHREAD_FUTURE_H
@@ -0,0 +1,427 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef  BTHREAD_FUTURE_INL_H
+#define  BTHREAD_FUTURE_INL_H
+
+#include <algorithm>                             // std::swap
+#include <exception>                             // std::exception
+#include <new>                                   // placement new
+#include "butil/atomicops.h"
+#include "butil/logging.h"                       // CHECK
+#include "butil/memory/aligned_memory.h"         // butil::AlignedMemory
+#include "butil/memory/scoped_ptr.h"             // scoped_ptr
+#include "butil/object_pool.h"                   // butil::get_object
+#include "bthread/butex.h"                       // butex_*
+#include "bthread/mutex.h"                       // internal::FastPthreadMutex
+
+namespace bthread {
+namespace internal {
+
+struct FutureUnit {};
+
+template <typename T> struct FutureValue { typedef T type; };
+template <> struct FutureValue<void> { typedef FutureUnit type; };
+
+// Called once when the future is ready, deletes itself.
+struct FutureCallback {
+    FutureCallback() : next(NULL) {}
+    virtual ~FutureCallback() {}
+    virtual void run() = 0;
+    FutureCallback* next;
+};
+
+template <typename T>
+class FutureState {
+public:
+    typedef typename FutureValue<T>::type Value;
+
+    // Called by ObjectPool only, butexes are reused with the states.
+    FutureState()
+        : _nref(0)
+        , _butex(butex_create_checked<butil::atomic<int> >())
+        , _has_value(false)
+        , _callbacks(NULL) {
+        _butex->store(0, butil::memory_order_relaxed);
+    }
+
+    static FutureState* create() {
+        FutureState* s = butil::get_object<FutureState>();
+        CHECK(s != NULL) << "Fail to allocate FutureState";
+        s->_nref.store(1, butil::memory_order_relaxed);
+        return s;
+    }
+
+    void add_ref() { _nref.fetch_add(1, butil::memory_order_relaxed); }
+
+    void release() {
+        if (_nref.fetch_sub(1, butil::memory_order_acq_rel) == 1) {
+            if (_has_value) {
+                _value.template data_as<Value>()->~Value();
+                _has_value = false;
+            }
+            _butex->store(0, butil::memory_order_relaxed);
+            butil::return_object(this);
+        }
+    }
+
+    bool is_ready() const {
+        return _butex->load(butil::memory_order_acquire) != 0;
+    }
+
+    int wait(const timespec* abstime) {
+        while (_butex->load(butil::memory_order_acquire) == 0) {
+            if (butex_wait(_butex, 0, abstime) < 0 &&
+                errno != EWOULDBLOCK && errno != EINTR) {
+                return errno;
+            }
+        }
+        return 0;
+    }
+
+    template <typename... Args>
+    void set_value(Args&&... args) {
+        CHECK(!is_ready()) << "Value of the future is already set";
+        new (_value.void_data()) Value(std::forward<Args>(args)...);
+        _has_value = true;
+        make_ready();
+    }
+
+    void set_broken() { make_ready(); }
+
+    bool broken() const { return !_has_value; }
+
+    Value take_value() {
+        CHECK(_has_value) << "The promise is broken";
+        return std::move(*_value.template data_as<Value>());
+    }
+
+    // Run `cb' when the state is ready, or now if it's already ready.
+    void add_callback(FutureCallback* cb) {
+        _mutex.lock();
+        if (!is_ready()) {
+            cb->next = _callbacks;
+            _callbacks = cb;
+            _mutex.unlock();
+            return;
+        }
+        _mutex.unlock();
+        run_callback(cb);
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(FutureState);
+
+    // An exception thrown by a callback is logged and swallowed, so that
+    // callbacks after it still run and the thread making the state ready is
+    // not unwound. The callback is deleted and its promise (if any) broken.
+    static void run_callback(FutureCallback* cb) {
+        try {
+            cb->run();
+        } catch (const std::exception& e) {
+            LOG(ERROR) << "Callback of bthread::Future threw: " << e.what();
+        } catch (...) {
+            LOG(ERROR) << "Callback of bthread::Future threw";
+        }
+    }
+
+    void make_ready() {
+        _mutex.lock();
+        _butex->store(1, butil::memory_order_release);
+        FutureCallback* head = _callbacks;
+        _callbacks = NULL;
+        _mutex.unlock();
+        butex_wake_all(_butex);
+        // Run callbacks in the order of adding.
+        FutureCallback* prev = NULL;
+        while (head) {
+            FutureCallback* next = head->next;
+            head->next = prev;
+            prev = head;
+            head = next;
+        }
+        while (prev) {
+            FutureCallback* next = prev->next;
+            run_callback(prev);
+            prev = next;
+        }
+    }
+
+    butil::atomic<int> _nref;
+    butil::atomic<int>* _butex;
+    bool _has_value;
+    butil::AlignedMemory<sizeof(Value), ALIGNOF(Value)> _value;
+    FastPthreadMutex _mutex;
+    FutureCallback* _callbacks;
+};
+
+template <typename T> struct FutureInvoke {
+    template <typename F>
+    static typename FutureThenResult<T, F>::type call(F& f, FutureState<T>* s) {
+        return f(s->take_value());
+    }
+};
+template <> struct FutureInvoke<void> {
+    template <typename F>
+    static typename FutureThenResult<void, F>::type call(F& f, FutureState<void>*) {
+        return f();
+    }
+};
+
+template <typename T, typename R> struct FutureThenRunner {
+    template <typename F>
+    static void run(F& f, FutureState<T>* s, Promise<R>* p) {
+        p->set_value(FutureInvoke<T>::call(f, s));
+    }
+};
+template <typename T> struct FutureThenRunner<T, void> {
+    template <typename F>
+    static void run(F& f, FutureState<T>* s, Promise<void>* p) {
+        FutureInvoke<T>::call(f, s);
+        p->set_value();
+    }
+};
+
+template <typename T, typename R, typename F>
+class ThenCallback : public FutureCallback {
+public:
+    ThenCallback(FutureState<T>* state, Promise<R>&& promise, const F& f)
+        : _state(state), _promise(std::move(promise)), _f(f) {}
+    ~ThenCallback() { _state->release(); }
+    void run() {
+        // Deleted even if `_f' throws, _promise is broken if unset.
+        scoped_ptr<ThenCallback> self_guard(this);
+        if (!_state->broken()) {
+            FutureThenRunner<T, R>::run(_f, _state, &_promise);
+        }
+    }
+private:
+    FutureState<T>* _state;
+    Promise<R> _promise;
+    F _f;
+};
+
+struct WhenAllContext {
+    butil::atomic<size_t> nremaining;
+    Promise<void> promise;
+};
+
+template <typename T>
+class WhenAllCallback : public FutureCallback {
+public:
+    WhenAllCallback(FutureState<T>* state, WhenAllContext* ctx)
+        : _state(state), _ctx(ctx) {}
+    void run() {
+        _state->release();
+        if (_ctx->nremaining.fetch_sub(1, butil::memory_order_acq_rel) == 1) {
+            _ctx->promise.set_value();
+            delete _ctx;
+        }
+        delete this;
+    }
+private:
+    FutureState<T>* _state;
+    WhenAllContext* _ctx;
+};
+
+struct WhenAnyContext {
+    butil::atomic<size_t> nref;
+    butil::atomic<bool> done;
+    Promise<size_t> promise;
+};
+
+template <typename T>
+class WhenAnyCallback : public FutureCallback {
+public:
+    WhenAnyCallback(FutureState<T>* state, WhenAnyContext* ctx, size_t index)
+        : _state(state), _ctx(ctx), _index(index) {}
+    void run() {
+        _state->release();
+        if (!_ctx->done.exchange(true, butil::memory_order_relaxed)) {
+            _ctx->promise.set_value(_index);
+        }
+        if (_ctx->nref.fetch_sub(1, butil::memory_order_acq_rel) == 1) {
+            delete _ctx;
+        }
+        delete this;
+    }
+private:
+    FutureState<T>* _state;
+    WhenAnyContext* _ctx;
+    size_t _index;
+};
+
+}  // namespace internal
+
+template <typename T>
+Future<T>& Future<T>::operator=(Future&& rhs) {
+    if (this != &rhs) {
+        if (_state) {
+            _state->release();
+        }
+        _state = rhs._state;
+        rhs._state = NULL;
+    }
+    return *this;
+}
+
+template <typename T>
+Future<T>::~Future() {
+    if (_state) {
+        _state->release();
+        _state = NULL;
+    }
+}
+
+template <typename T>
+bool Future<T>::is_ready() const {
+    return _state && _state->is_ready();
+}
+
+template <typename T>
+int Future<T>::wait() const {
+    if (_state == NULL) {
+        return EINVAL;
+    }
+    return _state->wait(NULL);
+}
+
+template <typename T>
+int Future<T>::timed_wait(const timespec& abstime) const {
+    if (_state == NULL) {
+        return EINVAL;
+    }
+    return _state->wait(&abstime);
+}
+
+template <typename T>
+T Future<T>::get() {
+    CHECK(_state != NULL) << "Invalid future";
+    _state->wait(NULL);
+    internal::FutureState<T>* s = _state;
+    _state = NULL;
+    typename internal::FutureState<T>::Value v = s->take_value();
+    s->release();
+    return static_cast<T>(std::move(v));
+}
+
+template <typename T>
+template <typename F>
+Future<typename internal::FutureThenResult<T, F>::type> Future<T>::then(F f) {
+    typedef typename internal::FutureThenResult<T, F>::type R;
+    CHECK(_state != NULL) << "Invalid future";
+    Promise<R> p;
+    Future<R> result = p.get_future();
+    internal::FutureState<T>* s = _state;
+    _state = NULL;
+    // The reference of this future is transferred to the callback.
+    s->add_callback(new internal::ThenCallback<T, R, F>(s, std::move(p), f));
+    return result;
+}
+
+template <typename T>
+Promise<T>::Promise()
+    : _state(internal::FutureState<T>::create())
+    , _future_retrieved(false) {
+}
+
+template <typename T>
+Promise<T>& Promise<T>::operator=(Promise&& rhs) {
+    // The previous state is broken(if unset) when `rhs' is destroyed.
+    std::swap(_state, rhs._state);
+    std::swap(_future_retrieved, rhs._future_retrieved);
+    return *this;
+}
+
+template <typename T>
+Promise<T>::~Promise() {
+    if (_state) {
+        if (!_state->is_ready()) {
+            _state->set_broken();
+        }
+        _state->release();
+        _state = NULL;
+    }
+}
+
+template <typename T>
+Future<T> Promise<T>::get_future() {
+    CHECK(_state != NULL) << "Invalid promise";
+    CHECK(!_future_retrieved) << "Future is already retrieved";
+    _future_retrieved = true;
+    _state->add_ref();
+    return Future<T>(_state);
+}
+
+template <typename T>
+template <typename... Args>
+void Promise<T>::set_value(Args&&... args) {
+    CHECK(_state != NULL) << "Invalid promise";
+    _state->set_value(std::forward<Args>(args)...);
+}
+
+template <typename T>
+Future<T> make_ready_future(T value) {
+    Promise<T> p;
+    p.set_value(std::move(value));
+    return p.get_future();
+}
+
+inline Future<void> make_ready_future() {
+    Promise<void> p;
+    p.set_value();
+    return p.get_future();
+}
+
+template <typename T>
+Future<void> when_all(const std::vector<Future<T> >& futures) {
+    internal::WhenAllContext* ctx = new internal::WhenAllContext;
+    Future<void> result = ctx->promise.get_future();
+    // Hold one count until all callbacks are added.
+    ctx->nremaining.store(futures.size() + 1, butil::memory_order_relaxed);
+    for (size_t i = 0; i < futures.size(); ++i) {
+        internal::FutureState<T>* s = futures[i]._state;
+        CHECK(s != NULL) << "Invalid future at " << i;
+        s->add_ref();
+        s->add_callback(new internal::WhenAllCallback<T>(s, ctx));
+    }
+    if (ctx->nremaining.fetch_sub(1, butil::memory_order_acq_rel) == 1) {
+        ctx->promise.set_value();
+        delete ctx;
+    }
+    return result;
+}
+
+template <typename T>
+Future<size_t> when_any(const std::vector<Future<T> >& futures) {
+    if (futures.empty()) {
+        return make_ready_future<size_t>(0);
+    }
+    internal::WhenAnyContext* ctx = new internal::WhenAnyContext;
+    Future<size_t> result = ctx->promise.get_future();
+    ctx->nref.store(futures.size(), butil::memory_order_relaxed);
+    ctx->done.store(false, butil::memory_order_relaxed);
+    for (size_t i = 0; i < futures.size(); ++i) {
+        internal::FutureState<T>* s = futures[i]._state;
+        CHECK(s != NULL) << "Invalid future at " << i;
+        s->add_ref();
+        s->add_callback(new internal::WhenAnyCallback<T>(s, ctx, i));
+    }
+    return result;
+}
+
+}  // namespace bthread
+
+#endif  // BTHREAD_FUTURE_INL_H
@@ -50,7 +50,7 @@ void* dummy_buf[4];
 const int ALLOW_UNUSED dummy_bt = backtrace(dummy_buf, arraysize(dummy_buf));
 
 // For controlling contentions collected per second.
-static bvar::CollectorSpeedLimit g_cp_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
+bvar::CollectorSpeedLimit g_cp_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
 
 const size_t MAX_CACHED_CONTENTIONS = 512;
 // Skip frames which are always same: the unlock function and submit_contention()
@@ -250,7 +250,7 @@ void ContentionProfiler::flush_to_disk(bool ending) {
 
 // If contention profiler is on, this variable will be set with a valid
 // instance. NULL otherwise.
-static ContentionProfiler* BAIDU_CACHELINE_ALIGNMENT g_cp = NULL;
+ContentionProfiler* BAIDU_CACHELINE_ALIGNMENT g_cp = NULL;
 // Need this version to solve an issue that non-empty entries left by
 // previous contention profilers should be detected and overwritten.
 static uint64_t g_cp_version = 0;
@@ -646,6 +646,50 @@ inline int mutex_timedlock_contended(
     return 0;
 }
 
+struct AsyncLockArg {
+    bthread_mutex_t* mutex;
+    void (*on_locked)(void*);
+    void* arg;
+};
+
+static void on_async_lock_wakeup(void* arg);
+
+// Returns 0 when the mutex is locked, EINPROGRESS when `a' is queued.
+inline int mutex_lock_async_contended(AsyncLockArg* a) {
+    butil::atomic<unsigned>* whole = (butil::atomic<unsigned>*)a->mutex->butex;
+    while (whole->exchange(BTHREAD_MUTEX_CONTENDED) & BTHREAD_MUTEX_LOCKED) {
+        if (bthread::butex_wait_async(whole, BTHREAD_MUTEX_CONTENDED,
+                                      on_async_lock_wakeup, a) == 0) {
+            return EINPROGRESS;
+        }
+    }
+    return 0;
+}
+
+static void on_async_lock_wakeup(void* arg) {
+    AsyncLockArg* a = static_cast<AsyncLockArg*>(arg);
+    if (mutex_lock_async_contended(a) == 0) {
+        a->on_locked(a->arg);
+        delete a;
+    }
+}
+
+int mutex_lock_async(bthread_mutex_t* m, void (*on_locked)(void*), void* arg) {
+    bthread::MutexInternal* split = (bthread::MutexInternal*)m->butex;
+    if (!split->locked.exchange(1, butil::memory_order_acquire)) {
+        return 0;
+    }
+    AsyncLockArg* a = new AsyncLockArg;
+    a->mutex = m;
+    a->on_locked = on_locked;
+    a->arg = arg;
+    const int rc = mutex_lock_async_contended(a);
+    if (rc == 0) {
+        delete a;
+    }
+    return rc;
+}
+
 #ifdef BTHREAD_USE_FAST_PTHREAD_MUTEX
 namespace internal {
 
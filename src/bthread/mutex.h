@@ -36,6 +36,12 @@ __END_DECLS
 
 namespace bthread {
 
+// Lock `mutex' without blocking the calling thread.
+// Returns 0 if the mutex is locked immediately. Otherwise returns EINPROGRESS
+// and `on_locked(arg)' will be called after the mutex is locked, by the
+// thread unlocking it, thus `on_locked' should not block.
+int mutex_lock_async(bthread_mutex_t* mutex, void (*on_locked)(void*), void* arg);
+
 // The C++ Wrapper of bthread_mutex
 
 // NOTE: Not aligned to cacheline as the container of Mutex is practically aligned
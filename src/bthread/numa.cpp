@@ -0,0 +1,119 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include "butil/file_util.h"                     // butil::ReadFileToString
+#include "butil/files/file_path.h"
+#include "butil/strings/string_split.h"
+#include "butil/strings/string_util.h"          // TrimWhitespaceASCII
+#include "bthread/numa.h"
+
+namespace bthread {
+
+int parse_cpu_list(const butil::StringPiece& str, std::vector<int>* cpus) {
+    cpus->clear();
+    std::string s;
+    butil::TrimWhitespaceASCII(str.as_string(), butil::TRIM_ALL, &s);
+    if (s.empty()) {
+        return 0;
+    }
+    std::vector<std::string> ranges;
+    butil::SplitString(s, ',', &ranges);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        int first = -1;
+        int last = -1;
+        char dummy;
+        const int n = sscanf(ranges[i].c_str(), "%d-%d%c", &first, &last, &dummy);
+        if (n == 1) {
+            last = first;
+        } else if (n != 2) {
+            return -1;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus->push_back(cpu);
+        }
+    }
+    return 0;
+}
+
+int get_numa_nodes(std::vector<std::vector<int> >* nodes) {
+    nodes->clear();
+    // Binding to CPUs outside the affinity mask of the process (e.g.
+    // restricted by taskset or cpusets of containers) fails.
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long i = 0; i < ncpu && i < CPU_SETSIZE; ++i) {
+            CPU_SET(i, &allowed);
+        }
+    }
+    // Node ids may be sparse, check more than MAX_NUMA_NODES of them.
+    for (int i = 0; i < 1024; ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+        std::string content;
+        if (!butil::ReadFileToString(butil::FilePath(path), &content)) {
+            continue;
+        }
+        std::vector<int> node_cpus;
+        if (parse_cpu_list(content, &node_cpus) != 0) {
+            continue;
+        }
+        std::vector<int> cpus;
+        for (size_t j = 0; j < node_cpus.size(); ++j) {
+            if (CPU_ISSET(node_cpus[j], &allowed)) {
+                cpus.push_back(node_cpus[j]);
+            }
+        }
+        if (cpus.empty()) {
+            continue;
+        }
+        if ((int)nodes->size() < MAX_NUMA_NODES) {
+            nodes->push_back(cpus);
+        } else {
+            nodes->back().insert(nodes->back().end(), cpus.begin(), cpus.end());
+        }
+    }
+    if (nodes->empty()) {
+        std::vector<int> cpus;
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &allowed)) {
+                cpus.push_back(i);
+            }
+        }
+        nodes->push_back(cpus);
+    }
+    return nodes->size();
+}
+
+int bind_to_cpus(const std::vector<int>& cpus) {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        CPU_SET(cpus[i], &cs);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+}
+
+}  // namespace bthread
@@ -0,0 +1,44 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BTHREAD_NUMA_H
+#define BTHREAD_NUMA_H
+
+#include <vector>
+#include "butil/strings/string_piece.h"
+
+namespace bthread {
+
+// Max number of NUMA nodes that workers can be bound to. CPUs of nodes
+// beyond this are merged into the last node.
+static const int MAX_NUMA_NODES = 8;
+
+// Parse cpulist format used by sysfs and cpusets, e.g. "0-3,8,10-11".
+// Returns 0 on success, -1 otherwise.
+int parse_cpu_list(const butil::StringPiece& str, std::vector<int>* cpus);
+
+// Put CPUs of each NUMA node into `nodes'. Only CPUs in the affinity mask
+// of the calling thread are counted, nodes without such CPUs are skipped.
+// If the topology is not available, all allowed CPUs are put into one node.
+// Returns number of nodes, which is at least 1.
+int get_numa_nodes(std::vector<std::vector<int> >* nodes);
+
+// Bind the calling pthread to `cpus'.
+// Returns 0 on success, error number otherwise.
+int bind_to_cpus(const std::vector<int>& cpus);
+
+}  // namespace bthread
+
+#endif  // BTHREAD_NUMA_H
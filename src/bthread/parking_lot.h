@@ -37,13 +37,23 @@ public:
         int val;
     };
 
-    ParkingLot() : _pending_signal(0) {}
+    ParkingLot() : _pending_signal(0), _nwaiter(0), _nfutex_call(0) {}
 
-    // Wake up at most `num_task' workers.
+    // Wake up at most `num_task' workers with one futex call, which is
+    // skipped when no worker is waiting.
     // Returns #workers woken up.
     int signal(int num_task) {
-        _pending_signal.fetch_add((num_task << 1), butil::memory_order_release);
-        return futex_wake_private(&_pending_signal, num_task);
+        // Any change of the value makes wait() with earlier states return.
+        _pending_signal.fetch_add((1 << 1), butil::memory_order_seq_cst);
+        // Pairs with the fetch_add in wait(): either the waiter is seen here,
+        // or the waiter sees the new _pending_signal and does not sleep.
+        const int nwaiter = _nwaiter.load(butil::memory_order_seq_cst);
+        if (nwaiter == 0) {
+            return 0;
+        }
+        _nfutex_call.fetch_add(1, butil::memory_order_relaxed);
+        return futex_wake_private(&_pending_signal,
+                                  (num_task < nwaiter ? num_task : nwaiter));
     }
 
     // Get a state for later wait().
@@ -54,7 +64,15 @@ public:
     // Wait for tasks.
     // If the `expected_state' does not match, wait() may finish directly.
     void wait(const State& expected_state) {
+        _nwaiter.fetch_add(1, butil::memory_order_seq_cst);
+        _nfutex_call.fetch_add(1, butil::memory_order_relaxed);
         futex_wait_private(&_pending_signal, expected_state.val, NULL);
+        _nwaiter.fetch_sub(1, butil::memory_order_relaxed);
+    }
+
+    // # of futex_wait and futex_wake called on this lot.
+    int64_t futex_call_count() const {
+        return _nfutex_call.load(butil::memory_order_relaxed);
     }
 
     // Wakeup suspended wait() and make them unwaitable ever. 
@@ -65,6 +83,8 @@ public:
 private:
     // higher 31 bits for signalling, MLB for stopping.
     butil::atomic<int> _pending_signal;
+    butil::atomic<int> _nwaiter;
+    butil::atomic<int64_t> _nfutex_call;
 };
 
 }  // namespace bthread
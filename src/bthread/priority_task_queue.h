@@ -0,0 +1,99 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BTHREAD_PRIORITY_TASK_QUEUE_H
+#define BTHREAD_PRIORITY_TASK_QUEUE_H
+
+#include <algorithm>                             // std::push_heap
+#include <vector>
+#include "butil/atomicops.h"
+#include "butil/macros.h"
+#include "butil/synchronization/lock.h"
+#include "bthread/types.h"
+
+namespace bthread {
+
+// A queue for storing bthreads with high priority or a deadline. Tasks with
+// earlier deadlines are popped first, tasks without deadlines are popped
+// after them in FIFO order. Such bthreads are supposed to be rare (health
+// checking, control-plane work...), so the queue is simply a heap protected
+// with a lock, emptiness is checked without the lock.
+class PriorityTaskQueue {
+public:
+    PriorityTaskQueue() : _seq(0), _size(0) {}
+
+    int init(size_t cap) {
+        _tasks.reserve(cap);
+        return 0;
+    }
+
+    bool empty() const {
+        return _size.load(butil::memory_order_relaxed) == 0;
+    }
+
+    size_t volatile_size() const {
+        return _size.load(butil::memory_order_relaxed);
+    }
+
+    void push(bthread_t task, int64_t deadline_us) {
+        _mutex.lock();
+        Entry e = { deadline_us ? deadline_us : INT64_MAX, _seq++, task };
+        _tasks.push_back(e);
+        std::push_heap(_tasks.begin(), _tasks.end(), Later());
+        _size.store(_tasks.size(), butil::memory_order_relaxed);
+        _mutex.unlock();
+    }
+
+    bool pop(bthread_t* task) {
+        if (empty()) {
+            return false;
+        }
+        _mutex.lock();
+        if (_tasks.empty()) {
+            _mutex.unlock();
+            return false;
+        }
+        std::pop_heap(_tasks.begin(), _tasks.end(), Later());
+        *task = _tasks.back().tid;
+        _tasks.pop_back();
+        _size.store(_tasks.size(), butil::memory_order_relaxed);
+        _mutex.unlock();
+        return true;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PriorityTaskQueue);
+    struct Entry {
+        int64_t deadline_us;
+        uint64_t seq;
+        bthread_t tid;
+    };
+    // std heaps put the largest element on top.
+    struct Later {
+        bool operator()(const Entry& a, const Entry& b) const {
+            return a.deadline_us != b.deadline_us ?
+                a.deadline_us > b.deadline_us : a.seq > b.seq;
+        }
+    };
+
+    butil::Mutex _mutex;
+    uint64_t _seq;
+    std::vector<Entry> _tasks;
+    butil::atomic<size_t> _size;
+};
+
+}  // namespace bthread
+
+#endif  // BTHREAD_PRIORITY_TASK_QUEUE_H
@@ -0,0 +1,403 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pthread.h>
+#include "butil/atomicops.h"
+#include "butil/time.h"                          // cpuwide_time_ns
+#include "bvar/collector.h"
+#include "bthread/butex.h"                       // butex_*
+#include "bthread/rwlock.h"
+
+namespace bthread {
+
+// Defined in mutex.cpp
+class ContentionProfiler;
+extern ContentionProfiler* g_cp;
+extern bvar::CollectorSpeedLimit g_cp_sl;
+extern void submit_contention(const bthread_contention_site_t& csite,
+                              int64_t now_ns);
+
+// Layout of the lock butex:
+//   bit 31     : a writer holds the lock.
+//   bit 30     : writers are waiting, new readers should wait as well so that
+//                writers are not starved by continuous readers.
+//   bit 29     : readers are waiting.
+//   bit 0 - 28 : number of readers holding the lock.
+// Readers wait on the lock butex for the writer bits to be cleared. Writers
+// leaving the lock wake them up only if bit 29 is set, so that the lock
+// used by writers only does not pay for butex_wake_all.
+static const unsigned RWLOCK_WRITER_LOCKED = 1u << 31;
+static const unsigned RWLOCK_WRITER_WAITING = 1u << 30;
+static const unsigned RWLOCK_WRITER_MASK =
+    RWLOCK_WRITER_LOCKED | RWLOCK_WRITER_WAITING;
+static const unsigned RWLOCK_READER_WAITING = 1u << 29;
+static const unsigned RWLOCK_READER_MASK = RWLOCK_READER_WAITING - 1;
+
+// Layout of the writer butex:
+//   bit 20 - 31: sequence bumped whenever the lock may become available to
+//                writers, waiting writers wait on the butex for the change.
+//   bit 0 - 19 : number of writers waiting.
+// Both are in the butex rather than bthread_rwlock_t because the lock may be
+// destroyed by others right after it's released, while butexes are never
+// returned to the system. Check comments before butex_create.
+static const unsigned RWLOCK_WRITER_SEQ_UNIT = 1u << 20;
+static const unsigned RWLOCK_NWAITING_WRITER_MASK = RWLOCK_WRITER_SEQ_UNIT - 1;
+
+typedef butil::atomic<unsigned> RWLockWord;
+
+inline RWLockWord* lock_word(bthread_rwlock_t* rw) {
+    return (RWLockWord*)rw->lock_butex;
+}
+
+inline RWLockWord* writer_word(bthread_rwlock_t* rw) {
+    return (RWLockWord*)rw->writer_butex;
+}
+
+inline int rwlock_tryrdlock(bthread_rwlock_t* rw) {
+    RWLockWord* word = lock_word(rw);
+    unsigned v = word->load(butil::memory_order_relaxed);
+    while (!(v & RWLOCK_WRITER_MASK)) {
+        if (word->compare_exchange_weak(v, v + 1, butil::memory_order_acquire,
+                                        butil::memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    return EBUSY;
+}
+
+inline int rwlock_rdlock_contended(bthread_rwlock_t* rw,
+                                   const struct timespec* abstime) {
+    RWLockWord* word = lock_word(rw);
+    while (true) {
+        unsigned v = word->load(butil::memory_order_relaxed);
+        if (!(v & RWLOCK_WRITER_MASK)) {
+            if (word->compare_exchange_weak(
+                    v, v + 1, butil::memory_order_acquire,
+                    butil::memory_order_relaxed)) {
+                return 0;
+            }
+            continue;
+        }
+        if (!(v & RWLOCK_READER_WAITING)) {
+            // Ask the writer to wake us up. The CAS fails if the writer
+            // leaves meanwhile.
+            if (!word->compare_exchange_weak(
+                    v, v | RWLOCK_READER_WAITING, butil::memory_order_relaxed)) {
+                continue;
+            }
+            v |= RWLOCK_READER_WAITING;
+        }
+        if (butex_wait(word, v, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR/*note*/) {
+            // Like bthread_mutex_t, interruptions are ignored.
+            return errno;
+        }
+    }
+}
+
+inline int rwlock_trywrlock(bthread_rwlock_t* rw) {
+    RWLockWord* word = lock_word(rw);
+    unsigned v = word->load(butil::memory_order_relaxed);
+    // WRITER_WAITING is kept so that readers are still blocked when other
+    // writers are waiting.
+    while (!(v & (RWLOCK_WRITER_LOCKED | RWLOCK_READER_MASK))) {
+        if (word->compare_exchange_weak(
+                v, v | RWLOCK_WRITER_LOCKED, butil::memory_order_acquire,
+                butil::memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    return EBUSY;
+}
+
+// Called after a writer released the lock(`unlocked' is true) or gave up
+// waiting. Only the butexes are touched since the lock may have been
+// destroyed.
+static void wake_up_after_writer_leaves(RWLockWord* word, RWLockWord* wword,
+                                        bool unlocked) {
+    // Readers can be blocked only by the lock we held or WRITER_WAITING
+    // that we clear.
+    bool wake_readers = unlocked;
+    while (true) {
+        if (wword->load(butil::memory_order_seq_cst) &
+            RWLOCK_NWAITING_WRITER_MASK) {
+            // Hand over to a waiting writer, readers are still blocked by
+            // WRITER_WAITING.
+            wword->fetch_add(RWLOCK_WRITER_SEQ_UNIT,
+                             butil::memory_order_release);
+            butex_wake(wword);
+            return;
+        }
+        // No writers are waiting, clear WRITER_WAITING and let readers in.
+        unsigned v = word->load(butil::memory_order_relaxed);
+        while ((v & RWLOCK_WRITER_WAITING) &&
+               !word->compare_exchange_weak(v, v & ~RWLOCK_WRITER_WAITING,
+                                            butil::memory_order_seq_cst,
+                                            butil::memory_order_relaxed)) {}
+        if (!(v & RWLOCK_WRITER_WAITING)) {
+            break;
+        }
+        wake_readers = true;
+        // A writer coming between the check above and clearing the bit may
+        // have seen WRITER_WAITING and gone to sleep without setting it, no
+        // one would wake it up. Pair with the seq_cst operations in
+        // rwlock_wrlock_contended(): either the writer sees the bit cleared
+        // and sets it again, or we see the writer.
+        if (!(wword->load(butil::memory_order_seq_cst) &
+              RWLOCK_NWAITING_WRITER_MASK)) {
+            break;
+        }
+        // Set the bit back and hand over to the writer, unless it's gone.
+        word->fetch_or(RWLOCK_WRITER_WAITING, butil::memory_order_seq_cst);
+    }
+    if (!wake_readers) {
+        return;
+    }
+    // Clear READER_WAITING and wake up readers only if they're waiting.
+    // Waking up readers is useless if another writer blocks them again, they
+    // will be woken up when the writer leaves.
+    unsigned v = word->load(butil::memory_order_relaxed);
+    while ((v & (RWLOCK_WRITER_MASK | RWLOCK_READER_WAITING)) ==
+           RWLOCK_READER_WAITING) {
+        if (word->compare_exchange_weak(v, v & ~RWLOCK_READER_WAITING,
+                                        butil::memory_order_relaxed)) {
+            butex_wake_all(word);
+            return;
+        }
+    }
+}
+
+inline int rwlock_wrlock_contended(bthread_rwlock_t* rw,
+                                   const struct timespec* abstime) {
+    RWLockWord* word = lock_word(rw);
+    RWLockWord* wword = writer_word(rw);
+    // seq_cst: see wake_up_after_writer_leaves().
+    wword->fetch_add(1, butil::memory_order_seq_cst);
+    while (true) {
+        // Load the sequence before checking the lock so that a wakeup
+        // between the check and butex_wait is not missed.
+        const unsigned seq = wword->load(butil::memory_order_acquire);
+        unsigned v = word->load(butil::memory_order_seq_cst);
+        if (!(v & (RWLOCK_WRITER_LOCKED | RWLOCK_READER_MASK))) {
+            if (word->compare_exchange_weak(
+                    v, v | RWLOCK_WRITER_LOCKED, butil::memory_order_acquire,
+                    butil::memory_order_relaxed)) {
+                wword->fetch_sub(1, butil::memory_order_relaxed);
+                return 0;
+            }
+            continue;
+        }
+        if (!(v & RWLOCK_WRITER_WAITING) &&
+            !word->compare_exchange_weak(
+                v, v | RWLOCK_WRITER_WAITING, butil::memory_order_relaxed)) {
+            continue;
+        }
+        // The wait also fails when the number of waiting writers changes,
+        // which is harmless.
+        if (butex_wait(wword, seq, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR/*note*/) {
+            const int rc = errno;
+            wword->fetch_sub(1, butil::memory_order_release);
+            // Readers blocked by us should be woken up. Also pass the wakeup
+            // that we may have consumed to other writers.
+            wake_up_after_writer_leaves(word, wword, false);
+            return rc;
+        }
+    }
+}
+
+static inline bool is_contention_site_valid(const bthread_contention_site_t& cs) {
+    return cs.sampling_range;
+}
+
+static inline void make_contention_site_invalid(bthread_contention_site_t* cs) {
+    cs->sampling_range = 0;
+}
+
+// Contended readers submit the contention right after getting the lock
+// since the lock may be held by many readers at the same time, while
+// the writer saves it in the lock and submits it in unlock like
+// bthread_mutex_t does.
+static int rwlock_rdlock_sampled(bthread_rwlock_t* rw,
+                                 const struct timespec* abstime) {
+    if (!g_cp) {
+        return rwlock_rdlock_contended(rw, abstime);
+    }
+    const size_t sampling_range = bvar::is_collectable(&g_cp_sl);
+    if (!sampling_range) {
+        return rwlock_rdlock_contended(rw, abstime);
+    }
+    const int64_t start_ns = butil::cpuwide_time_ns();
+    const int rc = rwlock_rdlock_contended(rw, abstime);
+    if (rc == 0 || rc == ETIMEDOUT) {
+        const int64_t end_ns = butil::cpuwide_time_ns();
+        const bthread_contention_site_t csite =
+            {end_ns - start_ns, sampling_range};
+        submit_contention(csite, end_ns);
+    }
+    return rc;
+}
+
+static int rwlock_wrlock_sampled(bthread_rwlock_t* rw,
+                                 const struct timespec* abstime) {
+    if (!g_cp) {
+        return rwlock_wrlock_contended(rw, abstime);
+    }
+    const size_t sampling_range = bvar::is_collectable(&g_cp_sl);
+    if (!sampling_range) {
+        return rwlock_wrlock_contended(rw, abstime);
+    }
+    const int64_t start_ns = butil::cpuwide_time_ns();
+    const int rc = rwlock_wrlock_contended(rw, abstime);
+    if (!rc) { // Inside lock
+        rw->writer_csite.duration_ns = butil::cpuwide_time_ns() - start_ns;
+        rw->writer_csite.sampling_range = sampling_range;
+    } else if (rc == ETIMEDOUT) {
+        const int64_t end_ns = butil::cpuwide_time_ns();
+        const bthread_contention_site_t csite =
+            {end_ns - start_ns, sampling_range};
+        submit_contention(csite, end_ns);
+    }
+    return rc;
+}
+
+}  // namespace bthread
+
+extern "C" {
+
+int bthread_rwlock_init(bthread_rwlock_t* __restrict rw,
+                        const bthread_rwlockattr_t* __restrict) __THROW {
+    rw->lock_butex = bthread::butex_create_checked<unsigned>();
+    if (!rw->lock_butex) {
+        return ENOMEM;
+    }
+    rw->writer_butex = bthread::butex_create_checked<unsigned>();
+    if (!rw->writer_butex) {
+        bthread::butex_destroy(rw->lock_butex);
+        return ENOMEM;
+    }
+    *rw->lock_butex = 0;
+    *rw->writer_butex = 0;
+    bthread::make_contention_site_invalid(&rw->writer_csite);
+    return 0;
+}
+
+int bthread_rwlock_destroy(bthread_rwlock_t* rw) __THROW {
+    bthread::butex_destroy(rw->lock_butex);
+    bthread::butex_destroy(rw->writer_butex);
+    return 0;
+}
+
+int bthread_rwlock_tryrdlock(bthread_rwlock_t* rw) __THROW {
+    return bthread::rwlock_tryrdlock(rw);
+}
+
+int bthread_rwlock_rdlock(bthread_rwlock_t* rw) __THROW {
+    if (bthread::rwlock_tryrdlock(rw) == 0) {
+        return 0;
+    }
+    return bthread::rwlock_rdlock_sampled(rw, NULL);
+}
+
+int bthread_rwlock_timedrdlock(bthread_rwlock_t* __restrict rw,
+                               const struct timespec* __restrict abstime) __THROW {
+    if (bthread::rwlock_tryrdlock(rw) == 0) {
+        return 0;
+    }
+    return bthread::rwlock_rdlock_sampled(rw, abstime);
+}
+
+int bthread_rwlock_trywrlock(bthread_rwlock_t* rw) __THROW {
+    return bthread::rwlock_trywrlock(rw);
+}
+
+int bthread_rwlock_wrlock(bthread_rwlock_t* rw) __THROW {
+    if (bthread::rwlock_trywrlock(rw) == 0) {
+        return 0;
+    }
+    return bthread::rwlock_wrlock_sampled(rw, NULL);
+}
+
+int bthread_rwlock_timedwrlock(bthread_rwlock_t* __restrict rw,
+                               const struct timespec* __restrict abstime) __THROW {
+    if (bthread::rwlock_trywrlock(rw) == 0) {
+        return 0;
+    }
+    return bthread::rwlock_wrlock_sampled(rw, abstime);
+}
+
+int bthread_rwlock_unlock(bthread_rwlock_t* rw) __THROW {
+    bthread::RWLockWord* word = bthread::lock_word(rw);
+    bthread::RWLockWord* wword = bthread::writer_word(rw);
+    const unsigned v = word->load(butil::memory_order_relaxed);
+    if (!(v & bthread::RWLOCK_WRITER_LOCKED)) {
+        // Unlock a reader.
+        const unsigned prev = word->fetch_sub(1, butil::memory_order_release);
+        // CAUTION: the lock may be destroyed, don't touch `rw' anymore.
+        if ((prev & bthread::RWLOCK_READER_MASK) == 1 &&
+            (prev & bthread::RWLOCK_WRITER_WAITING)) {
+            // The last reader wakes up a waiting writer.
+            wword->fetch_add(bthread::RWLOCK_WRITER_SEQ_UNIT,
+                             butil::memory_order_release);
+            bthread::butex_wake(wword);
+        }
+        return 0;
+    }
+    // Unlock the writer.
+    bthread_contention_site_t saved_csite = {0, 0};
+    if (bthread::is_contention_site_valid(rw->writer_csite)) {
+        saved_csite = rw->writer_csite;
+        bthread::make_contention_site_invalid(&rw->writer_csite);
+    }
+    const int64_t unlock_start_ns =
+        (saved_csite.sampling_range ? butil::cpuwide_time_ns() : 0);
+    word->fetch_sub(bthread::RWLOCK_WRITER_LOCKED, butil::memory_order_release);
+    // CAUTION: the lock may be destroyed, don't touch `rw' anymore.
+    bthread::wake_up_after_writer_leaves(word, wword, true);
+    if (saved_csite.sampling_range) {
+        const int64_t unlock_end_ns = butil::cpuwide_time_ns();
+        saved_csite.duration_ns += unlock_end_ns - unlock_start_ns;
+        bthread::submit_contention(saved_csite, unlock_end_ns);
+    }
+    return 0;
+}
+
+int bthread_rwlockattr_init(bthread_rwlockattr_t*) __THROW {
+    return 0;
+}
+
+int bthread_rwlockattr_destroy(bthread_rwlockattr_t*) __THROW {
+    return 0;
+}
+
+int bthread_rwlockattr_getkind_np(const bthread_rwlockattr_t*,
+                                  int* pref) __THROW {
+    *pref = PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP;
+    return 0;
+}
+
+int bthread_rwlockattr_setkind_np(bthread_rwlockattr_t*, int pref) __THROW {
+    // Writers are always preferred.
+    switch (pref) {
+    case PTHREAD_RWLOCK_PREFER_READER_NP:
+    case PTHREAD_RWLOCK_PREFER_WRITER_NP:
+    case PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP:
+        return 0;
+    default:
+        return EINVAL;
+    }
+}
+
+}  // extern "C"
@@ -0,0 +1,170 @@
+// bthread - A M:N threading library to make applications more concurrent.
+// Copyright (c) 2012 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "butil/atomicops.h"
+#include "bthread/butex.h"                       // butex_*
+#include "bthread/bthread.h"
+
+namespace bthread {
+
+// Layout of the butex of bthread_sem_t:
+//   bit 31     : some waiters may be sleeping on the butex.
+//   bit 0 - 30 : value of the semaphore.
+// Like bthread_mutex_t, the bit saves wakeups when nobody waits. It's cleared
+// by a post which wakes up waiters, and the woken-up waiters set it again
+// since other waiters may still be sleeping.
+static const unsigned SEM_WAITERS = 1u << 31;
+static const unsigned SEM_VALUE_MASK = SEM_WAITERS - 1;
+
+typedef butil::atomic<unsigned> SemWord;
+
+inline SemWord* sem_word(bthread_sem_t* sem) {
+    return (SemWord*)sem->butex;
+}
+
+// Take one from the semaphore if it's positive. `waited' is true if the
+// caller slept before, in which case SEM_WAITERS is set for other waiters
+// and one of them is woken up if the semaphore is still positive, since
+// posts seeing SEM_WAITERS cleared did not wake up anyone.
+inline bool sem_trywait(SemWord* word, bool waited) {
+    unsigned v = word->load(butil::memory_order_relaxed);
+    while (v & SEM_VALUE_MASK) {
+        const unsigned nv = (v - 1) | (waited ? SEM_WAITERS : 0);
+        if (word->compare_exchange_weak(v, nv, butil::memory_order_acquire,
+                                        butil::memory_order_relaxed)) {
+            if (waited && (nv & SEM_VALUE_MASK)) {
+                butex_wake(word);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static int sem_wait_contended(SemWord* word, const timespec* abstime) {
+    bool waited = false;
+    while (true) {
+        unsigned v = word->load(butil::memory_order_relaxed);
+        if (v & SEM_VALUE_MASK) {
+            if (sem_trywait(word, waited)) {
+                return 0;
+            }
+            continue;
+        }
+        if (!(v & SEM_WAITERS)) {
+            if (!word->compare_exchange_weak(v, SEM_WAITERS,
+                                             butil::memory_order_relaxed)) {
+                continue;
+            }
+        }
+        waited = true;
+        if (butex_wait(word, SEM_WAITERS, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR/*note*/) {
+            const int rc = errno;
+            if (sem_trywait(word, true)) {
+                return 0;
+            }
+            // We may have consumed a wakeup of a post, make sure that the
+            // next post wakes up other waiters.
+            v = word->load(butil::memory_order_relaxed);
+            while (!(v & SEM_WAITERS) &&
+                   !word->compare_exchange_weak(v, v | SEM_WAITERS,
+                                                butil::memory_order_relaxed)) {}
+            return rc;
+        }
+    }
+}
+
+inline int sem_post(bthread_sem_t* sem, unsigned n) {
+    // The semaphore may be destroyed by the woken-up waiter, don't touch
+    // `sem' after changing the value.
+    SemWord* word = sem_word(sem);
+    unsigned v = word->load(butil::memory_order_relaxed);
+    unsigned nv;
+    do {
+        if ((v & SEM_VALUE_MASK) + n > SEM_VALUE_MASK) {
+            return EOVERFLOW;
+        }
+        nv = (v & SEM_VALUE_MASK) + n;
+    } while (!word->compare_exchange_weak(v, nv, butil::memory_order_release,
+                                          butil::memory_order_relaxed));
+    if (v & SEM_WAITERS) {
+        // Woken-up waiters set SEM_WAITERS again if others are sleeping.
+        for (unsigned i = 0; i < n && butex_wake(word) > 0; ++i) {}
+    }
+    return 0;
+}
+
+}  // namespace bthread
+
+extern "C" {
+
+int bthread_sem_init(bthread_sem_t* sem, unsigned value) __THROW {
+    if (value > bthread::SEM_VALUE_MASK) {
+        return EINVAL;
+    }
+    sem->butex = bthread::butex_create_checked<unsigned>();
+    if (!sem->butex) {
+        return ENOMEM;
+    }
+    *sem->butex = value;
+    return 0;
+}
+
+int bthread_sem_destroy(bthread_sem_t* sem) __THROW {
+    bthread::butex_destroy(sem->butex);
+    return 0;
+}
+
+int bthread_sem_trywait(bthread_sem_t* sem) __THROW {
+    return bthread::sem_trywait(bthread::sem_word(sem), false) ? 0 : EAGAIN;
+}
+
+int bthread_sem_wait(bthread_sem_t* sem) __THROW {
+    bthread::SemWord* word = bthread::sem_word(sem);
+    if (bthread::sem_trywait(word, false)) {
+        return 0;
+    }
+    return bthread::sem_wait_contended(word, NULL);
+}
+
+int bthread_sem_timedwait(bthread_sem_t* __restrict sem,
+                          const struct timespec* __restrict abstime) __THROW {
+    bthread::SemWord* word = bthread::sem_word(sem);
+    if (bthread::sem_trywait(word, false)) {
+        return 0;
+    }
+    return bthread::sem_wait_contended(word, abstime);
+}
+
+int bthread_sem_post(bthread_sem_t* sem) __THROW {
+    return bthread::sem_post(sem, 1);
+}
+
+int bthread_sem_post_n(bthread_sem_t* sem, unsigned n) __THROW {
+    if (n == 0) {
+        return 0;
+    }
+    return bthread::sem_post(sem, n);
+}
+
+int bthread_sem_getvalue(bthread_sem_t* __restrict sem,
+                         int* __restrict value) __THROW {
+    *value = bthread::sem_word(sem)->load(butil::memory_order_relaxed)
+        & bthread::SEM_VALUE_MASK;
+    return 0;
+}
+
+}  // extern "C"
@@ -34,6 +34,15 @@ DEFINE_int32(stack_size_large, 8388608, "size of large stacks");
 DEFINE_int32(guard_page_size, 4096, "size of guard page, allocate stacks by malloc if it's 0(not recommended)");
 DEFINE_int32(tc_stack_small, 32, "maximum small stacks cached by each thread");
 DEFINE_int32(tc_stack_normal, 8, "maximum normal stacks cached by each thread");
+DEFINE_int32(bthread_stack_trim_threshold, -1,
+             "When more than so many stacks of a type are idle, pages of "
+             "stacks returned further are given back to the OS by madvise. "
+             "Pages are committed again lazily on next use. madvise is called "
+             "by the worker ending the bthread and may flush TLBs of other "
+             "workers, so trimming is disabled when this flag is negative");
+DEFINE_int32(bthread_max_cached_stacks, 8192,
+             "Maximum idle stacks of each type, stacks returned beyond the "
+             "limit are unmapped");
 
 namespace bthread {
 
@@ -50,6 +59,49 @@ static int64_t get_stack_count(void*) {
 static bvar::PassiveStatus<int64_t> bvar_stack_count(
     "bthread_stack_count", get_stack_count, NULL);
 
+// Bytes of address space occupied by stacks(including guard pages). Pages are
+// committed lazily, so resident memory is generally much smaller.
+static butil::static_atomic<int64_t> s_stack_memory = BUTIL_STATIC_ATOMIC_INIT(0);
+static butil::static_atomic<int64_t> s_stack_memory_max = BUTIL_STATIC_ATOMIC_INIT(0);
+static int64_t get_stack_memory(void*) {
+    return s_stack_memory.load(butil::memory_order_relaxed);
+}
+static bvar::PassiveStatus<int64_t> bvar_stack_memory(
+    "bthread_stack_memory", get_stack_memory, NULL);
+static int64_t get_stack_memory_max(void*) {
+    return s_stack_memory_max.load(butil::memory_order_relaxed);
+}
+static bvar::PassiveStatus<int64_t> bvar_stack_memory_max(
+    "bthread_stack_memory_max", get_stack_memory_max, NULL);
+
+butil::static_atomic<int64_t> SmallStackClass::nidle = BUTIL_STATIC_ATOMIC_INIT(0);
+butil::static_atomic<int64_t> NormalStackClass::nidle = BUTIL_STATIC_ATOMIC_INIT(0);
+butil::static_atomic<int64_t> LargeStackClass::nidle = BUTIL_STATIC_ATOMIC_INIT(0);
+static int64_t get_idle_stack_count(void*) {
+    return SmallStackClass::nidle.load(butil::memory_order_relaxed) +
+        NormalStackClass::nidle.load(butil::memory_order_relaxed) +
+        LargeStackClass::nidle.load(butil::memory_order_relaxed);
+}
+static bvar::PassiveStatus<int64_t> bvar_idle_stack_count(
+    "bthread_stack_idle_count", get_idle_stack_count, NULL);
+
+static butil::static_atomic<int64_t> s_trimmed_stack_count =
+    BUTIL_STATIC_ATOMIC_INIT(0);
+static int64_t get_trimmed_stack_count(void*) {
+    return s_trimmed_stack_count.load(butil::memory_order_relaxed);
+}
+static bvar::PassiveStatus<int64_t> bvar_trimmed_stack_count(
+    "bthread_stack_trimmed_count", get_trimmed_stack_count, NULL);
+
+static void add_stack_memory(int64_t memsize) {
+    const int64_t cur = s_stack_memory.fetch_add(
+        memsize, butil::memory_order_relaxed) + memsize;
+    int64_t max = s_stack_memory_max.load(butil::memory_order_relaxed);
+    while (cur > max &&
+           !s_stack_memory_max.compare_exchange_weak(
+               max, cur, butil::memory_order_relaxed)) {}
+}
+
 int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in) {
     const static int PAGESIZE = getpagesize();
     const int PAGESIZE_M1 = PAGESIZE - 1;
@@ -69,6 +121,7 @@ int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in)
             return -1;
         }
         s_stack_count.fetch_add(1, butil::memory_order_relaxed);
+        add_stack_memory(stacksize);
         s->bottom = (char*)mem + stacksize;
         s->stacksize = stacksize;
         s->guardsize = 0;
@@ -86,8 +139,11 @@ int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in)
             ~PAGESIZE_M1;
 
         const int memsize = stacksize + guardsize;
+        // Pages are committed on first touch, reserving swap for the whole
+        // stack is unnecessary since most bthreads use a small part of it.
         void* const mem = mmap(NULL, memsize, (PROT_READ | PROT_WRITE),
-                               (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+                               (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE),
+                               -1, 0);
 
         if (MAP_FAILED == mem) {
             PLOG_EVERY_SECOND(ERROR) 
@@ -114,6 +170,7 @@ int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in)
         }
 
         s_stack_count.fetch_add(1, butil::memory_order_relaxed);
+        add_stack_memory(memsize);
         s->bottom = (char*)mem + memsize;
         s->stacksize = stacksize;
         s->guardsize = guardsize;
@@ -136,6 +193,7 @@ void deallocate_stack_storage(StackStorage* s) {
         return;
     }
     s_stack_count.fetch_sub(1, butil::memory_order_relaxed);
+    s_stack_memory.fetch_sub(memsize, butil::memory_order_relaxed);
     if (s->guardsize <= 0) {
         free((char*)s->bottom - memsize);
     } else {
@@ -143,6 +201,26 @@ void deallocate_stack_storage(StackStorage* s) {
     }
 }
 
+void trim_stack_storage(StackStorage* s, const void* sp) {
+    if (s->guardsize <= 0) {
+        // Allocated by malloc, leave the memory to the allocator.
+        return;
+    }
+    const static intptr_t PAGESIZE = getpagesize();
+    char* const begin = (char*)s->bottom - s->stacksize;
+    // Contents above `sp' are still needed to resume the stack.
+    char* const end = (char*)((intptr_t)sp & ~(PAGESIZE - 1));
+    if (end <= begin || end > (char*)s->bottom) {
+        return;
+    }
+    if (madvise(begin, end - begin, MADV_DONTNEED) != 0) {
+        PLOG_EVERY_SECOND(WARNING) << "Fail to madvise " << (void*)begin
+                                   << " length=" << end - begin;
+        return;
+    }
+    s_trimmed_stack_count.fetch_add(1, butil::memory_order_relaxed);
+}
+
 int* SmallStackClass::stack_size_flag = &FLAGS_stack_size_small;
 int* NormalStackClass::stack_size_flag = &FLAGS_stack_size_normal;
 int* LargeStackClass::stack_size_flag = &FLAGS_stack_size_large;
@@ -23,6 +23,7 @@
 #include <gflags/gflags.h>          // DECLARE_int32
 #include "bthread/types.h"
 #include "bthread/context.h"        // bthread_fcontext_t
+#include "butil/atomicops.h"
 #include "butil/object_pool.h"
 
 namespace bthread {
@@ -49,6 +50,9 @@ int allocate_stack_storage(StackStorage* s, int stacksize, int guardsize);
 // Deallocate a piece of stack. Parameters MUST be returned or set by the
 // corresponding allocate_stack_storage() otherwise behavior is undefined.
 void deallocate_stack_storage(StackStorage* s);
+// Give pages of the stack below `sp' back to the OS. They're zero-filled and
+// committed again when touched.
+void trim_stack_storage(StackStorage* s, const void* sp);
 
 enum StackType {
     STACK_TYPE_MAIN = 0,
@@ -22,6 +22,8 @@
 DECLARE_int32(guard_page_size);
 DECLARE_int32(tc_stack_small);
 DECLARE_int32(tc_stack_normal);
+DECLARE_int32(bthread_stack_trim_threshold);
+DECLARE_int32(bthread_max_cached_stacks);
 
 namespace bthread {
 
@@ -29,47 +31,87 @@ struct MainStackClass {};
 
 struct SmallStackClass {
     static int* stack_size_flag;
+    // Number of stacks returned to the pool and not reused yet.
+    static butil::static_atomic<int64_t> nidle;
     // Older gcc does not allow static const enum, use int instead.
     static const int stacktype = (int)STACK_TYPE_SMALL;
 };
 
 struct NormalStackClass {
     static int* stack_size_flag;
+    static butil::static_atomic<int64_t> nidle;
     static const int stacktype = (int)STACK_TYPE_NORMAL;
 };
 
 struct LargeStackClass {
     static int* stack_size_flag;
+    static butil::static_atomic<int64_t> nidle;
     static const int stacktype = (int)STACK_TYPE_LARGE;
 };
 
 template <typename StackClass> struct StackFactory {
     struct Wrapper : public ContextualStack {
-        explicit Wrapper(void (*entry)(intptr_t)) {
+        explicit Wrapper(void (*entry)(intptr_t)) : idle(false) {
+            init(entry);
+        }
+        ~Wrapper() {
+            destroy();
+        }
+        int init(void (*entry)(intptr_t)) {
             if (allocate_stack_storage(&storage, *StackClass::stack_size_flag,
                                        FLAGS_guard_page_size) != 0) {
                 storage.zeroize();
                 context = NULL;
-                return;
+                return -1;
             }
             context = bthread_make_fcontext(storage.bottom, storage.stacksize, entry);
             stacktype = (StackType)StackClass::stacktype;
+            return 0;
         }
-        ~Wrapper() {
+        void destroy() {
             if (context) {
                 context = NULL;
                 deallocate_stack_storage(&storage);
                 storage.zeroize();
             }
         }
+        // True if the stack sits in the pool with storage.
+        bool idle;
     };
     
     static ContextualStack* get_stack(void (*entry)(intptr_t)) {
-        return butil::get_object<Wrapper>(entry);
+        Wrapper* w = butil::get_object<Wrapper>(entry);
+        if (w == NULL) {
+            return NULL;
+        }
+        if (w->idle) {
+            w->idle = false;
+            StackClass::nidle.fetch_sub(1, butil::memory_order_relaxed);
+        } else if (w->context == NULL && w->init(entry) != 0) {
+            // Storage of the recycled wrapper was released in return_stack.
+            butil::return_object(w);
+            return NULL;
+        }
+        return w;
     }
     
     static void return_stack(ContextualStack* sc) {
-        butil::return_object(static_cast<Wrapper*>(sc));
+        Wrapper* w = static_cast<Wrapper*>(sc);
+        const int64_t nidle =
+            StackClass::nidle.fetch_add(1, butil::memory_order_relaxed) + 1;
+        if (nidle > FLAGS_bthread_max_cached_stacks) {
+            // Too many stacks are cached after a burst of bthreads, release
+            // the storage and keep the (tiny) wrapper only.
+            StackClass::nidle.fetch_sub(1, butil::memory_order_relaxed);
+            w->destroy();
+        } else {
+            w->idle = true;
+            const int32_t trim_threshold = FLAGS_bthread_stack_trim_threshold;
+            if (trim_threshold >= 0 && nidle > trim_threshold) {
+                trim_stack_storage(&w->storage, w->context);
+            }
+        }
+        butil::return_object(w);
     }
 };
 
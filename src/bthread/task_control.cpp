@@ -20,6 +20,8 @@
 #include "butil/errno.h"                   // berror
 #include "butil/logging.h"
 #include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "butil/strings/string_split.h"   // SplitString
+#include "butil/strings/string_number_conversions.h"  // StringToInt
 #include "bthread/sys_futex.h"            // futex_wake_private
 #include "bthread/interrupt_pthread.h"
 #include "bthread/processor.h"            // cpu_relax
@@ -35,6 +37,18 @@ DEFINE_int32(task_group_runqueue_capacity, 4096,
              "capacity of runqueue in each TaskGroup");
 DEFINE_int32(task_group_yield_before_idle, 0,
              "TaskGroup yields so many times before idle");
+DEFINE_bool(bthread_numa_aware, false,
+            "Spread workers over NUMA nodes and bind them to CPUs of their "
+            "nodes. Idle workers steal tasks from workers on the same node "
+            "first and are woken up by signals from the same node first");
+DEFINE_bool(bthread_pin_workers, false,
+            "Pin each worker to one CPU. CPUs are assigned round-robin (in "
+            "nodes of workers if -bthread_numa_aware is on)");
+DEFINE_string(bthread_worker_pools, "",
+              "Worker pools created along with the default one, in form of "
+              "name1:concurrency1,name2:concurrency2. Tags of the pools are "
+              "1,2... in order. bthreads of a pool only run in workers of "
+              "the pool");
 
 namespace bthread {
 
@@ -54,18 +68,23 @@ void* TaskControl::worker_thread(void* arg) {
     logging::ComlogInitializer comlog_initializer;
 #endif
     
-    TaskControl* c = static_cast<TaskControl*>(arg);
-    TaskGroup* g = c->create_group();
+    WorkerPool* pool = static_cast<WorkerPool*>(arg);
+    TaskControl* c = pool->control;
+    const int numa_node = c->bind_worker(
+        c->_next_worker_index.fetch_add(1, butil::memory_order_relaxed));
+    TaskGroup* g = c->create_group(numa_node, pool->tag);
     TaskStatistics stat;
     if (NULL == g) {
         LOG(ERROR) << "Fail to create TaskGroup in pthread=" << pthread_self();
         return NULL;
     }
     BT_VLOG << "Created worker=" << pthread_self()
-            << " bthread=" << g->main_tid();
+            << " bthread=" << g->main_tid() << " numa_node=" << numa_node
+            << " pool=" << pool->name;
 
     tls_task_group = g;
     c->_nworkers << 1;
+    pool->nworkers << 1;
     g->run_main_task();
 
     stat = g->main_stat();
@@ -75,11 +94,38 @@ void* TaskControl::worker_thread(void* arg) {
     tls_task_group = NULL;
     g->destroy_self();
     c->_nworkers << -1;
+    pool->nworkers << -1;
     return NULL;
 }
 
-TaskGroup* TaskControl::create_group() {
-    TaskGroup* g = new (std::nothrow) TaskGroup(this);
+int TaskControl::bind_worker(int worker_index) {
+    if (_numa_nodes.empty()) {
+        return 0;
+    }
+    // Spread workers over nodes so that adjacent workers land on
+    // different nodes.
+    const int node = worker_index % _nnode;
+    std::vector<int> cpus;
+    if (FLAGS_bthread_pin_workers) {
+        // All CPUs are in one node when workers are not NUMA-aware.
+        const std::vector<int>& node_cpus =
+            _numa_nodes[FLAGS_bthread_numa_aware ? node : 0];
+        const int index = (FLAGS_bthread_numa_aware ?
+                           worker_index / _nnode : worker_index);
+        cpus.push_back(node_cpus[index % node_cpus.size()]);
+    } else {
+        cpus = _numa_nodes[node];
+    }
+    const int rc = bind_to_cpus(cpus);
+    if (rc != 0) {
+        LOG(WARNING) << "Fail to bind worker=" << pthread_self()
+                     << " to cpus of numa_node=" << node << ", " << berror(rc);
+    }
+    return node;
+}
+
+TaskGroup* TaskControl::create_group(int numa_node, bthread_tag_t tag) {
+    TaskGroup* g = new (std::nothrow) TaskGroup(this, numa_node, tag);
     if (NULL == g) {
         LOG(FATAL) << "Fail to new TaskGroup";
         return NULL;
@@ -113,12 +159,79 @@ static int64_t get_cumulated_signal_count_from_this(void *arg) {
     return static_cast<TaskControl*>(arg)->get_cumulated_signal_count();
 }
 
+static int64_t get_cumulated_futex_call_count_from_this(void *arg) {
+    return static_cast<TaskControl*>(arg)->get_cumulated_futex_call_count();
+}
+
+TaskControl::WorkerPool::WorkerPool(
+    TaskControl* c, bthread_tag_t tag2, const std::string& name2)
+    : control(c)
+    , tag(tag2)
+    , name(name2)
+    , concurrency(0)
+    , ngroup(0)
+    , groups((TaskGroup**)calloc(BTHREAD_MAX_CONCURRENCY, sizeof(TaskGroup*)))
+    , cumulated_worker_time(get_cumulated_worker_time, this)
+    , worker_usage_second(&cumulated_worker_time, 1)
+    , sched_vars(NULL)
+    , nspinning(0) {
+    CHECK(groups) << "Fail to create array of groups";
+}
+
+TaskControl::WorkerPool::~WorkerPool() {
+    nworkers.hide();
+    nbthreads.hide();
+    worker_usage_second.hide();
+    delete sched_vars.exchange(NULL, butil::memory_order_relaxed);
+    free(groups);
+    groups = NULL;
+}
+
+void TaskControl::WorkerPool::expose_vars() {
+    const std::string prefix = "bthread_worker_pool_" + name;
+    nworkers.expose_as(prefix, "worker_count");
+    nbthreads.expose_as(prefix, "count");
+    worker_usage_second.expose_as(prefix, "worker_usage");
+}
+
+TaskControl::WorkerPool::SchedVars*
+TaskControl::WorkerPool::create_exposed_sched_vars() {
+    bool is_creator = false;
+    sched_vars_mutex.lock();
+    SchedVars* v = sched_vars.load(butil::memory_order_consume);
+    if (!v) {
+        v = new SchedVars;
+        sched_vars.store(v, butil::memory_order_release);
+        is_creator = true;
+    }
+    sched_vars_mutex.unlock();
+    if (is_creator) {
+        const std::string prefix = "bthread_worker_pool_" + name;
+        v->sched_latency.expose(prefix, "sched");
+        v->cputime.expose(prefix, "cputime");
+    }
+    return v;
+}
+
+double TaskControl::WorkerPool::get_cumulated_worker_time(void* arg) {
+    WorkerPool* pool = static_cast<WorkerPool*>(arg);
+    int64_t cputime_ns = 0;
+    BAIDU_SCOPED_LOCK(pool->control->_modify_group_mutex);
+    const size_t ngroup = pool->ngroup.load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        if (pool->groups[i]) {
+            cputime_ns += pool->groups[i]->_cumulated_cputime_ns;
+        }
+    }
+    return cputime_ns / 1000000000.0;
+}
+
 TaskControl::TaskControl()
     // NOTE: all fileds must be initialized before the vars.
     : _ngroup(0)
     , _groups((TaskGroup**)calloc(BTHREAD_MAX_CONCURRENCY, sizeof(TaskGroup*)))
+    , _npool(0)
     , _stop(false)
-    , _concurrency(0)
     , _nworkers("bthread_worker_count")
     , _pending_time(NULL)
       // Delay exposure of following two vars because they rely on TC which
@@ -129,15 +242,25 @@ TaskControl::TaskControl()
     , _switch_per_second(&_cumulated_switch_count)
     , _cumulated_signal_count(get_cumulated_signal_count_from_this, this)
     , _signal_per_second(&_cumulated_signal_count)
+    , _cumulated_futex_call_count(get_cumulated_futex_call_count_from_this, this)
+    , _futex_call_per_second(&_cumulated_futex_call_count)
     , _status(print_rq_sizes_in_the_tc, this)
     , _nbthreads("bthread_count")
+    , _nnode(1)
+    , _next_worker_index(0)
 {
     // calloc shall set memory to zero
     CHECK(_groups) << "Fail to create array of groups";
+    memset(_pools, 0, sizeof(_pools));
+    // The default pool always exists, workers are created in init().
+    _pools[BTHREAD_TAG_DEFAULT] = new WorkerPool(this, BTHREAD_TAG_DEFAULT,
+                                                 "default");
+    _npool.store(1, butil::memory_order_release);
 }
 
 int TaskControl::init(int concurrency) {
-    if (_concurrency != 0) {
+    WorkerPool* default_pool = _pools[BTHREAD_TAG_DEFAULT];
+    if (default_pool->concurrency != 0) {
         LOG(ERROR) << "Already initialized";
         return -1;
     }
@@ -145,7 +268,6 @@ int TaskControl::init(int concurrency) {
         LOG(ERROR) << "Invalid concurrency=" << concurrency;
         return -1;
     }
-    _concurrency = concurrency;
 
     // Make sure TimerThread is ready.
     if (get_or_create_global_timer_thread() == NULL) {
@@ -153,60 +275,147 @@ int TaskControl::init(int concurrency) {
         return -1;
     }
     
-    _workers.resize(_concurrency);   
-    for (int i = 0; i < _concurrency; ++i) {
-        const int rc = pthread_create(&_workers[i], NULL, worker_thread, this);
-        if (rc) {
-            LOG(ERROR) << "Fail to create _workers[" << i << "], " << berror(rc);
-            return -1;
+    if (FLAGS_bthread_numa_aware || FLAGS_bthread_pin_workers) {
+        get_numa_nodes(&_numa_nodes);
+        if (FLAGS_bthread_numa_aware) {
+            _nnode = _numa_nodes.size();
+        } else {
+            // Treat all CPUs as one node.
+            for (size_t i = 1; i < _numa_nodes.size(); ++i) {
+                _numa_nodes[0].insert(_numa_nodes[0].end(),
+                                      _numa_nodes[i].begin(),
+                                      _numa_nodes[i].end());
+            }
+            _numa_nodes.resize(1);
         }
+        LOG(INFO) << "Spread workers over " << _nnode << " numa node(s)";
+    }
+
+    if (create_workers(default_pool, concurrency) != concurrency) {
+        LOG(ERROR) << "Fail to create " << concurrency << " workers";
+        return -1;
     }
     _worker_usage_second.expose("bthread_worker_usage");
     _switch_per_second.expose("bthread_switch_second");
     _signal_per_second.expose("bthread_signal_second");
+    _futex_call_per_second.expose("bthread_futex_call_second");
     _status.expose("bthread_group_status");
+    default_pool->expose_vars();
 
     // Wait for at least one group is added so that choose_one_group()
     // never returns NULL.
     // TODO: Handle the case that worker quits before add_group
-    while (_ngroup == 0) {
+    while (default_pool->ngroup == 0) {
         usleep(100);  // TODO: Elaborate
     }
+
+    std::vector<std::string> pools;
+    butil::SplitString(FLAGS_bthread_worker_pools, ',', &pools);
+    for (size_t i = 0; i < pools.size(); ++i) {
+        const size_t pos = pools[i].find(':');
+        int nworker = 0;
+        if (pos == std::string::npos ||
+            !butil::StringToInt(pools[i].substr(pos + 1), &nworker)) {
+            LOG(ERROR) << "Invalid worker pool=`" << pools[i]
+                       << "' in -bthread_worker_pools";
+            return -1;
+        }
+        bthread_tag_t tag = BTHREAD_TAG_INVALID;
+        const int rc = add_pool(pools[i].substr(0, pos), nworker, &tag);
+        if (rc != 0) {
+            LOG(ERROR) << "Fail to create worker pool=`" << pools[i]
+                       << "', " << berror(rc);
+            return -1;
+        }
+    }
     return 0;
 }
 
-int TaskControl::add_workers(int num) {
-    if (num <= 0) {
-        return 0;
-    }
+int TaskControl::create_workers(WorkerPool* pool, int num) {
+    const size_t old_nworker = _workers.size();
     try {
-        _workers.resize(_concurrency + num);
+        _workers.resize(old_nworker + num);
     } catch (...) {
         return 0;
     }
-    const int old_concurency = _concurrency.load(butil::memory_order_relaxed);
-    for (int i = 0; i < num; ++i) {
+    int i = 0;
+    for (; i < num; ++i) {
         // Worker will add itself to _idle_workers, so we have to add
-        // _concurrency before create a worker.
-        _concurrency.fetch_add(1);
+        // concurrency before create a worker.
+        pool->concurrency.fetch_add(1);
         const int rc = pthread_create(
-                &_workers[i + old_concurency], NULL, worker_thread, this);
+                &_workers[old_nworker + i], NULL, worker_thread, pool);
         if (rc) {
-            LOG(WARNING) << "Fail to create _workers[" << i + old_concurency
+            LOG(WARNING) << "Fail to create _workers[" << old_nworker + i
                          << "], " << berror(rc);
-            _concurrency.fetch_sub(1, butil::memory_order_release);
+            pool->concurrency.fetch_sub(1, butil::memory_order_release);
             break;
         }
     }
     // Cannot fail
-    _workers.resize(_concurrency.load(butil::memory_order_relaxed));
-    return _concurrency.load(butil::memory_order_relaxed) - old_concurency;
+    _workers.resize(old_nworker + i);
+    return i;
 }
 
-TaskGroup* TaskControl::choose_one_group() {
-    const size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
+int TaskControl::add_workers(int num, bthread_tag_t tag) {
+    if (num <= 0 || !valid_tag(tag)) {
+        return 0;
+    }
+    return create_workers(_pools[tag], num);
+}
+
+int TaskControl::add_pool(const std::string& name, int nconcurrency,
+                          bthread_tag_t* tag) {
+    if (name.empty() || nconcurrency <= 0 ||
+        nconcurrency > BTHREAD_MAX_CONCURRENCY) {
+        return EINVAL;
+    }
+    if (find_pool(name) != BTHREAD_TAG_INVALID) {
+        return EEXIST;
+    }
+    const int npool = _npool.load(butil::memory_order_relaxed);
+    if (npool >= BTHREAD_MAX_TAGS) {
+        return EAGAIN;
+    }
+    WorkerPool* pool = new (std::nothrow) WorkerPool(this, npool, name);
+    if (pool == NULL) {
+        return ENOMEM;
+    }
+    _pools[npool] = pool;
+    const int nworker = create_workers(pool, nconcurrency);
+    if (nworker == 0) {
+        _pools[npool] = NULL;
+        delete pool;
+        return EAGAIN;
+    }
+    while (pool->ngroup == 0) {
+        usleep(100);
+    }
+    pool->expose_vars();
+    // Publish the pool after it has groups so that choose_one_group() never
+    // returns NULL for valid tags.
+    _npool.store(npool + 1, butil::memory_order_release);
+    *tag = npool;
+    LOG(INFO) << "Created worker pool=" << name << " tag=" << npool
+              << " concurrency=" << nworker;
+    return 0;
+}
+
+bthread_tag_t TaskControl::find_pool(const std::string& name) const {
+    const int npool = _npool.load(butil::memory_order_acquire);
+    for (int i = 0; i < npool; ++i) {
+        if (_pools[i]->name == name) {
+            return i;
+        }
+    }
+    return BTHREAD_TAG_INVALID;
+}
+
+TaskGroup* TaskControl::choose_one_group(bthread_tag_t tag) {
+    WorkerPool* pool = _pools[tag];
+    const size_t ngroup = pool->ngroup.load(butil::memory_order_relaxed);
     if (ngroup != 0) {
-        return _groups[butil::fast_rand_less_than(ngroup)];
+        return pool->groups[butil::fast_rand_less_than(ngroup)];
     }
     CHECK(false) << "Impossible: ngroup is 0";
     return NULL;
@@ -224,9 +433,16 @@ void TaskControl::stop_and_join() {
         BAIDU_SCOPED_LOCK(_modify_group_mutex);
         _stop = true;
         _ngroup.exchange(0, butil::memory_order_relaxed); 
+        for (int i = 0; i < _npool; ++i) {
+            _pools[i]->ngroup.exchange(0, butil::memory_order_relaxed);
+        }
     }
-    for (int i = 0; i < PARKING_LOT_NUM; ++i) {
-        _pl[i].stop();
+    for (int i = 0; i < _npool; ++i) {
+        for (int j = 0; j < _nnode; ++j) {
+            for (int k = 0; k < PARKING_LOT_NUM; ++k) {
+                _pools[i]->pl[j][k].stop();
+            }
+        }
     }
     // Interrupt blocking operations.
     for (size_t i = 0; i < _workers.size(); ++i) {
@@ -245,10 +461,15 @@ TaskControl::~TaskControl() {
     _worker_usage_second.hide();
     _switch_per_second.hide();
     _signal_per_second.hide();
+    _futex_call_per_second.hide();
     _status.hide();
     
     stop_and_join();
 
+    for (int i = 0; i < _npool; ++i) {
+        delete _pools[i];
+        _pools[i] = NULL;
+    }
     free(_groups);
     _groups = NULL;
 }
@@ -266,13 +487,44 @@ int TaskControl::_add_group(TaskGroup* g) {
         _groups[ngroup] = g;
         _ngroup.store(ngroup + 1, butil::memory_order_release);
     }
+    WorkerPool* pool = _pools[g->_tag];
+    ngroup = pool->ngroup.load(butil::memory_order_relaxed);
+    if (ngroup < (size_t)BTHREAD_MAX_CONCURRENCY) {
+        pool->groups[ngroup] = g;
+        pool->ngroup.store(ngroup + 1, butil::memory_order_release);
+    }
     mu.unlock();
-    // See the comments in _destroy_group
+    // See the comments in erase_group
     // TODO: Not needed anymore since non-worker pthread cannot have TaskGroup
-    signal_task(65536);
+    signal_task(65536, g->_tag);
     return 0;
 }
 
+// Remove `g' from `groups'. Called with _modify_group_mutex held.
+static bool erase_group(TaskGroup** groups, butil::atomic<size_t>* ngroup_ptr,
+                        TaskGroup* g) {
+    const size_t ngroup = ngroup_ptr->load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        if (groups[i] == g) {
+            // No need for atomic_thread_fence because lock did it.
+            groups[i] = groups[ngroup - 1];
+            // Change ngroup and keep groups unchanged at last so that:
+            //  - If steal_task sees the newest ngroup, it would not touch
+            //    groups[ngroup -1]
+            //  - If steal_task sees old ngroup and is still iterating on
+            //    groups, it would not miss groups[ngroup - 1] which was 
+            //    swapped to groups[i]. Although adding new group would
+            //    overwrite it, since we do signal_task in _add_group(),
+            //    we think the pending tasks of groups[ngroup - 1] would
+            //    not miss.
+            ngroup_ptr->store(ngroup - 1, butil::memory_order_release);
+            //groups[ngroup - 1] = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
 void TaskControl::delete_task_group(void* arg) {
     delete(TaskGroup*)arg;
 }
@@ -290,26 +542,9 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     bool erased = false;
     {
         BAIDU_SCOPED_LOCK(_modify_group_mutex);
-        const size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
-        for (size_t i = 0; i < ngroup; ++i) {
-            if (_groups[i] == g) {
-                // No need for atomic_thread_fence because lock did it.
-                _groups[i] = _groups[ngroup - 1];
-                // Change _ngroup and keep _groups unchanged at last so that:
-                //  - If steal_task sees the newest _ngroup, it would not touch
-                //    _groups[ngroup -1]
-                //  - If steal_task sees old _ngroup and is still iterating on
-                //    _groups, it would not miss _groups[ngroup - 1] which was 
-                //    swapped to _groups[i]. Although adding new group would
-                //    overwrite it, since we do signal_task in _add_group(),
-                //    we think the pending tasks of _groups[ngroup - 1] would
-                //    not miss.
-                _ngroup.store(ngroup - 1, butil::memory_order_release);
-                //_groups[ngroup - 1] = NULL;
-                erased = true;
-                break;
-            }
-        }
+        WorkerPool* pool = _pools[g->_tag];
+        erased = erase_group(_groups, &_ngroup, g);
+        erase_group(pool->groups, &pool->ngroup, g);
     }
 
     // Can't delete g immediately because for performance consideration,
@@ -325,10 +560,12 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     return 0;
 }
 
-bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
+bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset,
+                             int numa_node, bthread_tag_t tag) {
+    WorkerPool* pool = _pools[tag];
     // 1: Acquiring fence is paired with releasing fence in _add_group to
-    // avoid accessing uninitialized slot of _groups.
-    const size_t ngroup = _ngroup.load(butil::memory_order_acquire/*1*/);
+    // avoid accessing uninitialized slot of groups.
+    const size_t ngroup = pool->ngroup.load(butil::memory_order_acquire/*1*/);
     if (0 == ngroup) {
         return false;
     }
@@ -336,10 +573,28 @@ bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     // NOTE: Don't return inside `for' iteration since we need to update |seed|
     bool stolen = false;
     size_t s = *seed;
+    // Prefer tasks with high priority or deadlines. Checking emptiness of
+    // _prio_rq does not lock.
     for (size_t i = 0; i < ngroup; ++i, s += offset) {
-        TaskGroup* g = _groups[s % ngroup];
-        // g is possibly NULL because of concurrent _destroy_group
-        if (g) {
+        TaskGroup* g = pool->groups[s % ngroup];
+        if (g != NULL && g->_prio_rq.pop(tid)) {
+            stolen = true;
+            break;
+        }
+    }
+    // Stealing from groups on other nodes touches remote memory, do it only
+    // when groups on the same node have nothing to steal.
+    const int npass = (_nnode > 1 ? 2 : 1);
+    for (int pass = 0; pass < npass && !stolen; ++pass) {
+        for (size_t i = 0; i < ngroup; ++i, s += offset) {
+            TaskGroup* g = pool->groups[s % ngroup];
+            // g is possibly NULL because of concurrent _destroy_group
+            if (g == NULL) {
+                continue;
+            }
+            if (npass > 1 && (g->_numa_node == numa_node) != (pass == 0)) {
+                continue;
+            }
             if (g->_rq.steal(tid)) {
                 stolen = true;
                 break;
@@ -354,25 +609,40 @@ bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     return stolen;
 }
 
-void TaskControl::signal_task(int num_task) {
+void TaskControl::signal_task(int num_task, bthread_tag_t tag) {
     if (num_task <= 0) {
         return;
     }
-    // TODO(gejun): Current algorithm does not guarantee enough threads will
-    // be created to match caller's requests. But in another side, there's also
-    // many useless signalings according to current impl. Capping the concurrency
-    // is a good balance between performance and timeliness of scheduling.
-    if (num_task > 2) {
-        num_task = 2;
+    // Spinning workers will find the tasks without signals. Pairs with the
+    // fence in TaskGroup::spin_for_task(): either the spinning worker is
+    // seen here, or it sees the tasks before parking.
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    num_task -= _pools[tag]->nspinning.load(butil::memory_order_relaxed);
+    if (num_task <= 0) {
+        return;
+    }
+    // Signaling lots without waiters costs no futex call, and waiters of a
+    // lot are woken up by one call, so a burst of tasks wakes up as many
+    // parked workers as possible with a few calls.
+    // Wake up workers on the same node first so that the task is likely to
+    // be run by a worker sharing caches with the signaling thread.
+    int node = 0;
+    if (_nnode > 1) {
+        TaskGroup* g = tls_task_group;
+        node = (g ? g->_numa_node : butil::fmix64(pthread_self()) % _nnode);
     }
     int start_index = butil::fmix64(pthread_self()) % PARKING_LOT_NUM;
-    num_task -= _pl[start_index].signal(1);
-    if (num_task > 0) {
-        for (int i = 1; i < PARKING_LOT_NUM && num_task > 0; ++i) {
+    for (int i = 0; i < _nnode && num_task > 0; ++i) {
+        ParkingLot* pl = _pools[tag]->pl[node];
+        num_task -= pl[start_index].signal(num_task);
+        for (int j = 1; j < PARKING_LOT_NUM && num_task > 0; ++j) {
             if (++start_index >= PARKING_LOT_NUM) {
                 start_index = 0;
             }
-            num_task -= _pl[start_index].signal(1);
+            num_task -= pl[start_index].signal(num_task);
+        }
+        if (++node >= _nnode) {
+            node = 0;
         }
     }
 }
@@ -417,6 +687,19 @@ int64_t TaskControl::get_cumulated_switch_count() {
     return c;
 }
 
+int64_t TaskControl::get_cumulated_futex_call_count() {
+    int64_t c = 0;
+    const int npool = _npool.load(butil::memory_order_acquire);
+    for (int i = 0; i < npool; ++i) {
+        for (int j = 0; j < _nnode; ++j) {
+            for (int k = 0; k < PARKING_LOT_NUM; ++k) {
+                c += _pools[i]->pl[j][k].futex_call_count();
+            }
+        }
+    }
+    return c;
+}
+
 int64_t TaskControl::get_cumulated_signal_count() {
     int64_t c = 0;
     BAIDU_SCOPED_LOCK(_modify_group_mutex);
@@ -23,12 +23,14 @@
 #include <iostream>                             // std::ostream
 #endif
 #include <stddef.h>                             // size_t
+#include <string>
 #include "butil/atomicops.h"                     // butil::atomic
 #include "bvar/bvar.h"                          // bvar::PassiveStatus
 #include "bthread/task_meta.h"                  // TaskMeta
 #include "butil/resource_pool.h"                 // ResourcePool
 #include "bthread/work_stealing_queue.h"        // WorkStealingQueue
 #include "bthread/parking_lot.h"
+#include "bthread/numa.h"                   // MAX_NUMA_NODES
 
 namespace bthread {
 
@@ -42,40 +44,104 @@ public:
     TaskControl();
     ~TaskControl();
 
-    // Must be called before using. `nconcurrency' is # of worker pthreads.
+    // Must be called before using. `nconcurrency' is # of worker pthreads
+    // in the default pool. Pools in -bthread_worker_pools are created as well.
     int init(int nconcurrency);
-    
-    // Create a TaskGroup in this control.
-    TaskGroup* create_group();
 
-    // Steal a task from a "random" group.
-    bool steal_task(bthread_t* tid, size_t* seed, size_t offset);
+    // [Not thread safe] Create a pool of `nconcurrency' workers named `name'
+    // and put its tag into `tag'.
+    // Returns 0 on success, error code otherwise.
+    int add_pool(const std::string& name, int nconcurrency,
+                 bthread_tag_t* tag);
+
+    // Tag of the pool named `name', BTHREAD_TAG_INVALID if not found.
+    bthread_tag_t find_pool(const std::string& name) const;
+
+    // True iff `tag' is a tag of created pools.
+    bool valid_tag(bthread_tag_t tag) const {
+        return tag >= 0 && tag < _npool.load(butil::memory_order_acquire);
+    }
+
+    // Create a TaskGroup in pool `tag' of this control. Workers of the
+    // group run on NUMA node `numa_node'.
+    TaskGroup* create_group(int numa_node,
+                            bthread_tag_t tag = BTHREAD_TAG_DEFAULT);
+
+    // Steal a task from a "random" group of pool `tag'. If workers are
+    // NUMA-aware, groups on `numa_node' are tried before others.
+    bool steal_task(bthread_t* tid, size_t* seed, size_t offset,
+                    int numa_node, bthread_tag_t tag = BTHREAD_TAG_DEFAULT);
 
-    // Tell other groups that `n' tasks was just added to caller's runqueue
-    void signal_task(int num_task);
+    // Tell other groups of pool `tag' that `n' tasks was just added to
+    // caller's runqueue
+    void signal_task(int num_task, bthread_tag_t tag = BTHREAD_TAG_DEFAULT);
 
     // Stop and join worker threads in TaskControl.
     void stop_and_join();
     
-    // Get # of worker threads.
-    int concurrency() const 
-    { return _concurrency.load(butil::memory_order_acquire); }
+    // Get # of worker threads in pool `tag'.
+    int concurrency(bthread_tag_t tag = BTHREAD_TAG_DEFAULT) const
+    { return _pools[tag]->concurrency.load(butil::memory_order_acquire); }
 
     void print_rq_sizes(std::ostream& os);
 
     double get_cumulated_worker_time();
     int64_t get_cumulated_switch_count();
     int64_t get_cumulated_signal_count();
+    // futex calls of parking and waking up workers.
+    int64_t get_cumulated_futex_call_count();
 
-    // [Not thread safe] Add more worker threads.
+    // [Not thread safe] Add more worker threads to pool `tag'.
     // Return the number of workers actually added, which may be less then |num|
-    int add_workers(int num);
+    int add_workers(int num, bthread_tag_t tag = BTHREAD_TAG_DEFAULT);
 
-    // Choose one TaskGroup (randomly right now).
-    // If this method is called after init(), it never returns NULL.
-    TaskGroup* choose_one_group();
+    // Choose one TaskGroup of pool `tag' (randomly right now).
+    // If this method is called after init() or add_pool() of the pool, it
+    // never returns NULL.
+    TaskGroup* choose_one_group(bthread_tag_t tag = BTHREAD_TAG_DEFAULT);
 
 private:
+    static const int PARKING_LOT_NUM = 4;
+
+    // Workers of a pool only run bthreads of the pool: they steal tasks from
+    // groups of the pool and are signaled by groups of the pool.
+    struct WorkerPool {
+        // Recorded when -show_bthread_sched_latency_in_vars is on.
+        struct SchedVars {
+            // Microseconds from being ready to running of bthreads.
+            bvar::LatencyRecorder sched_latency;
+            // Microseconds of cputime of finished bthreads.
+            bvar::LatencyRecorder cputime;
+        };
+
+        WorkerPool(TaskControl* c, bthread_tag_t tag, const std::string& name);
+        ~WorkerPool();
+        // Expose vars prefixed with "bthread_worker_pool_<name>_".
+        void expose_vars();
+        static double get_cumulated_worker_time(void* pool);
+        // SchedVars are created and exposed at the first call.
+        SchedVars& exposed_sched_vars();
+        SchedVars* create_exposed_sched_vars();
+
+        TaskControl* control;
+        bthread_tag_t tag;
+        std::string name;
+        butil::atomic<int> concurrency;
+        butil::atomic<size_t> ngroup;
+        TaskGroup** groups;
+        // Idle workers park in lots of their nodes.
+        ParkingLot pl[MAX_NUMA_NODES][PARKING_LOT_NUM];
+
+        bvar::Adder<int64_t> nworkers;
+        bvar::Adder<int64_t> nbthreads;
+        bvar::PassiveStatus<double> cumulated_worker_time;
+        bvar::PerSecond<bvar::PassiveStatus<double> > worker_usage_second;
+        butil::Mutex sched_vars_mutex;
+        butil::atomic<SchedVars*> sched_vars;
+        // Workers stealing tasks before parking, they don't need signals.
+        butil::atomic<int> nspinning;
+    };
+
     // Add/Remove a TaskGroup.
     // Returns 0 on success, -1 otherwise.
     int _add_group(TaskGroup*);
@@ -83,17 +149,28 @@ private:
 
     static void delete_task_group(void* arg);
 
-    static void* worker_thread(void* task_control);
+    static void* worker_thread(void* worker_pool);
+
+    // Bind calling worker to CPUs according to -bthread_numa_aware and
+    // -bthread_pin_workers. Returns the NUMA node of the worker.
+    int bind_worker(int worker_index);
+
+    // Create `num' workers in `pool', returns # of created ones.
+    int create_workers(WorkerPool* pool, int num);
 
     bvar::LatencyRecorder& exposed_pending_time();
     bvar::LatencyRecorder* create_exposed_pending_time();
 
+    // All groups of all pools.
     butil::atomic<size_t> _ngroup;
     TaskGroup** _groups;
     butil::Mutex _modify_group_mutex;
 
+    // Pools are never removed until TaskControl is destroyed.
+    WorkerPool* _pools[BTHREAD_MAX_TAGS];
+    butil::atomic<int> _npool;
+
     bool _stop;
-    butil::atomic<int> _concurrency;
     std::vector<pthread_t> _workers;
 
     bvar::Adder<int64_t> _nworkers;
@@ -105,13 +182,28 @@ private:
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _switch_per_second;
     bvar::PassiveStatus<int64_t> _cumulated_signal_count;
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _signal_per_second;
+    bvar::PassiveStatus<int64_t> _cumulated_futex_call_count;
+    bvar::PerSecond<bvar::PassiveStatus<int64_t> > _futex_call_per_second;
     bvar::PassiveStatus<std::string> _status;
     bvar::Adder<int64_t> _nbthreads;
 
-    static const int PARKING_LOT_NUM = 4;
-    ParkingLot _pl[PARKING_LOT_NUM];
+    // CPUs of NUMA nodes, loaded in init() when workers need to be bound.
+    std::vector<std::vector<int> > _numa_nodes;
+    // Number of nodes that workers are spread over, 1 when workers are not
+    // NUMA-aware.
+    int _nnode;
+    butil::atomic<int> _next_worker_index;
 };
 
+inline TaskControl::WorkerPool::SchedVars&
+TaskControl::WorkerPool::exposed_sched_vars() {
+    SchedVars* v = sched_vars.load(butil::memory_order_consume);
+    if (!v) {
+        v = create_exposed_sched_vars();
+    }
+    return *v;
+}
+
 inline bvar::LatencyRecorder& TaskControl::exposed_pending_time() {
     bvar::LatencyRecorder* pt = _pending_time.load(butil::memory_order_consume);
     if (!pt) {
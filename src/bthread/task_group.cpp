@@ -18,6 +18,8 @@
 
 #include <sys/types.h>
 #include <stddef.h>                         // size_t
+#include <unistd.h>                         // sysconf
+#include <algorithm>                        // std::min
 #include <gflags/gflags.h>
 #include "butil/macros.h"                    // ARRAY_SIZE
 #include "butil/scoped_lock.h"               // BAIDU_SCOPED_LOCK
@@ -33,10 +35,13 @@
 #include "bthread/timer_thread.h"
 #include "bthread/errno.h"
 
+DECLARE_int32(task_group_yield_before_idle);
+
 namespace bthread {
 
 static const bthread_attr_t BTHREAD_ATTR_TASKGROUP = {
-    BTHREAD_STACKTYPE_UNKNOWN, 0, NULL };
+    BTHREAD_STACKTYPE_UNKNOWN, 0, NULL, BTHREAD_TAG_INVALID,
+    BTHREAD_PRIORITY_NORMAL, 0 };
 
 static bool pass_bool(const char*, bool) { return true; }
 
@@ -47,12 +52,31 @@ const bool ALLOW_UNUSED dummy_show_bthread_creation_in_vars =
     ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_show_bthread_creation_in_vars,
                                     pass_bool);
 
+DEFINE_bool(show_bthread_sched_latency_in_vars, false, "When this flag is on, "
+            "the time from a bthread being ready to running and the cputime "
+            "of finished bthreads will be recorded and shown in /vars/"
+            "bthread_worker_pool_<name>_{sched,cputime}_*");
+const bool ALLOW_UNUSED dummy_show_bthread_sched_latency_in_vars =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_show_bthread_sched_latency_in_vars,
+                                    pass_bool);
+
 DEFINE_bool(show_per_worker_usage_in_vars, false,
             "Show per-worker usage in /vars/bthread_per_worker_usage_<tid>");
 const bool ALLOW_UNUSED dummy_show_per_worker_usage_in_vars =
     ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_show_per_worker_usage_in_vars,
                                     pass_bool);
 
+DEFINE_int32(bthread_max_spin_before_park, 64,
+             "Idle workers try stealing tasks for at most so many rounds "
+             "before parking. Actual rounds grow when spinning finds tasks or "
+             "parked workers are woken up soon, and shrink when parked "
+             "workers are woken up late. "
+             "0 disables spinning");
+
+DEFINE_int32(bthread_priority_starvation_limit, 16,
+             "A worker runs a normal bthread after running so many bthreads "
+             "with high priority or deadlines in a row");
+
 __thread TaskGroup* tls_task_group = NULL;
 __thread LocalStorage tls_bls = BTHREAD_LOCAL_STORAGE_INITIALIZER;
 
@@ -108,13 +132,76 @@ bool TaskGroup::is_stopped(bthread_t tid) {
     return true;
 }
 
+// Parking shorter than this means that tasks come frequently enough to be
+// caught by spinning.
+static const int64_t SHORT_PARK_NS = 50000;
+
+// Spinning on a single CPU only delays the threads producing tasks.
+static const bool g_can_spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1);
+
+bool TaskGroup::spin_for_task(bthread_t* tid) {
+    const int max_spin = (g_can_spin ? FLAGS_bthread_max_spin_before_park : 0);
+    if (_nspin > max_spin) {
+        _nspin = max_spin;
+    }
+    if (_nspin <= 0 && FLAGS_task_group_yield_before_idle <= 0) {
+        return false;
+    }
+    butil::atomic<int>& nspinning = _control->_pools[_tag]->nspinning;
+    nspinning.fetch_add(1, butil::memory_order_relaxed);
+    bool found = false;
+    for (int i = 0; i < _nspin; ++i) {
+        for (int j = 0; j < 16; ++j) {
+            cpu_relax();
+        }
+        if (steal_task(tid)) {
+            _nspin = std::min(_nspin * 2 + 1, max_spin);
+            found = true;
+            break;
+        }
+    }
+    for (int i = 0; !found && i < FLAGS_task_group_yield_before_idle; ++i) {
+        sched_yield();
+        found = steal_task(tid);
+    }
+    const bool last_spinning =
+        (nspinning.fetch_sub(1, butil::memory_order_relaxed) == 1);
+    if (found) {
+        // signal_task() may have skipped a signal for this worker while
+        // the task it found was another one, let a parked worker check.
+        if (last_spinning) {
+            _control->signal_task(1, _tag);
+        }
+        return true;
+    }
+    // Tasks pushed before the signalers saw this worker spinning were
+    // not signaled, check again after leaving spinning.
+    butil::atomic_thread_fence(butil::memory_order_seq_cst);
+    return steal_task(tid);
+}
+
+void TaskGroup::park(const ParkingLot::State& st) {
+    const int64_t begin_ns = butil::cpuwide_time_ns();
+    _pl->wait(st);
+    // Spin longer next time if a task came soon, shorter otherwise.
+    if (butil::cpuwide_time_ns() - begin_ns < SHORT_PARK_NS) {
+        _nspin = std::min(_nspin * 2 + 1,
+                          (int)FLAGS_bthread_max_spin_before_park);
+    } else {
+        _nspin /= 2;
+    }
+}
+
 bool TaskGroup::wait_task(bthread_t* tid) {
+    if (spin_for_task(tid)) {
+        return true;
+    }
     do {
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
         if (_last_pl_state.stopped()) {
             return -1;
         }
-        _pl->wait(_last_pl_state);
+        park(_last_pl_state);
         if (steal_task(tid)) {
             return true;
         }
@@ -126,7 +213,7 @@ bool TaskGroup::wait_task(bthread_t* tid) {
         if (steal_task(tid)) {
             return true;
         }
-        _pl->wait(st);
+        park(st);
 #endif
     } while (true);
 }
@@ -162,7 +249,7 @@ void TaskGroup::run_main_task() {
     current_task()->stat.cputime_ns += butil::cpuwide_time_ns() - _last_run_ns;
 }
 
-TaskGroup::TaskGroup(TaskControl* c)
+TaskGroup::TaskGroup(TaskControl* c, int numa_node, bthread_tag_t tag)
     :
 #ifndef NDEBUG
     _sched_recursive_guard(0),
@@ -177,14 +264,19 @@ TaskGroup::TaskGroup(TaskControl* c)
     , _last_context_remained(NULL)
     , _last_context_remained_arg(NULL)
     , _pl(NULL) 
+    , _numa_node(numa_node)
+    , _tag(tag)
     , _main_stack(NULL)
     , _main_tid(0)
+    , _nprio_in_row(0)
+    , _nspin(0)
     , _remote_num_nosignal(0)
     , _remote_nsignaled(0)
 {
     _steal_seed = butil::fast_rand();
     _steal_offset = OFFSET_TABLE[_steal_seed % ARRAY_SIZE(OFFSET_TABLE)];
-    _pl = &c->_pl[butil::fmix64(pthread_self()) % TaskControl::PARKING_LOT_NUM];
+    _pl = &c->_pools[tag]->pl[numa_node][butil::fmix64(pthread_self())
+                                         % TaskControl::PARKING_LOT_NUM];
     CHECK(c);
 }
 
@@ -207,6 +299,10 @@ int TaskGroup::init(size_t runqueue_capacity) {
         LOG(FATAL) << "Fail to init _remote_rq";
         return -1;
     }
+    if (_prio_rq.init(64) != 0) {
+        LOG(FATAL) << "Fail to init _prio_rq";
+        return -1;
+    }
     ContextualStack* stk = get_stack(STACK_TYPE_MAIN, NULL);
     if (NULL == stk) {
         LOG(FATAL) << "Fail to get main stack container";
@@ -233,6 +329,7 @@ int TaskGroup::init(size_t runqueue_capacity) {
     m->local_storage = tls_bls;
     m->cpuwide_start_ns = butil::cpuwide_time_ns();
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->attr = BTHREAD_ATTR_TASKGROUP;
     m->tid = make_tid(*m->version_butex, slot);
     m->set_stack(stk);
@@ -296,6 +393,14 @@ void TaskGroup::task_runner(intptr_t skip_remained) {
         // Group is probably changed
         g = tls_task_group;
 
+        if (FLAGS_show_bthread_sched_latency_in_vars) {
+            // Add the elapse since last switch which is not counted yet.
+            const int64_t cputime_ns = m->stat.cputime_ns +
+                butil::cpuwide_time_ns() - g->_last_run_ns;
+            g->_control->_pools[g->_tag]->exposed_sched_vars().cputime
+                << cputime_ns / 1000L;
+        }
+
         // TODO: Save thread_return
         (void)thread_return;
 
@@ -331,6 +436,7 @@ void TaskGroup::task_runner(intptr_t skip_remained) {
         butex_wake_except(m->version_butex, 0);
 
         g->_control->_nbthreads << -1;
+        g->_control->_pools[g->_tag]->nbthreads << -1;
         g->set_remained(TaskGroup::_release_last_context, m);
         ending_sched(&g);
         
@@ -374,9 +480,11 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     m->arg = arg;
     CHECK(m->stack == NULL);
     m->attr = using_attr;
+    m->attr.tag = (*pg)->_tag;
     m->local_storage = LOCAL_STORAGE_INIT;
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
@@ -385,9 +493,11 @@ int TaskGroup::start_foreground(TaskGroup** pg,
 
     TaskGroup* g = *pg;
     g->_control->_nbthreads << 1;
+    g->_control->_pools[g->_tag]->nbthreads << 1;
     if (g->is_current_pthread_task()) {
         // never create foreground task in pthread.
-        g->ready_to_run(m->tid, (using_attr.flags & BTHREAD_NOSIGNAL));
+        g->ready_to_run(m->tid, (using_attr.flags & BTHREAD_NOSIGNAL),
+                        is_prioritized(m));
     } else {
         // NOSIGNAL affects current task, not the new task.
         RemainedFn fn = NULL;
@@ -398,7 +508,8 @@ int TaskGroup::start_foreground(TaskGroup** pg,
         }
         ReadyToRunArgs args = {
             g->current_tid(),
-            (bool)(using_attr.flags & BTHREAD_NOSIGNAL)
+            (bool)(using_attr.flags & BTHREAD_NOSIGNAL),
+            is_prioritized(g->current_task())
         };
         g->set_remained(fn, &args);
         TaskGroup::sched_to(pg, m->tid);
@@ -429,19 +540,24 @@ int TaskGroup::start_background(bthread_t* __restrict th,
     m->arg = arg;
     CHECK(m->stack == NULL);
     m->attr = using_attr;
+    m->attr.tag = _tag;
     m->local_storage = LOCAL_STORAGE_INIT;
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
         LOG(INFO) << "Started bthread " << m->tid;
     }
     _control->_nbthreads << 1;
+    _control->_pools[_tag]->nbthreads << 1;
     if (REMOTE) {
-        ready_to_run_remote(m->tid, (using_attr.flags & BTHREAD_NOSIGNAL));
+        ready_to_run_remote(m->tid, (using_attr.flags & BTHREAD_NOSIGNAL),
+                            is_prioritized(m));
     } else {
-        ready_to_run(m->tid, (using_attr.flags & BTHREAD_NOSIGNAL));
+        ready_to_run(m->tid, (using_attr.flags & BTHREAD_NOSIGNAL),
+                     is_prioritized(m));
     }
     return 0;
 }
@@ -500,19 +616,44 @@ TaskStatistics TaskGroup::main_stat() const {
     return m ? m->stat : EMPTY_STAT;
 }
 
-void TaskGroup::ending_sched(TaskGroup** pg) {
-    TaskGroup* g = *pg;
-    bthread_t next_tid = 0;
-    // Find next task to run, if none, switch to idle thread of the group.
+bool TaskGroup::pop_task(bthread_t* tid) {
+    // Prioritized tasks go first, unless too many of them ran in a row.
+    bool starved = false;
+    if (!_prio_rq.empty()) {
+        if (_nprio_in_row < FLAGS_bthread_priority_starvation_limit) {
+            if (_prio_rq.pop(tid)) {
+                ++_nprio_in_row;
+                return true;
+            }
+        } else {
+            starved = true;
+        }
+    }
+    _nprio_in_row = 0;
 #ifndef BTHREAD_FAIR_WSQ
     // When BTHREAD_FAIR_WSQ is defined, profiling shows that cpu cost of
     // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
     // to 2.9%
-    const bool popped = g->_rq.pop(&next_tid);
+    if (_rq.pop(tid)) {
+        return true;
+    }
 #else
-    const bool popped = g->_rq.steal(&next_tid);
+    if (_rq.steal(tid)) {
+        return true;
+    }
 #endif
-    if (!popped && !g->steal_task(&next_tid)) {
+    // steal_task() prefers prioritized tasks to remote ones.
+    if (starved && _remote_rq.pop(tid)) {
+        return true;
+    }
+    return steal_task(tid);
+}
+
+void TaskGroup::ending_sched(TaskGroup** pg) {
+    TaskGroup* g = *pg;
+    bthread_t next_tid = 0;
+    // Find next task to run, if none, switch to idle thread of the group.
+    if (!g->pop_task(&next_tid)) {
         // Jump to main task if there's no task to run.
         next_tid = g->_main_tid;
     }
@@ -545,12 +686,7 @@ void TaskGroup::sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
     bthread_t next_tid = 0;
     // Find next task to run, if none, switch to idle thread of the group.
-#ifndef BTHREAD_FAIR_WSQ
-    const bool popped = g->_rq.pop(&next_tid);
-#else
-    const bool popped = g->_rq.steal(&next_tid);
-#endif
-    if (!popped && !g->steal_task(&next_tid)) {
+    if (!g->pop_task(&next_tid)) {
         // Jump to main task if there's no task to run.
         next_tid = g->_main_tid;
     }
@@ -579,6 +715,12 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
     }
     ++cur_meta->stat.nswitch;
     ++ g->_nswitch;
+    if (FLAGS_show_bthread_sched_latency_in_vars && next_meta->ready_ns) {
+        // Time spent in runqueues, the main task is never queued.
+        g->_control->_pools[g->_tag]->exposed_sched_vars().sched_latency
+            << (now - next_meta->ready_ns) / 1000L;
+        next_meta->ready_ns = 0;
+    }
     // Switch to the task
     if (__builtin_expect(next_meta != cur_meta, 1)) {
         g->_cur_meta = next_meta;
@@ -637,15 +779,15 @@ void TaskGroup::destroy_self() {
     }
 }
 
-void TaskGroup::ready_to_run(bthread_t tid, bool nosignal) {
-    push_rq(tid);
+void TaskGroup::ready_to_run(bthread_t tid, bool nosignal, bool prioritized) {
+    push_rq(tid, prioritized);
     if (nosignal) {
         ++_num_nosignal;
     } else {
         const int additional_signal = _num_nosignal;
         _num_nosignal = 0;
         _nsignaled += 1 + additional_signal;
-        _control->signal_task(1 + additional_signal);
+        _control->signal_task(1 + additional_signal, _tag);
     }
 }
 
@@ -654,18 +796,27 @@ void TaskGroup::flush_nosignal_tasks() {
     if (val) {
         _num_nosignal = 0;
         _nsignaled += val;
-        _control->signal_task(val);
+        _control->signal_task(val, _tag);
     }
 }
 
-void TaskGroup::ready_to_run_remote(bthread_t tid, bool nosignal) {
+void TaskGroup::ready_to_run_remote(bthread_t tid, bool nosignal,
+                                    bool prioritized) {
+    if (FLAGS_show_bthread_sched_latency_in_vars) {
+        address_meta(tid)->ready_ns = butil::cpuwide_time_ns();
+    }
     _remote_rq._mutex.lock();
-    while (!_remote_rq.push_locked(tid)) {
-        flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
-        LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
-                                << _remote_rq.capacity();
-        ::usleep(1000);
-        _remote_rq._mutex.lock();
+    if (prioritized) {
+        // _prio_rq is not bounded.
+        _prio_rq.push(tid, address_meta(tid)->attr.deadline_us);
+    } else {
+        while (!_remote_rq.push_locked(tid)) {
+            flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+            LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
+                                    << _remote_rq.capacity();
+            ::usleep(1000);
+            _remote_rq._mutex.lock();
+        }
     }
     if (nosignal) {
         ++_remote_num_nosignal;
@@ -675,7 +826,7 @@ void TaskGroup::ready_to_run_remote(bthread_t tid, bool nosignal) {
         _remote_num_nosignal = 0;
         _remote_nsignaled += 1 + additional_signal;
         _remote_rq._mutex.unlock();
-        _control->signal_task(1 + additional_signal);
+        _control->signal_task(1 + additional_signal, _tag);
     }
 }
 
@@ -688,14 +839,15 @@ void TaskGroup::flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex) {
     _remote_num_nosignal = 0;
     _remote_nsignaled += val;
     locked_mutex.unlock();
-    _control->signal_task(val);
+    _control->signal_task(val, _tag);
 }
 
-void TaskGroup::ready_to_run_general(bthread_t tid, bool nosignal) {
+void TaskGroup::ready_to_run_general(bthread_t tid, bool nosignal,
+                                     bool prioritized) {
     if (tls_task_group == this) {
-        return ready_to_run(tid, nosignal);
+        return ready_to_run(tid, nosignal, prioritized);
     }
-    return ready_to_run_remote(tid, nosignal);
+    return ready_to_run_remote(tid, nosignal, prioritized);
 }
 
 void TaskGroup::flush_nosignal_tasks_general() {
@@ -707,12 +859,13 @@ void TaskGroup::flush_nosignal_tasks_general() {
 
 void TaskGroup::ready_to_run_in_worker(void* args_in) {
     ReadyToRunArgs* args = static_cast<ReadyToRunArgs*>(args_in);
-    return tls_task_group->ready_to_run(args->tid, args->nosignal);
+    return tls_task_group->ready_to_run(args->tid, args->nosignal,
+                                        args->prioritized);
 }
 
 void TaskGroup::ready_to_run_in_worker_ignoresignal(void* args_in) {
     ReadyToRunArgs* args = static_cast<ReadyToRunArgs*>(args_in);
-    return tls_task_group->push_rq(args->tid);
+    return tls_task_group->push_rq(args->tid, args->prioritized);
 }
 
 struct SleepArgs {
@@ -725,7 +878,8 @@ struct SleepArgs {
 static void ready_to_run_from_timer_thread(void* arg) {
     CHECK(tls_task_group == NULL);
     const SleepArgs* e = static_cast<const SleepArgs*>(arg);
-    e->group->control()->choose_one_group()->ready_to_run_remote(e->tid);
+    e->group->control()->choose_one_group(e->group->tag())
+        ->ready_to_run_remote(e->tid, false, is_prioritized(e->meta));
 }
 
 void TaskGroup::_add_sleep_event(void* void_args) {
@@ -742,7 +896,7 @@ void TaskGroup::_add_sleep_event(void* void_args) {
 
     if (!sleep_id) {
         // fail to schedule timer, go back to previous thread.
-        g->ready_to_run(e.tid);
+        g->ready_to_run(e.tid, false, is_prioritized(e.meta));
         return;
     }
     
@@ -766,7 +920,7 @@ void TaskGroup::_add_sleep_event(void* void_args) {
         // schedule previous thread as well. If sleep_id does not exist,
         // previous thread is scheduled by timer thread before and we don't
         // have to do it again.
-        g->ready_to_run(e.tid);
+        g->ready_to_run(e.tid, false, is_prioritized(e.meta));
     }
 }
 
@@ -862,13 +1016,16 @@ int TaskGroup::interrupt(bthread_t tid, TaskControl* c) {
     } else if (sleep_id != 0) {
         if (get_global_timer_thread()->unschedule(sleep_id) == 0) {
             bthread::TaskGroup* g = bthread::tls_task_group;
-            if (g) {
-                g->ready_to_run(tid);
+            const TaskMeta* m = address_meta(tid);
+            const bthread_tag_t tag = m->attr.tag;
+            if (g && g->tag() == tag) {
+                g->ready_to_run(tid, false, is_prioritized(m));
             } else {
                 if (!c) {
                     return EINVAL;
                 }
-                c->choose_one_group()->ready_to_run_remote(tid);
+                c->choose_one_group(tag)->ready_to_run_remote(
+                    tid, false, is_prioritized(m));
             }
         }
     }
@@ -877,11 +1034,46 @@ int TaskGroup::interrupt(bthread_t tid, TaskControl* c) {
 
 void TaskGroup::yield(TaskGroup** pg) {
     TaskGroup* g = *pg;
-    ReadyToRunArgs args = { g->current_tid(), false };
+    ReadyToRunArgs args = { g->current_tid(), false,
+                            is_prioritized(g->current_task()) };
     g->set_remained(ready_to_run_in_worker, &args);
     sched(pg);
 }
 
+struct SwitchPoolArgs {
+    bthread_t tid;
+    bool prioritized;
+    TaskGroup* target;
+};
+
+static void ready_to_run_in_pool(void* arg) {
+    const SwitchPoolArgs* args = static_cast<const SwitchPoolArgs*>(arg);
+    args->target->ready_to_run_remote(args->tid, false, args->prioritized);
+}
+
+int TaskGroup::switch_pool(TaskGroup** pg, bthread_tag_t tag) {
+    TaskGroup* g = *pg;
+    if (g->_tag == tag) {
+        return 0;
+    }
+    if (!g->_control->valid_tag(tag)) {
+        return EINVAL;
+    }
+    if (g->is_current_pthread_task()) {
+        return EPERM;
+    }
+    TaskMeta* m = g->current_task();
+    g->_control->_pools[g->_tag]->nbthreads << -1;
+    g->_control->_pools[tag]->nbthreads << 1;
+    // Wakeups of this bthread go to the new pool from now on.
+    m->attr.tag = tag;
+    SwitchPoolArgs args = { m->tid, is_prioritized(m),
+                            g->_control->choose_one_group(tag) };
+    g->set_remained(ready_to_run_in_pool, &args);
+    sched(pg);
+    return 0;
+}
+
 void print_task(std::ostream& os, bthread_t tid) {
     TaskMeta* const m = TaskGroup::address_meta(tid);
     if (m == NULL) {
@@ -924,7 +1116,8 @@ void print_task(std::ostream& os, bthread_t tid) {
            << "\narg=" << (void*)arg
            << "\nattr={stack_type=" << attr.stack_type
            << " flags=" << attr.flags
-           << " keytable_pool=" << attr.keytable_pool 
+           << " keytable_pool=" << attr.keytable_pool
+           << " tag=" << attr.tag
            << "}\nhas_tls=" << has_tls
            << "\nuptime_ns=" << butil::cpuwide_time_ns() - cpuwide_start_ns
            << "\ncputime_ns=" << stat.cputime_ns
@@ -19,11 +19,13 @@
 #ifndef BTHREAD_TASK_GROUP_H
 #define BTHREAD_TASK_GROUP_H
 
+#include <gflags/gflags.h>                          // DECLARE_bool
 #include "butil/time.h"                             // cpuwide_time_ns
 #include "bthread/task_control.h"
 #include "bthread/task_meta.h"                     // bthread_t, TaskMeta
 #include "bthread/work_stealing_queue.h"           // WorkStealingQueue
 #include "bthread/remote_task_queue.h"             // RemoteTaskQueue
+#include "bthread/priority_task_queue.h"           // PriorityTaskQueue
 #include "butil/resource_pool.h"                    // ResourceId
 #include "bthread/parking_lot.h"
 
@@ -102,6 +104,11 @@ public:
     // is undefined.
     static void yield(TaskGroup** pg);
 
+    // Suspend caller and resume it in a worker of pool `tag'.
+    // Returns 0 on success, EINVAL if the pool does not exist, EPERM if
+    // the caller is in pthread-mode.
+    static int switch_pool(TaskGroup** pg, bthread_tag_t tag);
+
     // Suspend caller until bthread `tid' terminates.
     static int join(bthread_t tid, void** return_value);
 
@@ -143,24 +150,31 @@ public:
     // Active time in nanoseconds spent by this TaskGroup.
     int64_t cumulated_cputime_ns() const { return _cumulated_cputime_ns; }
 
-    // Push a bthread into the runqueue
-    void ready_to_run(bthread_t tid, bool nosignal = false);
+    // Push a bthread into the runqueue. Pass is_prioritized() of the meta of
+    // the bthread as `prioritized', the meta is not looked up otherwise.
+    void ready_to_run(bthread_t tid, bool nosignal = false,
+                      bool prioritized = false);
     // Flush tasks pushed to rq but signalled.
     void flush_nosignal_tasks();
 
     // Push a bthread into the runqueue from another non-worker thread.
-    void ready_to_run_remote(bthread_t tid, bool nosignal = false);
+    void ready_to_run_remote(bthread_t tid, bool nosignal = false,
+                             bool prioritized = false);
     void flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex);
     void flush_nosignal_tasks_remote();
 
     // Automatically decide the caller is remote or local, and call
     // the corresponding function.
-    void ready_to_run_general(bthread_t tid, bool nosignal = false);
+    void ready_to_run_general(bthread_t tid, bool nosignal = false,
+                              bool prioritized = false);
     void flush_nosignal_tasks_general();
 
     // The TaskControl that this TaskGroup belongs to.
     TaskControl* control() const { return _control; }
 
+    // Tag of the worker pool that this TaskGroup belongs to.
+    bthread_tag_t tag() const { return _tag; }
+
     // Call this instead of delete.
     void destroy_self();
 
@@ -172,14 +186,15 @@ public:
     static TaskMeta* address_meta(bthread_t tid);
 
     // Push a task into _rq, if _rq is full, retry after some time. This
-    // process make go on indefinitely.
-    void push_rq(bthread_t tid);
+    // process make go on indefinitely. Prioritized tasks are pushed into
+    // _prio_rq instead.
+    void push_rq(bthread_t tid, bool prioritized = false);
 
 private:
 friend class TaskControl;
 
     // You shall use TaskControl::create_group to create new instance.
-    explicit TaskGroup(TaskControl*);
+    TaskGroup(TaskControl*, int numa_node, bthread_tag_t tag);
 
     int init(size_t runqueue_capacity);
 
@@ -195,6 +210,7 @@ friend class TaskControl;
     struct ReadyToRunArgs {
         bthread_t tid;
         bool nosignal;
+        bool prioritized;
     };
     static void ready_to_run_in_worker(void*);
     static void ready_to_run_in_worker_ignoresignal(void*);
@@ -203,15 +219,25 @@ friend class TaskControl;
     // Returns true on success, false is treated as permanent error and the
     // loop calling this function should end.
     bool wait_task(bthread_t* tid);
+    // Try stealing tasks for a while before parking.
+    bool spin_for_task(bthread_t* tid);
+    void park(const ParkingLot::State& st);
+
+    // Pop the next task to run from local runqueues, or steal one.
+    bool pop_task(bthread_t* tid);
 
     bool steal_task(bthread_t* tid) {
+        if (_prio_rq.pop(tid)) {
+            return true;
+        }
         if (_remote_rq.pop(tid)) {
             return true;
         }
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
         _last_pl_state = _pl->get_state();
 #endif
-        return _control->steal_task(tid, &_steal_seed, _steal_offset);
+        return _control->steal_task(tid, &_steal_seed, _steal_offset,
+                                    _numa_node, _tag);
     }
 
 #ifndef NDEBUG
@@ -238,10 +264,19 @@ friend class TaskControl;
 #endif
     size_t _steal_seed;
     size_t _steal_offset;
+    // NUMA node that the worker running this group is bound to.
+    int _numa_node;
+    bthread_tag_t _tag;
     ContextualStack* _main_stack;
     bthread_t _main_tid;
     WorkStealingQueue<bthread_t> _rq;
     RemoteTaskQueue _remote_rq;
+    PriorityTaskQueue _prio_rq;
+    // Number of tasks popped from _prio_rq in a row.
+    int _nprio_in_row;
+    // Rounds of spinning before parking, adapted to recent successes of
+    // spinning and durations of parking.
+    int _nspin;
     int _remote_num_nosignal;
     int _remote_nsignaled;
 };
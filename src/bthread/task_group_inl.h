@@ -21,6 +21,8 @@
 
 namespace bthread {
 
+DECLARE_bool(show_bthread_sched_latency_in_vars);
+
 // Utilities to manipulate bthread_t
 inline bthread_t make_tid(uint32_t version, butil::ResourceId<TaskMeta> slot) {
     return (((bthread_t)version) << 32) | (bthread_t)slot.value;
@@ -43,12 +45,19 @@ inline TaskMeta* TaskGroup::address_meta(bthread_t tid) {
     return address_resource(get_slot(tid));
 }
 
+inline bool is_prioritized(const TaskMeta* m) {
+    return m->attr.priority != BTHREAD_PRIORITY_NORMAL ||
+        m->attr.deadline_us != 0;
+}
+
 inline void TaskGroup::exchange(TaskGroup** pg, bthread_t next_tid) {
     TaskGroup* g = *pg;
     if (g->is_current_pthread_task()) {
-        return g->ready_to_run(next_tid);
+        return g->ready_to_run(next_tid, false,
+                               is_prioritized(address_meta(next_tid)));
     }
-    ReadyToRunArgs args = { g->current_tid(), false };
+    ReadyToRunArgs args = { g->current_tid(), false,
+                            is_prioritized(g->current_task()) };
     g->set_remained((g->current_task()->about_to_quit
                      ? ready_to_run_in_worker_ignoresignal
                      : ready_to_run_in_worker),
@@ -75,7 +84,13 @@ inline void TaskGroup::sched_to(TaskGroup** pg, bthread_t next_tid) {
     sched_to(pg, next_meta);
 }
 
-inline void TaskGroup::push_rq(bthread_t tid) {
+inline void TaskGroup::push_rq(bthread_t tid, bool prioritized) {
+    if (FLAGS_show_bthread_sched_latency_in_vars) {
+        address_meta(tid)->ready_ns = butil::cpuwide_time_ns();
+    }
+    if (prioritized) {
+        return _prio_rq.push(tid, address_meta(tid)->attr.deadline_us);
+    }
     while (!_rq.push(tid)) {
         // Created too many bthreads: a promising approach is to insert the
         // task into another TaskGroup, but we don't use it because:
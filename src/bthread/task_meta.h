@@ -82,6 +82,9 @@ struct TaskMeta {
     // Statistics
     int64_t cpuwide_start_ns;
     TaskStatistics stat;
+    // When the thread was pushed into a runqueue, reset to 0 when it runs.
+    // Only set when -show_bthread_sched_latency_in_vars is on.
+    int64_t ready_ns;
 
     // bthread local storage.
     LocalStorage local_storage;
@@ -15,6 +15,8 @@
 
 // Author: Ge,Jun (gejun@baidu.com)
 
+#include <string.h>                        // memset
+#include <algorithm>                       // std::min
 #include <queue>                           // heap functions
 #include "butil/scoped_lock.h"
 #include "butil/logging.h"
@@ -33,7 +35,8 @@ void run_worker_startfn();
 const TimerThread::TaskId TimerThread::INVALID_TASK_ID = 0;
 
 TimerThreadOptions::TimerThreadOptions()
-    : num_buckets(13) {
+    : num_buckets(13)
+    , use_timing_wheel(true) {
 }
 
 // A task contains the necessary information for running fn(arg).
@@ -113,6 +116,139 @@ inline bool task_greater(const TimerThread::Task* a, const TimerThread::Task* b)
     return a->run_time > b->run_time;
 }
 
+// A hierarchical timing wheel (as the classic timers of linux kernel) for
+// storing tasks in the timer thread. Time is divided into ticks, a task is
+// linked into a slot of level-0 if it's due in 256 ticks, or a slot of
+// higher levels covering 256x longer time, which is cascaded into lower
+// levels when the time comes. Tasks of a tick are handed to the heap when
+// the tick begins so that they still run at accurate time.
+// Not thread-safe, only used in the timer thread.
+class TimingWheel {
+public:
+    typedef TimerThread::Task Task;
+    static const int SLOT_BITS = 8;
+    static const int64_t NSLOT = (1 << SLOT_BITS);
+    static const int64_t SLOT_MASK = NSLOT - 1;
+    static const int NLEVEL = 4;
+    static const int64_t TICK_US = 1000;
+
+    explicit TimingWheel(int64_t now_us)
+        : _cur_tick(now_us / TICK_US), _size(0) {
+        memset(_slots, 0, sizeof(_slots));
+        memset(_bitmap, 0, sizeof(_bitmap));
+    }
+
+    // Link `task' into a slot. Returns false if the task is due in ticks
+    // that were already passed to advance().
+    bool add(Task* task) {
+        int64_t tick = task->run_time / TICK_US;
+        if (tick < _cur_tick) {
+            return false;
+        }
+        const int64_t diff = tick - _cur_tick;
+        int level = 0;
+        if (diff >= (1L << (SLOT_BITS * NLEVEL))) {
+            // Too far, re-added when the last level is cascaded.
+            tick = _cur_tick + (1L << (SLOT_BITS * NLEVEL)) - 1;
+            level = NLEVEL - 1;
+        } else {
+            while (diff >= (1L << (SLOT_BITS * (level + 1)))) {
+                ++level;
+            }
+        }
+        const int64_t index = (tick >> (SLOT_BITS * level)) & SLOT_MASK;
+        task->next = _slots[level][index];
+        _slots[level][index] = task;
+        if (level == 0) {
+            _bitmap[index / 64] |= (1UL << (index % 64));
+        }
+        ++_size;
+        return true;
+    }
+
+    // Move tasks due before the end of the tick containing `now_us' into
+    // `due'.
+    void advance(int64_t now_us, std::vector<Task*>* due) {
+        const int64_t now_tick = now_us / TICK_US;
+        while (_cur_tick <= now_tick) {
+            if (_size == 0) {
+                _cur_tick = now_tick + 1;
+                return;
+            }
+            const int64_t index = _cur_tick & SLOT_MASK;
+            if (index == 0) {
+                for (int level = 1; level < NLEVEL && cascade(level); ++level) {}
+            }
+            const int64_t next = next_nonempty_slot(index);
+            if (next != index) {
+                // Skip empty slots, stop at the tick to cascade.
+                _cur_tick = std::min(_cur_tick + (next - index), now_tick + 1);
+                continue;
+            }
+            for (Task* p = _slots[0][index]; p != NULL; p = p->next) {
+                due->push_back(p);
+                --_size;
+            }
+            _slots[0][index] = NULL;
+            _bitmap[index / 64] &= ~(1UL << (index % 64));
+            ++_cur_tick;
+        }
+    }
+
+    // Realtime at which advance() should be called again.
+    int64_t next_advance_time() const {
+        if (_size == 0) {
+            return std::numeric_limits<int64_t>::max();
+        }
+        const int64_t index = _cur_tick & SLOT_MASK;
+        if (index == 0) {
+            // Higher levels are not cascaded into this round yet.
+            return _cur_tick * TICK_US;
+        }
+        return (_cur_tick + next_nonempty_slot(index) - index) * TICK_US;
+    }
+
+    size_t size() const { return _size; }
+
+private:
+    // Re-add tasks of current slot of `level' into lower levels.
+    // Returns true if the slot is the first one so that the higher level
+    // should be cascaded as well.
+    bool cascade(int level) {
+        const int64_t index = (_cur_tick >> (SLOT_BITS * level)) & SLOT_MASK;
+        Task* p = _slots[level][index];
+        _slots[level][index] = NULL;
+        while (p != NULL) {
+            Task* const saved_next = p->next;
+            --_size;
+            CHECK(add(p));
+            p = saved_next;
+        }
+        return index == 0;
+    }
+
+    // Index of the first non-empty slot of level-0 at or after `index',
+    // NSLOT if there's none.
+    int64_t next_nonempty_slot(int64_t index) const {
+        int64_t i = index / 64;
+        uint64_t word = _bitmap[i] & (~0UL << (index % 64));
+        while (word == 0) {
+            if (++i == NSLOT / 64) {
+                return NSLOT;
+            }
+            word = _bitmap[i];
+        }
+        return i * 64 + __builtin_ctzl(word);
+    }
+
+    Task* _slots[NLEVEL][NSLOT];
+    // Bits of non-empty slots of level-0.
+    uint64_t _bitmap[NSLOT / 64];
+    // Ticks before this one were all passed to advance().
+    int64_t _cur_tick;
+    size_t _size;
+};
+
 void* TimerThread::run_this(void* arg) {
     static_cast<TimerThread*>(arg)->run();
     return NULL;
@@ -319,6 +455,13 @@ void TimerThread::run() {
     // min heap of tasks (ordered by run_time)
     std::vector<Task*> tasks;
     tasks.reserve(4096);
+    // Tasks not due yet if timing wheel is enabled.
+    TimingWheel* wheel = NULL;
+    std::vector<Task*> due_tasks;
+    if (_options.use_timing_wheel) {
+        wheel = new TimingWheel(last_sleep_time);
+        due_tasks.reserve(4096);
+    }
 
     // vars
     size_t nscheduled = 0;
@@ -348,13 +491,30 @@ void TimerThread::run() {
         // Pull tasks from buckets.
         for (size_t i = 0; i < _options.num_buckets; ++i) {
             Bucket& bucket = _buckets[i];
-            for (Task* p = bucket.consume_tasks(); p != NULL;
-                 p = p->next, ++nscheduled) {
-                if (!p->try_delete()) { // remove the task if it's unscheduled
+            Task* p = bucket.consume_tasks();
+            while (p != NULL) {
+                // p->next is reused by the wheel.
+                Task* const saved_next = p->next;
+                ++nscheduled;
+                // remove the task if it's unscheduled
+                if (!p->try_delete() && (wheel == NULL || !wheel->add(p))) {
+                    tasks.push_back(p);
+                    std::push_heap(tasks.begin(), tasks.end(), task_greater);
+                }
+                p = saved_next;
+            }
+        }
+        if (wheel) {
+            // Sort tasks of the current tick with the heap.
+            wheel->advance(butil::gettimeofday_us(), &due_tasks);
+            for (size_t i = 0; i < due_tasks.size(); ++i) {
+                Task* p = due_tasks[i];
+                if (!p->try_delete()) {
                     tasks.push_back(p);
                     std::push_heap(tasks.begin(), tasks.end(), task_greater);
                 }
             }
+            due_tasks.clear();
         }
 
         bool pull_again = false;
@@ -404,6 +564,9 @@ void TimerThread::run() {
         } else {
             next_run_time = tasks[0]->run_time;
         }
+        if (wheel) {
+            next_run_time = std::min(next_run_time, wheel->next_advance_time());
+        }
         // Similarly with the situation before running tasks, we check
         // _nearest_run_time to prevent us from waiting on a non-earliest
         // task. We also use the _nsignal to make sure that if new task 
@@ -423,6 +586,10 @@ void TimerThread::run() {
         timespec* ptimeout = NULL;
         timespec next_timeout = { 0, 0 };
         const int64_t now = butil::gettimeofday_us();
+        if (next_run_time <= now) {
+            // Time passed during running tasks.
+            continue;
+        }
         if (next_run_time != std::numeric_limits<int64_t>::max()) {
             next_timeout = butil::microseconds_to_timespec(next_run_time - now);
             ptimeout = &next_timeout;
@@ -431,6 +598,7 @@ void TimerThread::run() {
         futex_wait_private(&_nsignals, expected_nsignals, ptimeout);
         last_sleep_time = butil::gettimeofday_us();
     }
+    delete wheel;
     BT_VLOG << "Ended TimerThread=" << pthread_self();
 }
 
@@ -40,6 +40,13 @@ struct TimerThreadOptions {
     // Default: ""
     std::string bvar_prefix;
 
+    // Put tasks which are not due in the current millisecond into a
+    // hierarchical timing wheel rather than a heap, making the cost of a
+    // task O(1) inside the timer thread. Tasks unscheduled before they're
+    // due (most RPC timeouts) are never sorted.
+    // Default: true
+    bool use_timing_wheel;
+
     // Constructed with default options.
     TimerThreadOptions();
 };
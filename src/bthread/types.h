@@ -43,6 +43,25 @@ static const bthread_attrflags_t BTHREAD_LOG_START_AND_FINISH = 8;
 static const bthread_attrflags_t BTHREAD_LOG_CONTEXT_SWITCH = 16;
 static const bthread_attrflags_t BTHREAD_NOSIGNAL = 32;
 
+// Identifier of a pool of worker pthreads. bthreads of a pool only run in
+// workers of the pool, which isolates them from bthreads of other pools.
+typedef int bthread_tag_t;
+// The pool created with -bthread_concurrency workers.
+static const bthread_tag_t BTHREAD_TAG_DEFAULT = 0;
+// Used in bthread_attr_t: the bthread runs in the pool of the creator, or the
+// default pool if the creator is not a bthread.
+static const bthread_tag_t BTHREAD_TAG_INVALID = -1;
+// Max number of worker pools, including the default one.
+static const int BTHREAD_MAX_TAGS = 16;
+
+// Workers run bthreads with high priority or a deadline before normal ones,
+// earliest deadline first. To keep normal bthreads progressing, a worker
+// runs one normal bthread after -bthread_priority_starvation_limit
+// consecutive prioritized ones.
+typedef int bthread_priority_t;
+static const bthread_priority_t BTHREAD_PRIORITY_NORMAL = 0;
+static const bthread_priority_t BTHREAD_PRIORITY_HIGH = 1;
+
 // Key of thread-local data, created by bthread_key_create.
 typedef struct {
     uint32_t index;    // index in KeyTable
@@ -88,12 +107,20 @@ typedef struct bthread_attr_t {
     bthread_stacktype_t stack_type;
     bthread_attrflags_t flags;
     bthread_keytable_pool_t* keytable_pool;
+    bthread_tag_t tag;
+    bthread_priority_t priority;
+    // Absolute time in microseconds (as butil::gettimeofday_us()) before
+    // which the bthread should run, 0 means no deadline.
+    int64_t deadline_us;
 
 #if defined(__cplusplus)
     void operator=(unsigned stacktype_and_flags) {
         stack_type = (stacktype_and_flags & 7);
         flags = (stacktype_and_flags & ~(unsigned)7u);
         keytable_pool = NULL;
+        tag = BTHREAD_TAG_INVALID;
+        priority = BTHREAD_PRIORITY_NORMAL;
+        deadline_us = 0;
     }
     bthread_attr_t operator|(unsigned other_flags) const {
         CHECK(!(other_flags & 7)) << "flags=" << other_flags;
@@ -111,23 +138,30 @@ typedef struct bthread_attr_t {
 // obvious drawback is that you need more worker pthreads when you have a lot
 // of such bthreads.
 static const bthread_attr_t BTHREAD_ATTR_PTHREAD =
-{ BTHREAD_STACKTYPE_PTHREAD, 0, NULL };
+{ BTHREAD_STACKTYPE_PTHREAD, 0, NULL, BTHREAD_TAG_INVALID,
+  BTHREAD_PRIORITY_NORMAL, 0 };
 
 // bthreads created with following attributes will have different size of
 // stacks. Default is BTHREAD_ATTR_NORMAL.
 static const bthread_attr_t BTHREAD_ATTR_SMALL =
-{ BTHREAD_STACKTYPE_SMALL, 0, NULL };
+{ BTHREAD_STACKTYPE_SMALL, 0, NULL, BTHREAD_TAG_INVALID,
+  BTHREAD_PRIORITY_NORMAL, 0 };
 static const bthread_attr_t BTHREAD_ATTR_NORMAL =
-{ BTHREAD_STACKTYPE_NORMAL, 0, NULL };
+{ BTHREAD_STACKTYPE_NORMAL, 0, NULL, BTHREAD_TAG_INVALID,
+  BTHREAD_PRIORITY_NORMAL, 0 };
 static const bthread_attr_t BTHREAD_ATTR_LARGE =
-{ BTHREAD_STACKTYPE_LARGE, 0, NULL };
+{ BTHREAD_STACKTYPE_LARGE, 0, NULL, BTHREAD_TAG_INVALID,
+  BTHREAD_PRIORITY_NORMAL, 0 };
 
 // bthreads created with this attribute will print log when it's started,
 // context-switched, finished.
 static const bthread_attr_t BTHREAD_ATTR_DEBUG = {
     BTHREAD_STACKTYPE_NORMAL,
     BTHREAD_LOG_START_AND_FINISH | BTHREAD_LOG_CONTEXT_SWITCH,
-    NULL
+    NULL,
+    BTHREAD_TAG_INVALID,
+    BTHREAD_PRIORITY_NORMAL,
+    0
 };
 
 static const size_t BTHREAD_EPOLL_THREAD_NUM = 1;
@@ -170,6 +204,9 @@ typedef struct {
 } bthread_condattr_t;
 
 typedef struct {
+    unsigned* lock_butex;
+    unsigned* writer_butex;
+    bthread_contention_site_t writer_csite;
 } bthread_rwlock_t;
 
 typedef struct {
@@ -177,11 +214,16 @@ typedef struct {
 
 typedef struct {
     unsigned int count;
+    unsigned* butex;
 } bthread_barrier_t;
 
 typedef struct {
 } bthread_barrierattr_t;
 
+typedef struct {
+    unsigned* butex;
+} bthread_sem_t;
+
 typedef struct {
     uint64_t value;
 } bthread_id_t;
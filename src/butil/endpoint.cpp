@@ -17,12 +17,19 @@
 
 #include <arpa/inet.h>                         // inet_pton, inet_ntop
 #include <netdb.h>                             // gethostbyname_r
+#include <sys/un.h>                            // sockaddr_un
+#include <sys/stat.h>                          // lstat
+#include <stddef.h>                            // offsetof
+#include <pthread.h>
+#include <map>
 #include <unistd.h>                            // gethostname
 #include <errno.h>                             // errno
 #include <string.h>                            // strcpy
 #include <stdio.h>                             // snprintf
 #include <stdlib.h>                            // strtol
 #include "butil/fd_guard.h"                    // fd_guard
+#include "butil/atomicops.h"                   // butil::static_atomic
+#include "butil/scoped_lock.h"                 // BAIDU_SCOPED_LOCK
 #include "butil/endpoint.h"                    // ip_t
 #include "butil/logging.h"
 #include "butil/memory/singleton_on_pthread_once.h"
@@ -88,8 +95,132 @@ int ip2hostname(ip_t ip, std::string* host) {
     return -1;
 }
 
+// Ports of unix domain sockets start from this value.
+static const int UNIX_PORT_BASE = 65536;
+static const size_t UNIX_PATH_MAX_LEN = sizeof(((sockaddr_un*)0)->sun_path) - 1;
+
+static pthread_mutex_t s_unix_path_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, int>* s_unix_path_map = NULL;
+// Entries before s_nunix_path are immutable and readable without locking.
+static const char* s_unix_paths[MAX_UNIX_SOCKET_PATHS];
+static butil::static_atomic<int> s_nunix_path = BUTIL_STATIC_ATOMIC_INIT(0);
+
+int unix_path2endpoint(const char* path, EndPoint* point) {
+    if (path == NULL || strlen(path) > UNIX_PATH_MAX_LEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    int index = 0;
+    {
+        BAIDU_SCOPED_LOCK(s_unix_path_mutex);
+        if (s_unix_path_map == NULL) {
+            s_unix_path_map = new std::map<std::string, int>;
+        }
+        std::map<std::string, int>::const_iterator it =
+            s_unix_path_map->find(path);
+        if (it != s_unix_path_map->end()) {
+            index = it->second;
+        } else {
+            index = s_nunix_path.load(butil::memory_order_relaxed);
+            if (index >= MAX_UNIX_SOCKET_PATHS) {
+                LOG(ERROR) << "Too many paths of unix domain sockets";
+                errno = ENOSPC;
+                return -1;
+            }
+            s_unix_paths[index] = strdup(path);
+            (*s_unix_path_map)[path] = index;
+            s_nunix_path.store(index + 1, butil::memory_order_release);
+        }
+    }
+    point->ip = IP_NONE;
+    point->port = UNIX_PORT_BASE + index;
+    return 0;
+}
+
+const char* endpoint2unix_path(const EndPoint& point) {
+    if (!is_unix_endpoint(point)) {
+        return NULL;
+    }
+    const int index = point.port - UNIX_PORT_BASE;
+    if (index >= s_nunix_path.load(butil::memory_order_acquire)) {
+        return NULL;
+    }
+    return s_unix_paths[index];
+}
+
+int endpoint2sockaddr(const EndPoint& point, sockaddr_storage* ss,
+                      socklen_t* len) {
+    bzero((char*)ss, sizeof(*ss));
+    if (is_unix_endpoint(point)) {
+        const char* path = endpoint2unix_path(point);
+        if (path == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        sockaddr_un* un = (sockaddr_un*)ss;
+        un->sun_family = AF_UNIX;
+        const size_t n = strlen(path);
+        memcpy(un->sun_path, path, n);
+        if (path[0] == '@') {
+            // Abstract namespace, not terminated by '\0'.
+            un->sun_path[0] = '\0';
+            *len = offsetof(sockaddr_un, sun_path) + n;
+        } else {
+            *len = offsetof(sockaddr_un, sun_path) + n + 1;
+        }
+        return 0;
+    }
+    sockaddr_in* in = (sockaddr_in*)ss;
+    in->sin_family = AF_INET;
+    in->sin_addr = point.ip;
+    in->sin_port = htons(point.port);
+    *len = sizeof(*in);
+    return 0;
+}
+
+int sockaddr2endpoint(const sockaddr_storage* ss, socklen_t len,
+                      EndPoint* point) {
+    if (ss->ss_family == AF_INET) {
+        *point = EndPoint(*(const sockaddr_in*)ss);
+        return 0;
+    }
+    if (ss->ss_family == AF_UNIX) {
+        const sockaddr_un* un = (const sockaddr_un*)ss;
+        const size_t offset = offsetof(sockaddr_un, sun_path);
+        size_t n = ((size_t)len > offset ? len - offset : 0);
+        if (n > sizeof(un->sun_path)) {
+            n = sizeof(un->sun_path);
+        }
+        // Unnamed sockets(e.g. the client side) have empty paths.
+        char path[sizeof(un->sun_path) + 1];
+        memcpy(path, un->sun_path, n);
+        path[n] = '\0';
+        if (n > 0 && path[0] == '\0') {
+            path[0] = '@';
+        }
+        // Don't intern paths unknown to this process, which are mostly
+        // bound by peers(e.g. autobind names) and would fill the table
+        // quickly on a server, treat them as unnamed instead.
+        {
+            BAIDU_SCOPED_LOCK(s_unix_path_mutex);
+            if (s_unix_path_map == NULL ||
+                s_unix_path_map->find(path) == s_unix_path_map->end()) {
+                path[0] = '\0';
+            }
+        }
+        return unix_path2endpoint(path, point);
+    }
+    errno = EAFNOSUPPORT;
+    return -1;
+}
+
 EndPointStr endpoint2str(const EndPoint& point) {
     EndPointStr str;
+    if (is_unix_endpoint(point)) {
+        const char* path = endpoint2unix_path(point);
+        snprintf(str._buf, sizeof(str._buf), "unix:%s", (path ? path : ""));
+        return str;
+    }
     if (inet_ntop(AF_INET, &point.ip, str._buf, INET_ADDRSTRLEN) == NULL) {
         return endpoint2str(EndPoint(IP_NONE, 0));
     }
@@ -153,6 +284,9 @@ const char* my_hostname() {
 }
 
 int str2endpoint(const char* str, EndPoint* point) {
+    if (strncmp(str, "unix:", 5) == 0) {
+        return (str[5] != '\0' ? unix_path2endpoint(str + 5, point) : -1);
+    }
     // Should be enough to hold ip address
     char buf[64];
     size_t i = 0;
@@ -195,6 +329,9 @@ int str2endpoint(const char* ip_str, int port, EndPoint* point) {
 }
 
 int hostname2endpoint(const char* str, EndPoint* point) {
+    if (strncmp(str, "unix:", 5) == 0) {
+        return (str[5] != '\0' ? unix_path2endpoint(str + 5, point) : -1);
+    }
     // Should be enough to hold ip address
     char buf[64];
     size_t i = 0;
@@ -240,6 +377,14 @@ int hostname2endpoint(const char* name_str, int port, EndPoint* point) {
 }
 
 int endpoint2hostname(const EndPoint& point, char* host, size_t host_len) {
+    if (is_unix_endpoint(point)) {
+        if (host == NULL || host_len == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        snprintf(host, host_len, "%s", endpoint2str(point).c_str());
+        return 0;
+    }
     if (ip2hostname(point.ip, host, host_len) == 0) {
         size_t len = strlen(host);
         if (len + 1 < host_len) {
@@ -260,26 +405,26 @@ int endpoint2hostname(const EndPoint& point, std::string* host) {
 }
 
 int tcp_connect(EndPoint point, int* self_port) {
-    fd_guard sockfd(socket(AF_INET, SOCK_STREAM, 0));
+    struct sockaddr_storage serv_addr;
+    socklen_t serv_addr_len = 0;
+    if (endpoint2sockaddr(point, &serv_addr, &serv_addr_len) != 0) {
+        return -1;
+    }
+    fd_guard sockfd(socket(serv_addr.ss_family, SOCK_STREAM, 0));
     if (sockfd < 0) {
         return -1;
     }
-    struct sockaddr_in serv_addr;
-    bzero((char*)&serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr = point.ip;
-    serv_addr.sin_port = htons(point.port);
     int rc = 0;
     if (bthread_connect != NULL) {
         rc = bthread_connect(sockfd, (struct sockaddr*)&serv_addr,
-                             sizeof(serv_addr));
+                             serv_addr_len);
     } else {
-        rc = ::connect(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
+        rc = ::connect(sockfd, (struct sockaddr*)&serv_addr, serv_addr_len);
     }
     if (rc < 0) {
         return -1;
     }
-    if (self_port != NULL) {
+    if (self_port != NULL && serv_addr.ss_family == AF_INET) {
         EndPoint pt;
         if (get_local_side(sockfd, &pt) == 0) {
             *self_port = pt.port;
@@ -291,23 +436,64 @@ int tcp_connect(EndPoint point, int* self_port) {
 }
 
 int tcp_listen(EndPoint point, bool reuse_addr) {
-    fd_guard sockfd(socket(AF_INET, SOCK_STREAM, 0));
+    return tcp_listen(point, reuse_addr, false);
+}
+
+int tcp_listen(EndPoint point, bool reuse_addr, bool reuse_port) {
+    struct sockaddr_storage serv_addr;
+    socklen_t serv_addr_len = 0;
+    if (endpoint2sockaddr(point, &serv_addr, &serv_addr_len) != 0) {
+        return -1;
+    }
+    if (serv_addr.ss_family == AF_UNIX) {
+        if (reuse_port) {
+            // Connections are not distributed between unix domain sockets
+            // listening to the same path.
+            errno = ENOPROTOOPT;
+            return -1;
+        }
+        const char* path = ((sockaddr_un*)&serv_addr)->sun_path;
+        struct stat st;
+        if (reuse_addr && path[0] != '\0' &&
+            lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            // Remove the socket file left by last run, otherwise bind fails
+            // with EADDRINUSE. Don't steal the path from a running server.
+            fd_guard probe_fd(socket(AF_UNIX, SOCK_STREAM, 0));
+            if (probe_fd < 0) {
+                return -1;
+            }
+            if (connect(probe_fd, (struct sockaddr*)&serv_addr,
+                        serv_addr_len) == 0 || errno != ECONNREFUSED) {
+                errno = EADDRINUSE;
+                return -1;
+            }
+            unlink(path);
+        }
+    }
+    fd_guard sockfd(socket(serv_addr.ss_family, SOCK_STREAM, 0));
     if (sockfd < 0) {
         return -1;
     }
-    if (reuse_addr) {
+    if (reuse_addr && serv_addr.ss_family == AF_INET) {
         const int on = 1;
         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR,
                        &on, sizeof(on)) != 0) {
             return -1;
         }
     }
-    struct sockaddr_in serv_addr;
-    bzero((char*)&serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr = point.ip;
-    serv_addr.sin_port = htons(point.port); 
-    if (bind(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) != 0) {
+    if (reuse_port) {
+#if defined(SO_REUSEPORT)
+        const int on = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT,
+                       &on, sizeof(on)) != 0) {
+            return -1;
+        }
+#else
+        errno = ENOPROTOOPT;
+        return -1;
+#endif
+    }
+    if (bind(sockfd, (struct sockaddr*)&serv_addr, serv_addr_len) != 0) {
         return -1;
     }
     if (listen(sockfd, INT_MAX) != 0) {
@@ -319,27 +505,27 @@ int tcp_listen(EndPoint point, bool reuse_addr) {
 }
 
 int get_local_side(int fd, EndPoint *out) {
-    struct sockaddr addr;
+    struct sockaddr_storage addr;
     socklen_t socklen = sizeof(addr);
-    const int rc = getsockname(fd, &addr, &socklen);
+    const int rc = getsockname(fd, (struct sockaddr*)&addr, &socklen);
     if (rc != 0) {
         return rc;
     }
     if (out) {
-        *out = butil::EndPoint(*(sockaddr_in*)&addr);
+        return sockaddr2endpoint(&addr, socklen, out);
     }
     return 0;
 }
 
 int get_remote_side(int fd, EndPoint *out) {
-    struct sockaddr addr;
+    struct sockaddr_storage addr;
     socklen_t socklen = sizeof(addr);
-    const int rc = getpeername(fd, &addr, &socklen);
+    const int rc = getpeername(fd, (struct sockaddr*)&addr, &socklen);
     if (rc != 0) {
         return rc;
     }
     if (out) {
-        *out = butil::EndPoint(*(sockaddr_in*)&addr);
+        return sockaddr2endpoint(&addr, socklen, out);
     }
     return 0;
 }
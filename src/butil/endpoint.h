@@ -21,6 +21,7 @@
 #define BUTIL_ENDPOINT_H
 
 #include <netinet/in.h>                          // in_addr
+#include <sys/socket.h>                          // sockaddr_storage
 #include <iostream>                              // std::ostream
 #include "butil/containers/hash_tables.h"         // hashing functions
 
@@ -90,7 +91,8 @@ struct EndPoint {
 
 struct EndPointStr {
     const char* c_str() const { return _buf; }
-    char _buf[INET_ADDRSTRLEN + 16];
+    // Large enough for "unix:" + path of an unix domain socket.
+    char _buf[128];
 };
 
 // Convert EndPoint to c-style string. Notice that you can serialize 
@@ -100,11 +102,13 @@ struct EndPointStr {
 EndPointStr endpoint2str(const EndPoint&);
 
 // Convert string `ip_and_port_str' to a EndPoint *point.
+// "unix:<path>" is converted to the endpoint of an unix domain socket.
 // Returns 0 on success, -1 otherwise.
 int str2endpoint(const char* ip_and_port_str, EndPoint* point);
 int str2endpoint(const char* ip_str, int port, EndPoint* point);
 
 // Convert `hostname_and_port_str' to a EndPoint *point.
+// "unix:<path>" is converted to the endpoint of an unix domain socket.
 // Returns 0 on success, -1 otherwise.
 int hostname2endpoint(const char* ip_and_port_str, EndPoint* point);
 int hostname2endpoint(const char* name_str, int port, EndPoint* point);
@@ -114,16 +118,60 @@ int hostname2endpoint(const char* name_str, int port, EndPoint* point);
 int endpoint2hostname(const EndPoint& point, char* hostname, size_t hostname_len);
 int endpoint2hostname(const EndPoint& point, std::string* host);
 
+// An unix domain socket is addressed by an EndPoint with IP_NONE and a port
+// larger than 65535, which indexes the path in a process-wide table. Paths
+// are never removed from the table, at most MAX_UNIX_SOCKET_PATHS different
+// paths can be used in a process.
+static const int MAX_UNIX_SOCKET_PATHS = 4096;
+
+// Convert `path' of an unix domain socket to EndPoint *point. A path
+// starting with '@' is in the abstract namespace(linux).
+// Returns 0 on success, -1 otherwise(the path is too long or the table
+// is full).
+int unix_path2endpoint(const char* path, EndPoint* point);
+
+// Path of the unix domain socket, NULL if `point' is not an unix domain
+// socket.
+const char* endpoint2unix_path(const EndPoint& point);
+
+inline bool is_unix_endpoint(const EndPoint& point) {
+    return ip2int(point.ip) == INADDR_NONE && point.port > 65535;
+}
+
+// Convert `point' to sockaddr_in or sockaddr_un stored in *ss, and write
+// length of the address into *len.
+// Returns 0 on success, -1 otherwise.
+int endpoint2sockaddr(const EndPoint& point, sockaddr_storage* ss,
+                      socklen_t* len);
+
+// Convert AF_INET or AF_UNIX address `ss' with `len' bytes to *point.
+// A path of an unix domain socket not converted by unix_path2endpoint()
+// before is converted to the unnamed endpoint("unix:") rather than being
+// added to the table, so that peers binding different paths don't use up
+// the table.
+// Returns 0 on success, -1 otherwise.
+int sockaddr2endpoint(const sockaddr_storage* ss, socklen_t len,
+                      EndPoint* point);
+
 // Create a TCP socket and connect it to `server'. Write port of this side
-// into `self_port' if it's not NULL.
+// into `self_port' if it's not NULL. If `server' is an unix domain socket,
+// an unix domain socket is created and `self_port' is untouched.
 // Returns the socket descriptor, -1 otherwise and errno is set.
 int tcp_connect(EndPoint server, int* self_port);
 
 // Create and listen to a TCP socket bound with `ip_and_port'. If `reuse_addr'
 // is true, ports in TIME_WAIT will be bound as well.
+// If `ip_and_port' is an unix domain socket, an unix domain socket is
+// created and `reuse_addr' removes the socket file left at the path unless
+// someone is still listening to it(errno is EADDRINUSE).
 // Returns the socket descriptor, -1 otherwise and errno is set.
 int tcp_listen(EndPoint ip_and_port, bool reuse_addr);
 
+// Same as above. Additionally if `reuse_port' is true, SO_REUSEPORT is set
+// so that multiple sockets can listen to the same port and the kernel
+// distributes incoming connections between them.
+int tcp_listen(EndPoint ip_and_port, bool reuse_addr, bool reuse_port);
+
 // Get the local end of a socket connection
 int get_local_side(int fd, EndPoint *out);
 
@@ -182,6 +230,10 @@ inline bool operator!=(EndPoint p1, EndPoint p2) {
 }
 
 inline std::ostream& operator<<(std::ostream& os, const EndPoint& ep) {
+    if (is_unix_endpoint(ep)) {
+        const char* path = endpoint2unix_path(ep);
+        return os << "unix:" << (path ? path : "");
+    }
     return os << ep.ip << ':' << ep.port;
 }
 inline std::ostream& operator<<(std::ostream& os, const EndPointStr& ep_str) {
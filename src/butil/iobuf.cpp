@@ -224,9 +224,18 @@ size_t IOBuf::new_bigview_count() {
     return iobuf::g_newbigview.load(butil::memory_order_relaxed);
 }
 
+// Stored right after the header of a Block referencing user data, where
+// the payload of other blocks begins.
+struct UserDataExtension {
+    char* data;
+    void (*deleter)(void*);
+};
+
 struct IOBuf::Block {
     butil::atomic<int> nshared;
     uint16_t size;
+    // Zero iff the block references user data(see append_user_data), which
+    // is always full() and never appended.
     uint16_t cap;
     Block* portal_next;
     char data[0];
@@ -239,6 +248,28 @@ struct IOBuf::Block {
         iobuf::g_blockmem.fetch_add(block_size, butil::memory_order_relaxed);
     }
 
+    Block(char* user_data, void (*deleter)(void*))
+        : nshared(1), size(0), cap(0), portal_next(NULL) {
+        UserDataExtension* ext = get_user_data_extension();
+        ext->data = user_data;
+        ext->deleter = deleter;
+    }
+
+    bool is_user_data() const { return cap == 0; }
+
+    UserDataExtension* get_user_data_extension() {
+        return reinterpret_cast<UserDataExtension*>(data);
+    }
+
+    // Where referenced bytes are. Blocks being appended are never user
+    // data and are written through `data' directly.
+    char* payload() {
+        if (BAIDU_UNLIKELY(is_user_data())) {
+            return get_user_data_extension()->data;
+        }
+        return data;
+    }
+
     void inc_ref() {
         nshared.fetch_add(1, butil::memory_order_relaxed);
     }
@@ -246,6 +277,13 @@ struct IOBuf::Block {
     void dec_ref() {
         if (nshared.fetch_sub(1, butil::memory_order_release) == 1) {
             butil::atomic_thread_fence(butil::memory_order_acquire);
+            if (is_user_data()) {
+                UserDataExtension* ext = get_user_data_extension();
+                ext->deleter(ext->data);
+                this->~Block();
+                free(this);
+                return;
+            }
             iobuf::g_nblock.fetch_sub(1, butil::memory_order_relaxed);
             iobuf::g_blockmem.fetch_sub(cap + offsetof(Block, data),
                                         butil::memory_order_relaxed);
@@ -754,7 +792,7 @@ bool IOBuf::cut1(char* c) {
         return false;
     }
     IOBuf::BlockRef &r = _front_ref();
-    *c = r.block->data[r.offset];
+    *c = r.block->payload()[r.offset];
     if (r.length > 1) {
         ++r.offset;
         --r.length;
@@ -825,12 +863,12 @@ size_t IOBuf::cutn(void* out, size_t n) {
     while (n) {   // length() == 0 does not enter
         IOBuf::BlockRef &r = _front_ref();
         if (r.length <= n) {
-            iobuf::cp(out, r.block->data + r.offset, r.length);
+            iobuf::cp(out, r.block->payload() + r.offset, r.length);
             out = (char*)out + r.length;
             n -= r.length;
             _pop_front_ref();
         } else {
-            iobuf::cp(out, r.block->data + r.offset, n);
+            iobuf::cp(out, r.block->payload() + r.offset, n);
             out = (char*)out + n;
             r.offset += n;
             r.length -= n;
@@ -863,7 +901,7 @@ int IOBuf::_cut_by_char(IOBuf* out, char d) {
     
     for (size_t i = 0; i < nref; ++i) {
         IOBuf::BlockRef const& r = _ref_at(i);
-        char const* const s = r.block->data + r.offset;
+        char const* const s = r.block->payload() + r.offset;
         for (uint32_t j = 0; j < r.length; ++j, ++n) {
             if (s[j] == d) {
                 // There's no way cutn/pop_front fails
@@ -899,7 +937,7 @@ int IOBuf::_cut_by_delim(IOBuf* out, char const* dbegin, size_t ndelim) {
 
     for (size_t i = 0; i < nref; ++i) {
         IOBuf::BlockRef const& r = _ref_at(i);
-        char const* const s = r.block->data + r.offset;
+        char const* const s = r.block->payload() + r.offset;
         
         for (uint32_t j = 0; j < r.length; ++j, ++n) {
             sig = ((sig << CHAR_BIT) | static_cast<SigType>(s[j])) & SIGMASK;
@@ -931,7 +969,7 @@ ssize_t IOBuf::pcut_into_file_descriptor(int fd, off_t offset, size_t size_hint)
 
     do {
         IOBuf::BlockRef const& r = _ref_at(nvec);
-        vec[nvec].iov_base = r.block->data + r.offset;
+        vec[nvec].iov_base = r.block->payload() + r.offset;
         vec[nvec].iov_len = r.length;
         ++nvec;
         cur_len += r.length;
@@ -958,7 +996,7 @@ ssize_t IOBuf::cut_into_SSL_channel(SSL* ssl, int* ssl_error) {
     }
     
     IOBuf::BlockRef const& r = _ref_at(0);
-    const int nw = SSL_write(ssl, r.block->data + r.offset, r.length);
+    const int nw = SSL_write(ssl, r.block->payload() + r.offset, r.length);
     if (nw > 0) {
         pop_front(nw);
     }
@@ -981,7 +1019,7 @@ ssize_t IOBuf::pcut_multiple_into_file_descriptor(
         const size_t nref = p->_ref_num();
         for (size_t j = 0; j < nref && nvec < IOBUF_IOV_MAX; ++j, ++nvec) {
             IOBuf::BlockRef const& r = p->_ref_at(j);
-            vec[nvec].iov_base = r.block->data + r.offset;
+            vec[nvec].iov_base = r.block->payload() + r.offset;
             vec[nvec].iov_len = r.length;
         }
     }
@@ -1072,6 +1110,32 @@ int IOBuf::append(void const* data, size_t count) {
     return 0;
 }
 
+int IOBuf::append_user_data(void* data, size_t size, void (*deleter)(void*)) {
+    if (BAIDU_UNLIKELY(!data)) {
+        return -1;
+    }
+    if (size > 0xFFFFFFFFULL) {
+        LOG(ERROR) << "data_size=" << size << " is too large";
+        return -1;
+    }
+    if (deleter == NULL) {
+        deleter = ::free;
+    }
+    if (size == 0) {
+        deleter(data);
+        return 0;
+    }
+    // Not allocated by blockmem_allocate which is for blocks of IOBuf's own.
+    void* mem = malloc(sizeof(IOBuf::Block) + sizeof(UserDataExtension));
+    if (BAIDU_UNLIKELY(mem == NULL)) {
+        return -1;
+    }
+    IOBuf::Block* b = new (mem) IOBuf::Block((char*)data, deleter);
+    const IOBuf::BlockRef r = { 0, (uint32_t)size, b };
+    _move_back_ref(r);
+    return 0;
+}
+
 int IOBuf::appendv(const const_iovec* vec, size_t n) {
     size_t offset = 0;
     for (size_t i = 0; i < n;) {
@@ -1190,7 +1254,7 @@ int IOBuf::unsafe_assign(Area area, const void* data) {
         // (by different BlockRef-s)
         
         const size_t nc = std::min(length, r.length - ref_offset);
-        iobuf::cp(r.block->data + r.offset + ref_offset, data, nc);
+        iobuf::cp(r.block->payload() + r.offset + ref_offset, data, nc);
         if (length == nc) {
             return 0;
         }
@@ -1251,7 +1315,7 @@ size_t IOBuf::copy_to(void* d, size_t n, size_t pos) const {
     for (; m != 0 && i < nref; ++i) {
         IOBuf::BlockRef const& r = _ref_at(i);
         const size_t nc = std::min(m, (size_t)r.length - offset);
-        iobuf::cp(d, r.block->data + r.offset + offset, nc);
+        iobuf::cp(d, r.block->payload() + r.offset + offset, nc);
         offset = 0;
         d = (char*)d + nc;
         m -= nc;
@@ -1296,20 +1360,20 @@ void const* IOBuf::fetch(void* d, size_t n) const {
     if (n <= length()) {
         IOBuf::BlockRef const& r0 = _ref_at(0);
         if (n <= r0.length) {
-            return r0.block->data + r0.offset;
+            return r0.block->payload() + r0.offset;
         }
     
-        iobuf::cp(d, r0.block->data + r0.offset, r0.length);
+        iobuf::cp(d, r0.block->payload() + r0.offset, r0.length);
         size_t total_nc = r0.length;
         const size_t nref = _ref_num();
         for (size_t i = 1; i < nref; ++i) {
             IOBuf::BlockRef const& r = _ref_at(i);
             if (n <= r.length + total_nc) {
                 iobuf::cp((char*)d + total_nc,
-                            r.block->data + r.offset, n - total_nc);
+                            r.block->payload() + r.offset, n - total_nc);
                 return d;
             }
-            iobuf::cp((char*)d + total_nc, r.block->data + r.offset, r.length);
+            iobuf::cp((char*)d + total_nc, r.block->payload() + r.offset, r.length);
             total_nc += r.length;
         }
     }
@@ -1319,7 +1383,7 @@ void const* IOBuf::fetch(void* d, size_t n) const {
 const void* IOBuf::fetch1() const {
     if (!empty()) {
         const IOBuf::BlockRef& r0 = _front_ref();
-        return r0.block->data + r0.offset;
+        return r0.block->payload() + r0.offset;
     }
     return NULL;
 }
@@ -1429,7 +1493,7 @@ bool IOBuf::equals(const butil::StringPiece& s) const {
     size_t soff = 0;
     for (size_t i = 0; i < nref; ++i) {
         const BlockRef& r = _ref_at(i);
-        if (memcmp(r.block->data + r.offset, s.data() + soff, r.length) != 0) {
+        if (memcmp(r.block->payload() + r.offset, s.data() + soff, r.length) != 0) {
             return false;
         }
         soff += r.length;
@@ -1440,7 +1504,7 @@ bool IOBuf::equals(const butil::StringPiece& s) const {
 StringPiece IOBuf::backing_block(size_t i) const {
     if (i < _ref_num()) {
         const BlockRef& r = _ref_at(i);
-        return StringPiece(r.block->data + r.offset, r.length);
+        return StringPiece(r.block->payload() + r.offset, r.length);
     }
     return StringPiece();
 }
@@ -1454,10 +1518,10 @@ bool IOBuf::equals(const butil::IOBuf& other) const {
         return true;
     }
     const BlockRef& r1 = _ref_at(0);
-    const char* d1 = r1.block->data + r1.offset;
+    const char* d1 = r1.block->payload() + r1.offset;
     size_t len1 = r1.length;
     const BlockRef& r2 = other._ref_at(0);
-    const char* d2 = r2.block->data + r2.offset;
+    const char* d2 = r2.block->payload() + r2.offset;
     size_t len2 = r2.length;
     const size_t nref1 = _ref_num();
     const size_t nref2 = other._ref_num();
@@ -1474,7 +1538,7 @@ bool IOBuf::equals(const butil::IOBuf& other) const {
                 return true;
             }
             const BlockRef& r = _ref_at(i++);
-            d1 = r.block->data + r.offset;
+            d1 = r.block->payload() + r.offset;
             len1 = r.length;
         } else {
             d1 += cmplen;
@@ -1485,7 +1549,7 @@ bool IOBuf::equals(const butil::IOBuf& other) const {
                 return true;
             }
             const BlockRef& r = other._ref_at(j++);
-            d2 = r.block->data + r.offset;
+            d2 = r.block->payload() + r.offset;
             len2 = r.length;
         } else {
             d2 += cmplen;
@@ -1507,6 +1571,22 @@ void IOPortal::clear() {
     return_cached_blocks();
 }
 
+void IOPortal::set_block_size(size_t block_size) {
+    if (block_size < DEFAULT_BLOCK_SIZE) {
+        block_size = DEFAULT_BLOCK_SIZE;
+    } else if (block_size > MAX_BLOCK_SIZE) {
+        block_size = MAX_BLOCK_SIZE;
+    }
+    _block_size = block_size;
+}
+
+inline IOBuf::Block* IOPortal::acquire_block() {
+    if (_block_size == DEFAULT_BLOCK_SIZE) {
+        return iobuf::acquire_tls_block();
+    }
+    return iobuf::create_block(_block_size);
+}
+
 const int MAX_APPEND_IOVEC = 64;
 
 ssize_t IOPortal::pappend_from_file_descriptor(
@@ -1519,7 +1599,7 @@ ssize_t IOPortal::pappend_from_file_descriptor(
     // Prepare at most MAX_APPEND_IOVEC blocks or space of blocks >= max_count
     do {
         if (p == NULL) {
-            p = iobuf::acquire_tls_block();
+            p = acquire_block();
             if (BAIDU_UNLIKELY(!p)) {
                 errno = ENOMEM;
                 return -1;
@@ -1573,7 +1653,7 @@ ssize_t IOPortal::pappend_from_file_descriptor(
 
 ssize_t IOPortal::append_from_SSL_channel(SSL* ssl, int* ssl_error) {
     if (!_block) {
-        _block = iobuf::acquire_tls_block();
+        _block = acquire_block();
         if (BAIDU_UNLIKELY(!_block)) {
             errno = ENOMEM;
             *ssl_error = SSL_ERROR_SYSCALL;
@@ -1596,7 +1676,24 @@ ssize_t IOPortal::append_from_SSL_channel(SSL* ssl, int* ssl_error) {
 }
 
 void IOPortal::return_cached_blocks_impl(Block* b) {
-    iobuf::release_tls_block_chain(b);
+    // Don't keep large blocks in TLS which is shared by all IOBufs in the
+    // thread and limited by number of blocks.
+    Block* head = NULL;
+    Block** ptail = &head;
+    do {
+        Block* const saved_next = b->portal_next;
+        if (b->cap > DEFAULT_PAYLOAD) {
+            b->dec_ref();
+        } else {
+            *ptail = b;
+            ptail = &b->portal_next;
+        }
+        b = saved_next;
+    } while (b);
+    *ptail = NULL;
+    if (head) {
+        iobuf::release_tls_block_chain(head);
+    }
 }
 
 IOBufAsZeroCopyInputStream::IOBufAsZeroCopyInputStream(const IOBuf& buf)
@@ -1610,7 +1707,7 @@ IOBufAsZeroCopyInputStream::IOBufAsZeroCopyInputStream(const IOBuf& buf)
 
 bool IOBufAsZeroCopyInputStream::Next(const void** data, int* size) {
     if (_cur_ref != NULL) {
-        *data = _cur_ref->block->data + _cur_ref->offset + _add_offset;
+        *data = _cur_ref->block->payload() + _cur_ref->offset + _add_offset;
         // Impl. of Backup/Skip guarantees that _add_offset < _cur_ref->length.
         *size = _cur_ref->length - _add_offset;
         _byte_count += _cur_ref->length - _add_offset;
@@ -1726,7 +1823,7 @@ void IOBufAsZeroCopyOutputStream::BackUp(int count) {
             // An extended BackUp which is undefined in regular 
             // ZeroCopyOutputStream. The `count' given by user is larger than 
             // size of last _cur_block (already released in last iteration).
-            if (r.block->ref_count() == 1) {
+            if (r.block->ref_count() == 1 && !r.block->is_user_data()) {
                 // A special case: the block is only referenced by last
                 // BlockRef of _buf. Safe to allocate more on the block.
                 if (r.offset + r.length != r.block->size) {
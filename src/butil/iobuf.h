@@ -199,6 +199,15 @@ public:
     // Returns 0 on success(include count == 0), -1 otherwise.
     int append(void const* data, size_t count);
 
+    // Append `size' bytes starting from `data' to back side, without
+    // copying. The memory is owned by the IOBuf(and IOBufs sharing it)
+    // since then and must not be modified. `deleter' is called with `data'
+    // when the memory is not referenced anymore, free() is used if
+    // `deleter' is NULL. `size' must be less than 4GB.
+    // Returns 0 on success, -1 otherwise and `data' is still owned by
+    // the caller.
+    int append_user_data(void* data, size_t size, void (*deleter)(void*));
+
     // Append multiple data to back side in one call, faster than appending
     // one by one separately.
     // Returns 0 on success, -1 otherwise.
@@ -417,8 +426,9 @@ inline bool operator!=(const butil::IOBuf& b1, const butil::IOBuf& b2)
 // Typically used as the buffer to store bytes from sockets.
 class IOPortal : public IOBuf {
 public:
-    IOPortal() : _block(NULL) { }
-    IOPortal(const IOPortal& rhs) : IOBuf(rhs), _block(NULL) { } 
+    IOPortal() : _block(NULL), _block_size(DEFAULT_BLOCK_SIZE) { }
+    IOPortal(const IOPortal& rhs)
+        : IOBuf(rhs), _block(NULL), _block_size(DEFAULT_BLOCK_SIZE) { }
     ~IOPortal();
     IOPortal& operator=(const IOPortal& rhs);
         
@@ -445,14 +455,25 @@ public:
     // performance. Read comments on field `_block' below.
     void return_cached_blocks();
 
+    // Size of blocks allocated by later append_xxx(), clamped into
+    // [DEFAULT_BLOCK_SIZE, MAX_BLOCK_SIZE]. Larger blocks make bulk data
+    // stored in fewer blocks and read with fewer iovecs, but they're not
+    // shared with other IOBufs in the thread. Cached blocks are not affected.
+    void set_block_size(size_t block_size);
+    size_t block_size() const { return _block_size; }
+
 private:
     static void return_cached_blocks_impl(Block*);
 
+    // Get a block of _block_size for appending.
+    Block* acquire_block();
+
     // Cached blocks for appending. Notice that the blocks are released
     // until return_cached_blocks()/clear()/dtor() are called, rather than
     // released after each append_xxx(), which makes messages read from one
     // file descriptor more likely to share blocks and have less BlockRefs.
     Block* _block;
+    size_t _block_size;
 };
 
 // Parse protobuf message from IOBuf. Notice that this wrapper does not change
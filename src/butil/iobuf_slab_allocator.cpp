@@ -0,0 +1,330 @@
+// Copyright (c) 2014 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pthread.h>
+#include <stdlib.h>                         // malloc, free
+#include <stdint.h>                         // uintptr_t
+#include <sys/mman.h>                       // mmap, madvise
+#include "butil/atomicops.h"                // butil::atomic
+#include "butil/scoped_lock.h"              // BAIDU_SCOPED_LOCK
+#include "butil/thread_local.h"             // thread_atexit
+#include "butil/logging.h"                  // PLOG
+#include "butil/iobuf.h"                    // IOBuf::DEFAULT_BLOCK_SIZE
+#include "butil/iobuf_slab_allocator.h"
+
+namespace butil {
+namespace iobuf {
+
+// Defined in iobuf.cpp
+extern void* (*blockmem_allocate)(size_t);
+extern void  (*blockmem_deallocate)(void*);
+extern void reset_blockmem_allocate_and_deallocate();
+
+SlabAllocatorOptions::SlabAllocatorOptions()
+    : max_memory(1024L * 1024 * 1024)
+    , use_hugepage(false) {
+}
+
+static const size_t SLAB_BLOCK_SIZE = IOBuf::DEFAULT_BLOCK_SIZE;
+static const size_t HUGEPAGE_SIZE = 2 * 1024 * 1024;
+// Number of blocks moved between thread caches and the central freelist
+// at once. A thread caches at most 2 * SLAB_BATCH_SIZE blocks.
+static const size_t SLAB_BATCH_SIZE = 32;
+
+// Overlays memory of free blocks.
+struct FreeBlock {
+    FreeBlock* next;
+    // Following fields are only valid in the first block of a batch in the
+    // central freelist.
+    FreeBlock* next_batch;
+    size_t nblock;
+};
+
+struct SlabCache {
+    FreeBlock* head;
+    size_t nblock;
+    // Allocations not added to g_nhit yet.
+    size_t nhit;
+    bool registered;
+    // Set when the thread is quitting, blocks are returned to the central
+    // freelist directly since then.
+    bool quit;
+};
+
+static __thread SlabCache tls_slab_cache = { NULL, 0, 0, false, false };
+
+// The region, set once in use_slab_allocator().
+static char* g_region_begin = NULL;
+static char* g_region_end = NULL;
+static bool g_hugepage = false;
+static butil::static_atomic<size_t> g_carved = BUTIL_STATIC_ATOMIC_INIT(0);
+
+static butil::static_atomic<size_t> g_nhit = BUTIL_STATIC_ATOMIC_INIT(0);
+static butil::static_atomic<size_t> g_nmiss = BUTIL_STATIC_ATOMIC_INIT(0);
+
+static pthread_mutex_t g_central_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FreeBlock* g_central_batches = NULL;
+
+static pthread_mutex_t g_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+inline bool in_region(const void* p) {
+    return (const char*)p >= g_region_begin && (const char*)p < g_region_end;
+}
+
+static void push_central_batch(FreeBlock* head, size_t nblock) {
+    head->nblock = nblock;
+    BAIDU_SCOPED_LOCK(g_central_mutex);
+    head->next_batch = g_central_batches;
+    g_central_batches = head;
+}
+
+static FreeBlock* pop_central_batch() {
+    BAIDU_SCOPED_LOCK(g_central_mutex);
+    FreeBlock* const head = g_central_batches;
+    if (head) {
+        g_central_batches = head->next_batch;
+    }
+    return head;
+}
+
+// Carve at most SLAB_BATCH_SIZE untouched blocks from the region.
+static FreeBlock* carve_batch(size_t* nblock) {
+    const size_t region_size = g_region_end - g_region_begin;
+    if (g_carved.load(butil::memory_order_relaxed) >= region_size) {
+        return NULL;
+    }
+    const size_t offset = g_carved.fetch_add(
+        SLAB_BATCH_SIZE * SLAB_BLOCK_SIZE, butil::memory_order_relaxed);
+    if (offset >= region_size) {
+        return NULL;
+    }
+    size_t n = (region_size - offset) / SLAB_BLOCK_SIZE;
+    if (n > SLAB_BATCH_SIZE) {
+        n = SLAB_BATCH_SIZE;
+    }
+    if (n == 0) {
+        return NULL;
+    }
+    char* const begin = g_region_begin + offset;
+    for (size_t i = 0; i + 1 < n; ++i) {
+        ((FreeBlock*)(begin + i * SLAB_BLOCK_SIZE))->next =
+            (FreeBlock*)(begin + (i + 1) * SLAB_BLOCK_SIZE);
+    }
+    ((FreeBlock*)(begin + (n - 1) * SLAB_BLOCK_SIZE))->next = NULL;
+    *nblock = n;
+    return (FreeBlock*)begin;
+}
+
+static void flush_slab_cache() {
+    SlabCache& c = tls_slab_cache;
+    c.quit = true;
+    if (c.nhit) {
+        g_nhit.fetch_add(c.nhit, butil::memory_order_relaxed);
+        c.nhit = 0;
+    }
+    if (c.head) {
+        push_central_batch(c.head, c.nblock);
+        c.head = NULL;
+        c.nblock = 0;
+    }
+}
+
+static bool refill_slab_cache(SlabCache& c) {
+    if (!c.registered) {
+        c.registered = true;
+        butil::thread_atexit(flush_slab_cache);
+    }
+    if (c.nhit) {
+        g_nhit.fetch_add(c.nhit, butil::memory_order_relaxed);
+        c.nhit = 0;
+    }
+    FreeBlock* head = pop_central_batch();
+    size_t n = 0;
+    if (head) {
+        n = head->nblock;
+    } else {
+        head = carve_batch(&n);
+        if (head == NULL) {
+            return false;
+        }
+    }
+    c.head = head;
+    c.nblock = n;
+    return true;
+}
+
+void* slab_allocate(size_t size) {
+    if (size != SLAB_BLOCK_SIZE) {
+        return ::malloc(size);
+    }
+    SlabCache& c = tls_slab_cache;
+    if (c.head == NULL && (c.quit || !refill_slab_cache(c))) {
+        g_nmiss.fetch_add(1, butil::memory_order_relaxed);
+        return ::malloc(size);
+    }
+    FreeBlock* const b = c.head;
+    c.head = b->next;
+    --c.nblock;
+    ++c.nhit;
+    return b;
+}
+
+void slab_deallocate(void* mem) {
+    if (!in_region(mem)) {
+        return ::free(mem);
+    }
+    FreeBlock* const b = (FreeBlock*)mem;
+    SlabCache& c = tls_slab_cache;
+    if (c.quit) {
+        b->next = NULL;
+        return push_central_batch(b, 1);
+    }
+    b->next = c.head;
+    c.head = b;
+    if (++c.nblock < 2 * SLAB_BATCH_SIZE) {
+        return;
+    }
+    // Too many cached blocks, give a batch back to the central freelist.
+    FreeBlock* last = b;
+    for (size_t i = 1; i < SLAB_BATCH_SIZE; ++i) {
+        last = last->next;
+    }
+    c.head = last->next;
+    c.nblock -= SLAB_BATCH_SIZE;
+    last->next = NULL;
+    push_central_batch(b, SLAB_BATCH_SIZE);
+}
+
+static char* map_region(size_t* size, bool use_hugepage, bool* hugepage) {
+    *hugepage = false;
+    if (!use_hugepage) {
+        void* p = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            PLOG(ERROR) << "Fail to mmap " << *size << " bytes";
+            return NULL;
+        }
+        return (char*)p;
+    }
+    *size = (*size + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+#ifdef MAP_HUGETLB
+    // Don't set MAP_NORESERVE which makes the program crash at touching the
+    // memory rather than failing here when huge pages are not enough.
+    void* p = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        *hugepage = true;
+        return (char*)p;
+    }
+    PLOG(WARNING) << "Fail to mmap " << *size << " bytes of huge pages,"
+        " try transparent huge pages";
+#endif
+    // Map more memory to align the region with huge pages.
+    const size_t mapped_size = *size + HUGEPAGE_SIZE;
+    char* mapped = (char*)mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                               -1, 0);
+    if (mapped == (char*)MAP_FAILED) {
+        PLOG(ERROR) << "Fail to mmap " << mapped_size << " bytes";
+        return NULL;
+    }
+    char* const begin = (char*)(((uintptr_t)mapped + HUGEPAGE_SIZE - 1)
+                                & ~(uintptr_t)(HUGEPAGE_SIZE - 1));
+    if (begin != mapped) {
+        munmap(mapped, begin - mapped);
+    }
+    if (mapped + mapped_size != begin + *size) {
+        munmap(begin + *size, mapped + mapped_size - begin - *size);
+    }
+#ifdef MADV_HUGEPAGE
+    if (madvise(begin, *size, MADV_HUGEPAGE) == 0) {
+        *hugepage = true;
+    } else {
+        PLOG(WARNING) << "Fail to madvise MADV_HUGEPAGE";
+    }
+#endif
+    return begin;
+}
+
+int use_slab_allocator(const SlabAllocatorOptions* options) {
+    {
+        BAIDU_SCOPED_LOCK(g_init_mutex);
+        if (g_region_begin == NULL) {
+            SlabAllocatorOptions default_options;
+            if (options == NULL) {
+                options = &default_options;
+            }
+            size_t size = options->max_memory / SLAB_BLOCK_SIZE * SLAB_BLOCK_SIZE;
+            if (size == 0) {
+                LOG(ERROR) << "max_memory=" << options->max_memory
+                           << " is less than one block";
+                return -1;
+            }
+            bool hugepage = false;
+            char* begin = map_region(&size, options->use_hugepage, &hugepage);
+            if (begin == NULL) {
+                return -1;
+            }
+            g_hugepage = hugepage;
+            g_region_end = begin + size;
+            g_region_begin = begin;
+        }
+    }
+    // Memory allocated before is passed to ::free by slab_deallocate, thus
+    // the deallocating function must be replaced first.
+    blockmem_deallocate = slab_deallocate;
+    blockmem_allocate = slab_allocate;
+    return 0;
+}
+
+// Called in UT. Make IOBuf use malloc again and release the region so that
+// the next use_slab_allocator() reserves a new one with its options.
+// No block of the region should be alive, nor cached by other threads.
+void reset_slab_allocator() {
+    reset_blockmem_allocate_and_deallocate();
+    BAIDU_SCOPED_LOCK(g_init_mutex);
+    SlabCache& c = tls_slab_cache;
+    if (c.nhit) {
+        g_nhit.fetch_add(c.nhit, butil::memory_order_relaxed);
+    }
+    c.head = NULL;
+    c.nblock = 0;
+    c.nhit = 0;
+    {
+        BAIDU_SCOPED_LOCK(g_central_mutex);
+        g_central_batches = NULL;
+    }
+    if (g_region_begin != NULL) {
+        munmap(g_region_begin, g_region_end - g_region_begin);
+    }
+    g_region_begin = NULL;
+    g_region_end = NULL;
+    g_hugepage = false;
+    g_carved.store(0, butil::memory_order_relaxed);
+    g_nhit.store(0, butil::memory_order_relaxed);
+    g_nmiss.store(0, butil::memory_order_relaxed);
+}
+
+void get_slab_allocator_stat(SlabAllocatorStat* stat) {
+    const size_t region_size = g_region_end - g_region_begin;
+    const size_t carved = g_carved.load(butil::memory_order_relaxed);
+    stat->carved_bytes = (carved < region_size ? carved : region_size);
+    stat->max_memory = region_size;
+    stat->hugepage = g_hugepage;
+    stat->nhit = g_nhit.load(butil::memory_order_relaxed);
+    stat->nmiss = g_nmiss.load(butil::memory_order_relaxed);
+}
+
+}  // namespace iobuf
+}  // namespace butil
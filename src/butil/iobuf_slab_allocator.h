@@ -0,0 +1,78 @@
+// Copyright (c) 2014 Baidu, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUTIL_IOBUF_SLAB_ALLOCATOR_H
+#define BUTIL_IOBUF_SLAB_ALLOCATOR_H
+
+#include <stddef.h>                              // size_t
+
+// Allocate blocks of IOBuf from a contiguous region which is reserved
+// at initialization and optionally backed by 2MB huge pages.
+// Freed blocks are cached in each thread and moved to/from a central
+// freelist in batches, memory of the region is never returned to the
+// system. Blocks of non-default sizes and blocks that can't be fit into
+// the region are allocated by malloc.
+
+namespace butil {
+namespace iobuf {
+
+struct SlabAllocatorOptions {
+    SlabAllocatorOptions();
+
+    // Size of the region. Memory consumed by blocks beyond this limit is
+    // allocated by malloc.
+    // Default: 1GB
+    size_t max_memory;
+
+    // Back the region with 2MB huge pages. Explicit huge pages(hugetlbfs)
+    // are tried first, then transparent huge pages.
+    // Default: false
+    bool use_hugepage;
+};
+
+struct SlabAllocatorStat {
+    // Bytes of the region ever carved into blocks and handed out to
+    // threads. Pages of the region are touched only after being carved, so
+    // this is an upper bound of the resident memory of the region.
+    size_t carved_bytes;
+    // Bytes of the region.
+    size_t max_memory;
+    // True if the region is backed by huge pages.
+    bool hugepage;
+    // Number of allocations served by the region.
+    size_t nhit;
+    // Number of allocations served by malloc because the region is full.
+    size_t nmiss;
+};
+
+// Make IOBuf allocate blocks from the slab allocator.
+// The region is reserved at the first call, later calls just make IOBuf
+// use the allocator again and `options' is ignored.
+// Returns 0 on success, -1 otherwise.
+int use_slab_allocator(const SlabAllocatorOptions* options);
+
+// Allocate/deallocate memory of a block. Memory not allocated by
+// slab_allocate() is passed to ::free() in slab_deallocate().
+// slab_allocate() is same with malloc before use_slab_allocator() is called.
+void* slab_allocate(size_t size);
+void slab_deallocate(void* mem);
+
+// Get statistics of the allocator. Numbers of allocations are updated in
+// batches and may lag behind.
+void get_slab_allocator_stat(SlabAllocatorStat* stat);
+
+}  // namespace iobuf
+}  // namespace butil
+
+#endif  // BUTIL_IOBUF_SLAB_ALLOCATOR_H
@@ -0,0 +1,165 @@
+// brpc - A framework to host and access services throughout Baidu.
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <gtest/gtest.h>
+
+#if defined(__cpp_impl_coroutine)
+
+#include <string>
+#include <vector>
+#include <google/protobuf/descriptor.h>
+#include "butil/time.h"
+#include "butil/logging.h"
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "brpc/coroutine.h"
+#include "echo.pb.h"
+
+namespace {
+
+class EchoServiceImpl : public test::EchoService {
+public:
+    virtual void Echo(google::protobuf::RpcController* cntl_base,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        if (request->sleep_us() > 0) {
+            bthread_usleep(request->sleep_us());
+        }
+        if (request->server_fail()) {
+            cntl->SetFailed(request->server_fail(), "Server fail");
+            return;
+        }
+        response->set_message(request->message());
+    }
+};
+
+class CoroutineTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        ASSERT_EQ(0, _server.AddService(&_echo_svc,
+                                        brpc::SERVER_DOESNT_OWN_SERVICE));
+        ASSERT_EQ(0, _server.Start("127.0.0.1:0", NULL));
+        ASSERT_EQ(0, _channel.Init(_server.listen_address(), NULL));
+    }
+    virtual void TearDown() {
+        _server.Stop(0);
+        _server.Join();
+    }
+
+    EchoServiceImpl _echo_svc;
+    brpc::Server _server;
+    brpc::Channel _channel;
+};
+
+bthread::CoTask<std::string> co_echo(brpc::Channel* channel,
+                                     std::string message,
+                                     int sleep_us, int server_fail) {
+    brpc::Controller cntl;
+    test::EchoRequest request;
+    test::EchoResponse response;
+    request.set_message(message);
+    request.set_sleep_us(sleep_us);
+    request.set_server_fail(server_fail);
+    co_await brpc::CoCallMethod(
+        channel, test::EchoService::descriptor()->FindMethodByName("Echo"),
+        &cntl, &request, &response);
+    // Resumed in a bthread after the response arrives.
+    EXPECT_NE(0UL, bthread_self());
+    if (cntl.Failed()) {
+        co_return "error:" + std::to_string(cntl.ErrorCode());
+    }
+    co_return response.message();
+}
+
+TEST_F(CoroutineTest, call_method) {
+    ASSERT_EQ("hello", bthread::sync_wait(co_echo(&_channel, "hello", 0, 0)));
+    // The response arrives after the coroutine is suspended.
+    ASSERT_EQ("world",
+              bthread::sync_wait(co_echo(&_channel, "world", 20000, 0)));
+    ASSERT_EQ("error:" + std::to_string(brpc::EINTERNAL),
+              bthread::sync_wait(co_echo(&_channel, "hello", 0,
+                                         brpc::EINTERNAL)));
+}
+
+bthread::CoTask<int> co_echo_with_stub(brpc::Channel* channel, int n) {
+    test::EchoService_Stub stub(channel);
+    int nsucc = 0;
+    for (int i = 0; i < n; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest request;
+        test::EchoResponse response;
+        request.set_message(std::to_string(i));
+        co_await brpc::CoAwaitDone([&](google::protobuf::Closure* done) {
+            stub.Echo(&cntl, &request, &response, done);
+        });
+        if (!cntl.Failed() && response.message() == std::to_string(i)) {
+            ++nsucc;
+        }
+    }
+    co_return nsucc;
+}
+
+TEST_F(CoroutineTest, await_done_of_stub) {
+    ASSERT_EQ(10, bthread::sync_wait(co_echo_with_stub(&_channel, 10)));
+}
+
+bthread::CoTask<void> co_echo_and_count(brpc::Channel* channel,
+                                        butil::atomic<int>* nsucc,
+                                        bthread::CountdownEvent* event) {
+    const std::string rsp = co_await co_echo(channel, "hi", 10000, 0);
+    if (rsp == "hi") {
+        nsucc->fetch_add(1);
+    }
+    event->signal();
+}
+
+TEST_F(CoroutineTest, concurrent_calls) {
+    const int N = 100;
+    butil::atomic<int> nsucc(0);
+    bthread::CountdownEvent event(N);
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread::co_start(
+                      co_echo_and_count(&_channel, &nsucc, &event)));
+    }
+    ASSERT_EQ(0, event.wait());
+    ASSERT_EQ(N, nsucc.load());
+}
+
+bthread::CoTask<int> co_fan_out(brpc::Channel* channel, int n, int sleep_us) {
+    std::vector<brpc::Controller> cntls(n);
+    std::vector<test::EchoRequest> requests(n);
+    std::vector<test::EchoResponse> responses(n);
+    test::EchoService_Stub stub(channel);
+    co_await brpc::CoAwaitAllDone(
+        n, [&](int i, google::protobuf::Closure* done) {
+            requests[i].set_message(std::to_string(i));
+            requests[i].set_sleep_us(sleep_us);
+            stub.Echo(&cntls[i], &requests[i], &responses[i], done);
+        });
+    int nsucc = 0;
+    for (int i = 0; i < n; ++i) {
+        if (!cntls[i].Failed() && responses[i].message() == std::to_string(i)) {
+            ++nsucc;
+        }
+    }
+    co_return nsucc;
+}
+
+TEST_F(CoroutineTest, fan_out) {
+    const int N = 10;
+    butil::Timer tm;
+    tm.start();
+    ASSERT_EQ(N, bthread::sync_wait(co_fan_out(&_channel, N, 50000)));
+    tm.stop();
+    // Calls are in flight at the same time.
+    ASSERT_LT(tm.m_elapsed(), N * 50 / 2);
+    ASSERT_EQ(0, bthread::sync_wait(co_fan_out(&_channel, 0, 0)));
+}
+
+} // namespace
+
+#endif  // __cpp_impl_coroutine
@@ -0,0 +1,111 @@
+// brpc - A framework to host and access services throughout Baidu.
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <google/protobuf/descriptor.h>
+#include "butil/string_printf.h"
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "brpc/future_done.h"
+#include "echo.pb.h"
+
+namespace {
+
+class EchoServiceImpl : public test::EchoService {
+public:
+    virtual void Echo(google::protobuf::RpcController* cntl_base,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        if (request->sleep_us() > 0) {
+            bthread_usleep(request->sleep_us());
+        }
+        if (request->server_fail()) {
+            cntl->SetFailed(request->server_fail(), "Server fail");
+            return;
+        }
+        response->set_message(request->message());
+    }
+};
+
+class FutureDoneTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        ASSERT_EQ(0, _server.AddService(&_echo_svc,
+                                        brpc::SERVER_DOESNT_OWN_SERVICE));
+        ASSERT_EQ(0, _server.Start("127.0.0.1:0", NULL));
+        ASSERT_EQ(0, _channel.Init(_server.listen_address(), NULL));
+    }
+    virtual void TearDown() {
+        _server.Stop(0);
+        _server.Join();
+    }
+
+    EchoServiceImpl _echo_svc;
+    brpc::Server _server;
+    brpc::Channel _channel;
+};
+
+TEST_F(FutureDoneTest, when_all_of_call_method_async) {
+    const size_t N = 10;
+    const size_t FAILED_INDEX = 3;
+    const google::protobuf::MethodDescriptor* method =
+        test::EchoService::descriptor()->FindMethodByName("Echo");
+    std::vector<brpc::Controller> cntls(N);
+    std::vector<test::EchoRequest> requests(N);
+    std::vector<test::EchoResponse> responses(N);
+    std::vector<bthread::Future<void> > futures;
+    for (size_t i = 0; i < N; ++i) {
+        requests[i].set_message(butil::string_printf("hello%lu", i));
+        // Complete in the reverse order of issuing.
+        requests[i].set_sleep_us((N - i) * 5000);
+        if (i == FAILED_INDEX) {
+            requests[i].set_server_fail(brpc::EINTERNAL);
+        }
+        futures.push_back(brpc::CallMethodAsync(
+                              &_channel, method, &cntls[i],
+                              &requests[i], &responses[i]));
+    }
+    bthread::Future<void> all = bthread::when_all(futures);
+    ASSERT_EQ(0, all.wait());
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_TRUE(futures[i].is_ready());
+        if (i == FAILED_INDEX) {
+            ASSERT_TRUE(cntls[i].Failed());
+            ASSERT_EQ(brpc::EINTERNAL, cntls[i].ErrorCode());
+        } else {
+            ASSERT_FALSE(cntls[i].Failed()) << cntls[i].ErrorText();
+            ASSERT_EQ(requests[i].message(), responses[i].message());
+        }
+    }
+}
+
+TEST_F(FutureDoneTest, when_any_of_call_method_async) {
+    const google::protobuf::MethodDescriptor* method =
+        test::EchoService::descriptor()->FindMethodByName("Echo");
+    brpc::Controller cntls[2];
+    test::EchoRequest requests[2];
+    test::EchoResponse responses[2];
+    requests[0].set_message("slow");
+    requests[0].set_sleep_us(200000);
+    requests[1].set_message("fast");
+    std::vector<bthread::Future<void> > futures;
+    for (size_t i = 0; i < 2; ++i) {
+        futures.push_back(brpc::CallMethodAsync(
+                              &_channel, method, &cntls[i],
+                              &requests[i], &responses[i]));
+    }
+    ASSERT_EQ(1UL, bthread::when_any(futures).get());
+    ASSERT_FALSE(cntls[1].Failed()) << cntls[1].ErrorText();
+    ASSERT_EQ("fast", responses[1].message());
+    // Controllers must outlive the RPCs.
+    ASSERT_EQ(0, futures[0].wait());
+    ASSERT_EQ("slow", responses[0].message());
+}
+
+} // namespace
@@ -0,0 +1,112 @@
+// brpc - A framework to host and access services throughout Baidu.
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "brpc/socket.h"
+#include "brpc/socket_map.h"
+#include "brpc/acceptor.h"
+#include "brpc/server.h"
+#include "brpc/channel.h"
+#include "brpc/controller.h"
+#include "brpc/event_dispatcher.h"
+#include "brpc/details/io_uring.h"
+#include "echo.pb.h"
+
+namespace brpc {
+DECLARE_bool(event_dispatcher_use_io_uring);
+}
+
+int main(int argc, char* argv[]) {
+    // Must be set before the global dispatchers are created.
+    brpc::FLAGS_event_dispatcher_use_io_uring = true;
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+class EchoServiceImpl : public test::EchoService {
+public:
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        response->set_message(request->message());
+    }
+};
+
+class IOUringTest : public ::testing::Test{
+protected:
+    IOUringTest(){
+    };
+    virtual ~IOUringTest(){};
+    virtual void SetUp() {
+    };
+    virtual void TearDown() {
+    };
+};
+
+TEST_F(IOUringTest, echo_and_release_fd_after_close) {
+    brpc::IOUring ring;
+    if (ring.Init(8) != 0) {
+        // Don't pass silently when the sockets are polled by epoll.
+        GTEST_SKIP() << "io_uring is not supported: " << berror();
+    }
+    // Dispatchers fall back to epoll as well if they fail to set up rings.
+    if (brpc::GetGlobalEventDispatcher(0)._ring == NULL) {
+        GTEST_SKIP() << "Global event dispatchers are not using io_uring";
+    }
+
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start("127.0.0.1:0", NULL));
+    const butil::EndPoint ep = server.listen_address();
+
+    brpc::ChannelOptions opt;
+    opt.connection_type = brpc::CONNECTION_TYPE_SINGLE;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init(ep, &opt));
+    test::EchoService_Stub stub(&chan);
+    // Connecting waits for EPOLLOUT with a oneshot poll, the connection
+    // is polled by a multishot poll afterwards.
+    for (int i = 0; i < 10; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message("hello io_uring");
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ("hello io_uring", res.message());
+    }
+    std::vector<brpc::SocketId> conns;
+    server._am->ListConnections(&conns);
+    ASSERT_EQ(1ul, conns.size());
+
+    // Polls in io_uring hold references to the file. If any poll of the
+    // client connection were left in the ring, closing the fd would not
+    // release the connection and the server would never see EOF.
+    brpc::SocketId client_id;
+    ASSERT_EQ(0, brpc::SocketMapFind(ep, &client_id));
+    brpc::SocketUniquePtr client_sock;
+    ASSERT_EQ(0, brpc::Socket::Address(client_id, &client_sock));
+    client_sock->SetFailed();
+    client_sock.reset();
+    const int64_t deadline_us = butil::gettimeofday_us() + 5000000L;
+    do {
+        usleep(10000);
+        server._am->ListConnections(&conns);
+    } while (!conns.empty() && butil::gettimeofday_us() < deadline_us);
+    ASSERT_TRUE(conns.empty());
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+} // namespace
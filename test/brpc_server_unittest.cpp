@@ -6,7 +6,9 @@
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <fstream>
+#include <openssl/ssl.h>
 #include <gtest/gtest.h>
 #include <google/protobuf/descriptor.h>
 #include "butil/time.h"
@@ -14,6 +16,7 @@
 #include "butil/fd_guard.h"
 #include "butil/files/scoped_file.h"
 #include "brpc/socket.h"
+#include "brpc/acceptor.h"
 #include "brpc/builtin/version_service.h"
 #include "brpc/builtin/health_service.h"
 #include "brpc/builtin/list_service.h"
@@ -49,6 +52,8 @@ int main(int argc, char* argv[]) {
 namespace brpc {
 DECLARE_bool(enable_threads_service);
 DECLARE_bool(enable_dir_service);
+DECLARE_int32(event_dispatcher_busy_poll_us);
+DECLARE_int32(event_dispatcher_inline_max_bytes);
 }
 
 namespace {
@@ -1385,6 +1390,167 @@ TEST_F(ServerTest, ssl_reload) {
      server.Join();
 }
 
+TEST_F(ServerTest, unix_domain_socket) {
+    const char* path = "/tmp/brpc_server_unittest.sock";
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start("unix:/tmp/brpc_server_unittest.sock", NULL));
+    ASSERT_STREQ(path, butil::endpoint2unix_path(server.listen_address()));
+
+    const brpc::ConnectionType types[] = {
+        brpc::CONNECTION_TYPE_SINGLE, brpc::CONNECTION_TYPE_POOLED,
+        brpc::CONNECTION_TYPE_SHORT };
+    for (size_t i = 0; i < ARRAY_SIZE(types); ++i) {
+        brpc::ChannelOptions chan_options;
+        chan_options.connection_type = types[i];
+        brpc::Channel chan;
+        ASSERT_EQ(0, chan.Init("unix:/tmp/brpc_server_unittest.sock",
+                               &chan_options));
+        test::EchoService_Stub stub(&chan);
+        for (int j = 0; j < 10; ++j) {
+            brpc::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_EQ(EXP_RESPONSE, res.message());
+        }
+    }
+    ASSERT_EQ(30, echo_svc.count.load());
+
+    // Peers binding their own(autobind) paths are seen as unnamed.
+    const int NCLIENT = 8;
+    butil::fd_guard client_fds[NCLIENT];
+    for (int i = 0; i < NCLIENT; ++i) {
+        client_fds[i].reset(socket(AF_UNIX, SOCK_STREAM, 0));
+        ASSERT_LE(0, client_fds[i]);
+        sockaddr_un autobind;
+        autobind.sun_family = AF_UNIX;
+        ASSERT_EQ(0, bind(client_fds[i], (sockaddr*)&autobind,
+                          sizeof(sa_family_t)));
+        sockaddr_storage ss;
+        socklen_t len = 0;
+        ASSERT_EQ(0, butil::endpoint2sockaddr(server.listen_address(),
+                                              &ss, &len));
+        ASSERT_EQ(0, connect(client_fds[i], (sockaddr*)&ss, len));
+    }
+    std::vector<brpc::SocketId> conns;
+    const int64_t deadline_us = butil::gettimeofday_us() + 1000000L;
+    do {
+        usleep(10000);
+        server._am->ListConnections(&conns);
+    } while (conns.size() < (size_t)NCLIENT &&
+             butil::gettimeofday_us() < deadline_us);
+    ASSERT_LE((size_t)NCLIENT, conns.size());
+    for (size_t i = 0; i < conns.size(); ++i) {
+        brpc::SocketUniquePtr s;
+        if (brpc::Socket::Address(conns[i], &s) == 0) {
+            ASSERT_STREQ("unix:", butil::endpoint2str(s->remote_side()).c_str());
+        }
+    }
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    unlink(path);
+}
+
+// Call EchoService over http on a TLS connection to `port' for `n' times.
+// TLS 1.2 and `cipher_list' are used if it's not NULL. Returns the server
+// side Socket of the connection in `server_sock'.
+void SSLEcho(brpc::Server* server, int port, const char* cipher_list,
+             int n, brpc::SocketUniquePtr* server_sock) {
+    butil::EndPoint ep;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", port, &ep));
+    butil::fd_guard fd(butil::tcp_connect(ep, NULL));
+    ASSERT_LE(0, fd);
+    SSL_CTX* ctx = SSL_CTX_new(SSLv23_client_method());
+    ASSERT_TRUE(ctx != NULL);
+    if (cipher_list) {
+#ifdef SSL_OP_NO_TLSv1_3
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TLSv1_3);
+#endif
+        ASSERT_EQ(1, SSL_CTX_set_cipher_list(ctx, cipher_list));
+    }
+    SSL* ssl = SSL_new(ctx);
+    ASSERT_TRUE(ssl != NULL);
+    ASSERT_EQ(1, SSL_set_fd(ssl, fd));
+    ASSERT_EQ(1, SSL_connect(ssl));
+    const std::string body = "{\"message\":\"" + EXP_REQUEST + "\"}";
+    const std::string req = butil::string_printf(
+        "POST /EchoService/Echo HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %lu\r\n\r\n%s",
+        body.size(), body.c_str());
+    for (int i = 0; i < n; ++i) {
+        ASSERT_EQ((int)req.size(), SSL_write(ssl, req.data(), req.size()));
+        std::string res;
+        char buf[4096];
+        while (res.find(EXP_RESPONSE) == std::string::npos) {
+            const int nr = SSL_read(ssl, buf, sizeof(buf));
+            ASSERT_LT(0, nr) << res;
+            res.append(buf, nr);
+        }
+        ASSERT_EQ(0ul, res.find("HTTP/1.1 200")) << res;
+    }
+    butil::EndPoint local_side;
+    ASSERT_EQ(0, butil::get_local_side(fd, &local_side));
+    std::vector<brpc::SocketId> conns;
+    server->_am->ListConnections(&conns);
+    for (size_t i = 0; i < conns.size(); ++i) {
+        brpc::SocketUniquePtr s;
+        if (brpc::Socket::Address(conns[i], &s) == 0 &&
+            s->remote_side() == local_side) {
+            server_sock->reset(s.release());
+        }
+    }
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    SSL_CTX_free(ctx);
+}
+
+TEST_F(ServerTest, ssl_echo_with_ktls) {
+    EchoServiceImpl echo_svc;
+    for (int enable_ktls = 0; enable_ktls <= 1; ++enable_ktls) {
+        brpc::Server server;
+        ASSERT_EQ(0, server.AddService(&echo_svc,
+                                       brpc::SERVER_DOESNT_OWN_SERVICE));
+        brpc::ServerOptions options;
+        options.ssl_options.default_cert.certificate = "cert1.crt";
+        options.ssl_options.default_cert.private_key = "cert1.key";
+        options.ssl_options.enable_ktls = enable_ktls;
+        ASSERT_EQ(0, server.Start("127.0.0.1:0", &options));
+        const int port = server.listen_address().port;
+        {
+            // kTLS is used if the kernel(and OpenSSL) supports it.
+            brpc::SocketUniquePtr s;
+            SSLEcho(&server, port, NULL, 10, &s);
+            ASSERT_TRUE(s);
+            LOG(INFO) << "enable_ktls=" << enable_ktls << " ktls_send="
+                      << s->_ktls_send.load() << " ktls_recv=" << s->_ktls_recv;
+            if (!enable_ktls) {
+                ASSERT_FALSE(s->_ktls_send.load());
+                ASSERT_FALSE(s->_ktls_recv);
+            }
+            s->SetFailed();
+        }
+        {
+            // The kernel does not offload CBC ciphers, the connection
+            // stays on SSL_read/SSL_write just like kTLS is unavailable.
+            brpc::SocketUniquePtr s;
+            SSLEcho(&server, port, "AES128-SHA", 10, &s);
+            ASSERT_TRUE(s);
+            ASSERT_FALSE(s->_ktls_send.load());
+            ASSERT_FALSE(s->_ktls_recv);
+            s->SetFailed();
+        }
+        ASSERT_EQ(0, server.Stop(0));
+        ASSERT_EQ(0, server.Join());
+    }
+}
+
 TEST_F(ServerTest, max_concurrency) {
     const int port = 9200;
     brpc::Server server1;
@@ -1452,4 +1618,184 @@ TEST_F(ServerTest, max_concurrency) {
     stub.Echo(&cntl4, &req, NULL, NULL);
     ASSERT_FALSE(cntl4.Failed()) << cntl4.ErrorText();
 }
+TEST_F(ServerTest, reuse_port) {
+    brpc::ServerOptions opt;
+    opt.reuse_port = true;
+    EchoServiceImpl service1;
+    brpc::Server server1;
+    ASSERT_EQ(0, server1.AddService(&service1, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server1.Start("127.0.0.1:0", &opt));
+    const butil::EndPoint ep = server1.listen_address();
+
+    // Without reuse_port, the port can't be listened again.
+    brpc::Server server3;
+    ASSERT_EQ(-1, server3.Start(ep, NULL));
+
+    EchoServiceImpl service2;
+    brpc::Server server2;
+    ASSERT_EQ(0, server2.AddService(&service2, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server2.Start(ep, &opt));
+    ASSERT_EQ(ep, server2.listen_address());
+
+    // The kernel spreads new connections between listeners of both
+    // servers, one server gets all of them with a chance of 2^-63.
+    brpc::ChannelOptions chan_options;
+    chan_options.connection_type = brpc::CONNECTION_TYPE_SHORT;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init(ep, &chan_options));
+    test::EchoService_Stub stub(&chan);
+    const int N = 64;
+    for (int i = 0; i < N; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+    }
+    ASSERT_EQ(N, service1.count.load() + service2.count.load());
+    ASSERT_LT(0, service1.count.load());
+    ASSERT_LT(0, service2.count.load());
+
+    ASSERT_EQ(0, server1.Stop(0));
+    ASSERT_EQ(0, server1.Join());
+    ASSERT_EQ(0, server2.Stop(0));
+    ASSERT_EQ(0, server2.Join());
+}
+
+// Forwards requests to another server synchronously.
+class NestedEchoService : public test::EchoService {
+public:
+    explicit NestedEchoService(brpc::Channel* chan) : _stub(chan) {}
+    virtual void Echo(google::protobuf::RpcController* cntl_base,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller nested_cntl;
+        _stub.Echo(&nested_cntl, request, response, NULL);
+        if (nested_cntl.Failed()) {
+            cntl_base->SetFailed(nested_cntl.ErrorText());
+        }
+    }
+private:
+    test::EchoService_Stub _stub;
+};
+
+TEST_F(ServerTest, nested_sync_rpc_with_busy_polling) {
+    // The dispatcher keeps polling, messages of both connections are small.
+    // If the handler of the front server ran inside the dispatcher, the
+    // nested RPC would wait for a response which could only be read by the
+    // blocked dispatcher.
+    ASSERT_EQ(0, brpc::FLAGS_event_dispatcher_inline_max_bytes);
+    const int saved_busy_poll_us = brpc::FLAGS_event_dispatcher_busy_poll_us;
+    brpc::FLAGS_event_dispatcher_busy_poll_us = 100;
+
+    EchoServiceImpl back_service;
+    brpc::Server back_server;
+    ASSERT_EQ(0, back_server.AddService(&back_service,
+                                        brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, back_server.Start("127.0.0.1:0", NULL));
+    brpc::ChannelOptions chan_options;
+    chan_options.timeout_ms = 1000;
+    brpc::Channel back_chan;
+    ASSERT_EQ(0, back_chan.Init(back_server.listen_address(), &chan_options));
+
+    NestedEchoService front_service(&back_chan);
+    brpc::Server front_server;
+    ASSERT_EQ(0, front_server.AddService(&front_service,
+                                         brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, front_server.Start("127.0.0.1:0", NULL));
+    brpc::Channel front_chan;
+    ASSERT_EQ(0, front_chan.Init(front_server.listen_address(),
+                                 &chan_options));
+    test::EchoService_Stub stub(&front_chan);
+    for (int i = 0; i < 50; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+    }
+
+    ASSERT_EQ(0, front_server.Stop(0));
+    ASSERT_EQ(0, front_server.Join());
+    ASSERT_EQ(0, back_server.Stop(0));
+    ASSERT_EQ(0, back_server.Join());
+    brpc::FLAGS_event_dispatcher_busy_poll_us = saved_busy_poll_us;
+}
+
+// Records the worker pools running the methods.
+class TagRecordingService : public test::EchoService {
+public:
+    TagRecordingService()
+        : echo_tag(BTHREAD_TAG_INVALID), bytes_echo_tag(BTHREAD_TAG_INVALID) {}
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        echo_tag = bthread_self_tag();
+        response->set_message(request->message());
+    }
+    virtual void BytesEcho1(google::protobuf::RpcController*,
+                            const test::BytesRequest* request,
+                            test::BytesResponse* response,
+                            google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        bytes_echo_tag = bthread_self_tag();
+        response->set_databytes(request->databytes());
+    }
+    bthread_tag_t echo_tag;
+    bthread_tag_t bytes_echo_tag;
+};
+
+TEST_F(ServerTest, method_in_worker_pool) {
+    bthread_tag_t tag = bthread_find_worker_pool("server_test_method");
+    if (tag == BTHREAD_TAG_INVALID) {
+        ASSERT_EQ(0, bthread_add_worker_pool("server_test_method", 1, &tag));
+    }
+    TagRecordingService service;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&service, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.SetBthreadTagOf("test.EchoService.Echo", tag));
+    ASSERT_EQ(0, server.Start("127.0.0.1:0", NULL));
+
+    const char* protocols[] = { "baidu_std", "http", "hulu_pbrpc",
+                                "sofa_pbrpc" };
+    for (size_t i = 0; i < arraysize(protocols); ++i) {
+        brpc::ChannelOptions chan_options;
+        chan_options.protocol = protocols[i];
+        brpc::Channel chan;
+        ASSERT_EQ(0, chan.Init(server.listen_address(), &chan_options));
+        test::EchoService_Stub stub(&chan);
+        // Requests on the same connection are read by the same bthread
+        // which may process the last message in-place. Running a method in
+        // its pool must not move that bthread, otherwise methods without
+        // tags would run in the pool as well.
+        for (int j = 0; j < 10; ++j) {
+            brpc::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_EQ(tag, service.echo_tag) << protocols[i];
+
+            brpc::Controller cntl2;
+            test::BytesRequest breq;
+            test::BytesResponse bres;
+            breq.set_databytes(EXP_REQUEST);
+            stub.BytesEcho1(&cntl2, &breq, &bres, NULL);
+            ASSERT_FALSE(cntl2.Failed()) << cntl2.ErrorText();
+            ASSERT_EQ(BTHREAD_TAG_DEFAULT, service.bytes_echo_tag)
+                << protocols[i];
+        }
+    }
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
 } //namespace
@@ -0,0 +1,349 @@
+// brpc - A framework to host and access services throughout Baidu.
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <gtest/gtest.h>
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "butil/fd_guard.h"
+#include "butil/fd_utility.h"
+#include "butil/endpoint.h"
+#include "brpc/details/shm_transport.h"
+
+namespace {
+
+class ShmTransportTest : public ::testing::Test{
+protected:
+    ShmTransportTest(){
+    };
+    virtual ~ShmTransportTest(){};
+    virtual void SetUp() {
+    };
+    virtual void TearDown() {
+    };
+};
+
+TEST_F(ShmTransportTest, ring_wraps) {
+    brpc::ShmRingHeader header;
+    memset(&header, 0, sizeof(header));
+    char data[16];
+    brpc::ShmRing ring;
+    ring.Init(&header, data, sizeof(data));
+    ASSERT_EQ(0ul, ring.readable_size());
+    ASSERT_EQ(16ul, ring.writable_size());
+
+    butil::IOBuf src;
+    src.append("0123456789");
+    butil::IOBuf* pieces[1] = { &src };
+    ASSERT_EQ(10, ring.CutFrom(pieces, 1));
+    butil::IOBuf out;
+    ASSERT_EQ(10, ring.AppendTo(&out));
+    ASSERT_EQ("0123456789", out.to_string());
+
+    // Cross the end of the ring.
+    out.clear();
+    src.append("abcdefghijklmnopqrst");
+    ASSERT_EQ(16, ring.CutFrom(pieces, 1));
+    ASSERT_EQ(4ul, src.size());
+    ASSERT_EQ(0ul, ring.writable_size());
+    ASSERT_EQ(0, ring.CutFrom(pieces, 1));
+    ASSERT_EQ(16, ring.AppendTo(&out));
+    ASSERT_EQ(4, ring.CutFrom(pieces, 1));
+    ASSERT_EQ(4, ring.AppendTo(&out));
+    ASSERT_EQ("abcdefghijklmnopqrst", out.to_string());
+    ASSERT_EQ(0, ring.AppendTo(&out));
+}
+
+TEST_F(ShmTransportTest, corrupted_ring) {
+    brpc::ShmRingHeader header;
+    memset(&header, 0, sizeof(header));
+    char data[16];
+    brpc::ShmRing ring;
+    ring.Init(&header, data, sizeof(data));
+    butil::IOBuf src;
+    src.append("0123456789");
+    butil::IOBuf* pieces[1] = { &src };
+    butil::IOBuf out;
+
+    // The peer claims more data than the ring holds.
+    header.tail.store(17);
+    ASSERT_EQ(0ul, ring.readable_size());
+    ASSERT_EQ(0ul, ring.writable_size());
+    ASSERT_EQ(-1, ring.AppendTo(&out));
+    ASSERT_EQ(EPROTO, errno);
+    ASSERT_EQ(-1, ring.CutFrom(pieces, 1));
+    ASSERT_EQ(EPROTO, errno);
+    // The peer moves head beyond tail.
+    header.tail.store(0);
+    header.head.store(1);
+    ASSERT_EQ(-1, ring.AppendTo(&out));
+    ASSERT_EQ(EPROTO, errno);
+    ASSERT_EQ(-1, ring.CutFrom(pieces, 1));
+    ASSERT_EQ(EPROTO, errno);
+    ASSERT_TRUE(out.empty());
+    ASSERT_EQ(10ul, src.size());
+}
+
+struct TransportPair {
+    TransportPair() : client(NULL), server(NULL) {
+        fds[0] = -1;
+        fds[1] = -1;
+    }
+    ~TransportPair() {
+        delete client;
+        delete server;
+        if (fds[0] >= 0) {
+            close(fds[0]);
+        }
+        if (fds[1] >= 0) {
+            close(fds[1]);
+        }
+    }
+    int fds[2];
+    brpc::ShmTransport* client;
+    brpc::ShmTransport* server;
+};
+
+void CreateTransportPair(size_t ring_size, TransportPair* p) {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, p->fds));
+    ASSERT_EQ(0, butil::make_non_blocking(p->fds[0]));
+    ASSERT_EQ(0, butil::make_non_blocking(p->fds[1]));
+    ASSERT_EQ(0, brpc::ShmTransport::Create(ring_size, &p->client));
+    ASSERT_TRUE(p->client != NULL);
+    // Nothing is sent until the first write.
+    ASSERT_EQ(-1, brpc::ShmTransport::Accept(p->fds[1], &p->server));
+    ASSERT_EQ(EAGAIN, errno);
+    ASSERT_EQ(0, p->client->Write(p->fds[0], NULL, 0));
+    ASSERT_EQ(1, brpc::ShmTransport::Accept(p->fds[1], &p->server));
+    ASSERT_TRUE(p->server != NULL);
+    ASSERT_EQ(p->client->ring_size(), p->server->ring_size());
+}
+
+TEST_F(ShmTransportTest, not_shm) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    butil::fd_guard g0(fds[0]);
+    butil::fd_guard g1(fds[1]);
+    ASSERT_EQ(0, butil::make_non_blocking(fds[1]));
+    brpc::ShmTransport* t = NULL;
+    // Nothing sent yet.
+    ASSERT_EQ(-1, brpc::ShmTransport::Accept(fds[1], &t));
+    ASSERT_EQ(EAGAIN, errno);
+    // Prefix of the magic is not enough to decide.
+    ASSERT_EQ(4, write(fds[0], "BRPC", 4));
+    ASSERT_EQ(-1, brpc::ShmTransport::Accept(fds[1], &t));
+    ASSERT_EQ(EAGAIN, errno);
+    ASSERT_EQ(4, write(fds[0], "PRPC", 4));
+    ASSERT_EQ(0, brpc::ShmTransport::Accept(fds[1], &t));
+    ASSERT_TRUE(t == NULL);
+    // Data is not consumed.
+    char buf[16];
+    ASSERT_EQ(8, read(fds[1], buf, sizeof(buf)));
+    ASSERT_EQ(0, memcmp(buf, "BRPCPRPC", 8));
+}
+
+// Send `shm_fd' as the client does with a hello of `ring_size'.
+void SendHello(int fd, int shm_fd, uint32_t ring_size) {
+    struct {
+        char magic[8];
+        uint32_t version;
+        uint32_t ring_size;
+    } hello = { { 'B', 'R', 'P', 'C', 'S', 'H', 'M', '\0' }, 1, ring_size };
+    struct iovec iov = { &hello, sizeof(hello) };
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    memset(cbuf, 0, sizeof(cbuf));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &shm_fd, sizeof(int));
+    ASSERT_EQ((ssize_t)sizeof(hello), sendmsg(fd, &msg, 0));
+}
+
+TEST_F(ShmTransportTest, reject_resizable_memory) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    butil::fd_guard g0(fds[0]);
+    butil::fd_guard g1(fds[1]);
+    ASSERT_EQ(0, butil::make_non_blocking(fds[1]));
+    // Large enough for the rings but not sealed, the client could shrink
+    // it after the server mapped it.
+    butil::fd_guard shm_fd(syscall(SYS_memfd_create, "test_shm", 0));
+    ASSERT_GE(shm_fd, 0);
+    ASSERT_EQ(0, ftruncate(shm_fd, 4096 + 2 * 64 * 1024));
+    SendHello(fds[0], shm_fd, 64 * 1024);
+    brpc::ShmTransport* t = NULL;
+    ASSERT_EQ(-1, brpc::ShmTransport::Accept(fds[1], &t));
+    ASSERT_EQ(EPROTO, errno);
+    ASSERT_TRUE(t == NULL);
+}
+
+TEST_F(ShmTransportTest, read_write) {
+    TransportPair p;
+    CreateTransportPair(1, &p);
+    ASSERT_EQ(64 * 1024ul, p.client->ring_size());
+
+    butil::IOBuf out;
+    ASSERT_EQ(-1, p.server->Read(p.fds[1], &out));
+    ASSERT_EQ(EAGAIN, errno);
+
+    // The server is waiting, the client rings the doorbell.
+    butil::IOBuf req;
+    req.append("hello");
+    butil::IOBuf* pieces[1] = { &req };
+    ASSERT_EQ(5, p.client->Write(p.fds[0], pieces, 1));
+    pollfd pfd = { p.fds[1], POLLIN, 0 };
+    ASSERT_EQ(1, poll(&pfd, 1, 1000));
+    ASSERT_EQ(5, p.server->Read(p.fds[1], &out));
+    ASSERT_EQ("hello", out.to_string());
+    ASSERT_EQ(-1, p.server->Read(p.fds[1], &out));
+    ASSERT_EQ(EAGAIN, errno);
+    // Doorbells are consumed.
+    ASSERT_EQ(0, poll(&pfd, 1, 0));
+
+    // Fill up the ring of server->client.
+    std::string big(200 * 1024, 'x');
+    butil::IOBuf res;
+    res.append(big);
+    pieces[0] = &res;
+    ASSERT_EQ(64 * 1024, p.server->Write(p.fds[1], pieces, 1));
+    ASSERT_EQ(-1, p.server->Write(p.fds[1], pieces, 1));
+    ASSERT_EQ(EAGAIN, errno);
+    ASSERT_TRUE(p.server->BeginWaitWritable());
+
+    // The client reads and wakes up the server.
+    butil::IOBuf got;
+    ASSERT_EQ(64 * 1024, p.client->Read(p.fds[0], &got));
+    ASSERT_EQ(1, poll(&pfd, 1, 1000));
+    ASSERT_TRUE(p.server->ShouldWakeWriters());
+    ASSERT_EQ(-1, p.server->Read(p.fds[1], &out));
+    ASSERT_EQ(EAGAIN, errno);
+    p.server->EndWaitWritable();
+    ASSERT_FALSE(p.server->ShouldWakeWriters());
+    while (!res.empty()) {
+        const ssize_t nw = p.server->Write(p.fds[1], pieces, 1);
+        if (nw < 0) {
+            ASSERT_EQ(EAGAIN, errno);
+        }
+        p.client->Read(p.fds[0], &got);
+    }
+    while (p.client->Read(p.fds[0], &got) > 0) {}
+    ASSERT_EQ(big, got.to_string());
+
+    // EOF after all data is read.
+    req.append("bye");
+    pieces[0] = &req;
+    ASSERT_EQ(3, p.client->Write(p.fds[0], pieces, 1));
+    close(p.fds[0]);
+    p.fds[0] = -1;
+    out.clear();
+    ASSERT_EQ(3, p.server->Read(p.fds[1], &out));
+    ASSERT_EQ(0, p.server->Read(p.fds[1], &out));
+    ASSERT_EQ("bye", out.to_string());
+}
+
+void WaitFd(int fd, short events) {
+    pollfd pfd = { fd, events, 0 };
+    poll(&pfd, 1, -1);
+}
+
+// Send `msg' from fds[0] and echo it back from fds[1], both sides wait with
+// poll() like EventDispatcher does.
+int64_t PingPong(int fds[2], brpc::ShmTransport* t[2],
+                 const butil::IOBuf& msg, int times) {
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < times; ++i) {
+        for (int side = 0; side < 2; ++side) {
+            const int fd = fds[side];
+            const int peer_fd = fds[1 - side];
+            butil::IOBuf data(msg);
+            butil::IOBuf* pieces[1] = { &data };
+            butil::IOPortal received;
+            while (!data.empty() || received.size() < msg.size()) {
+                if (!data.empty()) {
+                    const ssize_t nw = (t[side] ? t[side]->Write(fd, pieces, 1)
+                                        : data.cut_into_file_descriptor(fd));
+                    if (nw < 0) {
+                        EXPECT_EQ(EAGAIN, errno);
+                    }
+                }
+                const ssize_t nr = (t[1 - side] ?
+                                    t[1 - side]->Read(peer_fd, &received) :
+                                    received.append_from_file_descriptor(
+                                        peer_fd, 1024 * 1024));
+                if (nr < 0) {
+                    EXPECT_EQ(EAGAIN, errno);
+                    if (data.empty()) {
+                        WaitFd(peer_fd, POLLIN);
+                    }
+                } else if (nr == 0) {
+                    ADD_FAILURE() << "Unexpected EOF";
+                    return -1;
+                }
+            }
+        }
+    }
+    tm.stop();
+    return tm.n_elapsed() / times;
+}
+
+TEST_F(ShmTransportTest, ping_pong_performance) {
+    const size_t sizes[] = { 64, 4096, 64 * 1024 };
+    const int N = 10000;
+
+    TransportPair shm;
+    CreateTransportPair(1024 * 1024, &shm);
+    brpc::ShmTransport* shm_t[2] = { shm.client, shm.server };
+
+    int uds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, uds));
+    butil::fd_guard uds0(uds[0]);
+    butil::fd_guard uds1(uds[1]);
+    ASSERT_EQ(0, butil::make_non_blocking(uds[0]));
+    ASSERT_EQ(0, butil::make_non_blocking(uds[1]));
+
+    butil::fd_guard listen_fd(butil::tcp_listen(
+            butil::EndPoint(butil::IP_ANY, 0), false));
+    ASSERT_GE(listen_fd, 0);
+    butil::EndPoint listen_ep;
+    ASSERT_EQ(0, butil::get_local_side(listen_fd, &listen_ep));
+    listen_ep.ip.s_addr = htonl(INADDR_LOOPBACK);
+    int tcp[2];
+    tcp[0] = butil::tcp_connect(listen_ep, NULL);
+    ASSERT_GE(tcp[0], 0);
+    tcp[1] = accept(listen_fd, NULL, NULL);
+    ASSERT_GE(tcp[1], 0);
+    butil::fd_guard tcp0(tcp[0]);
+    butil::fd_guard tcp1(tcp[1]);
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQ(0, butil::make_non_blocking(tcp[i]));
+        ASSERT_EQ(0, butil::make_no_delay(tcp[i]));
+    }
+    brpc::ShmTransport* no_t[2] = { NULL, NULL };
+
+    for (size_t i = 0; i < arraysize(sizes); ++i) {
+        butil::IOBuf msg;
+        msg.append(std::string(sizes[i], 'a'));
+        const int64_t shm_ns = PingPong(shm.fds, shm_t, msg, N);
+        const int64_t uds_ns = PingPong(uds, no_t, msg, N);
+        const int64_t tcp_ns = PingPong(tcp, no_t, msg, N);
+        LOG(INFO) << "size=" << sizes[i] << " round-trip: shm=" << shm_ns
+                  << "ns unix_socket=" << uds_ns << "ns tcp_loopback="
+                  << tcp_ns << "ns";
+    }
+}
+
+} // namespace
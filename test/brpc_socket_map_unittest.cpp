@@ -5,6 +5,8 @@
 
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
+#include "butil/fd_guard.h"
+#include "butil/time.h"
 #include "brpc/socket.h"
 #include "brpc/socket_map.h"
 #include "brpc/reloadable_flags.h"
@@ -123,6 +125,76 @@ TEST_F(SocketMapTest, max_pool_size) {
         EXPECT_TRUE(ptrs[i]->Failed());
     }
 }
+
+size_t WaitPooledSockets(brpc::SocketId main_id, size_t expected_size) {
+    std::vector<brpc::SocketId> ids;
+    const int64_t start_us = butil::gettimeofday_us();
+    do {
+        brpc::SocketUniquePtr main_ptr;
+        EXPECT_EQ(0, brpc::Socket::Address(main_id, &main_ptr));
+        main_ptr->ListPooledSockets(&ids);
+        size_t nalive = 0;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            brpc::SocketUniquePtr ptr;
+            if (brpc::Socket::Address(ids[i], &ptr) == 0) {
+                ++nalive;
+            }
+        }
+        if (nalive == expected_size) {
+            return nalive;
+        }
+        usleep(10000);
+    } while (butil::gettimeofday_us() < start_us + 3000000L);
+    return ids.size();
+}
+
+TEST_F(SocketMapTest, min_idle_connections) {
+    const int saved_idle_timeout_second = brpc::FLAGS_idle_timeout_second;
+    brpc::FLAGS_idle_timeout_second = 0;
+    butil::fd_guard listen_fd(butil::tcp_listen(
+            butil::EndPoint(butil::IP_ANY, 0), false));
+    ASSERT_GE(listen_fd, 0);
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::get_local_side(listen_fd, &point));
+    point.ip = butil::my_ip();
+
+    brpc::SocketId main_id;
+    ASSERT_EQ(0, brpc::SocketMapInsert(point, &main_id));
+    brpc::SocketUniquePtr main_ptr;
+    ASSERT_EQ(0, brpc::Socket::Address(main_id, &main_ptr));
+    // Connections are established in background.
+    main_ptr->SetPooledSocketLimits(3, 4, 1000);
+    ASSERT_EQ(3u, WaitPooledSockets(main_id, 3));
+    brpc::SocketUniquePtr ptrs[6];
+    for (int i = 0; i < 6; ++i) {
+        ASSERT_EQ(0, brpc::Socket::GetPooledSocket(main_ptr.get(), &ptrs[i]));
+    }
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_GE(ptrs[i]->fd(), 0) << "Not connected";
+    }
+    for (int i = 0; i < 6; ++i) {
+        ASSERT_EQ(0, ptrs[i]->ReturnToPool());
+        ptrs[i].reset();
+    }
+    // Idle connections beyond max_idle are closed.
+    ASSERT_EQ(4u, WaitPooledSockets(main_id, 4));
+
+    // Closed connections are re-established.
+    std::vector<brpc::SocketId> ids;
+    main_ptr->ListPooledSockets(&ids);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        brpc::Socket::SetFailed(ids[i]);
+    }
+    ASSERT_EQ(3u, WaitPooledSockets(main_id, 3));
+
+    // Idle timeout does not close connections below min_idle.
+    brpc::FLAGS_idle_timeout_second = 1;
+    usleep(2500000L);
+    ASSERT_EQ(3u, WaitPooledSockets(main_id, 3));
+    main_ptr.reset();
+    brpc::SocketMapRemove(point);
+    brpc::FLAGS_idle_timeout_second = saved_idle_timeout_second;
+}
 } //namespace
 
 int main(int argc, char* argv[]) {
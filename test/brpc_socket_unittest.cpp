@@ -7,11 +7,14 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <fcntl.h>  // F_GETFD
+#include <poll.h>
 #include <gtest/gtest.h>
 #include "butil/gperftools_profiler.h"
 #include "butil/time.h"
 #include "butil/macros.h"
 #include "butil/fd_utility.h"
+#include "butil/fd_guard.h"
+#include "bvar/variable.h"
 #include "bthread/unstable.h"
 #include "bthread/task_control.h"
 #include "brpc/socket.h"
@@ -27,6 +30,11 @@ namespace bthread {
 extern TaskControl* g_task_control;
 }
 
+namespace brpc {
+DECLARE_bool(socket_zerocopy_send);
+DECLARE_int32(socket_zerocopy_min_bytes);
+}
+
 void EchoProcessHuluRequest(brpc::InputMessageBase* msg_base);
 
 int main(int argc, char* argv[]) {
@@ -259,6 +267,178 @@ TEST_F(SocketTest, single_threaded_write) {
     close(fds[0]);
 }
 
+// Read from `fd' of a SOCK_SEQPACKET socket until `len' bytes are got, each
+// write into the peer is read as one record. Returns number of records or -1
+// if the data does not arrive in time.
+static int read_records(int fd, size_t len, std::string* out) {
+    out->clear();
+    int nrecord = 0;
+    while (out->size() < len) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 2000) != 1) {
+            return -1;
+        }
+        char buf[4096];
+        const ssize_t nr = read(fd, buf, sizeof(buf));
+        if (nr <= 0) {
+            return -1;
+        }
+        out->append(buf, nr);
+        ++nrecord;
+    }
+    return nrecord;
+}
+
+TEST_F(SocketTest, cork_write) {
+    int fds[2];
+    // Writes into the socket are not merged by the kernel.
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.user = new CheckRecycle;
+    options.cork_window_us = 100000;
+    options.cork_max_bytes = 1024;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        global_sock = s.get();
+        std::string dest;
+        // Small writes are coalesced into one until the window ends.
+        for (int i = 0; i < 3; ++i) {
+            butil::IOBuf src;
+            src.append("hello");
+            ASSERT_EQ(0, s->Write(&src));
+        }
+        ASSERT_EQ(1, read_records(fds[0], 15, &dest));
+        ASSERT_EQ("hellohellohello", dest);
+
+        // Following writes are flushed long before the window ends, or
+        // read_records() times out.
+        s->SetCorkOptions(60000000, -1);
+
+        // Queued data is flushed along with a write with flush_immediately.
+        butil::IOBuf src;
+        src.append("hello");
+        ASSERT_EQ(0, s->Write(&src));
+        src.append("world");
+        brpc::Socket::WriteOptions wopt;
+        wopt.flush_immediately = true;
+        ASSERT_EQ(0, s->Write(&src, &wopt));
+        ASSERT_EQ(1, read_records(fds[0], 10, &dest));
+        ASSERT_EQ("helloworld", dest);
+
+        // Or by reaching cork_max_bytes.
+        src.append("hello");
+        ASSERT_EQ(0, s->Write(&src));
+        src.append(std::string(1024, 'a'));
+        ASSERT_EQ(0, s->Write(&src));
+        ASSERT_EQ(1, read_records(fds[0], 1029, &dest));
+
+        // A write flushed without waiting does not make later writes skip
+        // coalescing.
+        src.append("hello");
+        ASSERT_EQ(0, s->Write(&src, &wopt));
+        ASSERT_EQ(1, read_records(fds[0], 5, &dest));
+        for (int i = 0; i < 3; ++i) {
+            src.append("hello");
+            ASSERT_EQ(0, s->Write(&src));
+        }
+        src.append("world");
+        ASSERT_EQ(0, s->Write(&src, &wopt));
+        ASSERT_EQ(1, read_records(fds[0], 20, &dest));
+        ASSERT_EQ("hellohellohelloworld", dest);
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    close(fds[0]);
+}
+
+static int64_t GetExposedInt64(const char* name) {
+    return strtoll(bvar::Variable::describe_exposed(name).c_str(), NULL, 10);
+}
+
+TEST_F(SocketTest, zerocopy_write) {
+    const bool saved_zerocopy_send = brpc::FLAGS_socket_zerocopy_send;
+    const int32_t saved_min_bytes = brpc::FLAGS_socket_zerocopy_min_bytes;
+    brpc::FLAGS_socket_zerocopy_send = true;
+    brpc::FLAGS_socket_zerocopy_min_bytes = 4096;
+
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:0", &point));
+    butil::fd_guard listening_fd(butil::tcp_listen(point, false));
+    ASSERT_LE(0, listening_fd);
+    ASSERT_EQ(0, butil::get_local_side(listening_fd, &point));
+    const int client_fd = butil::tcp_connect(point, NULL);
+    ASSERT_LE(0, client_fd);
+    butil::fd_guard server_fd(accept(listening_fd, NULL, NULL));
+    ASSERT_LE(0, server_fd);
+
+    const int64_t old_zerocopy_bytes =
+        GetExposedInt64("rpc_socket_zerocopy_bytes");
+    const int64_t old_fallback_count =
+        GetExposedInt64("rpc_socket_zerocopy_fallback_count");
+
+    brpc::SocketId id = 8888;
+    brpc::SocketOptions options;
+    options.fd = client_fd;
+    options.user = new CheckRecycle;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        global_sock = s.get();
+        // Written data is sent with MSG_ZEROCOPY, or copied as usual when
+        // the kernel does not support it.
+        const size_t N = 4 * 1024 * 1024;
+        std::string expected;
+        expected.reserve(N);
+        for (size_t i = 0; expected.size() < N; ++i) {
+            expected.append((const char*)&i, sizeof(i));
+        }
+        butil::IOBuf src;
+        src.append(expected);
+        ASSERT_EQ(0, s->Write(&src));
+        std::string received;
+        char buf[65536];
+        while (received.size() < N) {
+            const ssize_t nr = read(server_fd, buf, sizeof(buf));
+            ASSERT_LT(0, nr);
+            received.append(buf, nr);
+        }
+        ASSERT_TRUE(expected == received);
+        ASSERT_LT(old_zerocopy_bytes + old_fallback_count,
+                  GetExposedInt64("rpc_socket_zerocopy_bytes") +
+                  GetExposedInt64("rpc_socket_zerocopy_fallback_count"));
+
+        // All data is received by the peer, completions should have been
+        // notified, reap them as EventDispatcher does on EPOLLERR.
+        if (s->_zerocopy_state > 0) {
+            int64_t start_time = butil::gettimeofday_us();
+            while (true) {
+                brpc::Socket::ReapZeroCopyCompletions(id);
+                BAIDU_SCOPED_LOCK(s->_zerocopy_mutex);
+                if (s->_zerocopy_q->empty()) {
+                    break;
+                }
+                ASSERT_LT(butil::gettimeofday_us(), start_time + 1000000L);
+                usleep(1000);
+            }
+        } else {
+            LOG(INFO) << "MSG_ZEROCOPY is not supported, data was copied";
+        }
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    // The peer sees EOF after the socket is recycled.
+    char c;
+    ASSERT_EQ(0, read(server_fd, &c, 1));
+
+    brpc::FLAGS_socket_zerocopy_send = saved_zerocopy_send;
+    brpc::FLAGS_socket_zerocopy_min_bytes = saved_min_bytes;
+}
+
 void EchoProcessHuluRequest(brpc::InputMessageBase* msg_base) {
     brpc::DestroyingPtr<brpc::policy::MostCommonMessage> msg(
         static_cast<brpc::policy::MostCommonMessage*>(msg_base));
@@ -0,0 +1,117 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <gtest/gtest.h>
+#include "butil/atomicops.h"
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "bthread/bthread.h"
+
+namespace {
+
+TEST(BarrierTest, invalid_count) {
+    bthread_barrier_t b;
+    ASSERT_EQ(EINVAL, bthread_barrier_init(&b, NULL, 0));
+    ASSERT_EQ(0, bthread_barrier_init(&b, NULL, 1));
+    ASSERT_EQ(PTHREAD_BARRIER_SERIAL_THREAD, bthread_barrier_wait(&b));
+    ASSERT_EQ(PTHREAD_BARRIER_SERIAL_THREAD, bthread_barrier_wait(&b));
+    ASSERT_EQ(0, bthread_barrier_destroy(&b));
+}
+
+struct StageArg {
+    bthread_barrier_t* barrier;
+    butil::atomic<int>* arrived;
+    int nstage;
+    int nparty;
+    int nserial;
+    bool failed;
+};
+
+// Every party waits for all parties to finish current stage before
+// moving to the next one.
+void* run_stages(void* void_arg) {
+    StageArg* arg = (StageArg*)void_arg;
+    for (int i = 0; i < arg->nstage; ++i) {
+        arg->arrived->fetch_add(1);
+        const int rc = bthread_barrier_wait(arg->barrier);
+        if (rc == PTHREAD_BARRIER_SERIAL_THREAD) {
+            ++arg->nserial;
+        } else if (rc != 0) {
+            arg->failed = true;
+        }
+        if (arg->arrived->load() < (i + 1) * arg->nparty) {
+            arg->failed = true;
+        }
+        // Wait again so that nobody enters next stage before all parties
+        // checked `arrived'.
+        bthread_barrier_wait(arg->barrier);
+    }
+    return NULL;
+}
+
+void run_parties(int nparty, int nstage, const bthread_attr_t* attr) {
+    bthread_barrier_t b;
+    ASSERT_EQ(0, bthread_barrier_init(&b, NULL, nparty));
+    butil::atomic<int> arrived(0);
+    std::vector<StageArg> args(nparty);
+    std::vector<bthread_t> th(nparty);
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < nparty; ++i) {
+        StageArg arg = { &b, &arrived, nstage, nparty, 0, false };
+        args[i] = arg;
+        ASSERT_EQ(0, bthread_start_background(&th[i], attr, run_stages, &args[i]));
+    }
+    int nserial = 0;
+    for (int i = 0; i < nparty; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+        ASSERT_FALSE(args[i].failed);
+        nserial += args[i].nserial;
+    }
+    tm.stop();
+    ASSERT_EQ(nstage, nserial);
+    ASSERT_EQ(nparty * nstage, arrived.load());
+    LOG(INFO) << nparty << " parties passed " << nstage << " stages in "
+              << tm.u_elapsed() << "us";
+    ASSERT_EQ(0, bthread_barrier_destroy(&b));
+}
+
+TEST(BarrierTest, stages) {
+    run_parties(4, 1000, NULL);
+}
+
+TEST(BarrierTest, many_waiters) {
+    run_parties(10000, 3, &BTHREAD_ATTR_SMALL);
+}
+
+struct TimedArg {
+    bthread_barrier_t* barrier;
+    const timespec* abstime;
+    int rc;
+};
+
+void* timed_waiter(void* void_arg) {
+    TimedArg* arg = (TimedArg*)void_arg;
+    arg->rc = bthread_barrier_timedwait(arg->barrier, arg->abstime);
+    return NULL;
+}
+
+TEST(BarrierTest, timedwait) {
+    bthread_barrier_t b;
+    ASSERT_EQ(0, bthread_barrier_init(&b, NULL, 2));
+    timespec abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(ETIMEDOUT, bthread_barrier_timedwait(&b, &abstime));
+    // The timed-out party is not counted.
+    abstime = butil::milliseconds_from_now(1000);
+    TimedArg arg = { &b, &abstime, -1 };
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, timed_waiter, &arg));
+    bthread_usleep(5000);
+    ASSERT_EQ(-1, arg.rc);
+    const int rc = bthread_barrier_wait(&b);
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(PTHREAD_BARRIER_SERIAL_THREAD, rc + arg.rc);
+    ASSERT_EQ(0, bthread_barrier_destroy(&b));
+}
+
+} // namespace
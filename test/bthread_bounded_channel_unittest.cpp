@@ -0,0 +1,372 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <string>
+#include <gtest/gtest.h>
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "butil/fast_rand.h"
+#include "bthread/bthread.h"
+#include "bthread/bounded_channel.h"
+#include "bthread/execution_queue.h"
+
+namespace {
+
+typedef bthread::BoundedChannel<long> LongChannel;
+
+TEST(BoundedChannelTest, sanity) {
+    LongChannel chan;
+    ASSERT_EQ(EINVAL, chan.init(0));
+    ASSERT_EQ(0, chan.init(5));
+    ASSERT_EQ(EINVAL, chan.init(5));
+    ASSERT_EQ(8UL, chan.capacity());
+    ASSERT_EQ(0UL, chan.size());
+    long v = 0;
+    ASSERT_EQ(EAGAIN, chan.try_recv(&v));
+    for (long i = 0; i < 8; ++i) {
+        ASSERT_EQ(0, chan.try_send(i));
+    }
+    ASSERT_EQ(8UL, chan.size());
+    ASSERT_EQ(EAGAIN, chan.try_send(8));
+    for (long i = 0; i < 8; ++i) {
+        ASSERT_EQ(0, chan.recv(&v));
+        ASSERT_EQ(i, v);
+    }
+    ASSERT_EQ(0UL, chan.size());
+    ASSERT_EQ(EAGAIN, chan.try_recv(&v));
+}
+
+TEST(BoundedChannelTest, remaining_items_are_destroyed) {
+    bthread::BoundedChannel<std::string>* chan =
+        new bthread::BoundedChannel<std::string>;
+    ASSERT_EQ(0, chan->init(4));
+    ASSERT_EQ(0, chan->send(std::string(100, 'a')));
+    ASSERT_EQ(0, chan->send(std::string(100, 'b')));
+    ASSERT_EQ(0, chan->send(std::string(100, 'c')));
+    std::string s;
+    ASSERT_EQ(0, chan->recv(&s));
+    ASSERT_EQ(std::string(100, 'a'), s);
+    delete chan;  // valgrind/asan report leaks if not destroyed.
+}
+
+TEST(BoundedChannelTest, timeout) {
+    LongChannel chan;
+    ASSERT_EQ(0, chan.init(1));
+    ASSERT_EQ(2UL, chan.capacity());
+    long v = 0;
+    butil::Timer tm;
+    tm.start();
+    timespec abstime = butil::milliseconds_from_now(50);
+    ASSERT_EQ(ETIMEDOUT, chan.recv(&v, &abstime));
+    tm.stop();
+    ASSERT_GE(tm.m_elapsed(), 40);
+    ASSERT_EQ(0, chan.send(1));
+    ASSERT_EQ(0, chan.send(2));
+    tm.start();
+    abstime = butil::milliseconds_from_now(50);
+    ASSERT_EQ(ETIMEDOUT, chan.send(3, &abstime));
+    tm.stop();
+    ASSERT_GE(tm.m_elapsed(), 40);
+    ASSERT_EQ(0, chan.recv(&v));
+    ASSERT_EQ(1, v);
+}
+
+struct ChannelArg {
+    LongChannel* chan;
+    long begin;
+    long end;
+    long sum;
+    long count;
+    int rc;
+};
+
+void* sender(void* arg) {
+    ChannelArg* a = (ChannelArg*)arg;
+    for (long i = a->begin; i < a->end; ++i) {
+        a->rc = a->chan->send(i);
+        if (a->rc != 0) {
+            break;
+        }
+        a->sum += i;
+        ++a->count;
+    }
+    return NULL;
+}
+
+void* receiver(void* arg) {
+    ChannelArg* a = (ChannelArg*)arg;
+    long v = 0;
+    while ((a->rc = a->chan->recv(&v)) == 0) {
+        a->sum += v;
+        ++a->count;
+    }
+    return NULL;
+}
+
+void* batch_receiver(void* arg) {
+    ChannelArg* a = (ChannelArg*)arg;
+    long items[16];
+    size_t n = 0;
+    while ((a->rc = a->chan->recv_batch(items, arraysize(items), &n)) == 0) {
+        for (size_t i = 0; i < n; ++i) {
+            a->sum += items[i];
+        }
+        a->count += n;
+    }
+    return NULL;
+}
+
+TEST(BoundedChannelTest, close_wakes_up_blocked_ones) {
+    LongChannel chan;
+    ASSERT_EQ(0, chan.init(2));
+    ChannelArg r = { &chan, 0, 0, 0, 0, 0 };
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, receiver, &r));
+    usleep(10000);
+    chan.close();
+    ASSERT_TRUE(chan.closed());
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(ESTOP, r.rc);
+    ASSERT_EQ(0, r.count);
+    ASSERT_EQ(ESTOP, chan.send(1));
+
+    LongChannel chan2;
+    ASSERT_EQ(0, chan2.init(2));
+    ChannelArg s = { &chan2, 0, 100, 0, 0, 0 };
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, sender, &s));
+    usleep(10000);
+    ASSERT_EQ(2UL, chan2.size());
+    chan2.close();
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(ESTOP, s.rc);
+    ASSERT_EQ(2, s.count);
+    // Items sent before close() can still be received.
+    long v = -1;
+    ASSERT_EQ(0, chan2.recv(&v));
+    ASSERT_EQ(0, v);
+    ASSERT_EQ(0, chan2.try_recv(&v));
+    ASSERT_EQ(1, v);
+    ASSERT_EQ(ESTOP, chan2.recv(&v));
+    ASSERT_EQ(ESTOP, chan2.try_recv(&v));
+}
+
+TEST(BoundedChannelTest, receive_item_in_flight_after_close) {
+    LongChannel chan;
+    ASSERT_EQ(0, chan.init(2));
+    // A sender claimed position 0 before close() and has not written the
+    // item yet.
+    chan._send_pos.store(1);
+    chan.close();
+    ASSERT_EQ(ESTOP, chan.send(1));
+    long v = -1;
+    ASSERT_EQ(EAGAIN, chan.try_recv(&v));
+    ChannelArg r[2];
+    bthread_t th[2];
+    for (int i = 0; i < 2; ++i) {
+        ChannelArg a = { &chan, 0, 0, 0, 0, 0 };
+        r[i] = a;
+        ASSERT_EQ(0, bthread_start_urgent(&th[i], NULL, receiver, &r[i]));
+    }
+    usleep(10000);
+    // Finish the push like the sender does.
+    new (chan._cells[0].data.void_data()) long(100);
+    chan._cells[0].seq.store(1, butil::memory_order_release);
+    chan.wake_up(chan._recv_butex, &chan._nwaiting_receivers, 1);
+    // Both receivers fail after the item is received by one of them.
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+        ASSERT_EQ(ESTOP, r[i].rc);
+    }
+    ASSERT_EQ(1, r[0].count + r[1].count);
+    ASSERT_EQ(100, r[0].sum + r[1].sum);
+}
+
+TEST(BoundedChannelTest, send_races_with_close) {
+    // Every successful send must be received before receivers get ESTOP.
+    for (int round = 0; round < 100; ++round) {
+        LongChannel chan;
+        ASSERT_EQ(0, chan.init(1024));
+        const int NSENDER = 4;
+        const int NRECEIVER = 2;
+        ChannelArg sargs[NSENDER];
+        ChannelArg rargs[NRECEIVER];
+        bthread_t sth[NSENDER];
+        bthread_t rth[NRECEIVER];
+        for (int i = 0; i < NRECEIVER; ++i) {
+            ChannelArg a = { &chan, 0, 0, 0, 0, 0 };
+            rargs[i] = a;
+            ASSERT_EQ(0, bthread_start_background(
+                          &rth[i], NULL, (i % 2 ? batch_receiver : receiver),
+                          &rargs[i]));
+        }
+        for (int i = 0; i < NSENDER; ++i) {
+            ChannelArg a = { &chan, 0, 1L << 40, 0, 0, 0 };
+            sargs[i] = a;
+            ASSERT_EQ(0, bthread_start_background(&sth[i], NULL, sender,
+                                                  &sargs[i]));
+        }
+        bthread_usleep(butil::fast_rand_less_than(1000));
+        chan.close();
+        long sent_sum = 0;
+        long sent_count = 0;
+        for (int i = 0; i < NSENDER; ++i) {
+            ASSERT_EQ(0, bthread_join(sth[i], NULL));
+            ASSERT_EQ(ESTOP, sargs[i].rc);
+            sent_sum += sargs[i].sum;
+            sent_count += sargs[i].count;
+        }
+        long recv_sum = 0;
+        long recv_count = 0;
+        for (int i = 0; i < NRECEIVER; ++i) {
+            ASSERT_EQ(0, bthread_join(rth[i], NULL));
+            ASSERT_EQ(ESTOP, rargs[i].rc);
+            recv_sum += rargs[i].sum;
+            recv_count += rargs[i].count;
+        }
+        ASSERT_EQ(sent_count, recv_count) << "round=" << round;
+        ASSERT_EQ(sent_sum, recv_sum) << "round=" << round;
+        ASSERT_EQ(0UL, chan.size());
+    }
+}
+
+TEST(BoundedChannelTest, batch_receive) {
+    LongChannel chan;
+    ASSERT_EQ(0, chan.init(16));
+    for (long i = 0; i < 10; ++i) {
+        ASSERT_EQ(0, chan.send(i));
+    }
+    long items[4];
+    size_t n = 0;
+    ASSERT_EQ(0, chan.recv_batch(items, arraysize(items), &n));
+    ASSERT_EQ(4UL, n);
+    ASSERT_EQ(0, chan.recv_batch(items, arraysize(items), &n));
+    ASSERT_EQ(4UL, n);
+    ASSERT_EQ(0, chan.recv_batch(items, arraysize(items), &n));
+    ASSERT_EQ(2UL, n);
+    ASSERT_EQ(8, items[0]);
+    ASSERT_EQ(9, items[1]);
+    timespec abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(ETIMEDOUT, chan.recv_batch(items, arraysize(items), &n, &abstime));
+    ASSERT_EQ(0UL, n);
+}
+
+void run_mpmc(size_t capacity, int nsender, int nreceiver, bool batch,
+              bool use_pthread) {
+    const long N = 100000;
+    LongChannel chan;
+    ASSERT_EQ(0, chan.init(capacity));
+    ChannelArg sargs[nsender];
+    ChannelArg rargs[nreceiver];
+    bthread_t sth[nsender];
+    bthread_t rth[nreceiver];
+    pthread_t spth[nsender];
+    pthread_t rpth[nreceiver];
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < nreceiver; ++i) {
+        ChannelArg a = { &chan, 0, 0, 0, 0, 0 };
+        rargs[i] = a;
+        void* (*fn)(void*) = (batch ? batch_receiver : receiver);
+        if (use_pthread) {
+            ASSERT_EQ(0, pthread_create(&rpth[i], NULL, fn, &rargs[i]));
+        } else {
+            ASSERT_EQ(0, bthread_start_background(&rth[i], NULL, fn, &rargs[i]));
+        }
+    }
+    for (int i = 0; i < nsender; ++i) {
+        ChannelArg a = { &chan, i * N, (i + 1) * N, 0, 0, 0 };
+        sargs[i] = a;
+        if (use_pthread) {
+            ASSERT_EQ(0, pthread_create(&spth[i], NULL, sender, &sargs[i]));
+        } else {
+            ASSERT_EQ(0, bthread_start_background(&sth[i], NULL, sender, &sargs[i]));
+        }
+    }
+    long sent_sum = 0;
+    for (int i = 0; i < nsender; ++i) {
+        if (use_pthread) {
+            pthread_join(spth[i], NULL);
+        } else {
+            bthread_join(sth[i], NULL);
+        }
+        ASSERT_EQ(0, sargs[i].rc);
+        ASSERT_EQ(N, sargs[i].count);
+        sent_sum += sargs[i].sum;
+    }
+    chan.close();
+    long recv_sum = 0;
+    long recv_count = 0;
+    for (int i = 0; i < nreceiver; ++i) {
+        if (use_pthread) {
+            pthread_join(rpth[i], NULL);
+        } else {
+            bthread_join(rth[i], NULL);
+        }
+        ASSERT_EQ(ESTOP, rargs[i].rc);
+        recv_sum += rargs[i].sum;
+        recv_count += rargs[i].count;
+    }
+    tm.stop();
+    ASSERT_EQ(N * nsender, recv_count);
+    ASSERT_EQ(sent_sum, recv_sum);
+    LOG(INFO) << "capacity=" << capacity << " nsender=" << nsender
+              << " nreceiver=" << nreceiver << " batch=" << batch
+              << " pthread=" << use_pthread << " "
+              << recv_count * 1000000L / (tm.u_elapsed() + 1) << " items/s";
+}
+
+TEST(BoundedChannelTest, mpmc) {
+    run_mpmc(1, 1, 1, false, false);
+    run_mpmc(4, 4, 4, false, false);
+    run_mpmc(64, 8, 2, false, false);
+    run_mpmc(64, 2, 8, true, false);
+    run_mpmc(1024, 8, 8, true, false);
+    run_mpmc(4, 4, 4, false, true);
+    run_mpmc(64, 4, 4, true, true);
+}
+
+// Compare with ExecutionQueue which runs the consumer in a bthread created
+// on demand and never blocks producers.
+int add_all(void* meta, bthread::TaskIterator<long>& iter) {
+    long* sum = (long*)meta;
+    for (; iter; ++iter) {
+        *sum += *iter;
+    }
+    return 0;
+}
+
+void* execute_all(void* arg) {
+    bthread::ExecutionQueueId<long>* id = (bthread::ExecutionQueueId<long>*)arg;
+    for (long i = 0; i < 100000; ++i) {
+        bthread::execution_queue_execute(*id, i);
+    }
+    return NULL;
+}
+
+TEST(BoundedChannelTest, performance_against_execution_queue) {
+    const int nsender = 4;
+    long sum = 0;
+    bthread::ExecutionQueueId<long> id;
+    bthread::ExecutionQueueOptions options;
+    ASSERT_EQ(0, bthread::execution_queue_start(&id, &options, add_all, &sum));
+    bthread_t th[nsender];
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < nsender; ++i) {
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, execute_all, &id));
+    }
+    for (int i = 0; i < nsender; ++i) {
+        bthread_join(th[i], NULL);
+    }
+    ASSERT_EQ(0, bthread::execution_queue_stop(id));
+    ASSERT_EQ(0, bthread::execution_queue_join(id));
+    tm.stop();
+    ASSERT_EQ(nsender * (100000L * 99999 / 2), sum);
+    LOG(INFO) << "ExecutionQueue nsender=" << nsender << " "
+              << nsender * 100000L * 1000000L / (tm.u_elapsed() + 1)
+              << " items/s";
+    run_mpmc(1024, nsender, 1, true, false);
+    run_mpmc(1024, nsender, 1, false, false);
+}
+
+} // namespace
@@ -0,0 +1,149 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <gtest/gtest.h>
+
+#if defined(__cpp_impl_coroutine)
+
+#include <stdexcept>
+#include "butil/time.h"
+#include "bvar/variable.h"
+#include "bthread/coroutine.h"
+
+namespace {
+
+bthread::CoTask<int64_t> sleep_and_measure(int64_t us) {
+    const int64_t start_us = butil::gettimeofday_us();
+    co_await bthread::co_sleep(us);
+    EXPECT_NE(0UL, bthread_self());
+    co_return butil::gettimeofday_us() - start_us;
+}
+
+TEST(CoroutineTest, sleep) {
+    const int64_t elapsed_us = bthread::sync_wait(sleep_and_measure(20000));
+    ASSERT_GE(elapsed_us, 20000);
+    ASSERT_LT(elapsed_us, 200000);
+}
+
+bthread::CoTask<int> add_one(int x) {
+    co_await bthread::co_sleep(1000);
+    co_return x + 1;
+}
+
+bthread::CoTask<int> add_two(int x) {
+    const int y = co_await add_one(x);
+    co_return co_await add_one(y);
+}
+
+bthread::CoTask<void> throw_after_sleep() {
+    co_await bthread::co_sleep(1000);
+    throw std::runtime_error("expected");
+}
+
+TEST(CoroutineTest, nested_and_exception) {
+    ASSERT_EQ(3, bthread::sync_wait(add_two(1)));
+    bool caught = false;
+    try {
+        bthread::sync_wait(throw_after_sleep());
+    } catch (const std::runtime_error&) {
+        caught = true;
+    }
+    ASSERT_TRUE(caught);
+}
+
+struct Counter {
+    bthread::Mutex mutex;
+    int64_t value;
+};
+
+bthread::CoTask<void> increase(Counter* c, int times,
+                               bthread::CountdownEvent* done) {
+    for (int i = 0; i < times; ++i) {
+        co_await bthread::co_lock(c->mutex);
+        const int64_t v = c->value;
+        if (i % 16 == 0) {
+            // Hold the lock across a suspension.
+            co_await bthread::co_sleep(100);
+        }
+        c->value = v + 1;
+        c->mutex.unlock();
+    }
+    done->signal();
+}
+
+void* increase_in_bthread(void* arg) {
+    Counter* c = static_cast<Counter*>(arg);
+    for (int i = 0; i < 1000; ++i) {
+        BAIDU_SCOPED_LOCK(c->mutex);
+        ++c->value;
+    }
+    return NULL;
+}
+
+TEST(CoroutineTest, mutex) {
+    Counter c;
+    c.value = 0;
+    const int N = 50;
+    const int TIMES = 200;
+    bthread::CountdownEvent done(N);
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread::co_start(increase(&c, TIMES, &done)));
+    }
+    bthread_t th[4];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL,
+                                              increase_in_bthread, &c));
+    }
+    ASSERT_EQ(0, done.wait());
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    ASSERT_EQ(N * TIMES + 4000, c.value);
+}
+
+bthread::CoTask<void> wait_butex(butil::atomic<int>* butex,
+                                 butil::atomic<int>* nwoken,
+                                 bthread::CountdownEvent* done) {
+    while (butex->load() == 0) {
+        co_await bthread::co_butex_wait(butex, 0);
+    }
+    nwoken->fetch_add(1);
+    done->signal();
+}
+
+int64_t get_bvar(const char* name) {
+    return strtoll(bvar::Variable::describe_exposed(name).c_str(), NULL, 10);
+}
+
+TEST(CoroutineTest, butex_without_bthreads) {
+    butil::atomic<int>* butex = bthread::butex_create_checked<butil::atomic<int> >();
+    *butex = 0;
+    butil::atomic<int> nwoken(0);
+    const int N = 10000;
+    bthread::CountdownEvent done(N);
+    const int64_t nbthread_before = get_bvar("bthread_count");
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread::co_start(wait_butex(butex, &nwoken, &done)));
+    }
+    usleep(100000);
+    ASSERT_EQ(0, nwoken.load());
+    // Suspended coroutines don't occupy bthreads.
+    ASSERT_LT(get_bvar("bthread_count") - nbthread_before, N / 10);
+
+    ASSERT_EQ(EWOULDBLOCK, bthread::sync_wait(
+                  [](void* b) -> bthread::CoTask<int> {
+                      if (co_await bthread::co_butex_wait(b, 1) < 0) {
+                          co_return errno;
+                      }
+                      co_return 0;
+                  }(butex)));
+
+    *butex = 1;
+    ASSERT_EQ(N, bthread::butex_wake_all(butex));
+    ASSERT_EQ(0, done.wait());
+    ASSERT_EQ(N, nwoken.load());
+    bthread::butex_destroy(butex);
+}
+
+} // namespace
+
+#endif  // __cpp_impl_coroutine
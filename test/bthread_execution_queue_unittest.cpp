@@ -695,4 +695,141 @@ TEST_F(ExecutionQueueTest, cancel_unexecuted_high_priority_task) {
 
     ASSERT_EQ(12345, result);
 }
+struct BatchMeta {
+    int64_t sum;
+    int max_batch;
+    int nbatch;
+    butil::atomic<bool> blocking;
+    butil::atomic<bool> blocked;
+};
+
+int add_in_batches(void* meta, bthread::TaskIterator<LongIntTask>& iter) {
+    BatchMeta* m = (BatchMeta*)meta;
+    if (iter.is_queue_stopped()) {
+        return 0;
+    }
+    int n = 0;
+    for (; iter; ++iter) {
+        if (iter->value < 0) {
+            m->blocked = true;
+            while (m->blocking) {
+                usleep(100);
+            }
+            continue;
+        }
+        m->sum += iter->value;
+        ++n;
+    }
+    m->max_batch = std::max(m->max_batch, n);
+    ++m->nbatch;
+    return 0;
+}
+
+TEST_F(ExecutionQueueTest, max_tasks_in_batch) {
+    BatchMeta m;
+    m.sum = 0;
+    m.max_batch = 0;
+    m.nbatch = 0;
+    m.blocking = true;
+    m.blocked = false;
+    bthread::ExecutionQueueId<LongIntTask> queue_id = { 0 };
+    bthread::ExecutionQueueOptions options;
+    options.max_tasks_in_batch = 10;
+    ASSERT_EQ(0, bthread::execution_queue_start(&queue_id, &options,
+                                                add_in_batches, &m));
+    // Block the consumer to accumulate tasks.
+    ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, -1));
+    while (!m.blocked) {
+        usleep(100);
+    }
+    int64_t expected = 0;
+    for (int i = 0; i < 1000; ++i) {
+        expected += i;
+        ASSERT_EQ(0, bthread::execution_queue_execute(queue_id, i));
+    }
+    m.blocking = false;
+    ASSERT_EQ(0, bthread::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, bthread::execution_queue_join(queue_id));
+    ASSERT_EQ(expected, m.sum);
+    ASSERT_EQ(10, m.max_batch);
+    ASSERT_GE(m.nbatch, 100);
+}
+
+struct KeyedTask {
+    uint64_t key;
+    int64_t seq;
+};
+
+const size_t NKEY = 64;
+
+struct KeyedMeta {
+    // Each key is consumed by one queue, no race on the slots.
+    int64_t last_seq[NKEY];
+    butil::atomic<int64_t> disorder;
+    butil::atomic<int64_t> nexecuted;
+};
+
+int check_order(void* meta, bthread::TaskIterator<KeyedTask>& iter) {
+    KeyedMeta* m = (KeyedMeta*)meta;
+    for (; iter; ++iter) {
+        if (iter->seq != m->last_seq[iter->key] + 1) {
+            m->disorder.fetch_add(1);
+        }
+        m->last_seq[iter->key] = iter->seq;
+        m->nexecuted.fetch_add(1, butil::memory_order_relaxed);
+    }
+    return 0;
+}
+
+struct KeyedPushArg {
+    bthread::ExecutionQueueGroup<KeyedTask>* group;
+    uint64_t first_key;
+    int times;
+};
+
+void* push_keyed(void* arg) {
+    KeyedPushArg* a = (KeyedPushArg*)arg;
+    // Every thread owns 8 keys so that seqs of one key are sequential.
+    for (int i = 0; i < a->times; ++i) {
+        KeyedTask t;
+        t.key = a->first_key + i % 8;
+        t.seq = i / 8 + 1;
+        EXPECT_EQ(0, a->group->execute(t.key, t));
+    }
+    return NULL;
+}
+
+TEST_F(ExecutionQueueTest, group_keeps_order_per_key) {
+    KeyedMeta m;
+    memset(m.last_seq, 0, sizeof(m.last_seq));
+    m.disorder = 0;
+    m.nexecuted = 0;
+    bthread::ExecutionQueueGroup<KeyedTask> group;
+    bthread::ExecutionQueueOptions options;
+    options.max_tasks_in_batch = 32;
+    ASSERT_EQ(0, group.init(4, &options, check_order, &m));
+    ASSERT_EQ(4UL, group.queue_count());
+    ASSERT_EQ(EINVAL, group.init(4, &options, check_order, &m));
+
+    const int TIMES = 8000;
+    pthread_t th[NKEY / 8];
+    KeyedPushArg args[NKEY / 8];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        args[i].group = &group;
+        args[i].first_key = i * 8;
+        args[i].times = TIMES;
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, push_keyed, &args[i]));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        pthread_join(th[i], NULL);
+    }
+    ASSERT_EQ(0, group.stop());
+    ASSERT_EQ(0, group.join());
+    ASSERT_NE(0, group.execute(0, KeyedTask()));
+    ASSERT_EQ(0, m.disorder.load());
+    ASSERT_EQ((int64_t)(TIMES * ARRAY_SIZE(th)), m.nexecuted.load());
+    for (size_t i = 0; i < NKEY; ++i) {
+        ASSERT_EQ(TIMES / 8, m.last_seq[i]);
+    }
+}
 } // namespace
@@ -0,0 +1,206 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "bthread/future.h"
+
+namespace {
+
+struct SetLaterArg {
+    bthread::Promise<int>* promise;
+    int value;
+    int64_t delay_us;
+};
+
+void* set_later(void* void_arg) {
+    SetLaterArg* arg = static_cast<SetLaterArg*>(void_arg);
+    bthread_usleep(arg->delay_us);
+    arg->promise->set_value(arg->value);
+    return NULL;
+}
+
+int g_got = 0;
+
+void* get_in_bthread(void* arg) {
+    g_got = static_cast<bthread::Future<int>*>(arg)->get();
+    return NULL;
+}
+
+TEST(FutureTest, set_and_get) {
+    bthread::Promise<int> p;
+    bthread::Future<int> f = p.get_future();
+    ASSERT_TRUE(f.valid());
+    ASSERT_FALSE(f.is_ready());
+    ASSERT_EQ(ETIMEDOUT, f.timed_wait(butil::milliseconds_from_now(10)));
+
+    SetLaterArg arg = { &p, 7, 20000 };
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, NULL, set_later, &arg));
+    bthread_t getter;
+    ASSERT_EQ(0, bthread_start_background(&getter, NULL, get_in_bthread, &f));
+    ASSERT_EQ(0, bthread_join(getter, NULL));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_FALSE(f.valid());
+    ASSERT_EQ(7, g_got);
+}
+
+TEST(FutureTest, wait_from_pthread) {
+    bthread::Promise<std::string> p;
+    bthread::Future<std::string> f = p.get_future();
+    bthread::Promise<int> p2;
+    bthread::Future<int> f2 = p2.get_future();
+    SetLaterArg arg = { &p2, 3, 10000 };
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, NULL, set_later, &arg));
+    ASSERT_EQ(0, f2.wait());
+    ASSERT_TRUE(f2.is_ready());
+    ASSERT_EQ(3, f2.get());
+    p.set_value("hello");
+    ASSERT_EQ("hello", f.get());
+    ASSERT_EQ(0, bthread_join(th, NULL));
+}
+
+TEST(FutureTest, then) {
+    bthread::Promise<int> p;
+    bthread::Future<std::string> f = p.get_future()
+        .then([](int x) { return x * 2; })
+        .then([](int x) { ASSERT_EQ(10, x); })
+        .then([]() { return std::string("done"); });
+    ASSERT_FALSE(f.is_ready());
+    p.set_value(5);
+    ASSERT_TRUE(f.is_ready());
+    ASSERT_EQ("done", f.get());
+
+    // Callbacks run immediately on ready futures.
+    ASSERT_EQ(2, bthread::make_ready_future(1).then(
+                  [](int x) { return x + 1; }).get());
+    int called = 0;
+    bthread::make_ready_future().then([&called]() { ++called; }).get();
+    ASSERT_EQ(1, called);
+}
+
+TEST(FutureTest, move_only_value) {
+    bthread::Promise<std::unique_ptr<int> > p;
+    bthread::Future<std::unique_ptr<int> > f = p.get_future();
+    p.set_value(new int(3));
+    std::unique_ptr<int> v = f.get();
+    ASSERT_EQ(3, *v);
+}
+
+TEST(FutureTest, broken_promise) {
+    bthread::Future<int> f;
+    bthread::Future<int> f2;
+    {
+        bthread::Promise<int> p;
+        f = p.get_future();
+        bthread::Promise<int> p2;
+        f2 = p2.get_future();
+        p2.set_value(1);
+    }
+    ASSERT_TRUE(f.is_ready());
+    ASSERT_EQ(0, f.wait());
+    bool called = false;
+    bthread::Future<void> f3 = f.then([&called](int) { called = true; });
+    ASSERT_TRUE(f3.is_ready());
+    ASSERT_FALSE(called);
+    ASSERT_EQ(1, f2.get());
+}
+
+TEST(FutureTest, throwing_then_callback) {
+    bthread::Promise<int> p;
+    bthread::Future<int> f = p.get_future().then([](int x) -> int {
+            throw std::runtime_error("expected");
+        });
+    // The exception does not reach the thread setting the value.
+    p.set_value(1);
+    // The callback is gone and the returned future is broken.
+    ASSERT_TRUE(f.is_ready());
+    bool called = false;
+    f.then([&called](int) { called = true; });
+    ASSERT_FALSE(called);
+
+    // Same for a future which is already ready.
+    bthread::Future<int> f2 = bthread::make_ready_future(1).then(
+        [](int x) -> int { throw std::runtime_error("expected"); });
+    ASSERT_TRUE(f2.is_ready());
+    f2.then([&called](int) { called = true; });
+    ASSERT_FALSE(called);
+}
+
+struct ThrowingCallback : public bthread::internal::FutureCallback {
+    void run() {
+        std::unique_ptr<ThrowingCallback> self_guard(this);
+        throw std::runtime_error("expected");
+    }
+};
+
+struct CountingCallback : public bthread::internal::FutureCallback {
+    explicit CountingCallback(int* n) : nrun(n) {}
+    void run() {
+        ++*nrun;
+        delete this;
+    }
+    int* nrun;
+};
+
+TEST(FutureTest, callbacks_after_throwing_one_still_run) {
+    bthread::internal::FutureState<int>* s =
+        bthread::internal::FutureState<int>::create();
+    int nrun = 0;
+    s->add_callback(new ThrowingCallback);
+    s->add_callback(new CountingCallback(&nrun));
+    s->set_value(1);
+    ASSERT_EQ(1, nrun);
+    s->release();
+}
+
+TEST(FutureTest, when_all_and_when_any) {
+    const size_t N = 10;
+    std::vector<bthread::Promise<int> > promises(N);
+    std::vector<bthread::Future<int> > futures;
+    for (size_t i = 0; i < N; ++i) {
+        futures.push_back(promises[i].get_future());
+    }
+    bthread::Future<void> all = bthread::when_all(futures);
+    bthread::Future<size_t> any = bthread::when_any(futures);
+    ASSERT_FALSE(all.is_ready());
+    ASSERT_FALSE(any.is_ready());
+
+    std::vector<SetLaterArg> args(N);
+    std::vector<bthread_t> tids(N);
+    for (size_t i = 0; i < N; ++i) {
+        // The 4th one is set first.
+        SetLaterArg arg = { &promises[i], (int)i,
+                            i == 3 ? 1000 : 50000 + (int64_t)i * 1000 };
+        args[i] = arg;
+        ASSERT_EQ(0, bthread_start_background(&tids[i], NULL, set_later, &args[i]));
+    }
+    ASSERT_EQ(3UL, any.get());
+    ASSERT_EQ(0, all.wait());
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_TRUE(futures[i].is_ready());
+        ASSERT_EQ((int)i, futures[i].get());
+        ASSERT_EQ(0, bthread_join(tids[i], NULL));
+    }
+
+    std::vector<bthread::Future<void> > empty;
+    ASSERT_TRUE(bthread::when_all(empty).is_ready());
+    ASSERT_EQ(0UL, bthread::when_any(empty).get());
+}
+
+TEST(FutureTest, states_are_pooled) {
+    void* first_state = NULL;
+    {
+        bthread::Promise<int> p;
+        first_state = p._state;
+    }
+    bthread::Promise<int> p;
+    ASSERT_EQ(first_state, (void*)p._state);
+}
+
+} // namespace
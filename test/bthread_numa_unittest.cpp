@@ -0,0 +1,102 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <sched.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "bthread/bthread.h"
+#include "bthread/numa.h"
+#include "bthread/task_control.h"
+#include "bthread/task_group.h"
+
+DECLARE_bool(bthread_pin_workers);
+
+namespace {
+
+TEST(NumaTest, parse_cpu_list) {
+    std::vector<int> cpus;
+    ASSERT_EQ(0, bthread::parse_cpu_list("0-3,8,10-11\n", &cpus));
+    const int expected[] = { 0, 1, 2, 3, 8, 10, 11 };
+    ASSERT_EQ(std::vector<int>(expected, expected + arraysize(expected)), cpus);
+    ASSERT_EQ(0, bthread::parse_cpu_list("5", &cpus));
+    ASSERT_EQ(1ul, cpus.size());
+    ASSERT_EQ(5, cpus[0]);
+    // Memory-only nodes have empty cpulist.
+    ASSERT_EQ(0, bthread::parse_cpu_list("\n", &cpus));
+    ASSERT_TRUE(cpus.empty());
+    ASSERT_EQ(-1, bthread::parse_cpu_list("3-1", &cpus));
+    ASSERT_EQ(-1, bthread::parse_cpu_list("a", &cpus));
+    ASSERT_EQ(-1, bthread::parse_cpu_list("1-2x", &cpus));
+    ASSERT_EQ(-1, bthread::parse_cpu_list("-1", &cpus));
+}
+
+TEST(NumaTest, get_numa_nodes) {
+    std::vector<std::vector<int> > nodes;
+    const int n = bthread::get_numa_nodes(&nodes);
+    ASSERT_GE(n, 1);
+    ASSERT_LE(n, bthread::MAX_NUMA_NODES);
+    ASSERT_EQ((size_t)n, nodes.size());
+    cpu_set_t allowed;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        ASSERT_FALSE(nodes[i].empty());
+        for (size_t j = 0; j < nodes[i].size(); ++j) {
+            ASSERT_TRUE(CPU_ISSET(nodes[i][j], &allowed)) << nodes[i][j];
+        }
+        LOG(INFO) << "node" << i << " has " << nodes[i].size() << " cpus";
+    }
+}
+
+TEST(NumaTest, steal_from_local_node_first) {
+    // Not initialized, no workers.
+    bthread::TaskControl* c = new bthread::TaskControl;
+    c->_nnode = 2;
+    bthread::TaskGroup* g0 = c->create_group(0);
+    bthread::TaskGroup* g1 = c->create_group(1);
+    ASSERT_TRUE(g0 && g1);
+    ASSERT_EQ(0, g0->_numa_node);
+    const bthread::ParkingLot* pl = c->_pools[BTHREAD_TAG_DEFAULT]->pl[1];
+    ASSERT_TRUE(g1->_pl >= pl &&
+                g1->_pl < pl + bthread::TaskControl::PARKING_LOT_NUM);
+    ASSERT_TRUE(g0->_rq.push(100));
+    ASSERT_TRUE(g0->_rq.push(101));
+    ASSERT_TRUE(g1->_rq.push(200));
+    size_t seed = 0;
+    bthread_t tid = 0;
+    // Workers on node 1 take the task of node 1 first.
+    ASSERT_TRUE(c->steal_task(&tid, &seed, 1, 1));
+    ASSERT_EQ(200ul, tid);
+    ASSERT_TRUE(c->steal_task(&tid, &seed, 1, 1));
+    ASSERT_EQ(100ul, tid);
+    ASSERT_TRUE(c->steal_task(&tid, &seed, 1, 0));
+    ASSERT_EQ(101ul, tid);
+    ASSERT_FALSE(c->steal_task(&tid, &seed, 1, 0));
+    // `c' is leaked intentionally since destroying TaskControl stops
+    // global epoll threads.
+}
+
+void* get_affinity(void* arg) {
+    cpu_set_t* cs = (cpu_set_t*)arg;
+    CPU_ZERO(cs);
+    pthread_getaffinity_np(pthread_self(), sizeof(*cs), cs);
+    return NULL;
+}
+
+TEST(NumaTest, pin_workers) {
+    // Workers are not created yet, the main thread has the affinity mask of
+    // the process, which may not include CPU0 (e.g. under taskset).
+    cpu_set_t allowed;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+    FLAGS_bthread_pin_workers = true;
+    bthread_t th;
+    cpu_set_t cs;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, get_affinity, &cs));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(1, CPU_COUNT(&cs));
+    cpu_set_t both;
+    CPU_AND(&both, &cs, &allowed);
+    ASSERT_EQ(1, CPU_COUNT(&both));
+}
+
+} // namespace
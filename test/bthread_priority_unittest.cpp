@@ -0,0 +1,170 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <vector>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "butil/atomicops.h"
+#include "bthread/bthread.h"
+
+namespace bthread {
+DECLARE_int32(bthread_priority_starvation_limit);
+}
+
+namespace {
+
+// Tasks are queued into a pool with one worker which is blocked, so that
+// the order of running is decided by the worker only.
+bthread_tag_t get_single_worker_pool() {
+    bthread_tag_t tag = bthread_find_worker_pool("prio_test");
+    if (tag == BTHREAD_TAG_INVALID) {
+        EXPECT_EQ(0, bthread_add_worker_pool("prio_test", 1, &tag));
+    }
+    return tag;
+}
+
+butil::atomic<bool> g_blocker_started(false);
+butil::atomic<bool> g_stop_blocker(false);
+
+void* block_worker(void*) {
+    g_blocker_started = true;
+    while (!g_stop_blocker.load(butil::memory_order_relaxed)) {}
+    return NULL;
+}
+
+butil::atomic<int> g_seq(0);
+
+struct OrderArg {
+    int order;
+};
+
+void* record_order(void* arg) {
+    static_cast<OrderArg*>(arg)->order = g_seq.fetch_add(1);
+    return NULL;
+}
+
+class PriorityTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        _tag = get_single_worker_pool();
+        g_seq = 0;
+        g_blocker_started = false;
+        g_stop_blocker = false;
+        bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+        attr.tag = _tag;
+        ASSERT_EQ(0, bthread_start_background(&_blocker, &attr,
+                                              block_worker, NULL));
+        while (!g_blocker_started) {
+            usleep(100);
+        }
+    }
+
+    void start(OrderArg* arg, bthread_priority_t prio, int64_t deadline_us) {
+        bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+        attr.tag = _tag;
+        attr.priority = prio;
+        attr.deadline_us = deadline_us;
+        bthread_t th;
+        ASSERT_EQ(0, bthread_start_background(&th, &attr, record_order, arg));
+        _tids.push_back(th);
+    }
+
+    void run_all() {
+        g_stop_blocker = true;
+        ASSERT_EQ(0, bthread_join(_blocker, NULL));
+        for (size_t i = 0; i < _tids.size(); ++i) {
+            ASSERT_EQ(0, bthread_join(_tids[i], NULL));
+        }
+        _tids.clear();
+    }
+
+    bthread_tag_t _tag;
+    bthread_t _blocker;
+    std::vector<bthread_t> _tids;
+};
+
+TEST_F(PriorityTest, high_priority_runs_first) {
+    OrderArg normal[5];
+    for (int i = 0; i < 5; ++i) {
+        start(&normal[i], BTHREAD_PRIORITY_NORMAL, 0);
+    }
+    OrderArg high;
+    start(&high, BTHREAD_PRIORITY_HIGH, 0);
+    run_all();
+    ASSERT_EQ(0, high.order);
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_EQ(i + 1, normal[i].order);
+    }
+}
+
+TEST_F(PriorityTest, earliest_deadline_first) {
+    const int64_t now_us = butil::gettimeofday_us();
+    OrderArg no_deadline;
+    OrderArg args[3];
+    start(&no_deadline, BTHREAD_PRIORITY_HIGH, 0);
+    start(&args[0], BTHREAD_PRIORITY_NORMAL, now_us + 3000000);
+    start(&args[1], BTHREAD_PRIORITY_HIGH, now_us + 1000000);
+    start(&args[2], BTHREAD_PRIORITY_NORMAL, now_us + 2000000);
+    run_all();
+    ASSERT_EQ(0, args[1].order);
+    ASSERT_EQ(1, args[2].order);
+    ASSERT_EQ(2, args[0].order);
+    ASSERT_EQ(3, no_deadline.order);
+}
+
+TEST_F(PriorityTest, normal_ones_are_not_starved) {
+    const int32_t saved_limit = bthread::FLAGS_bthread_priority_starvation_limit;
+    bthread::FLAGS_bthread_priority_starvation_limit = 2;
+    OrderArg normal;
+    start(&normal, BTHREAD_PRIORITY_NORMAL, 0);
+    OrderArg high[10];
+    for (int i = 0; i < 10; ++i) {
+        start(&high[i], BTHREAD_PRIORITY_HIGH, 0);
+    }
+    run_all();
+    bthread::FLAGS_bthread_priority_starvation_limit = saved_limit;
+    ASSERT_EQ(2, normal.order);
+    ASSERT_EQ(0, high[0].order);
+    ASSERT_EQ(1, high[1].order);
+    ASSERT_EQ(3, high[2].order);
+}
+
+butil::atomic<bool> g_sleeper_started(false);
+
+void* sleep_and_record_order(void* arg) {
+    g_sleeper_started = true;
+    bthread_usleep(10000);
+    return record_order(arg);
+}
+
+TEST_F(PriorityTest, woken_up_with_priority) {
+    // Let the blocker go so that the sleeper can start.
+    g_stop_blocker = true;
+    ASSERT_EQ(0, bthread_join(_blocker, NULL));
+    g_sleeper_started = false;
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = _tag;
+    attr.priority = BTHREAD_PRIORITY_HIGH;
+    OrderArg high;
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, &attr,
+                                          sleep_and_record_order, &high));
+    while (!g_sleeper_started) {
+        usleep(100);
+    }
+    SetUp();
+    OrderArg normal[5];
+    for (int i = 0; i < 5; ++i) {
+        start(&normal[i], BTHREAD_PRIORITY_NORMAL, 0);
+    }
+    // The sleeper is woken up by the TimerThread while the worker is blocked.
+    usleep(50000);
+    _tids.push_back(th);
+    run_all();
+    ASSERT_EQ(0, high.order);
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_EQ(i + 1, normal[i].order);
+    }
+}
+
+} // namespace
@@ -8,6 +8,15 @@
 #include <gtest/gtest.h>
 #include "butil/time.h"
 #include "butil/macros.h"
+#include "butil/logging.h"
+#include "butil/fast_rand.h"
+#include "bthread/bthread.h"
+#include "bthread/rwlock.h"
+
+namespace bthread {
+extern bool ContentionProfilerStart(const char* filename);
+extern void ContentionProfilerStop();
+}
 
 namespace {
 void* read_thread(void* arg) {
@@ -62,4 +71,355 @@ TEST(RWLockTest, rdlock_performance) {
     pthread_mutex_destroy(&lock1);
 #endif
 }
+
+TEST(RWLockTest, sanity) {
+    bthread_rwlock_t rw;
+    ASSERT_EQ(0, bthread_rwlock_init(&rw, NULL));
+    ASSERT_EQ(0, bthread_rwlock_rdlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(EBUSY, bthread_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_wrlock(&rw));
+    ASSERT_EQ(EBUSY, bthread_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(EBUSY, bthread_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0u, *rw.lock_butex);
+    ASSERT_EQ(0, bthread_rwlock_destroy(&rw));
+
+    bthread_rwlockattr_t attr;
+    int pref = 0;
+    ASSERT_EQ(0, bthread_rwlockattr_init(&attr));
+    ASSERT_EQ(0, bthread_rwlockattr_getkind_np(&attr, &pref));
+    ASSERT_EQ(PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP, pref);
+    ASSERT_EQ(EINVAL, bthread_rwlockattr_setkind_np(&attr, -1));
+    ASSERT_EQ(0, bthread_rwlockattr_destroy(&attr));
+}
+
+void* wrlocker(void* arg) {
+    bthread_rwlock_t* rw = (bthread_rwlock_t*)arg;
+    bthread_rwlock_wrlock(rw);
+    bthread_usleep(10000);
+    bthread_rwlock_unlock(rw);
+    return NULL;
+}
+
+struct TimedLockArg {
+    bthread_rwlock_t* rw;
+    int rc;
+};
+
+void* timed_wrlocker(void* void_arg) {
+    TimedLockArg* arg = (TimedLockArg*)void_arg;
+    const timespec abstime = butil::milliseconds_from_now(10);
+    arg->rc = bthread_rwlock_timedwrlock(arg->rw, &abstime);
+    return NULL;
+}
+
+TEST(RWLockTest, writer_preference) {
+    bthread_rwlock_t rw;
+    ASSERT_EQ(0, bthread_rwlock_init(&rw, NULL));
+    ASSERT_EQ(0, bthread_rwlock_rdlock(&rw));
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, wrlocker, &rw));
+    bthread_usleep(5000);
+    // New readers wait for the waiting writer.
+    ASSERT_EQ(EBUSY, bthread_rwlock_tryrdlock(&rw));
+    timespec abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(ETIMEDOUT, bthread_rwlock_timedrdlock(&rw, &abstime));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    // Got after the writer.
+    const int64_t start_us = butil::gettimeofday_us();
+    ASSERT_EQ(0, bthread_rwlock_rdlock(&rw));
+    ASSERT_GT(butil::gettimeofday_us() - start_us, 5000);
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(0u, *rw.lock_butex);
+    ASSERT_EQ(0, bthread_rwlock_destroy(&rw));
+}
+
+TEST(RWLockTest, timed_writer_lets_readers_in) {
+    bthread_rwlock_t rw;
+    ASSERT_EQ(0, bthread_rwlock_init(&rw, NULL));
+    ASSERT_EQ(0, bthread_rwlock_rdlock(&rw));
+    bthread_t th;
+    TimedLockArg arg = { &rw, 0 };
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, timed_wrlocker, &arg));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(ETIMEDOUT, arg.rc);
+    // Readers are not blocked anymore.
+    ASSERT_EQ(0, bthread_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    timespec abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(ETIMEDOUT, bthread_rwlock_timedwrlock(&rw, &abstime));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(0, bthread_rwlock_timedwrlock(&rw, &abstime));
+    abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(ETIMEDOUT, bthread_rwlock_timedrdlock(&rw, &abstime));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0u, *rw.lock_butex);
+    ASSERT_EQ(0, bthread_rwlock_destroy(&rw));
+}
+
+void* rdlocker(void* arg) {
+    bthread_rwlock_t* rw = (bthread_rwlock_t*)arg;
+    bthread_rwlock_rdlock(rw);
+    bthread_rwlock_unlock(rw);
+    return NULL;
+}
+
+TEST(RWLockTest, writer_wakes_up_readers_only_if_waiting) {
+    const unsigned READER_WAITING = 1u << 29;
+    bthread_rwlock_t rw;
+    ASSERT_EQ(0, bthread_rwlock_init(&rw, NULL));
+    ASSERT_EQ(0, bthread_rwlock_wrlock(&rw));
+    ASSERT_EQ(0u, *rw.lock_butex & READER_WAITING);
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+
+    ASSERT_EQ(0, bthread_rwlock_wrlock(&rw));
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, rdlocker, &rw));
+    bthread_usleep(5000);
+    // The blocked reader asks the writer to wake it up.
+    ASSERT_TRUE(*rw.lock_butex & READER_WAITING);
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(0u, *rw.lock_butex);
+    ASSERT_EQ(0, bthread_rwlock_destroy(&rw));
+}
+
+struct BAIDU_CACHELINE_ALIGNMENT MixedArg {
+    bthread::RWLock* rw;
+    int64_t* values;  // 2 values modified by writers together.
+    bool writer;
+    bool stop;
+    bool inconsistent;
+    int64_t count;
+};
+
+void* mixed_locker(void* void_arg) {
+    MixedArg* arg = (MixedArg*)void_arg;
+    while (!*(volatile bool*)&arg->stop) {
+        if (arg->writer) {
+            std::unique_lock<bthread::RWLock> lck(*arg->rw);
+            ++arg->values[0];
+            bthread_yield();
+            ++arg->values[1];
+        } else {
+            bthread::ReadLockGuard guard(*arg->rw);
+            if (arg->values[0] != arg->values[1]) {
+                arg->inconsistent = true;
+            }
+        }
+        ++arg->count;
+    }
+    return NULL;
+}
+
+void run_mixed(int nreader, int nwriter) {
+    bthread::RWLock rw;
+    int64_t values[2] = { 0, 0 };
+    std::vector<MixedArg> args(nreader + nwriter);
+    std::vector<bthread_t> th(args.size());
+    for (size_t i = 0; i < args.size(); ++i) {
+        MixedArg arg = { &rw, values, (int)i < nwriter, false, false, 0 };
+        args[i] = arg;
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, mixed_locker, &args[i]));
+    }
+    bthread_usleep(200000);
+    for (size_t i = 0; i < args.size(); ++i) {
+        args[i].stop = true;
+    }
+    int64_t nwrite = 0;
+    for (size_t i = 0; i < args.size(); ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+        ASSERT_FALSE(args[i].inconsistent);
+        ASSERT_GT(args[i].count, 0) << "Starved writer=" << args[i].writer;
+        if (args[i].writer) {
+            nwrite += args[i].count;
+        }
+    }
+    ASSERT_EQ(nwrite, values[0]);
+    ASSERT_EQ(nwrite, values[1]);
+}
+
+TEST(RWLockTest, mixed_readers_and_writers) {
+    run_mixed(8, 2);
+}
+
+struct BAIDU_CACHELINE_ALIGNMENT StressArg {
+    bthread_rwlock_t* rw;
+    int64_t* values;  // 2 values modified by writers together.
+    int type;  // STRESS_READER, STRESS_WRITER or STRESS_TIMED_WRITER
+    bool stop;
+    bool done;
+    bool inconsistent;
+    int64_t nwrite;
+    int64_t ntimedout;
+};
+
+const int STRESS_READER = 0;
+const int STRESS_WRITER = 1;
+const int STRESS_TIMED_WRITER = 2;
+
+void* stress_locker(void* void_arg) {
+    StressArg* arg = (StressArg*)void_arg;
+    while (!*(volatile bool*)&arg->stop) {
+        if (arg->type == STRESS_READER) {
+            bthread_rwlock_rdlock(arg->rw);
+            if (arg->values[0] != arg->values[1]) {
+                arg->inconsistent = true;
+            }
+            bthread_rwlock_unlock(arg->rw);
+            continue;
+        }
+        if (arg->type == STRESS_TIMED_WRITER) {
+            // Time out at any point of waiting, including right before
+            // other writers leave.
+            const timespec abstime =
+                butil::microseconds_from_now(butil::fast_rand_less_than(100));
+            const int rc = bthread_rwlock_timedwrlock(arg->rw, &abstime);
+            if (rc != 0) {
+                if (rc != ETIMEDOUT) {
+                    arg->inconsistent = true;
+                }
+                ++arg->ntimedout;
+                continue;
+            }
+        } else {
+            bthread_rwlock_wrlock(arg->rw);
+        }
+        ++arg->values[0];
+        bthread_yield();
+        ++arg->values[1];
+        bthread_rwlock_unlock(arg->rw);
+        ++arg->nwrite;
+    }
+    *(volatile bool*)&arg->done = true;
+    return NULL;
+}
+
+TEST(RWLockTest, timed_and_untimed_writers_with_readers) {
+    bthread_rwlock_t rw;
+    ASSERT_EQ(0, bthread_rwlock_init(&rw, NULL));
+    int64_t values[2] = { 0, 0 };
+    const int types[] = { STRESS_READER, STRESS_READER, STRESS_READER,
+                          STRESS_READER, STRESS_WRITER, STRESS_WRITER,
+                          STRESS_TIMED_WRITER, STRESS_TIMED_WRITER,
+                          STRESS_TIMED_WRITER, STRESS_TIMED_WRITER };
+    const size_t N = arraysize(types);
+    std::vector<StressArg> args(N);
+    bthread_t th[N];
+    for (size_t i = 0; i < N; ++i) {
+        StressArg arg = { &rw, values, types[i], false, false, false, 0, 0 };
+        args[i] = arg;
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, stress_locker,
+                                              &args[i]));
+    }
+    bthread_usleep(1000000);
+    for (size_t i = 0; i < N; ++i) {
+        args[i].stop = true;
+    }
+    // A lost wakeup leaves a writer(and readers behind it) sleeping forever,
+    // check before joining.
+    const int64_t deadline_us = butil::gettimeofday_us() + 5000000L;
+    for (size_t i = 0; i < N; ++i) {
+        while (!*(volatile bool*)&args[i].done &&
+               butil::gettimeofday_us() < deadline_us) {
+            bthread_usleep(1000);
+        }
+        ASSERT_TRUE(args[i].done) << "Stuck locker, type=" << args[i].type;
+    }
+    int64_t nwrite = 0;
+    int64_t ntimedout = 0;
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+        ASSERT_FALSE(args[i].inconsistent);
+        nwrite += args[i].nwrite;
+        ntimedout += args[i].ntimedout;
+    }
+    LOG(INFO) << "nwrite=" << nwrite << " ntimedout=" << ntimedout;
+    ASSERT_GT(ntimedout, 0);
+    ASSERT_EQ(nwrite, values[0]);
+    ASSERT_EQ(nwrite, values[1]);
+    ASSERT_EQ(0u, *rw.lock_butex);
+    ASSERT_EQ(0u, *rw.writer_butex & 0xFFFFF/*number of waiting writers*/);
+    ASSERT_EQ(0, bthread_rwlock_destroy(&rw));
+}
+
+TEST(RWLockTest, contention_profiler) {
+    ASSERT_TRUE(bthread::ContentionProfilerStart("rwlock.contention"));
+    run_mixed(8, 2);
+    bthread::ContentionProfilerStop();
+}
+
+struct BAIDU_CACHELINE_ALIGNMENT ScalingArg {
+    bthread_rwlock_t* rw;
+    bthread_mutex_t* m;
+    bool stop;
+    int64_t count;
+};
+
+void* scaling_reader(void* void_arg) {
+    ScalingArg* arg = (ScalingArg*)void_arg;
+    int64_t count = 0;
+    while (!*(volatile bool*)&arg->stop) {
+        if (arg->rw) {
+            bthread_rwlock_rdlock(arg->rw);
+            bthread_rwlock_unlock(arg->rw);
+        } else {
+            bthread_mutex_lock(arg->m);
+            bthread_mutex_unlock(arg->m);
+        }
+        ++count;
+    }
+    arg->count = count;
+    return NULL;
+}
+
+// Returns reads per second of `nreader' bthreads.
+int64_t measure_reads(bthread_rwlock_t* rw, bthread_mutex_t* m, int nreader) {
+    std::vector<ScalingArg> args(nreader);
+    std::vector<bthread_t> th(nreader);
+    for (int i = 0; i < nreader; ++i) {
+        ScalingArg arg = { rw, m, false, 0 };
+        args[i] = arg;
+        if (bthread_start_background(&th[i], NULL, scaling_reader, &args[i]) != 0) {
+            return -1;
+        }
+    }
+    butil::Timer tm;
+    tm.start();
+    bthread_usleep(100000);
+    for (int i = 0; i < nreader; ++i) {
+        args[i].stop = true;
+    }
+    int64_t total = 0;
+    for (int i = 0; i < nreader; ++i) {
+        bthread_join(th[i], NULL);
+        total += args[i].count;
+    }
+    tm.stop();
+    return total * 1000000L / tm.u_elapsed();
+}
+
+TEST(RWLockTest, reader_scaling_performance) {
+    bthread_rwlock_t rw;
+    ASSERT_EQ(0, bthread_rwlock_init(&rw, NULL));
+    bthread_mutex_t m;
+    ASSERT_EQ(0, bthread_mutex_init(&m, NULL));
+    const int nreaders[] = { 1, 2, 4, 8, 16 };
+    for (size_t i = 0; i < ARRAY_SIZE(nreaders); ++i) {
+        const int64_t rwlock_qps = measure_reads(&rw, NULL, nreaders[i]);
+        const int64_t mutex_qps = measure_reads(NULL, &m, nreaders[i]);
+        LOG(INFO) << "nreader=" << nreaders[i]
+                  << " bthread_rwlock=" << rwlock_qps << "/s"
+                  << " bthread_mutex=" << mutex_qps << "/s";
+    }
+    ASSERT_EQ(0, bthread_mutex_destroy(&m));
+    ASSERT_EQ(0, bthread_rwlock_destroy(&rw));
+}
 } // namespace
@@ -0,0 +1,178 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <gtest/gtest.h>
+#include "butil/atomicops.h"
+#include "butil/time.h"
+#include "butil/macros.h"
+#include "butil/logging.h"
+#include "bthread/bthread.h"
+
+namespace {
+
+TEST(SemaphoreTest, sanity) {
+    bthread_sem_t sem;
+    ASSERT_EQ(0, bthread_sem_init(&sem, 2));
+    int value = -1;
+    ASSERT_EQ(0, bthread_sem_getvalue(&sem, &value));
+    ASSERT_EQ(2, value);
+    ASSERT_EQ(0, bthread_sem_wait(&sem));
+    ASSERT_EQ(0, bthread_sem_trywait(&sem));
+    ASSERT_EQ(EAGAIN, bthread_sem_trywait(&sem));
+    timespec abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(ETIMEDOUT, bthread_sem_timedwait(&sem, &abstime));
+    ASSERT_EQ(0, bthread_sem_post_n(&sem, 3));
+    ASSERT_EQ(0, bthread_sem_getvalue(&sem, &value));
+    ASSERT_EQ(3, value);
+    abstime = butil::milliseconds_from_now(10);
+    ASSERT_EQ(0, bthread_sem_timedwait(&sem, &abstime));
+    ASSERT_EQ(0, bthread_sem_destroy(&sem));
+}
+
+struct WaitArg {
+    bthread_sem_t* sem;
+    butil::atomic<int>* nwaited;
+    const timespec* abstime;
+    int rc;
+};
+
+void* waiter(void* void_arg) {
+    WaitArg* arg = (WaitArg*)void_arg;
+    arg->rc = (arg->abstime ? bthread_sem_timedwait(arg->sem, arg->abstime)
+               : bthread_sem_wait(arg->sem));
+    if (arg->rc == 0) {
+        arg->nwaited->fetch_add(1);
+    }
+    return NULL;
+}
+
+TEST(SemaphoreTest, post_wakes_up_waiters) {
+    bthread_sem_t sem;
+    ASSERT_EQ(0, bthread_sem_init(&sem, 0));
+    butil::atomic<int> nwaited(0);
+    WaitArg args[4];
+    bthread_t th[ARRAY_SIZE(args)];
+    for (size_t i = 0; i < ARRAY_SIZE(args); ++i) {
+        WaitArg arg = { &sem, &nwaited, NULL, -1 };
+        args[i] = arg;
+        ASSERT_EQ(0, bthread_start_urgent(&th[i], NULL, waiter, &args[i]));
+    }
+    bthread_usleep(5000);
+    ASSERT_EQ(0, nwaited.load());
+    ASSERT_EQ(0, bthread_sem_post(&sem));
+    bthread_usleep(5000);
+    ASSERT_EQ(1, nwaited.load());
+    ASSERT_EQ(0, bthread_sem_post_n(&sem, 3));
+    for (size_t i = 0; i < ARRAY_SIZE(args); ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+        ASSERT_EQ(0, args[i].rc);
+    }
+    ASSERT_EQ(4, nwaited.load());
+    ASSERT_EQ(0, bthread_sem_destroy(&sem));
+}
+
+TEST(SemaphoreTest, timed_out_waiter_does_not_lose_posts) {
+    bthread_sem_t sem;
+    ASSERT_EQ(0, bthread_sem_init(&sem, 0));
+    butil::atomic<int> nwaited(0);
+    const timespec abstime = butil::milliseconds_from_now(5);
+    WaitArg timed_args[8];
+    bthread_t timed_th[ARRAY_SIZE(timed_args)];
+    WaitArg arg = { &sem, &nwaited, NULL, -1 };
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, waiter, &arg));
+    for (size_t i = 0; i < ARRAY_SIZE(timed_args); ++i) {
+        WaitArg targ = { &sem, &nwaited, &abstime, -1 };
+        timed_args[i] = targ;
+        ASSERT_EQ(0, bthread_start_urgent(&timed_th[i], NULL, waiter,
+                                          &timed_args[i]));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(timed_args); ++i) {
+        ASSERT_EQ(0, bthread_join(timed_th[i], NULL));
+        ASSERT_EQ(ETIMEDOUT, timed_args[i].rc);
+    }
+    ASSERT_EQ(0, bthread_sem_post(&sem));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(0, arg.rc);
+    ASSERT_EQ(0, bthread_sem_destroy(&sem));
+}
+
+struct PingPongArg {
+    bthread_sem_t* consume;
+    bthread_sem_t* produce;
+    int64_t* counter;
+    int times;
+};
+
+void* ping_pong(void* void_arg) {
+    PingPongArg* arg = (PingPongArg*)void_arg;
+    for (int i = 0; i < arg->times; ++i) {
+        bthread_sem_wait(arg->consume);
+        ++*arg->counter;
+        bthread_sem_post(arg->produce);
+    }
+    return NULL;
+}
+
+// A producer hands items to consumers through a one-slot buffer guarded by
+// two semaphores.
+TEST(SemaphoreTest, producer_consumer) {
+    bthread_sem_t full;
+    bthread_sem_t empty;
+    ASSERT_EQ(0, bthread_sem_init(&full, 0));
+    ASSERT_EQ(0, bthread_sem_init(&empty, 1));
+    int64_t counter = 0;
+    const int N = 100000;
+    const int NTHREAD = 4;
+    PingPongArg producer = { &empty, &full, &counter, N * NTHREAD };
+    PingPongArg consumer = { &full, &empty, &counter, N };
+    bthread_t pth;
+    bthread_t cth[NTHREAD];
+    butil::Timer tm;
+    tm.start();
+    ASSERT_EQ(0, bthread_start_background(&pth, NULL, ping_pong, &producer));
+    for (int i = 0; i < NTHREAD; ++i) {
+        ASSERT_EQ(0, bthread_start_background(&cth[i], NULL, ping_pong, &consumer));
+    }
+    ASSERT_EQ(0, bthread_join(pth, NULL));
+    for (int i = 0; i < NTHREAD; ++i) {
+        ASSERT_EQ(0, bthread_join(cth[i], NULL));
+    }
+    tm.stop();
+    ASSERT_EQ(2 * N * NTHREAD, counter);
+    LOG(INFO) << "post+wait=" << tm.n_elapsed() / (N * NTHREAD * 2) << "ns";
+    ASSERT_EQ(0, bthread_sem_destroy(&full));
+    ASSERT_EQ(0, bthread_sem_destroy(&empty));
+}
+
+TEST(SemaphoreTest, many_waiters) {
+    const int N = 10000;
+    bthread_sem_t sem;
+    ASSERT_EQ(0, bthread_sem_init(&sem, 0));
+    butil::atomic<int> nwaited(0);
+    std::vector<WaitArg> args(N);
+    std::vector<bthread_t> th(N);
+    for (int i = 0; i < N; ++i) {
+        WaitArg arg = { &sem, &nwaited, NULL, -1 };
+        args[i] = arg;
+        ASSERT_EQ(0, bthread_start_background(&th[i], &BTHREAD_ATTR_SMALL,
+                                              waiter, &args[i]));
+    }
+    butil::Timer tm;
+    tm.start();
+    // Wake up all waiters one by one.
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_sem_post(&sem));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    tm.stop();
+    ASSERT_EQ(N, nwaited.load());
+    LOG(INFO) << "Woke up " << N << " waiters in " << tm.u_elapsed() << "us";
+    int value = -1;
+    ASSERT_EQ(0, bthread_sem_getvalue(&sem, &value));
+    ASSERT_EQ(0, value);
+    ASSERT_EQ(0, bthread_sem_destroy(&sem));
+}
+
+} // namespace
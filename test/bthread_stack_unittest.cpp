@@ -0,0 +1,105 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "bvar/variable.h"
+#include "bthread/bthread.h"
+#include "bthread/stack.h"
+
+DECLARE_int32(bthread_stack_trim_threshold);
+DECLARE_int32(bthread_max_cached_stacks);
+DECLARE_int32(stack_size_normal);
+
+namespace {
+
+int64_t get_bvar(const char* name) {
+    const std::string value = bvar::Variable::describe_exposed(name);
+    EXPECT_FALSE(value.empty()) << name;
+    return strtoll(value.c_str(), NULL, 10);
+}
+
+butil::atomic<int> g_nstarted(0);
+butil::atomic<bool> g_stop(false);
+butil::atomic<int> g_checksum(0);
+
+// Touch some pages of the stack and stay alive until stopped.
+void* use_stack(void*) {
+    char buf[65536];
+    memset(buf, 1, sizeof(buf));
+    g_nstarted.fetch_add(1);
+    while (!g_stop.load(butil::memory_order_relaxed)) {
+        bthread_usleep(1000);
+    }
+    int sum = 0;
+    for (size_t i = 0; i < sizeof(buf); i += 4096) {
+        sum += buf[i];
+    }
+    g_checksum.fetch_add(sum);
+    return NULL;
+}
+
+void run_burst(std::vector<bthread_t>* tids, int n) {
+    g_nstarted = 0;
+    g_stop = false;
+    g_checksum = 0;
+    tids->resize(n);
+    for (int i = 0; i < n; ++i) {
+        ASSERT_EQ(0, bthread_start_background(&(*tids)[i], NULL, use_stack, NULL));
+    }
+    while (g_nstarted.load() != n) {
+        usleep(1000);
+    }
+}
+
+void finish_burst(std::vector<bthread_t>* tids) {
+    g_stop = true;
+    for (size_t i = 0; i < tids->size(); ++i) {
+        ASSERT_EQ(0, bthread_join((*tids)[i], NULL));
+    }
+    ASSERT_EQ((int)tids->size() * 65536 / 4096, g_checksum.load());
+    tids->clear();
+}
+
+TEST(StackTest, idle_stacks_are_capped) {
+    const int32_t saved_max = FLAGS_bthread_max_cached_stacks;
+    FLAGS_bthread_max_cached_stacks = 16;
+    std::vector<bthread_t> tids;
+    run_burst(&tids, 500);
+    const int64_t peak_count = get_bvar("bthread_stack_count");
+    const int64_t peak_memory = get_bvar("bthread_stack_memory");
+    ASSERT_GE(peak_count, 500);
+    ASSERT_GE(peak_memory, 500LL * FLAGS_stack_size_normal);
+    finish_burst(&tids);
+
+    ASSERT_LE(bthread::NormalStackClass::nidle.load(butil::memory_order_relaxed),
+              16);
+    ASSERT_LE(get_bvar("bthread_stack_count"), peak_count - 400);
+    ASSERT_LT(get_bvar("bthread_stack_memory"), peak_memory);
+    ASSERT_GE(get_bvar("bthread_stack_memory_max"), peak_memory);
+    // Stacks are not trimmed by default.
+    ASSERT_EQ(0, get_bvar("bthread_stack_trimmed_count"));
+
+    // Wrappers whose storage was released are still usable.
+    run_burst(&tids, 500);
+    finish_burst(&tids);
+    FLAGS_bthread_max_cached_stacks = saved_max;
+}
+
+TEST(StackTest, trimmed_stacks_are_reusable) {
+    const int32_t saved_threshold = FLAGS_bthread_stack_trim_threshold;
+    FLAGS_bthread_stack_trim_threshold = 0;
+    const int64_t trimmed0 = get_bvar("bthread_stack_trimmed_count");
+    std::vector<bthread_t> tids;
+    for (int i = 0; i < 3; ++i) {
+        run_burst(&tids, 100);
+        finish_burst(&tids);
+    }
+    ASSERT_GE(get_bvar("bthread_stack_trimmed_count") - trimmed0, 100);
+    FLAGS_bthread_stack_trim_threshold = saved_threshold;
+}
+
+} // namespace
@@ -1,8 +1,11 @@
 // Copyright (c) 2014 Baidu, Inc.
 // Author: Yang Liu (yangliu@baidu.com)
 
+#include <pthread.h>
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
+#include "butil/fast_rand.h"
+#include "butil/time.h"
 #include "bthread/sys_futex.h"
 #include "bthread/timer_thread.h"
 #include "bthread/bthread.h"
@@ -240,4 +243,173 @@ TEST(TimerThreadTest, schedule_and_unschedule_in_task) {
     keeper5.expect_first_run();
 }
 
+struct DelayArg {
+    int64_t expected_us;
+    int64_t run_us;
+};
+
+void record_run_time(void* arg) {
+    static_cast<DelayArg*>(arg)->run_us = butil::gettimeofday_us();
+}
+
+void check_accuracy(bool use_timing_wheel) {
+    bthread::TimerThread timer_thread;
+    bthread::TimerThreadOptions options;
+    options.use_timing_wheel = use_timing_wheel;
+    ASSERT_EQ(0, timer_thread.start(&options));
+    // Cover slots of level-0 and cascading from level-1 of the wheel.
+    const size_t N = 2000;
+    std::vector<DelayArg> args(N);
+    const int64_t now_us = butil::gettimeofday_us();
+    for (size_t i = 0; i < N; ++i) {
+        args[i].expected_us = now_us + butil::fast_rand_less_than(1500000);
+        args[i].run_us = 0;
+        timer_thread.schedule(record_run_time, &args[i],
+                              butil::microseconds_to_timespec(args[i].expected_us));
+    }
+    usleep(1600000);
+    timer_thread.stop_and_join();
+    int64_t max_delay_us = 0;
+    int64_t total_delay_us = 0;
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_GE(args[i].run_us, args[i].expected_us);
+        const int64_t delay_us = args[i].run_us - args[i].expected_us;
+        max_delay_us = std::max(max_delay_us, delay_us);
+        total_delay_us += delay_us;
+    }
+    LOG(INFO) << "use_timing_wheel=" << use_timing_wheel
+              << " avg_delay_us=" << total_delay_us / (int64_t)N
+              << " max_delay_us=" << max_delay_us;
+    // The timer thread may be descheduled occasionally on a busy machine,
+    // check the average instead of the maximum delay.
+    EXPECT_LT(total_delay_us / (int64_t)N, 5000);
+    EXPECT_LT(max_delay_us, 200000);
+}
+
+TEST(TimerThreadTest, accuracy) {
+    check_accuracy(false);
+    check_accuracy(true);
+}
+
+// Returns true if all tasks ran within one tick(1ms) of the wheel.
+bool run_beyond_first_wheel_level() {
+    bthread::TimerThread timer_thread;
+    bthread::TimerThreadOptions options;
+    options.use_timing_wheel = true;
+    EXPECT_EQ(0, timer_thread.start(&options));
+    // Level-0 of the wheel covers 256 ticks, these tasks are linked into
+    // level-1 and cascaded into level-0 before running.
+    const int64_t delays_ms[] = { 300, 517, 800 };
+    const size_t N = arraysize(delays_ms);
+    DelayArg args[N];
+    const int64_t now_us = butil::gettimeofday_us();
+    for (size_t i = 0; i < N; ++i) {
+        args[i].expected_us = now_us + delays_ms[i] * 1000L;
+        args[i].run_us = 0;
+        timer_thread.schedule(record_run_time, &args[i],
+                              butil::microseconds_to_timespec(args[i].expected_us));
+    }
+    usleep(900000);
+    timer_thread.stop_and_join();
+    bool in_one_tick = true;
+    for (size_t i = 0; i < N; ++i) {
+        EXPECT_GE(args[i].run_us, args[i].expected_us);
+        const int64_t delay_us = args[i].run_us - args[i].expected_us;
+        LOG(INFO) << "delay_ms=" << delays_ms[i] << " late_us=" << delay_us;
+        if (delay_us >= 1000) {
+            in_one_tick = false;
+        }
+    }
+    return in_one_tick;
+}
+
+TEST(TimerThreadTest, timer_beyond_first_wheel_level_fires_in_one_tick) {
+    // The timer thread may be descheduled occasionally on a busy machine,
+    // a task misplaced in the wheel would be late by hundreds of ticks in
+    // every round.
+    bool in_one_tick = false;
+    for (int i = 0; i < 3 && !in_one_tick; ++i) {
+        in_one_tick = run_beyond_first_wheel_level();
+    }
+    EXPECT_TRUE(in_one_tick);
+}
+
+void do_nothing(void*) {}
+
+void* schedule_and_unschedule(void* arg) {
+    bthread::TimerThread* timer_thread = (bthread::TimerThread*)arg;
+    // Keep so many tasks in flight like timeouts of concurrent RPC.
+    const size_t WINDOW = 32768;
+    std::vector<bthread::TimerThread::TaskId> ids(WINDOW, bthread::TimerThread::INVALID_TASK_ID);
+    for (size_t i = 0; i < 500000; ++i) {
+        bthread::TimerThread::TaskId& id = ids[i % WINDOW];
+        if (id != bthread::TimerThread::INVALID_TASK_ID) {
+            timer_thread->unschedule(id);
+        }
+        id = timer_thread->schedule(do_nothing, NULL,
+                                    butil::milliseconds_from_now(1000));
+    }
+    for (size_t i = 0; i < WINDOW; ++i) {
+        timer_thread->unschedule(ids[i]);
+    }
+    return NULL;
+}
+
+// Wake up the timer thread every millisecond like short sleeps in servers,
+// so that scheduled tasks are pulled before being unscheduled.
+struct Ticker {
+    bthread::TimerThread* timer_thread;
+    butil::atomic<bool> stop;
+};
+
+void tick(void* arg) {
+    Ticker* t = (Ticker*)arg;
+    if (!t->stop.load(butil::memory_order_relaxed)) {
+        t->timer_thread->schedule(tick, t, butil::milliseconds_from_now(1));
+    }
+}
+
+int64_t thread_cputime_us(pthread_t th) {
+    clockid_t cid;
+    timespec ts;
+    if (pthread_getcpuclockid(th, &cid) != 0 || clock_gettime(cid, &ts) != 0) {
+        return -1;
+    }
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+TEST(TimerThreadTest, schedule_unschedule_throughput) {
+    for (int use_timing_wheel = 0; use_timing_wheel < 2; ++use_timing_wheel) {
+        bthread::TimerThread timer_thread;
+        bthread::TimerThreadOptions options;
+        options.use_timing_wheel = use_timing_wheel;
+        ASSERT_EQ(0, timer_thread.start(&options));
+        Ticker ticker;
+        ticker.timer_thread = &timer_thread;
+        ticker.stop = false;
+        tick(&ticker);
+        const int nthread = 4;
+        pthread_t th[nthread];
+        butil::Timer tm;
+        tm.start();
+        for (int i = 0; i < nthread; ++i) {
+            ASSERT_EQ(0, pthread_create(&th[i], NULL, schedule_and_unschedule,
+                                        &timer_thread));
+        }
+        for (int i = 0; i < nthread; ++i) {
+            pthread_join(th[i], NULL);
+        }
+        tm.stop();
+        // Let the timer thread drop all unscheduled tasks.
+        usleep(1100000);
+        ticker.stop = true;
+        const int64_t cputime_us = thread_cputime_us(timer_thread.thread_id());
+        timer_thread.stop_and_join();
+        LOG(INFO) << "use_timing_wheel=" << use_timing_wheel
+                  << " schedule+unschedule="
+                  << nthread * 500000L * 1000000L / tm.u_elapsed() << "/s"
+                  << " cputime_of_timer_thread=" << cputime_us / 1000 << "ms";
+    }
+}
+
 } // end namespace
@@ -12,6 +12,18 @@
 #include "bthread/bthread.h"
 #include "bthread/unstable.h"
 #include "bthread/task_meta.h"
+#include "bthread/task_control.h"
+#include "bthread/task_group.h"
+#include "bthread/processor.h"
+#include "bvar/variable.h"
+
+DECLARE_int32(task_group_yield_before_idle);
+
+namespace bthread {
+DECLARE_bool(show_bthread_sched_latency_in_vars);
+DECLARE_int32(bthread_max_spin_before_park);
+extern TaskControl* g_task_control;
+}
 
 namespace {
 class BthreadTest : public ::testing::Test{
@@ -518,4 +530,151 @@ TEST_F(BthreadTest, yield_single_thread) {
     ASSERT_EQ(0, bthread_join(tid, NULL));
 }
 
+static void* spin_and_yield(void*) {
+    const int64_t end_us = butil::gettimeofday_us() + 2000;
+    while (butil::gettimeofday_us() < end_us) {
+        bthread_yield();
+    }
+    return NULL;
+}
+
+static int64_t get_count_of(const char* name) {
+    return strtoll(bvar::Variable::describe_exposed(name).c_str(), NULL, 10);
+}
+
+TEST_F(BthreadTest, sched_latency_and_cputime) {
+    const char* sched_count = "bthread_worker_pool_default_sched_count";
+    const char* cputime_count = "bthread_worker_pool_default_cputime_count";
+    // Not exposed until the flag is on.
+    ASSERT_TRUE(bvar::Variable::describe_exposed(sched_count).empty());
+    ASSERT_TRUE(bvar::Variable::describe_exposed(cputime_count).empty());
+    const int64_t sched_count_before = get_count_of(sched_count);
+    const int64_t cputime_count_before = get_count_of(cputime_count);
+    bthread::FLAGS_show_bthread_sched_latency_in_vars = true;
+    bthread_t th[8];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, spin_and_yield, NULL));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, bthread_join(th[i], NULL));
+    }
+    bthread::FLAGS_show_bthread_sched_latency_in_vars = false;
+    // Every yield goes through the runqueue.
+    ASSERT_GT(get_count_of(sched_count) - sched_count_before,
+              (int64_t)ARRAY_SIZE(th));
+    ASSERT_GE(get_count_of(cputime_count) - cputime_count_before,
+              (int64_t)ARRAY_SIZE(th));
+}
+
+static void* short_task(void* arg) {
+    butil::atomic<int>* counter = (butil::atomic<int>*)arg;
+    for (int i = 0; i < 100; ++i) {
+        cpu_relax();
+    }
+    counter->fetch_add(1, butil::memory_order_relaxed);
+    return NULL;
+}
+
+// Futex calls of parking and waking up workers per task with bursts of
+// short tasks. Waking up workers for a flushed burst costs fewer calls than
+// waking up them for each task, and spinning workers are neither parked nor
+// signaled.
+TEST_F(BthreadTest, futex_calls_per_task) {
+    const int saved_max_spin = bthread::FLAGS_bthread_max_spin_before_park;
+    const int saved_yield = FLAGS_task_group_yield_before_idle;
+    FLAGS_task_group_yield_before_idle = 0;
+    // Make sure that workers are created.
+    bthread_t th0;
+    ASSERT_EQ(0, bthread_start_background(&th0, NULL, dummy_thread, NULL));
+    ASSERT_EQ(0, bthread_join(th0, NULL));
+    bthread::TaskControl* c = bthread::g_task_control;
+    ASSERT_TRUE(c);
+    const int BURST = 64;
+    const int NBURST = 2000;
+    // Indexed by [spinning][batched].
+    double futex_calls_per_task[2][2] = { { 0, 0 }, { 0, 0 } };
+    for (int spinning = 0; spinning < 2; ++spinning) {
+        bthread::FLAGS_bthread_max_spin_before_park = (spinning ? 64 : 0);
+        for (int batched = 0; batched < 2; ++batched) {
+            butil::atomic<int> counter(0);
+            bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+            if (batched) {
+                attr = BTHREAD_ATTR_NORMAL | BTHREAD_NOSIGNAL;
+            }
+            const int64_t futex_calls_before =
+                c->get_cumulated_futex_call_count();
+            butil::Timer tm;
+            tm.start();
+            for (int i = 0; i < NBURST; ++i) {
+                for (int j = 0; j < BURST; ++j) {
+                    bthread_t th;
+                    ASSERT_EQ(0, bthread_start_background(
+                                  &th, &attr, short_task, &counter));
+                }
+                if (batched) {
+                    bthread_flush();
+                }
+                while (counter.load(butil::memory_order_relaxed) <
+                       (i + 1) * BURST) {
+                    cpu_relax();
+                }
+            }
+            tm.stop();
+            const int64_t futex_calls =
+                c->get_cumulated_futex_call_count() - futex_calls_before;
+            futex_calls_per_task[spinning][batched] =
+                (double)futex_calls / (BURST * NBURST);
+            LOG(INFO) << (spinning ? "spinning" : "not spinning") << ' '
+                      << (batched ? "batched" : "unbatched")
+                      << " futex_calls_per_task="
+                      << futex_calls_per_task[spinning][batched]
+                      << " ns_per_task=" << tm.n_elapsed() / (BURST * NBURST);
+        }
+    }
+    bthread::FLAGS_bthread_max_spin_before_park = saved_max_spin;
+    FLAGS_task_group_yield_before_idle = saved_yield;
+    ASSERT_LE(futex_calls_per_task[0][1], futex_calls_per_task[0][0]);
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= 1) {
+        LOG(INFO) << "Workers don't spin on a single CPU, skip comparing";
+        return;
+    }
+    ASSERT_LE(futex_calls_per_task[1][0], futex_calls_per_task[0][0]);
+}
+
+static void* signal_later(void* arg) {
+    usleep(10000);
+    static_cast<bthread::ParkingLot*>(arg)->signal(1);
+    return NULL;
+}
+
+TEST_F(BthreadTest, spin_rounds_adapt_to_parking_time) {
+    bthread_t th0;
+    ASSERT_EQ(0, bthread_start_background(&th0, NULL, dummy_thread, NULL));
+    ASSERT_EQ(0, bthread_join(th0, NULL));
+    const int saved_max_spin = bthread::FLAGS_bthread_max_spin_before_park;
+    bthread::FLAGS_bthread_max_spin_before_park = 64;
+    // A group not running, parking on its own lot.
+    bthread::TaskGroup g(bthread::g_task_control, 0, BTHREAD_TAG_DEFAULT);
+    bthread::ParkingLot pl;
+    g._pl = &pl;
+    ASSERT_EQ(0, g._nspin);
+    // Signaled before parking, so wait() returns at once.
+    for (int i = 0; i < 10; ++i) {
+        const bthread::ParkingLot::State st = pl.get_state();
+        pl.signal(1);
+        g.park(st);
+    }
+    ASSERT_EQ(64, g._nspin);
+    // Signaled long after parking.
+    for (int expected = 32; g._nspin > 0; expected /= 2) {
+        const bthread::ParkingLot::State st = pl.get_state();
+        pthread_t th;
+        ASSERT_EQ(0, pthread_create(&th, NULL, signal_later, &pl));
+        g.park(st);
+        ASSERT_EQ(0, pthread_join(th, NULL));
+        ASSERT_EQ(expected, g._nspin);
+    }
+    bthread::FLAGS_bthread_max_spin_before_park = saved_max_spin;
+}
+
 } // namespace
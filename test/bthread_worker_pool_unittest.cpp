@@ -0,0 +1,179 @@
+// Copyright (c) 2014 Baidu, Inc.
+
+#include <string>
+#include <gtest/gtest.h>
+#include "butil/time.h"
+#include "butil/atomicops.h"
+#include "butil/logging.h"
+#include "bvar/variable.h"
+#include "bthread/bthread.h"
+#include "bthread/countdown_event.h"
+
+namespace {
+
+bthread_tag_t get_or_add_pool(const char* name, int concurrency) {
+    bthread_tag_t tag = bthread_find_worker_pool(name);
+    if (tag == BTHREAD_TAG_INVALID) {
+        EXPECT_EQ(0, bthread_add_worker_pool(name, concurrency, &tag));
+    }
+    return tag;
+}
+
+TEST(WorkerPoolTest, add_and_find) {
+    const bthread_tag_t tag = get_or_add_pool("wp_test", 2);
+    ASSERT_GT(tag, BTHREAD_TAG_DEFAULT);
+    ASSERT_EQ(tag, bthread_find_worker_pool("wp_test"));
+    ASSERT_EQ(BTHREAD_TAG_DEFAULT, bthread_find_worker_pool("default"));
+    ASSERT_EQ(BTHREAD_TAG_INVALID, bthread_find_worker_pool("not_exist"));
+    ASSERT_EQ(2, bthread_getconcurrency_by_tag(tag));
+    ASSERT_EQ(bthread_getconcurrency(),
+              bthread_getconcurrency_by_tag(BTHREAD_TAG_DEFAULT));
+    ASSERT_EQ(-1, bthread_getconcurrency_by_tag(BTHREAD_MAX_TAGS));
+    bthread_tag_t tag2 = BTHREAD_TAG_INVALID;
+    ASSERT_EQ(EEXIST, bthread_add_worker_pool("wp_test", 2, &tag2));
+    ASSERT_EQ(EINVAL, bthread_add_worker_pool("wp_test2", 0, &tag2));
+    ASSERT_EQ(BTHREAD_TAG_INVALID, bthread_self_tag());
+    ASSERT_EQ(EPERM, bthread_switch_worker_pool(tag));
+    // Workers are counted after they start running.
+    std::string nworkers;
+    for (int i = 0; i < 1000; ++i) {
+        nworkers = bvar::Variable::describe_exposed(
+            "bthread_worker_pool_wp_test_worker_count");
+        if (nworkers == "2") {
+            break;
+        }
+        usleep(1000);
+    }
+    ASSERT_EQ("2", nworkers);
+}
+
+struct TagArg {
+    bthread_tag_t tag;
+    bthread_tag_t child_tag;
+};
+
+void* get_child_tag(void* arg) {
+    static_cast<TagArg*>(arg)->child_tag = bthread_self_tag();
+    return NULL;
+}
+
+void* get_tag(void* arg) {
+    TagArg* a = static_cast<TagArg*>(arg);
+    a->tag = bthread_self_tag();
+    // Children run in the pool of the creator by default.
+    bthread_t th;
+    EXPECT_EQ(0, bthread_start_urgent(&th, NULL, get_child_tag, a));
+    EXPECT_EQ(0, bthread_join(th, NULL));
+    return NULL;
+}
+
+TEST(WorkerPoolTest, start_in_pool) {
+    const bthread_tag_t tag = get_or_add_pool("wp_test", 2);
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    ASSERT_EQ(BTHREAD_TAG_INVALID, attr.tag);
+    for (int i = 0; i < 2; ++i) {
+        TagArg a = { BTHREAD_TAG_INVALID, BTHREAD_TAG_INVALID };
+        bthread_t th;
+        attr.tag = tag;
+        if (i == 0) {
+            ASSERT_EQ(0, bthread_start_background(&th, &attr, get_tag, &a));
+        } else {
+            ASSERT_EQ(0, bthread_start_urgent(&th, &attr, get_tag, &a));
+        }
+        ASSERT_EQ(0, bthread_join(th, NULL));
+        ASSERT_EQ(tag, a.tag);
+        ASSERT_EQ(tag, a.child_tag);
+    }
+    TagArg a = { BTHREAD_TAG_INVALID, BTHREAD_TAG_INVALID };
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, NULL, get_tag, &a));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(BTHREAD_TAG_DEFAULT, a.tag);
+    attr.tag = BTHREAD_MAX_TAGS;
+    ASSERT_EQ(EINVAL, bthread_start_background(&th, &attr, get_tag, &a));
+}
+
+struct CrossPoolArg {
+    bthread_tag_t target;
+    bthread_tag_t tag_after_switch;
+    bthread_tag_t tag_after_sleep;
+    bthread_tag_t tag_after_wait;
+    bthread::CountdownEvent* event;
+};
+
+void* switch_and_wait(void* arg) {
+    CrossPoolArg* a = static_cast<CrossPoolArg*>(arg);
+    EXPECT_EQ(0, bthread_switch_worker_pool(a->target));
+    a->tag_after_switch = bthread_self_tag();
+    bthread_usleep(1000);
+    a->tag_after_sleep = bthread_self_tag();
+    // Woken up by a bthread of another pool.
+    a->event->wait();
+    a->tag_after_wait = bthread_self_tag();
+    return NULL;
+}
+
+void* signal_event(void* arg) {
+    bthread_usleep(10000);
+    static_cast<bthread::CountdownEvent*>(arg)->signal();
+    return NULL;
+}
+
+TEST(WorkerPoolTest, wakeup_across_pools) {
+    const bthread_tag_t tag = get_or_add_pool("wp_test", 2);
+    for (int i = 0; i < 10; ++i) {
+        bthread::CountdownEvent event(1);
+        CrossPoolArg a = { tag, BTHREAD_TAG_INVALID, BTHREAD_TAG_INVALID,
+                           BTHREAD_TAG_INVALID, &event };
+        bthread_t th1;
+        bthread_t th2;
+        ASSERT_EQ(0, bthread_start_background(&th1, NULL, switch_and_wait, &a));
+        ASSERT_EQ(0, bthread_start_background(&th2, NULL, signal_event, &event));
+        ASSERT_EQ(0, bthread_join(th1, NULL));
+        ASSERT_EQ(0, bthread_join(th2, NULL));
+        ASSERT_EQ(tag, a.tag_after_switch);
+        ASSERT_EQ(tag, a.tag_after_sleep);
+        ASSERT_EQ(tag, a.tag_after_wait);
+    }
+}
+
+butil::atomic<bool> g_stop_busy(false);
+
+void* busy_loop(void*) {
+    while (!g_stop_busy.load(butil::memory_order_relaxed)) {}
+    return NULL;
+}
+
+void* record_start_time(void* arg) {
+    *static_cast<int64_t*>(arg) = butil::gettimeofday_us();
+    return NULL;
+}
+
+TEST(WorkerPoolTest, isolated_from_busy_pool) {
+    const bthread_tag_t tag = get_or_add_pool("wp_test", 2);
+    // Occupy all workers of the default pool.
+    const int nbusy = bthread_getconcurrency_by_tag(BTHREAD_TAG_DEFAULT) * 2;
+    std::vector<bthread_t> busy(nbusy);
+    g_stop_busy = false;
+    for (int i = 0; i < nbusy; ++i) {
+        ASSERT_EQ(0, bthread_start_background(&busy[i], NULL, busy_loop, NULL));
+    }
+    usleep(10000);
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = tag;
+    for (int i = 0; i < 10; ++i) {
+        int64_t start_us = 0;
+        const int64_t begin_us = butil::gettimeofday_us();
+        bthread_t th;
+        ASSERT_EQ(0, bthread_start_background(&th, &attr, record_start_time,
+                                              &start_us));
+        ASSERT_EQ(0, bthread_join(th, NULL));
+        ASSERT_LT(start_us - begin_us, 100000);
+    }
+    g_stop_busy = true;
+    for (int i = 0; i < nbusy; ++i) {
+        ASSERT_EQ(0, bthread_join(busy[i], NULL));
+    }
+}
+
+} // namespace
@@ -3,9 +3,13 @@
 // Author: Ge,Jun (gejun@baidu.com)
 // Date: 2010-12-04 11:59
 
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <gtest/gtest.h>
 #include "butil/errno.h"
 #include "butil/endpoint.h"
+#include "butil/fd_guard.h"
 #include "butil/logging.h"
 
 namespace {
@@ -109,4 +113,125 @@ TEST(EndPointTest, hash_table) {
     ASSERT_EQ(2u, m.size());
 }
 
+TEST(EndPointTest, tcp_listen_reuse_port) {
+    butil::fd_guard fd1(butil::tcp_listen(butil::EndPoint(butil::IP_ANY, 0),
+                                          true, true));
+    ASSERT_GE(fd1, 0) << berror();
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::get_local_side(fd1, &point));
+    ASSERT_NE(0, point.port);
+
+    // Listening to the same port again succeeds with SO_REUSEPORT only.
+    butil::fd_guard fd2(butil::tcp_listen(point, true, true));
+    ASSERT_GE(fd2, 0) << berror();
+    butil::fd_guard fd3(butil::tcp_listen(point, true, false));
+    ASSERT_LT(fd3, 0);
+}
+
+TEST(EndPointTest, unix_socket) {
+    const char* path = "/tmp/endpoint_unittest.sock";
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::str2endpoint("unix:/tmp/endpoint_unittest.sock", &point));
+    ASSERT_TRUE(butil::is_unix_endpoint(point));
+    ASSERT_STREQ(path, butil::endpoint2unix_path(point));
+    ASSERT_STREQ("unix:/tmp/endpoint_unittest.sock",
+                 butil::endpoint2str(point).c_str());
+    std::ostringstream oss;
+    oss << point;
+    ASSERT_EQ("unix:/tmp/endpoint_unittest.sock", oss.str());
+
+    // Same path, same endpoint.
+    butil::EndPoint point2;
+    ASSERT_EQ(0, butil::hostname2endpoint("unix:/tmp/endpoint_unittest.sock",
+                                          &point2));
+    ASSERT_EQ(point, point2);
+    ASSERT_EQ(0, butil::unix_path2endpoint("/tmp/other.sock", &point2));
+    ASSERT_NE(point, point2);
+    ASSERT_EQ(-1, butil::str2endpoint("unix:", &point2));
+    ASSERT_FALSE(butil::is_unix_endpoint(butil::EndPoint(butil::IP_NONE, 80)));
+    ASSERT_EQ(NULL, butil::endpoint2unix_path(butil::EndPoint()));
+
+    // Regular files are never removed.
+    unlink(path);
+    butil::fd_guard file_fd(open(path, O_CREAT | O_WRONLY, 0600));
+    ASSERT_GE(file_fd, 0);
+    ASSERT_LT(butil::tcp_listen(point, true), 0);
+    ASSERT_EQ(0, access(path, F_OK));
+    unlink(path);
+
+    butil::fd_guard listen_fd(butil::tcp_listen(point, true));
+    ASSERT_GE(listen_fd, 0) << berror();
+    // The path of a running server is not stolen.
+    ASSERT_LT(butil::tcp_listen(point, false), 0);
+    ASSERT_LT(butil::tcp_listen(point, true), 0);
+    ASSERT_EQ(EADDRINUSE, errno);
+    ASSERT_LT(butil::tcp_listen(point, true, true), 0);
+    // Socket files left by last listening are removed with reuse_addr only.
+    listen_fd.reset(-1);
+    ASSERT_LT(butil::tcp_listen(point, false), 0);
+    listen_fd.reset(butil::tcp_listen(point, true));
+    ASSERT_GE(listen_fd, 0) << berror();
+    butil::EndPoint local;
+    ASSERT_EQ(0, butil::get_local_side(listen_fd, &local));
+    ASSERT_EQ(point, local);
+
+    butil::fd_guard client_fd(butil::tcp_connect(point, NULL));
+    ASSERT_GE(client_fd, 0) << berror();
+    butil::EndPoint remote;
+    ASSERT_EQ(0, butil::get_remote_side(client_fd, &remote));
+    ASSERT_EQ(point, remote);
+    // The client side is unnamed.
+    ASSERT_EQ(0, butil::get_local_side(client_fd, &local));
+    ASSERT_STREQ("unix:", butil::endpoint2str(local).c_str());
+    unlink(path);
+}
+
+TEST(EndPointTest, sockaddr) {
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::str2endpoint("127.0.0.1:8080", &point));
+    sockaddr_storage ss;
+    socklen_t len = 0;
+    ASSERT_EQ(0, butil::endpoint2sockaddr(point, &ss, &len));
+    ASSERT_EQ(AF_INET, ss.ss_family);
+    ASSERT_EQ(sizeof(sockaddr_in), (size_t)len);
+    butil::EndPoint point2;
+    ASSERT_EQ(0, butil::sockaddr2endpoint(&ss, len, &point2));
+    ASSERT_EQ(point, point2);
+
+    // Abstract namespace.
+    ASSERT_EQ(0, butil::str2endpoint("unix:@endpoint_unittest", &point));
+    ASSERT_EQ(0, butil::endpoint2sockaddr(point, &ss, &len));
+    ASSERT_EQ(AF_UNIX, ss.ss_family);
+    ASSERT_EQ('\0', ((sockaddr_un*)&ss)->sun_path[0]);
+    ASSERT_EQ(0, butil::sockaddr2endpoint(&ss, len, &point2));
+    ASSERT_EQ(point, point2);
+    butil::fd_guard listen_fd(butil::tcp_listen(point, true));
+    ASSERT_GE(listen_fd, 0) << berror();
+    butil::fd_guard client_fd(butil::tcp_connect(point, NULL));
+    ASSERT_GE(client_fd, 0) << berror();
+}
+
+
+TEST(EndPointTest, unknown_unix_paths_are_not_interned) {
+    butil::EndPoint unnamed;
+    ASSERT_EQ(0, butil::unix_path2endpoint("", &unnamed));
+    // e.g. peers of a server binding different paths.
+    for (int i = 0; i < butil::MAX_UNIX_SOCKET_PATHS + 10; ++i) {
+        sockaddr_storage ss;
+        memset(&ss, 0, sizeof(ss));
+        sockaddr_un* un = (sockaddr_un*)&ss;
+        un->sun_family = AF_UNIX;
+        const int n = snprintf(un->sun_path + 1, sizeof(un->sun_path) - 1,
+                               "%05x", i);
+        butil::EndPoint point;
+        ASSERT_EQ(0, butil::sockaddr2endpoint(
+                      &ss, offsetof(sockaddr_un, sun_path) + 1 + n, &point));
+        ASSERT_EQ(unnamed, point);
+    }
+    // The table is not full.
+    butil::EndPoint point;
+    ASSERT_EQ(0, butil::unix_path2endpoint("/tmp/not_full.sock", &point));
+    ASSERT_STREQ("/tmp/not_full.sock", butil::endpoint2unix_path(point));
+}
+
 }
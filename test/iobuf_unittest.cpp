@@ -7,12 +7,16 @@
 #include <sys/socket.h>                // socketpair
 #include <errno.h>                     // errno
 #include <fcntl.h>                     // O_RDONLY
+#include <dlfcn.h>                     // dlsym
+#include <set>
+#include <vector>
 #include <butil/files/temp_file.h>      // TempFile
 #include <butil/containers/flat_map.h>
 #include <butil/macros.h>
 #include <butil/time.h>                 // Timer
 #include <butil/fd_utility.h>           // make_non_blocking
 #include <butil/iobuf.h>
+#include <butil/iobuf_slab_allocator.h>
 #include <butil/logging.h>
 #include <butil/fd_guard.h>
 #include <butil/errno.h>
@@ -29,6 +33,7 @@ extern uint32_t block_cap(butil::IOBuf::Block const* b);
 extern IOBuf::Block* get_tls_block_head();
 extern int get_tls_block_count();
 extern void remove_tls_block_chain();
+extern void reset_slab_allocator();
 IOBuf::Block* get_portal_next(IOBuf::Block const* b);
 }
 }
@@ -1551,4 +1556,277 @@ TEST_F(IOBufTest, copy_to_string_from_iterator) {
     }
     ASSERT_EQ(nc, b0.length());
 }
+
+static int s_user_data_deleted = 0;
+static void delete_user_data(void* data) {
+    ++s_user_data_deleted;
+    free(data);
+}
+
+TEST_F(IOBufTest, append_user_data) {
+    s_user_data_deleted = 0;
+    const size_t LEN = 1024 * 1024;
+    char* data = (char*)malloc(LEN);
+    for (size_t i = 0; i < LEN; ++i) {
+        data[i] = 'a' + i % 26;
+    }
+    const std::string expected(data, LEN);
+    {
+        butil::IOBuf b0;
+        b0.append("head");
+        ASSERT_EQ(0, b0.append_user_data(data, LEN, delete_user_data));
+        b0.append("tail");
+        ASSERT_EQ(LEN + 8, b0.size());
+        ASSERT_EQ("head" + expected + "tail", b0.to_string());
+        // Memory is referenced rather than copied.
+        ASSERT_EQ(data, b0.backing_block(1).data());
+
+        butil::IOBuf b1;
+        b0.cutn(&b1, 4 + LEN / 2);
+        butil::IOBuf b2(b0);
+        b0.clear();
+        ASSERT_EQ(0, s_user_data_deleted);
+        ASSERT_EQ("head" + expected.substr(0, LEN / 2), b1.to_string());
+
+        // Written into fd like other blocks.
+        int fds[2];
+        ASSERT_EQ(0, pipe(fds));
+        butil::make_non_blocking(fds[0]);
+        butil::make_non_blocking(fds[1]);
+        std::string out;
+        while (!b2.empty()) {
+            ASSERT_GT(b2.cut_into_file_descriptor(fds[1]), 0);
+            butil::IOPortal p;
+            while (p.append_from_file_descriptor(fds[0], 65536) > 0) {}
+            out.append(p.to_string());
+        }
+        close(fds[0]);
+        close(fds[1]);
+        ASSERT_EQ(expected.substr(LEN / 2) + "tail", out);
+        ASSERT_EQ(0, s_user_data_deleted);
+    }
+    ASSERT_EQ(1, s_user_data_deleted);
+
+    // Empty data is deleted immediately.
+    ASSERT_EQ(0, butil::IOBuf().append_user_data(malloc(1), 0,
+                                                 delete_user_data));
+    ASSERT_EQ(2, s_user_data_deleted);
+}
+
+TEST_F(IOBufTest, portal_block_size) {
+    const size_t DEFAULT_BLOCK_SIZE = butil::IOBuf::DEFAULT_BLOCK_SIZE;
+    const size_t MAX_BLOCK_SIZE = butil::IOBuf::MAX_BLOCK_SIZE;
+    const size_t MAX_PAYLOAD = butil::IOBuf::MAX_PAYLOAD;
+    butil::iobuf::remove_tls_block_chain();
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    butil::make_non_blocking(fds[0]);
+    butil::make_non_blocking(fds[1]);
+    const std::string data(200000, 'x');
+    ASSERT_EQ((ssize_t)data.size(), write(fds[1], data.data(), data.size()));
+
+    butil::IOPortal p;
+    ASSERT_EQ(DEFAULT_BLOCK_SIZE, p.block_size());
+    p.set_block_size(1);
+    ASSERT_EQ(DEFAULT_BLOCK_SIZE, p.block_size());
+    p.set_block_size(1L << 30);
+    ASSERT_EQ(MAX_BLOCK_SIZE, p.block_size());
+    ssize_t total = 0;
+    while (total < (ssize_t)data.size()) {
+        const ssize_t nr = p.append_from_file_descriptor(fds[0], 1L << 20);
+        ASSERT_GT(nr, 0);
+        total += nr;
+    }
+    ASSERT_EQ(data, p.to_string());
+    // Stored in large blocks.
+    ASSERT_GE(p.backing_block_num(),
+              (data.size() + MAX_PAYLOAD - 1) / MAX_PAYLOAD);
+    ASSERT_LT(p.backing_block_num(), data.size() / butil::IOBuf::DEFAULT_PAYLOAD);
+    ASSERT_EQ(MAX_PAYLOAD, p.backing_block(0).size());
+
+    // Large blocks are not returned to TLS.
+    p.clear();
+    ASSERT_EQ(0, butil::iobuf::get_tls_block_count());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// The slab allocator is global and its region is reserved by the first
+// use_slab_allocator(), reset it before and after each test.
+class SlabAllocatorTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        butil::iobuf::remove_tls_block_chain();
+        butil::iobuf::reset_slab_allocator();
+    }
+    virtual void TearDown() {
+        butil::iobuf::remove_tls_block_chain();
+        butil::iobuf::reset_slab_allocator();
+    }
+};
+
+TEST_F(SlabAllocatorTest, sanity) {
+    const size_t BLOCK_SIZE = butil::IOBuf::DEFAULT_BLOCK_SIZE;
+    const size_t NBLOCK = 2048;
+    butil::iobuf::SlabAllocatorOptions options;
+    options.max_memory = NBLOCK * BLOCK_SIZE;
+    ASSERT_EQ(0, butil::iobuf::use_slab_allocator(&options));
+    butil::iobuf::reset_blockmem_allocate_and_deallocate();
+    butil::iobuf::SlabAllocatorStat stat;
+    butil::iobuf::get_slab_allocator_stat(&stat);
+    ASSERT_EQ(NBLOCK * BLOCK_SIZE, stat.max_memory);
+    ASSERT_EQ(0ul, stat.carved_bytes);
+    ASSERT_EQ(0ul, stat.nmiss);
+
+    // Exhaust the region.
+    std::set<void*> blocks;
+    for (size_t i = 0; i < NBLOCK; ++i) {
+        void* b = butil::iobuf::slab_allocate(BLOCK_SIZE);
+        ASSERT_TRUE(b != NULL);
+        ASSERT_TRUE(blocks.insert(b).second);
+    }
+    ASSERT_EQ((char*)*blocks.begin() + (NBLOCK - 1) * BLOCK_SIZE,
+              (char*)*blocks.rbegin());
+    butil::iobuf::get_slab_allocator_stat(&stat);
+    ASSERT_EQ(NBLOCK * BLOCK_SIZE, stat.carved_bytes);
+    ASSERT_EQ(0ul, stat.nmiss);
+    void* b1 = butil::iobuf::slab_allocate(BLOCK_SIZE);
+    void* b2 = butil::iobuf::slab_allocate(BLOCK_SIZE * 2);
+    ASSERT_EQ(0ul, blocks.count(b1));
+    butil::iobuf::get_slab_allocator_stat(&stat);
+    ASSERT_EQ(1ul, stat.nmiss);
+    butil::iobuf::slab_deallocate(b1);
+    butil::iobuf::slab_deallocate(b2);
+
+    // Freed blocks are reused.
+    for (std::set<void*>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+        butil::iobuf::slab_deallocate(*it);
+    }
+    for (size_t i = 0; i < NBLOCK; ++i) {
+        ASSERT_EQ(1ul, blocks.count(butil::iobuf::slab_allocate(BLOCK_SIZE)));
+    }
+    for (std::set<void*>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+        butil::iobuf::slab_deallocate(*it);
+    }
+    butil::iobuf::get_slab_allocator_stat(&stat);
+    ASSERT_EQ(1ul, stat.nmiss);
+
+    // Blocks of IOBuf come from the region.
+    butil::iobuf::remove_tls_block_chain();
+    ASSERT_EQ(0, butil::iobuf::use_slab_allocator(NULL));
+    {
+        std::string s;
+        for (size_t i = 0; i < 100 * BLOCK_SIZE; ++i) {
+            s.push_back('a' + i % 26);
+        }
+        butil::IOBuf buf;
+        buf.append(s);
+        ASSERT_EQ(s, buf.to_string());
+        const size_t saved_nhit = stat.nhit;
+        butil::iobuf::get_slab_allocator_stat(&stat);
+        ASSERT_LT(saved_nhit, stat.nhit);
+        const size_t header_size = butil::IOBuf::DEFAULT_BLOCK_SIZE
+            - butil::IOBuf::DEFAULT_PAYLOAD;
+        ASSERT_EQ(1ul, blocks.count(
+                      (void*)(buf.backing_block(0).data() - header_size)));
+    }
+}
+
+struct SlabThreadArgs {
+    void* (*allocate)(size_t);
+    void (*deallocate)(void*);
+    uint64_t tag;
+    size_t nround;
+    size_t ncorrupted;
+    int64_t elapsed_ns;
+};
+
+void* run_block_allocation(void* void_args) {
+    SlabThreadArgs* args = (SlabThreadArgs*)void_args;
+    const size_t BATCH = 64;
+    uint64_t* blocks[BATCH];
+    butil::Timer tm;
+    tm.start();
+    for (size_t i = 0; i < args->nround; ++i) {
+        for (size_t j = 0; j < BATCH; ++j) {
+            blocks[j] = (uint64_t*)args->allocate(
+                butil::IOBuf::DEFAULT_BLOCK_SIZE);
+            blocks[j][0] = args->tag + j;
+            blocks[j][butil::IOBuf::DEFAULT_BLOCK_SIZE / 8 - 1] = args->tag + j;
+        }
+        // A block handed out to two threads at the same time is overwritten.
+        for (size_t j = 0; j < BATCH; ++j) {
+            if (blocks[j][0] != args->tag + j ||
+                blocks[j][butil::IOBuf::DEFAULT_BLOCK_SIZE / 8 - 1]
+                != args->tag + j) {
+                ++args->ncorrupted;
+            }
+            args->deallocate(blocks[j]);
+        }
+    }
+    tm.stop();
+    args->elapsed_ns = tm.n_elapsed() / (args->nround * BATCH);
+    return NULL;
+}
+
+TEST_F(SlabAllocatorTest, multi_threaded) {
+    butil::iobuf::SlabAllocatorOptions options;
+    options.max_memory = 64 * 1024 * 1024;
+    ASSERT_EQ(0, butil::iobuf::use_slab_allocator(&options));
+    butil::iobuf::reset_blockmem_allocate_and_deallocate();
+    std::vector<const char*> names;
+    std::vector<void* (*)(size_t)> allocates;
+    std::vector<void (*)(void*)> deallocates;
+    names.push_back("malloc");
+    allocates.push_back(::malloc);
+    deallocates.push_back(::free);
+    // Compare with tcmalloc as well when it's linked or preloaded.
+    void* tc_malloc_fn = dlsym(RTLD_DEFAULT, "tc_malloc");
+    void* tc_free_fn = dlsym(RTLD_DEFAULT, "tc_free");
+    if (tc_malloc_fn && tc_free_fn) {
+        names.push_back("tcmalloc");
+        allocates.push_back((void* (*)(size_t))tc_malloc_fn);
+        deallocates.push_back((void (*)(void*))tc_free_fn);
+    } else {
+        LOG(INFO) << "tcmalloc is not linked, skip comparing with it";
+    }
+    names.push_back("slab");
+    allocates.push_back(butil::iobuf::slab_allocate);
+    deallocates.push_back(butil::iobuf::slab_deallocate);
+    const size_t nthreads[] = { 1, 4, 16 };
+    for (size_t t = 0; t < ARRAY_SIZE(nthreads); ++t) {
+        for (size_t k = 0; k < names.size(); ++k) {
+            pthread_t th[nthreads[t]];
+            SlabThreadArgs args[nthreads[t]];
+            for (size_t i = 0; i < nthreads[t]; ++i) {
+                args[i].allocate = allocates[k];
+                args[i].deallocate = deallocates[k];
+                args[i].tag = (i + 1) << 32;
+                args[i].nround = 2000;
+                args[i].ncorrupted = 0;
+                args[i].elapsed_ns = 0;
+                ASSERT_EQ(0, pthread_create(&th[i], NULL, run_block_allocation,
+                                            &args[i]));
+            }
+            int64_t total_ns = 0;
+            for (size_t i = 0; i < nthreads[t]; ++i) {
+                pthread_join(th[i], NULL);
+                ASSERT_EQ(0ul, args[i].ncorrupted);
+                total_ns += args[i].elapsed_ns;
+            }
+            LOG(INFO) << names[k] << " allocates a block in "
+                      << total_ns / (int64_t)nthreads[t] << "ns with "
+                      << nthreads[t] << " threads";
+        }
+    }
+    // Blocks cached by quitted threads are reused, the region is never
+    // exhausted: each thread holds at most 64 allocated blocks plus 64
+    // cached ones, far less than the region.
+    butil::iobuf::SlabAllocatorStat stat;
+    butil::iobuf::get_slab_allocator_stat(&stat);
+    ASSERT_EQ(0ul, stat.nmiss);
+    ASSERT_EQ(2000ul * 64 * (1 + 4 + 16), stat.nhit);
+    ASSERT_GE(16ul * 256 * butil::IOBuf::DEFAULT_BLOCK_SIZE,
+              stat.carved_bytes);
+}
 } // namespace